@@ -0,0 +1,151 @@
+﻿using NUnit.Framework;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+using Protocol = ReactivityProfiler.Protocol;
+
+namespace ReactivityMonitor.ProfilerClient.Tests
+{
+    [TestFixture]
+    public class StoreFileTests
+    {
+        private const int cHeaderSize = 64;
+        private const int cChunkSize = 256;
+
+        // Builds a store file in the documented format, one chunk at a time.
+        private sealed class StoreFileBuilder
+        {
+            private readonly MemoryStream mStream = new MemoryStream();
+            private readonly BinaryWriter mWriter;
+            private long mChunkStart;
+
+            public StoreFileBuilder()
+            {
+                mWriter = new BinaryWriter(mStream);
+                mWriter.Write(Encoding.ASCII.GetBytes("RXSTORE\0"));
+                mWriter.Write(1u);
+                mWriter.Write((uint)cHeaderSize);
+                mWriter.Write((uint)cChunkSize);
+                mWriter.Write(1234u);
+                mStream.SetLength(cHeaderSize + cChunkSize);
+                mStream.Position = mChunkStart = cHeaderSize;
+            }
+
+            public StoreFileBuilder Record(uint eventId, Action<BinaryWriter> writeFields)
+            {
+                var record = new MemoryStream();
+                var recordWriter = new BinaryWriter(record);
+                recordWriter.Write(eventId);
+                writeFields(recordWriter);
+
+                int paddedLength = (4 + (int)record.Length + 3) & ~3;
+                if (mStream.Position + paddedLength > mChunkStart + cChunkSize)
+                {
+                    Padding((int)(mChunkStart + cChunkSize - mStream.Position));
+                }
+
+                mWriter.Write(0x80000000 | (uint)record.Length);
+                mWriter.Write(record.ToArray());
+                mStream.Position = (mStream.Position + 3) & ~3;
+                return this;
+            }
+
+            public StoreFileBuilder String(uint id, string s) => Record(4, w => { WriteVarUInt32(w, id); WriteString(w, s); });
+
+            private void Padding(int length)
+            {
+                mWriter.Write(0x40000000 | (uint)length);
+                mChunkStart += cChunkSize;
+                mStream.SetLength(mChunkStart + cChunkSize);
+                mStream.Position = mChunkStart;
+            }
+
+            public MemoryStream Build()
+            {
+                mStream.Position = 0;
+                return mStream;
+            }
+        }
+
+        private static void WriteVarUInt32(BinaryWriter writer, uint value)
+        {
+            while (value >= 0x80)
+            {
+                writer.Write((byte)(value | 0x80));
+                value >>= 7;
+            }
+            writer.Write((byte)value);
+        }
+
+        private static void WriteString(BinaryWriter writer, string s)
+        {
+            byte[] bytes = Encoding.UTF8.GetBytes(s);
+            WriteVarUInt32(writer, (uint)bytes.Length);
+            writer.Write(bytes);
+        }
+
+        [Test]
+        public void RecognisesStoreFiles()
+        {
+            Assert.That(StoreFile.HasStoreFileHeader(new StoreFileBuilder().Build()), Is.True);
+            Assert.That(StoreFile.HasStoreFileHeader(new MemoryStream(new byte[] { 4, 0, 0, 0, 1, 2, 3, 4 })), Is.False);
+        }
+
+        [Test]
+        public void ReadsInstrumentationEvents()
+        {
+            var stream = new StoreFileBuilder()
+                .Record(0, w => { w.Write(7ul); WriteString(w, @"C:\app\App.dll"); WriteString(w, "App"); })
+                .String(0, "My.Type")
+                .String(1, "Method\u00e9")
+                .Record(1, w => { w.Write(1); w.Write(7ul); w.Write(0x06000001u); WriteVarUInt32(w, 0); WriteVarUInt32(w, 1); })
+                .String(2, "System.Reactive.Linq.Observable.Select")
+                .Record(2, w => { w.Write(5); w.Write(1); w.Write(0x10); WriteVarUInt32(w, 2); })
+                .Record(3, w => w.Write(1))
+                .Build();
+
+            var events = StoreFile.ReadEvents(stream).ToList();
+
+            Assert.That(events.Select(e => e.EventCase), Is.EqualTo(new[]
+            {
+                Protocol.EventMessage.EventOneofCase.ModuleLoaded,
+                Protocol.EventMessage.EventOneofCase.MethodInstrumentationStart,
+                Protocol.EventMessage.EventOneofCase.MethodCallInstrumented,
+                Protocol.EventMessage.EventOneofCase.MethodInstrumentationDone
+            }));
+            Assert.That(events[0].ModuleLoaded.Path, Is.EqualTo(@"C:\app\App.dll"));
+            Assert.That(events[1].MethodInstrumentationStart.OwningTypeName, Is.EqualTo("My.Type"));
+            Assert.That(events[1].MethodInstrumentationStart.Name, Is.EqualTo("Method\u00e9"));
+            Assert.That(events[1].MethodInstrumentationStart.FunctionToken, Is.EqualTo(0x06000001u));
+            Assert.That(events[2].MethodCallInstrumented.CalledMethodName, Is.EqualTo("System.Reactive.Linq.Observable.Select"));
+            Assert.That(events[2].MethodCallInstrumented.InstructionOffset, Is.EqualTo(0x10));
+        }
+
+        [Test]
+        public void ReadsRecordsAcrossChunks()
+        {
+            var builder = new StoreFileBuilder().String(0, "Name");
+            for (int i = 0; i < 100; i++)
+            {
+                builder.Record(2, w => { w.Write(i); w.Write(1); w.Write(0); WriteVarUInt32(w, 0); });
+            }
+
+            var events = StoreFile.ReadEvents(builder.Build()).ToList();
+
+            Assert.That(events.Select(e => e.MethodCallInstrumented.InstrumentationPointId), Is.EqualTo(Enumerable.Range(0, 100)));
+        }
+
+        [Test]
+        public void RejectsUnknownVersion()
+        {
+            var stream = new StoreFileBuilder().Build();
+            stream.Position = 8;
+            stream.WriteByte(2);
+            stream.Position = 0;
+
+            Assert.That(() => StoreFile.ReadEvents(stream).ToList(), Throws.TypeOf<InvalidDataException>());
+        }
+    }
+}
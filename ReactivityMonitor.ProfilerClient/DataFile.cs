@@ -16,7 +16,23 @@ namespace ReactivityMonitor.ProfilerClient
 
         public static IModelUpdateSource CreateModelUpdateSource(string path)
         {
-            return new ModelUpdateSource(GetDataFileStream(path));
+            return new ModelUpdateSource(IsStoreFile(path) ? GetStoreFileStream(path) : GetDataFileStream(path));
+        }
+
+        private static bool IsStoreFile(string path)
+        {
+            using (var stream = OpenStoreFile(path))
+            {
+                return StoreFile.HasStoreFileHeader(stream);
+            }
+        }
+
+        // Store files may still be open for writing by the profiled process.
+        private static Stream OpenStoreFile(string path) => new FileStream(path, FileMode.Open, FileAccess.Read, FileShare.ReadWrite);
+
+        private static IObservable<EventMessage> GetStoreFileStream(string path)
+        {
+            return Observable.Using(() => OpenStoreFile(path), stream => StoreFile.ReadEvents(stream).ToObservable());
         }
 
         private static IObservable<EventMessage> GetDataFileStream(string path)
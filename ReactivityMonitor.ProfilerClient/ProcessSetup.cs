@@ -27,6 +27,12 @@ namespace ReactivityMonitor.ProfilerClient
         public bool WaitForConnection { get; set; }
         public bool MonitorAllFromStart { get; set; }
 
+        /// <summary>
+        /// If set, the profiler writes its instrumentation store to this file instead of
+        /// keeping it in memory. The file can be opened with <see cref="DataFile"/>.
+        /// </summary>
+        public string StoreFilePath { get; set; }
+
         public string PipeName => mPipeName;
 
         public IEnumerable<KeyValuePair<string, string>> GetEnvironmentVariables()
@@ -47,6 +53,11 @@ namespace ReactivityMonitor.ProfilerClient
 
                 yield return ("REACTIVITYPROFILER_WAITFORCONNECTION", WaitForConnection.ToString());
                 yield return ("REACTIVITYPROFILER_MONITORALLFROMSTART", MonitorAllFromStart.ToString());
+
+                if (!string.IsNullOrEmpty(StoreFilePath))
+                {
+                    yield return ("REACTIVITYPROFILER_STOREFILE", StoreFilePath);
+                }
             }
 
             return Generate().Select(x => new KeyValuePair<string, string>(x.Item1, x.Item2));
@@ -0,0 +1,212 @@
+﻿using ReactivityProfiler.Protocol;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Linq;
+using System.Text;
+
+namespace ReactivityMonitor.ProfilerClient
+{
+    /// <summary>
+    /// Reads the instrumentation events from a profiler store file (written by the profiler
+    /// when REACTIVITYPROFILER_STOREFILE is set). The format is documented in the profiler's
+    /// StoreFile.h.
+    /// </summary>
+    internal static class StoreFile
+    {
+        private static readonly byte[] cMagic = Encoding.ASCII.GetBytes("RXSTORE\0");
+        private const uint cVersion = 1;
+
+        private const uint cRecordHeader = 0x80000000;
+        private const uint cPaddingHeader = 0x40000000;
+        private const uint cOversizedHeader = 0x20000000;
+        private const uint cHeaderLengthMask = 0x0FFFFFFF;
+
+        private const uint cModuleInfoEventId = 0;
+        private const uint cMethodInfoEventId = 1;
+        private const uint cCallInfoEventId = 2;
+        private const uint cMethodInstrumentationDoneEventId = 3;
+        private const uint cStringDefinedEventId = 4;
+
+        public static bool HasStoreFileHeader(Stream stream)
+        {
+            byte[] magic = new byte[cMagic.Length];
+            long position = stream.Position;
+            int count = stream.Read(magic, 0, magic.Length);
+            stream.Position = position;
+
+            return count == magic.Length && magic.SequenceEqual(cMagic);
+        }
+
+        public static IEnumerable<EventMessage> ReadEvents(Stream stream)
+        {
+            var reader = new BinaryReader(stream);
+            if (!HasStoreFileHeader(stream))
+            {
+                throw new InvalidDataException("Not a profiler store file.");
+            }
+
+            stream.Position = cMagic.Length;
+            uint version = reader.ReadUInt32();
+            if (version != cVersion)
+            {
+                throw new InvalidDataException($"Unsupported profiler store file version {version}.");
+            }
+
+            uint headerSize = reader.ReadUInt32();
+            uint chunkSize = reader.ReadUInt32();
+
+            var strings = new List<string>();
+            byte[] chunk = new byte[chunkSize];
+            for (long chunkOffset = headerSize; chunkOffset < stream.Length; chunkOffset += chunkSize)
+            {
+                stream.Position = chunkOffset;
+                int chunkLength = ReadFully(stream, chunk);
+
+                int offset = 0;
+                while (offset + sizeof(uint) <= chunkLength)
+                {
+                    uint header = BitConverter.ToUInt32(chunk, offset);
+                    int length = (int)(header & cHeaderLengthMask);
+                    if (header == 0)
+                    {
+                        // End of the data, or a record still being written.
+                        yield break;
+                    }
+                    else if ((header & cPaddingHeader) != 0)
+                    {
+                        offset += length;
+                    }
+                    else if ((header & cOversizedHeader) != 0)
+                    {
+                        // Oversized records are not kept in the file.
+                        offset += sizeof(uint);
+                    }
+                    else if ((header & cRecordHeader) != 0)
+                    {
+                        int recordOffset = offset + sizeof(uint);
+                        if (recordOffset + length > chunkLength)
+                        {
+                            yield break;
+                        }
+
+                        var recordReader = new BinaryReader(new MemoryStream(chunk, recordOffset, length, false));
+                        EventMessage message = DecodeRecord(recordReader, strings);
+                        if (message != null)
+                        {
+                            yield return message;
+                        }
+
+                        offset += (sizeof(uint) + length + 3) & ~3;
+                    }
+                    else
+                    {
+                        throw new InvalidDataException($"Invalid record header at offset {chunkOffset + offset}.");
+                    }
+                }
+            }
+        }
+
+        private static EventMessage DecodeRecord(BinaryReader reader, List<string> strings)
+        {
+            switch (reader.ReadUInt32())
+            {
+                case cModuleInfoEventId:
+                    return new EventMessage
+                    {
+                        ModuleLoaded = new ModuleLoadedEvent
+                        {
+                            ModuleID = reader.ReadUInt64(),
+                            Path = ReadString(reader),
+                            AssemblyName = ReadString(reader)
+                        }
+                    };
+
+                case cMethodInfoEventId:
+                    return new EventMessage
+                    {
+                        MethodInstrumentationStart = new MethodInstrumentationStartEvent
+                        {
+                            InstrumentedMethodId = reader.ReadInt32(),
+                            ModuleId = reader.ReadUInt64(),
+                            FunctionToken = reader.ReadUInt32(),
+                            OwningTypeName = strings[(int)ReadVarUInt32(reader)],
+                            Name = strings[(int)ReadVarUInt32(reader)]
+                        }
+                    };
+
+                case cCallInfoEventId:
+                    return new EventMessage
+                    {
+                        MethodCallInstrumented = new MethodCallInstrumentedEvent
+                        {
+                            InstrumentationPointId = reader.ReadInt32(),
+                            InstrumentedMethodId = reader.ReadInt32(),
+                            InstructionOffset = reader.ReadInt32(),
+                            CalledMethodName = strings[(int)ReadVarUInt32(reader)]
+                        }
+                    };
+
+                case cMethodInstrumentationDoneEventId:
+                    return new EventMessage
+                    {
+                        MethodInstrumentationDone = new MethodInstrumentationDoneEvent
+                        {
+                            InstrumentedMethodId = reader.ReadInt32()
+                        }
+                    };
+
+                case cStringDefinedEventId:
+                    {
+                        uint id = ReadVarUInt32(reader);
+                        string s = ReadString(reader);
+                        if (id == strings.Count)
+                        {
+                            strings.Add(s);
+                        }
+                        return null;
+                    }
+
+                default:
+                    return null;
+            }
+        }
+
+        private static uint ReadVarUInt32(BinaryReader reader)
+        {
+            uint value = 0;
+            for (int shift = 0; ; shift += 7)
+            {
+                byte b = reader.ReadByte();
+                value |= (uint)(b & 0x7F) << shift;
+                if ((b & 0x80) == 0)
+                {
+                    return value;
+                }
+            }
+        }
+
+        private static string ReadString(BinaryReader reader)
+        {
+            int length = (int)ReadVarUInt32(reader);
+            return Encoding.UTF8.GetString(reader.ReadBytes(length));
+        }
+
+        private static int ReadFully(Stream stream, byte[] buffer)
+        {
+            int offset = 0;
+            while (offset < buffer.Length)
+            {
+                int count = stream.Read(buffer, offset, buffer.Length - offset);
+                if (count == 0)
+                {
+                    break;
+                }
+
+                offset += count;
+            }
+
+            return offset;
+        }
+    }
+}
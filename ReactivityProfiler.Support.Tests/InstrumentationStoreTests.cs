@@ -0,0 +1,137 @@
+﻿using NUnit.Framework;
+using ReactivityProfiler.Support.Store;
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Text;
+
+namespace ReactivityProfiler.Support.Tests
+{
+    [TestFixture]
+    public class InstrumentationStoreTests
+    {
+        // Holds records in unmanaged memory, as the profiler's store does.
+        private sealed class FakeRawEventSource : IRawEventSource, IDisposable
+        {
+            private readonly List<(IntPtr Data, int Size)> mRecords = new List<(IntPtr, int)>();
+
+            public FakeRawEventSource Record(uint eventId, Action<BinaryWriter> writeFields)
+            {
+                var record = new MemoryStream();
+                var writer = new BinaryWriter(record);
+                writer.Write(eventId);
+                writeFields(writer);
+                return Add(record.ToArray());
+            }
+
+            // What the store publishes in place of a record it failed to write.
+            public FakeRawEventSource Abandoned() => Add(Array.Empty<byte>());
+
+            public FakeRawEventSource StringDefined(uint id, string value)
+            {
+                return Record(4, w =>
+                {
+                    WriteVarUInt32(w, id);
+                    WriteString(w, value);
+                });
+            }
+
+            public int GetEventCount() => mRecords.Count;
+
+            public byte[] ReadEvent(int index)
+            {
+                var (data, size) = mRecords[index];
+                byte[] buffer = new byte[size];
+                Marshal.Copy(data, buffer, 0, size);
+                return buffer;
+            }
+
+            public unsafe int ReadEvents(int startIndex, int maxCount, byte** buffers, int* sizes)
+            {
+                int count = Math.Max(0, Math.Min(maxCount, mRecords.Count - startIndex));
+                for (int i = 0; i < count; i++)
+                {
+                    buffers[i] = (byte*)mRecords[startIndex + i].Data;
+                    sizes[i] = mRecords[startIndex + i].Size;
+                }
+
+                return count;
+            }
+
+            public void Dispose()
+            {
+                foreach (var (data, _) in mRecords)
+                {
+                    Marshal.FreeHGlobal(data);
+                }
+            }
+
+            private FakeRawEventSource Add(byte[] record)
+            {
+                IntPtr data = Marshal.AllocHGlobal(Math.Max(record.Length, 1));
+                Marshal.Copy(record, 0, data, record.Length);
+                mRecords.Add((data, record.Length));
+                return this;
+            }
+
+            private static void WriteVarUInt32(BinaryWriter w, uint value)
+            {
+                while (value >= 0x80)
+                {
+                    w.Write((byte)(value | 0x80));
+                    value >>= 7;
+                }
+
+                w.Write((byte)value);
+            }
+
+            private static void WriteString(BinaryWriter w, string value)
+            {
+                byte[] bytes = Encoding.UTF8.GetBytes(value);
+                WriteVarUInt32(w, (uint)bytes.Length);
+                w.Write(bytes);
+            }
+        }
+
+        [Test]
+        public void DecodesAroundAbandonedRecords()
+        {
+            using (var source = new FakeRawEventSource())
+            {
+                source
+                    .Abandoned()
+                    .StringDefined(0, "MyType")
+                    .Abandoned()
+                    .StringDefined(1, "MyMethod")
+                    .Record(1, w =>
+                    {
+                        w.Write(7);
+                        w.Write(0x1234UL);
+                        w.Write(0x06000001u);
+                        w.Write((byte)0);
+                        w.Write((byte)1);
+                    })
+                    .Abandoned()
+                    .Record(3, w => w.Write(7));
+
+                var store = new InstrumentationStore(source);
+
+                var events = new object[source.GetEventCount()];
+                Assert.That(store.GetEvents(0, events), Is.EqualTo(7));
+                Assert.That(events[0], Is.Null);
+                Assert.That(events[2], Is.Null);
+                Assert.That(events[5], Is.Null);
+
+                var methodInfo = (MethodInfoEvent)events[4];
+                Assert.That(methodInfo.InstrumentedMethodId, Is.EqualTo(7));
+                Assert.That(methodInfo.OwningTypeName, Is.EqualTo("MyType"));
+                Assert.That(methodInfo.Name, Is.EqualTo("MyMethod"));
+                Assert.That(((MethodDoneEvent)events[6]).InstrumentedMethodId, Is.EqualTo(7));
+
+                Assert.That(store.GetEvent(5), Is.Null);
+                Assert.That(((MethodDoneEvent)store.GetEvent(6)).InstrumentedMethodId, Is.EqualTo(7));
+            }
+        }
+    }
+}
@@ -26,6 +26,14 @@ namespace ReactivityProfiler.Support
             return buffer;
         }
 
+        /// <summary>
+        /// Gets pointers to the data of up to <paramref name="maxCount"/> events starting at
+        /// <paramref name="startIndex"/>, without copying. The data stays valid for the life of
+        /// the process. Returns the number of events filled in.
+        /// </summary>
+        [DllImport("ReactivityProfiler.dll")]
+        public extern static unsafe int ReadStoreEvents(int startIndex, int maxCount, byte** buffers, int* sizes);
+
         [DllImport("ReactivityProfiler.dll", CharSet = CharSet.Unicode)]
         public extern static void SetChannelPipeName(string pipeName);
 
@@ -15,6 +15,8 @@ namespace ReactivityProfiler.Support.Server
 {
     internal sealed class Server
     {
+        private const int cInstrumentationEventBatchSize = 256;
+
         private readonly IStore mStore;
         private Channel mChannel;
         private PayloadStore mPayloadStore;
@@ -262,12 +264,20 @@ namespace ReactivityProfiler.Support.Server
                 return false;
             }
 
+            var batch = new object[cInstrumentationEventBatchSize];
             while (index < eventCount)
             {
-                object e = mStore.Instrumentation.GetEvent(index);
-                EventMessage msg = CreateInstrumentationMessage(e);
-                SendEvent(channel, msg);
-                index++;
+                int batchCount = mStore.Instrumentation.GetEvents(index, batch);
+                for (int i = 0; i < batchCount; i++)
+                {
+                    // String definitions are only used within the store, so decode to null.
+                    if (batch[i] != null)
+                    {
+                        EventMessage msg = CreateInstrumentationMessage(batch[i]);
+                        SendEvent(channel, msg);
+                    }
+                }
+                index += batchCount;
             }
 
             UpdateInstrumentationIndex(index);
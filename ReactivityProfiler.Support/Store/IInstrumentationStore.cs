@@ -3,6 +3,7 @@
     internal interface IInstrumentationStore
     {
         object GetEvent(int index);
+        int GetEvents(int startIndex, object[] events);
         int GetEventCount();
     }
 }
\ No newline at end of file
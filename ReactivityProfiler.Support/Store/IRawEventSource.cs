@@ -0,0 +1,12 @@
+﻿namespace ReactivityProfiler.Support.Store
+{
+    /// <summary>
+    /// The records InstrumentationStore decodes, as written by the profiler.
+    /// </summary>
+    internal unsafe interface IRawEventSource
+    {
+        int GetEventCount();
+        byte[] ReadEvent(int index);
+        int ReadEvents(int startIndex, int maxCount, byte** buffers, int* sizes);
+    }
+}
@@ -1,4 +1,5 @@
 ﻿using System;
+using System.Buffers.Binary;
 using System.Collections.Generic;
 using System.Diagnostics;
 using System.IO;
@@ -9,79 +10,248 @@ namespace ReactivityProfiler.Support.Store
 {
     internal sealed class InstrumentationStore : IInstrumentationStore
     {
+        private const uint cStringDefinedEventId = 4;
+        private const int cStringScanBatchSize = 256;
+
+        // Interned strings by ID. Records only refer to strings whose StringDefined event comes
+        // earlier in the store, so a missing ID is found by scanning forward from mStringScanIndex.
+        private readonly object mStringTableLock = new object();
+        private readonly List<string> mStrings = new List<string>();
+        private readonly IRawEventSource mRawEvents;
+        private int mStringScanIndex;
+
+        public InstrumentationStore()
+            : this(new NativeRawEventSource())
+        {
+        }
+
+        internal InstrumentationStore(IRawEventSource rawEvents)
+        {
+            mRawEvents = rawEvents;
+        }
+
         public int GetEventCount()
         {
-            return NativeMethods.GetStoreEventCount();
+            return mRawEvents.GetEventCount();
         }
 
         public object GetEvent(int index)
         {
-            byte[] rawEvent = NativeMethods.ReadStoreEvent(index);
-            return Decode(rawEvent);
+            byte[] rawEvent = mRawEvents.ReadEvent(index);
+            return Decode(index, rawEvent);
+        }
+
+        /// <summary>
+        /// Decodes up to <c>events.Length</c> events starting at <paramref name="startIndex"/>
+        /// directly from the native store's memory. Returns the number of events decoded;
+        /// string definitions decode to null.
+        /// </summary>
+        public unsafe int GetEvents(int startIndex, object[] events)
+        {
+            var buffers = stackalloc byte*[events.Length];
+            var sizes = stackalloc int[events.Length];
+            int count = mRawEvents.ReadEvents(startIndex, events.Length, buffers, sizes);
+
+            for (int i = 0; i < count; i++)
+            {
+                events[i] = Decode(startIndex + i, new ReadOnlySpan<byte>(buffers[i], sizes[i]));
+            }
+
+            return count;
         }
 
-        private static object Decode(byte[] rawEvent)
+        private object Decode(int index, ReadOnlySpan<byte> rawEvent)
         {
-            var reader = new BinaryReader(new MemoryStream(rawEvent), Encoding.Unicode);
+            // The profiler leaves an empty record where it failed to write one.
+            if (rawEvent.Length < sizeof(uint))
+            {
+                return null;
+            }
+
+            var reader = new EventReader(rawEvent, this, index);
             uint eventTypeId = reader.ReadUInt32();
 
             switch (eventTypeId)
             {
                 case 0:
-                    return DecodeModuleLoadEvent(reader);
+                    return DecodeModuleLoadEvent(ref reader);
                 case 1:
-                    return DecodeMethodEvent(reader);
+                    return DecodeMethodEvent(ref reader);
                 case 2:
-                    return DecodeMethodCallInstrumentedEvent(reader);
+                    return DecodeMethodCallInstrumentedEvent(ref reader);
                 case 3:
-                    return DecodeMethodInstrumentationDoneEvent(reader);
+                    return DecodeMethodInstrumentationDoneEvent(ref reader);
+                case cStringDefinedEventId:
+                    // Handled by ScanForStringDefinitions when the string is first used.
+                    return null;
                 default:
                     return null;
             }
         }
 
-        private static object DecodeMethodInstrumentationDoneEvent(BinaryReader reader)
+        private static object DecodeMethodInstrumentationDoneEvent(ref EventReader reader)
         {
             var e = new MethodDoneEvent();
             e.InstrumentedMethodId = reader.ReadInt32();
             return e;
         }
 
-        private static object DecodeMethodEvent(BinaryReader reader)
+        private static object DecodeMethodEvent(ref EventReader reader)
         {
             var e = new MethodInfoEvent();
             e.InstrumentedMethodId = reader.ReadInt32();
             e.ModuleId = reader.ReadUInt64();
             e.FunctionToken = reader.ReadUInt32();
-            e.OwningTypeName = ReadInt32LengthString(reader);
-            e.Name = ReadInt32LengthString(reader);
+            e.OwningTypeName = reader.ReadInternedString();
+            e.Name = reader.ReadInternedString();
             return e;
         }
 
-        private static object DecodeModuleLoadEvent(BinaryReader reader)
+        private static object DecodeModuleLoadEvent(ref EventReader reader)
         {
             var e = new ModuleLoadEvent();
             e.ModuleId = reader.ReadUInt64();
-            e.ModulePath = ReadInt32LengthString(reader);
-            e.AssemblyName = ReadInt32LengthString(reader);
+            e.ModulePath = reader.ReadString();
+            e.AssemblyName = reader.ReadString();
             return e;
         }
 
-        private static object DecodeMethodCallInstrumentedEvent(BinaryReader reader)
+        private static object DecodeMethodCallInstrumentedEvent(ref EventReader reader)
         {
             var e = new MethodCallInstrumentedEvent();
             e.InstrumentationPointId = reader.ReadInt32();
             e.InstrumentedMethodId = reader.ReadInt32();
             e.InstructionOffset = reader.ReadInt32();
-            e.CalledMethodName = ReadInt32LengthString(reader);
+            e.CalledMethodName = reader.ReadInternedString();
             return e;
         }
 
-        private static string ReadInt32LengthString(BinaryReader reader)
+        private string GetString(uint id, int referencingIndex)
+        {
+            lock (mStringTableLock)
+            {
+                if (id >= mStrings.Count)
+                {
+                    ScanForStringDefinitions(referencingIndex);
+                    if (id >= mStrings.Count)
+                    {
+                        throw new InvalidDataException($"Event {referencingIndex} refers to undefined string {id}");
+                    }
+                }
+
+                return mStrings[(int)id];
+            }
+        }
+
+        private unsafe void ScanForStringDefinitions(int endIndex)
         {
-            int length = reader.ReadInt32();
-            char[] chars = reader.ReadChars(length);
-            return new string(chars);
+            var buffers = stackalloc byte*[cStringScanBatchSize];
+            var sizes = stackalloc int[cStringScanBatchSize];
+
+            while (mStringScanIndex < endIndex)
+            {
+                int count = mRawEvents.ReadEvents(mStringScanIndex, Math.Min(cStringScanBatchSize, endIndex - mStringScanIndex), buffers, sizes);
+                if (count == 0)
+                {
+                    break;
+                }
+
+                for (int i = 0; i < count; i++)
+                {
+                    if (sizes[i] < sizeof(uint))
+                    {
+                        continue;
+                    }
+
+                    var reader = new EventReader(new ReadOnlySpan<byte>(buffers[i], sizes[i]), this, mStringScanIndex + i);
+                    if (reader.ReadUInt32() == cStringDefinedEventId)
+                    {
+                        uint id = reader.ReadVarUInt32();
+                        if (id == mStrings.Count)
+                        {
+                            mStrings.Add(reader.ReadString());
+                        }
+                    }
+                }
+
+                mStringScanIndex += count;
+            }
+        }
+
+        /// <summary>
+        /// Reads the fields of an event record in place. Fixed-size fields are little-endian,
+        /// lengths and string IDs are LEB128 varints and strings are UTF-8.
+        /// </summary>
+        private ref struct EventReader
+        {
+            private ReadOnlySpan<byte> mRemaining;
+            private readonly InstrumentationStore mStore;
+            private readonly int mIndex;
+
+            public EventReader(ReadOnlySpan<byte> data, InstrumentationStore store, int index)
+            {
+                mRemaining = data;
+                mStore = store;
+                mIndex = index;
+            }
+
+            public uint ReadUInt32()
+            {
+                uint value = BinaryPrimitives.ReadUInt32LittleEndian(mRemaining);
+                mRemaining = mRemaining.Slice(sizeof(uint));
+                return value;
+            }
+
+            public int ReadInt32()
+            {
+                int value = BinaryPrimitives.ReadInt32LittleEndian(mRemaining);
+                mRemaining = mRemaining.Slice(sizeof(int));
+                return value;
+            }
+
+            public ulong ReadUInt64()
+            {
+                ulong value = BinaryPrimitives.ReadUInt64LittleEndian(mRemaining);
+                mRemaining = mRemaining.Slice(sizeof(ulong));
+                return value;
+            }
+
+            public uint ReadVarUInt32()
+            {
+                uint value = 0;
+                for (int shift = 0; ; shift += 7)
+                {
+                    byte b = mRemaining[0];
+                    mRemaining = mRemaining.Slice(1);
+                    value |= (uint)(b & 0x7F) << shift;
+                    if ((b & 0x80) == 0)
+                    {
+                        return value;
+                    }
+                }
+            }
+
+            public string ReadInternedString()
+            {
+                return mStore.GetString(ReadVarUInt32(), mIndex);
+            }
+
+            public unsafe string ReadString()
+            {
+                int length = (int)ReadVarUInt32();
+                ReadOnlySpan<byte> bytes = mRemaining.Slice(0, length);
+                mRemaining = mRemaining.Slice(bytes.Length);
+
+                if (bytes.IsEmpty)
+                {
+                    return string.Empty;
+                }
+
+                fixed (byte* pBytes = bytes)
+                {
+                    return Encoding.UTF8.GetString(pBytes, bytes.Length);
+                }
+            }
         }
     }
 }
@@ -0,0 +1,14 @@
+﻿namespace ReactivityProfiler.Support.Store
+{
+    internal sealed class NativeRawEventSource : IRawEventSource
+    {
+        public int GetEventCount() => NativeMethods.GetStoreEventCount();
+
+        public byte[] ReadEvent(int index) => NativeMethods.ReadStoreEvent(index);
+
+        public unsafe int ReadEvents(int startIndex, int maxCount, byte** buffers, int* sizes)
+        {
+            return NativeMethods.ReadStoreEvents(startIndex, maxCount, buffers, sizes);
+        }
+    }
+}
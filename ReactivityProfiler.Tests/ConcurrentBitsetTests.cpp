@@ -0,0 +1,59 @@
+#include "pch.h"
+#include "concurrentbitset.h"
+
+#include <thread>
+
+TEST(ConcurrentBitset, SetsAndTestsFlags) {
+    concurrent_bitset bits;
+    EXPECT_FALSE(bits.test(0));
+
+    bits.reset(100);
+    EXPECT_EQ(bits.size(), 100u);
+    bits.set(0);
+    bits.set(31);
+    bits.set(32);
+    bits.set(99);
+
+    for (size_t i = 0; i < 100; i++)
+    {
+        EXPECT_EQ(bits.test(i), i == 0 || i == 31 || i == 32 || i == 99) << i;
+    }
+}
+
+TEST(ConcurrentBitset, IgnoresIndexesOutOfRange) {
+    concurrent_bitset bits;
+    bits.reset(10);
+    bits.set(10);
+    bits.set(1000);
+    EXPECT_FALSE(bits.test(10));
+    EXPECT_FALSE(bits.test(1000));
+}
+
+TEST(ConcurrentBitset, ConcurrentSetsAreNotLost) {
+    const size_t c_size = 100000;
+    const int c_threads = 8;
+    concurrent_bitset bits;
+    bits.reset(c_size);
+
+    // Threads set interleaved bits, so they're all writing to the same words.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < c_threads; t++)
+    {
+        threads.emplace_back([&, t] {
+            for (size_t i = t; i < c_size; i += c_threads)
+            {
+                bits.set(i);
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < c_size; i++)
+    {
+        ASSERT_TRUE(bits.test(i)) << i;
+    }
+}
@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "concurrentmap.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+TEST(ConcurrentMap, AddsAndGets) {
+    concurrent_map<uintptr_t, int> map;
+    int value = 0;
+    EXPECT_FALSE(map.try_get(1, value));
+
+    EXPECT_TRUE(map.try_add(1, 10));
+    EXPECT_FALSE(map.try_add(1, 11));
+    EXPECT_TRUE(map.try_get(1, value));
+    EXPECT_EQ(value, 10);
+
+    EXPECT_EQ(map.add_or_get(2, [] { return 20; }), 20);
+    EXPECT_EQ(map.add_or_get(2, [] { return 21; }), 20);
+}
+
+TEST(ConcurrentMap, ConcurrentAddOrGetCreatesEachValueOnce) {
+    const int c_threads = 8;
+    const uintptr_t c_keys = 2000;
+    concurrent_map<uintptr_t, std::shared_ptr<uintptr_t>> map;
+    std::atomic_int factoryCalls = 0;
+
+    // All threads race to add the same keys (pointer-like, as ModuleIDs are) while also
+    // reading them back.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < c_threads; t++)
+    {
+        threads.emplace_back([&] {
+            for (uintptr_t i = 0; i < c_keys; i++)
+            {
+                uintptr_t key = 0x10000 + i * 0x40;
+                auto value = map.add_or_get(key, [&] {
+                    factoryCalls++;
+                    return std::make_shared<uintptr_t>(key);
+                });
+                ASSERT_EQ(*value, key);
+
+                std::shared_ptr<uintptr_t> readBack;
+                ASSERT_TRUE(map.try_get(key, readBack));
+                ASSERT_EQ(readBack, value);
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(factoryCalls, static_cast<int>(c_keys));
+}
+
+// The previous implementation, kept for comparison: one mutex for the whole map.
+template <typename Key, typename Value>
+class single_mutex_map
+{
+public:
+    bool try_get(Key key, Value& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto location = m_map.find(key);
+        if (location == m_map.end())
+        {
+            return false;
+        }
+
+        value = location->second;
+        return true;
+    }
+
+    bool try_add(Key key, const Value& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_map.insert({ key, value }).second;
+    }
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<Key, Value> m_map;
+};
+
+template<typename TMap>
+static double TimeLookups(int threadCount, int lookupsPerThread)
+{
+    const uintptr_t c_modules = 200;
+    TMap map;
+    for (uintptr_t i = 0; i < c_modules; i++)
+    {
+        map.try_add(0x7ff800000000 + i * 0x1000, std::make_shared<int>(0));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t] {
+            std::shared_ptr<int> value;
+            for (int i = 0; i < lookupsPerThread; i++)
+            {
+                map.try_get(0x7ff800000000 + ((i + t) % c_modules) * 0x1000, value);
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Lookup throughput as seen by JITCompilationStarted. Run with --gtest_also_run_disabled_tests.
+TEST(ConcurrentMap, DISABLED_BenchmarkLookups) {
+    const int c_lookupsPerThread = 1000000;
+    for (int threads : { 1, 2, 4, 8, 16 })
+    {
+        double mutexMs = TimeLookups<single_mutex_map<uintptr_t, std::shared_ptr<int>>>(threads, c_lookupsPerThread);
+        double shardedMs = TimeLookups<concurrent_map<uintptr_t, std::shared_ptr<int>>>(threads, c_lookupsPerThread);
+        std::cout << threads << " threads: single mutex " << mutexMs << "ms, sharded " << shardedMs << "ms" << std::endl;
+    }
+}
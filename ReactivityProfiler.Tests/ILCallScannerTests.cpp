@@ -0,0 +1,165 @@
+#include "pch.h"
+#include "Instrumentation/ILCallScanner.h"
+#include "Instrumentation/Method.h"
+
+#include <chrono>
+#include <iostream>
+#include <unordered_set>
+
+using namespace Instrumentation;
+
+static std::vector<mdToken> GetCallTokens(const std::vector<BYTE>& image, bool* pResult = nullptr)
+{
+    std::vector<mdToken> tokens;
+    bool result = ILCallScanner::AnyCall(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()), [&](mdToken token) {
+        tokens.push_back(token);
+        return false;
+    });
+
+    if (pResult)
+    {
+        *pResult = result;
+    }
+    return tokens;
+}
+
+TEST(ILCallScanner, FindsCallsInTinyMethod) {
+    auto image = MakeTinyMethodImage({
+        0x02,                         // ldarg.0
+        0x28, 0x01, 0x00, 0x00, 0x0a, // call 0a000001
+        0x6f, 0x02, 0x00, 0x00, 0x2b, // callvirt 2b000002
+        0x2a                          // ret
+    });
+
+    bool result;
+    auto tokens = GetCallTokens(image, &result);
+    EXPECT_FALSE(result);
+    EXPECT_EQ(std::vector<mdToken>({ 0x0a000001, 0x2b000002 }), tokens);
+}
+
+TEST(ILCallScanner, FindsCallsInFatMethod) {
+    auto image = MakeFatMethodImage({
+        0x28, 0x03, 0x00, 0x00, 0x06, // call 06000003
+        0x2a                          // ret
+    });
+
+    EXPECT_EQ(std::vector<mdToken>({ 0x06000003 }), GetCallTokens(image));
+}
+
+TEST(ILCallScanner, SkipsOperandsThatLookLikeCalls) {
+    auto image = MakeTinyMethodImage({
+        0x20, 0x28, 0x28, 0x28, 0x28, // ldc.i4 0x28282828
+        0x1f, 0x6f,                   // ldc.i4.s 0x6f
+        0xfe, 0x0c, 0x28, 0x00,       // ldloc 0x28
+        0x45, 0x02, 0x00, 0x00, 0x00, // switch (2 targets)
+        0x28, 0x00, 0x00, 0x00,
+        0x6f, 0x00, 0x00, 0x00,
+        0x26,                         // pop
+        0x2a                          // ret
+    });
+
+    bool result;
+    auto tokens = GetCallTokens(image, &result);
+    EXPECT_FALSE(result);
+    EXPECT_TRUE(tokens.empty());
+}
+
+TEST(ILCallScanner, StopsWhenPredicateReturnsTrue) {
+    auto image = MakeTinyMethodImage({
+        0x28, 0x01, 0x00, 0x00, 0x0a, // call 0a000001
+        0x28, 0x02, 0x00, 0x00, 0x0a, // call 0a000002
+        0x2a                          // ret
+    });
+
+    std::vector<mdToken> tokens;
+    bool result = ILCallScanner::AnyCall(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()), [&](mdToken token) {
+        tokens.push_back(token);
+        return true;
+    });
+
+    EXPECT_TRUE(result);
+    EXPECT_EQ(std::vector<mdToken>({ 0x0a000001 }), tokens);
+}
+
+TEST(ILCallScanner, ReportsUndecodableILAsPossibleMatch) {
+    std::vector<std::vector<BYTE>> badCode =
+    {
+        { 0x28, 0x01, 0x00 },                         // truncated operand
+        { 0xfe },                                     // truncated two-byte opcode
+        { 0x45, 0xff, 0xff, 0xff, 0x0f, 0x00, 0x00 }  // switch with more targets than bytes
+    };
+
+    for (size_t i = 0; i < badCode.size(); i++)
+    {
+        bool result;
+        auto tokens = GetCallTokens(MakeTinyMethodImage(badCode[i]), &result);
+        EXPECT_TRUE(result) << "case " << i;
+        EXPECT_TRUE(tokens.empty());
+    }
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(ILCallScanner, DISABLED_BenchmarkMissHeavyModule) {
+    const int c_methods = 20000;
+    const int c_callsPerMethod = 16;
+
+    // Methods that make plenty of calls, none of them to anything returning an observable.
+    std::vector<std::vector<BYTE>> images;
+    for (int m = 0; m < c_methods; m++)
+    {
+        std::vector<BYTE> code;
+        for (int c = 0; c < c_callsPerMethod; c++)
+        {
+            mdToken token = 0x0a000000 + ((m * c_callsPerMethod + c) % 500) + 1;
+            BYTE callCode[] = {
+                0x02,                                          // ldarg.0
+                0x7b, 0x01, 0x00, 0x00, 0x04,                  // ldfld 04000001
+                0x2d, 0x06,                                    // brtrue.s +6
+                0x6f, (BYTE)token, (BYTE)(token >> 8), (BYTE)(token >> 16), (BYTE)(token >> 24), // callvirt
+                0x0a,                                          // stloc.0
+                0x06                                           // ldloc.0
+            };
+            code.insert(code.end(), std::begin(callCode), std::end(callCode));
+            code.push_back(0x26); // pop
+        }
+        code.push_back(0x2a); // ret
+        images.push_back(MakeFatMethodImage(code));
+    }
+
+    std::unordered_set<mdToken> observableReturningMethods = { 0x0a0fffff };
+    auto returnsObservable = [&](mdToken token) { return observableReturningMethods.count(token) != 0; };
+
+    auto start = std::chrono::steady_clock::now();
+    int methodModelHits = 0;
+    for (auto& image : images)
+    {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+        for (auto& pInstr : method.m_instructions)
+        {
+            if ((pInstr->m_operation == CEE_CALL || pInstr->m_operation == CEE_CALLVIRT) &&
+                returnsObservable(static_cast<mdToken>(pInstr->m_operand)))
+            {
+                methodModelHits++;
+                break;
+            }
+        }
+    }
+    auto methodModelNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    int scannerHits = 0;
+    for (auto& image : images)
+    {
+        if (ILCallScanner::AnyCall(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()), returnsObservable))
+        {
+            scannerHits++;
+        }
+    }
+    auto scannerNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(0, methodModelHits);
+    EXPECT_EQ(0, scannerHits);
+
+    std::cout << "Method model: " << methodModelNs / c_methods << "ns/method" << std::endl;
+    std::cout << "IL call scan: " << scannerNs / c_methods << "ns/method" << std::endl;
+}
@@ -0,0 +1,120 @@
+#include "pch.h"
+#include "LocalsAllocator.h"
+#include "Signature.h"
+
+#include <chrono>
+#include <iostream>
+
+static const std::vector<COR_SIGNATURE> c_observableOfString = { ELEMENT_TYPE_GENERICINST, ELEMENT_TYPE_CLASS, 0x35, 0x01, ELEMENT_TYPE_STRING };
+static const std::vector<COR_SIGNATURE> c_observableOfInt = { ELEMENT_TYPE_GENERICINST, ELEMENT_TYPE_CLASS, 0x35, 0x01, ELEMENT_TYPE_I4 };
+static const std::vector<COR_SIGNATURE> c_funcOfObservable = { ELEMENT_TYPE_CLASS, 0x49 };
+
+TEST(LocalsAllocator, MakesSignatureForMethodWithoutLocals) {
+    LocalsAllocator locals({});
+    EXPECT_FALSE(locals.HasNewLocals());
+
+    EXPECT_EQ(0u, locals.Allocate(c_observableOfString));
+    EXPECT_EQ(1u, locals.Allocate(c_funcOfObservable));
+    EXPECT_TRUE(locals.HasNewLocals());
+    EXPECT_EQ(2u, locals.GetCount());
+
+    std::vector<COR_SIGNATURE> expected = { IMAGE_CEE_CS_CALLCONV_LOCAL_SIG, 0x02 };
+    expected.insert(expected.end(), c_observableOfString.begin(), c_observableOfString.end());
+    expected.insert(expected.end(), c_funcOfObservable.begin(), c_funcOfObservable.end());
+    EXPECT_EQ(expected, locals.GetSignature());
+}
+
+TEST(LocalsAllocator, AppendsToExistingLocals) {
+    std::vector<COR_SIGNATURE> existing = { IMAGE_CEE_CS_CALLCONV_LOCAL_SIG, 0x02, ELEMENT_TYPE_I4, ELEMENT_TYPE_STRING };
+    LocalsAllocator locals(existing);
+    EXPECT_EQ(2u, locals.GetExistingCount());
+
+    EXPECT_EQ(2u, locals.Allocate(c_observableOfInt));
+
+    std::vector<COR_SIGNATURE> expected = { IMAGE_CEE_CS_CALLCONV_LOCAL_SIG, 0x03, ELEMENT_TYPE_I4, ELEMENT_TYPE_STRING };
+    expected.insert(expected.end(), c_observableOfInt.begin(), c_observableOfInt.end());
+    EXPECT_EQ(expected, locals.GetSignature());
+
+    LocalsSignatureReader reader(locals.GetSignature());
+    EXPECT_EQ(3, reader.GetCount());
+}
+
+TEST(LocalsAllocator, GivesDistinctLocalsWithinOneSite) {
+    LocalsAllocator locals({});
+    ULONG first = locals.Allocate(c_observableOfString);
+    ULONG second = locals.Allocate(c_observableOfString);
+    EXPECT_NE(first, second);
+    EXPECT_EQ(2u, locals.GetCount());
+}
+
+TEST(LocalsAllocator, ReusesLocalsOfSameTypeAcrossSites) {
+    LocalsAllocator locals({});
+    ULONG string1 = locals.Allocate(c_observableOfString);
+    ULONG string2 = locals.Allocate(c_observableOfString);
+    locals.ReleaseAll();
+
+    // Only types that match exactly are shared.
+    ULONG int1 = locals.Allocate(c_observableOfInt);
+    EXPECT_EQ(string1, locals.Allocate(c_observableOfString));
+    EXPECT_EQ(string2, locals.Allocate(c_observableOfString));
+    EXPECT_EQ(3u, locals.GetCount());
+    locals.ReleaseAll();
+
+    EXPECT_EQ(int1, locals.Allocate(c_observableOfInt));
+    EXPECT_EQ(3u, locals.GetCount());
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(LocalsAllocator, DISABLED_BenchmarkOperatorHeavyMethod) {
+    const int c_methods = 2000;
+    const int c_callSites = 60;
+    const std::vector<COR_SIGNATURE>* argTypes[] = { &c_observableOfString, &c_observableOfInt, &c_funcOfObservable };
+    std::vector<COR_SIGNATURE> existing = { IMAGE_CEE_CS_CALLCONV_LOCAL_SIG, 0x02, ELEMENT_TYPE_I4, ELEMENT_TYPE_STRING };
+
+    // Each site passes an observable plus one or two more args, as with Select, Merge, Zip etc.
+    auto getSiteArgs = [&](int site) {
+        std::vector<SignatureBlob> args;
+        for (int arg = 0; arg < 2 + site % 2; arg++)
+        {
+            args.push_back(*argTypes[(site + arg) % std::size(argTypes)]);
+        }
+        return args;
+    };
+
+    // Previous scheme: fresh locals for every arg of every site, with the signature rebuilt each time.
+    auto start = std::chrono::steady_clock::now();
+    size_t perSiteLocals = 0;
+    for (int m = 0; m < c_methods; m++)
+    {
+        std::vector<COR_SIGNATURE> sig = existing;
+        for (int site = 0; site < c_callSites; site++)
+        {
+            sig = LocalsSignatureReader(sig).AppendLocals(getSiteArgs(site));
+        }
+        perSiteLocals = LocalsSignatureReader(sig).GetCount();
+    }
+    auto perSiteNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    size_t sharedLocals = 0;
+    for (int m = 0; m < c_methods; m++)
+    {
+        LocalsAllocator locals(existing);
+        for (int site = 0; site < c_callSites; site++)
+        {
+            auto args = getSiteArgs(site);
+            for (size_t arg = 1; arg < args.size(); arg++)
+            {
+                locals.Allocate(args[arg]);
+            }
+            locals.ReleaseAll();
+        }
+        sharedLocals = LocalsSignatureReader(locals.GetSignature()).GetCount();
+    }
+    auto sharedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_LT(sharedLocals, perSiteLocals);
+
+    std::cout << "Per-site locals: " << perSiteLocals << " locals, " << perSiteNs / c_methods << "ns/method" << std::endl;
+    std::cout << "Shared locals:   " << sharedLocals << " locals, " << sharedNs / c_methods << "ns/method" << std::endl;
+}
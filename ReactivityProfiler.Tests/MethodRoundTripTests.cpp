@@ -0,0 +1,767 @@
+#include "pch.h"
+#include "Instrumentation/Method.h"
+
+#include <chrono>
+#include <iostream>
+
+using namespace Instrumentation;
+
+// Generates method bodies from a stream of bytes, and checks that Method reads and writes them
+// back faithfully, with and without instrumentation inserted. The bytes come either from a
+// seeded random number generator (the tests below) or from libFuzzer (see the end of the file).
+
+namespace
+{
+    struct DecodedInstruction
+    {
+        CanonicalName m_operation;
+        ULONG m_offset;
+        std::vector<BYTE> m_operand; // not set for branches and switches
+        std::vector<ULONG> m_targets;
+    };
+
+    struct DecodedClause
+    {
+        ULONG m_flags;
+        ULONG m_tryStart;
+        ULONG m_tryEnd;
+        ULONG m_handlerStart;
+        ULONG m_handlerEnd;
+        ULONG m_filterStartOrToken;
+    };
+
+    struct DecodedMethod
+    {
+        bool m_isTiny = false;
+        WORD m_flags = 0; // fat header flags other than the format and MoreSects
+        WORD m_maxStack = 8;
+        mdSignature m_localsSignature = mdTokenNil;
+        ULONG m_codeSize = 0;
+        std::vector<DecodedInstruction> m_instructions;
+        std::vector<DecodedClause> m_clauses;
+    };
+
+    const LONG c_markerBase = 0x40000000;
+    const LONG c_markerMask = 0x70000000;
+
+    ULONG ReadULong(const BYTE* p)
+    {
+        ULONG value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    void AppendBytes(std::vector<BYTE>& image, ULONGLONG value, size_t size)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            image.push_back(static_cast<BYTE>(value >> (8 * i)));
+        }
+    }
+
+    // Decodes a method image independently of Method, using just the opcode table.
+    DecodedMethod Decode(const std::vector<BYTE>& image)
+    {
+        DecodedMethod method;
+        const BYTE* pCode;
+        size_t position;
+        auto pFat = reinterpret_cast<const IMAGE_COR_ILMETHOD_FAT*>(image.data());
+        if ((image[0] & CorILMethod_FormatMask) != CorILMethod_FatFormat)
+        {
+            method.m_isTiny = true;
+            method.m_codeSize = image[0] >> (CorILMethod_FormatShift - 1);
+            pCode = image.data() + 1;
+            position = 1;
+        }
+        else
+        {
+            method.m_flags = pFat->Flags & ~(CorILMethod_FormatMask | CorILMethod_MoreSects);
+            method.m_maxStack = pFat->MaxStack;
+            method.m_localsSignature = pFat->LocalVarSigTok;
+            method.m_codeSize = pFat->CodeSize;
+            pCode = image.data() + pFat->Size * sizeof(DWORD);
+            position = pFat->Size * sizeof(DWORD);
+        }
+
+        if (position + method.m_codeSize > image.size())
+        {
+            throw std::string("code runs beyond end of image");
+        }
+
+        ULONG offset = 0;
+        while (offset < method.m_codeSize)
+        {
+            DecodedInstruction instr;
+            instr.m_offset = offset;
+            BYTE op = pCode[offset++];
+            const OperationDetails* pDetails = &Operations::GetDetails(REFPRE, op);
+            if (op == STP1 && offset < method.m_codeSize)
+            {
+                pDetails = &Operations::GetDetails(STP1, pCode[offset++]);
+            }
+
+            if (pDetails->canonicalName == CEE_ILLEGAL || offset + pDetails->operandSize > method.m_codeSize)
+            {
+                throw std::string("undecodable instruction at ") + std::to_string(instr.m_offset);
+            }
+
+            instr.m_operation = pDetails->canonicalName;
+            const BYTE* pOperand = pCode + offset;
+            offset += pDetails->operandSize;
+            if (pDetails->operandParam == InlineSwitch)
+            {
+                ULONG count = ReadULong(pOperand);
+                ULONG end = offset + 4 * count;
+                for (ULONG i = 0; i < count; i++)
+                {
+                    instr.m_targets.push_back(end + static_cast<LONG>(ReadULong(pCode + offset + 4 * i)));
+                }
+                offset = end;
+            }
+            else if (pDetails->operandParam == ShortInlineBrTarget)
+            {
+                instr.m_targets.push_back(offset + static_cast<signed char>(*pOperand));
+            }
+            else if (pDetails->operandParam == InlineBrTarget)
+            {
+                instr.m_targets.push_back(offset + static_cast<LONG>(ReadULong(pOperand)));
+            }
+            else
+            {
+                instr.m_operand.assign(pOperand, pOperand + pDetails->operandSize);
+            }
+
+            method.m_instructions.push_back(instr);
+        }
+
+        if (method.m_isTiny || (pFat->Flags & CorILMethod_MoreSects) == 0)
+        {
+            return method;
+        }
+
+        position += method.m_codeSize;
+        BYTE kind;
+        do
+        {
+            position = (position + 3) & ~3;
+            kind = image.at(position);
+            if (kind & CorILMethod_Sect_FatFormat)
+            {
+                ULONG dataSize = ReadULong(&image.at(position)) >> 8;
+                for (size_t clause = position + 4; clause + 24 <= position + dataSize; clause += 24)
+                {
+                    const BYTE* p = &image.at(clause + 23) - 23;
+                    method.m_clauses.push_back({
+                        ReadULong(p),
+                        ReadULong(p + 4),
+                        ReadULong(p + 4) + ReadULong(p + 8),
+                        ReadULong(p + 12),
+                        ReadULong(p + 12) + ReadULong(p + 16),
+                        ReadULong(p + 20) });
+                }
+                position += dataSize;
+            }
+            else
+            {
+                BYTE dataSize = image.at(position + 1);
+                for (size_t clause = position + 4; clause + 12 <= position + dataSize; clause += 12)
+                {
+                    const BYTE* p = &image.at(clause + 11) - 11;
+                    auto readUShort = [](const BYTE* q) { return static_cast<ULONG>(q[0] | (q[1] << 8)); };
+                    method.m_clauses.push_back({
+                        readUShort(p),
+                        readUShort(p + 2),
+                        readUShort(p + 2) + p[4],
+                        readUShort(p + 5),
+                        readUShort(p + 5) + p[7],
+                        ReadULong(p + 8) });
+                }
+                position += dataSize;
+            }
+        } while (kind & CorILMethod_Sect_MoreSects);
+
+        return method;
+    }
+
+    // Decodes a method image, saying which one it was if it can't be decoded.
+    DecodedMethod Decode(const std::vector<BYTE>& image, const char* stage)
+    {
+        try
+        {
+            return Decode(image);
+        }
+        catch (const std::string& failure)
+        {
+            throw stage + (": " + failure);
+        }
+    }
+
+    CanonicalName GetLongBranch(CanonicalName operation)
+    {
+        const OperationDetails& details = Operations::GetDetails(operation);
+        if (details.operandParam != ShortInlineBrTarget)
+        {
+            return operation;
+        }
+
+        // br.s => br, leave.s => leave etc.
+        std::basic_string<TCHAR> name(details.stringName);
+        name.resize(name.size() - 2);
+        for (const OperationDetails& longDetails : OperationTables::c_operationDetails)
+        {
+            if (name == longDetails.stringName)
+            {
+                return longDetails.canonicalName;
+            }
+        }
+        return operation;
+    }
+
+    // Index of the instruction at an offset, or the instruction count for the end of the code.
+    size_t GetIndex(const DecodedMethod& method, ULONG offset)
+    {
+        if (offset == method.m_codeSize)
+        {
+            return method.m_instructions.size();
+        }
+
+        auto it = std::lower_bound(method.m_instructions.begin(), method.m_instructions.end(), offset,
+            [](const DecodedInstruction& instr, ULONG offset) { return instr.m_offset < offset; });
+        if (it == method.m_instructions.end() || it->m_offset != offset)
+        {
+            throw std::string("reference to offset ") + std::to_string(offset) + " which is not the start of an instruction";
+        }
+        return it - method.m_instructions.begin();
+    }
+
+    std::vector<ULONG> GetClauseOffsets(const DecodedClause& clause)
+    {
+        std::vector<ULONG> offsets = { clause.m_tryStart, clause.m_tryEnd, clause.m_handlerStart, clause.m_handlerEnd };
+        if (clause.m_flags & COR_ILEXCEPTION_CLAUSE_FILTER)
+        {
+            offsets.push_back(clause.m_filterStartOrToken);
+        }
+        return offsets;
+    }
+
+    // Generates a method with arbitrary instructions, but with branches, switches and exception
+    // clauses that all refer to the starts of instructions.
+    std::vector<BYTE> GenerateMethod(FuzzInput& input, bool allowShortForms)
+    {
+        static const std::vector<CanonicalName> c_operations = [] {
+            std::vector<CanonicalName> operations;
+            for (const OperationDetails& details : OperationTables::c_operationDetails)
+            {
+                if ((details.op1 == REFPRE || details.op1 == STP1) &&
+                    details.canonicalName != CEE_ILLEGAL &&
+                    details.opcodeKind != IInternal)
+                {
+                    operations.push_back(details.canonicalName);
+                }
+            }
+            return operations;
+        }();
+        static const std::vector<CanonicalName> c_longOperations = [] {
+            std::vector<CanonicalName> operations;
+            for (CanonicalName operation : c_operations)
+            {
+                if (Operations::GetDetails(operation).operandParam != ShortInlineBrTarget)
+                {
+                    operations.push_back(operation);
+                }
+            }
+            return operations;
+        }();
+        const std::vector<CanonicalName>& operations = allowShortForms ? c_operations : c_longOperations;
+
+        ULONG count = 1 + input.Next(input.NextBool() ? 16 : 200);
+        std::vector<CanonicalName> instrs;
+        std::vector<ULONG> switchCounts;
+        std::vector<ULONG> offsets;
+        ULONG offset = 0;
+        for (ULONG i = 0; i < count; i++)
+        {
+            CanonicalName operation = i + 1 == count ? CEE_RET : operations[input.Next(static_cast<ULONG>(operations.size()))];
+            if (i > 0 && i + 1 < count && Operations::GetDetails(instrs.back()).opcodeKind == IPrefix)
+            {
+                operation = input.NextBool() ? CEE_CALL : CEE_CALLVIRT;
+            }
+            const OperationDetails& details = Operations::GetDetails(operation);
+            ULONG switchCount = details.operandParam == InlineSwitch ? input.Next(5) : 0;
+            instrs.push_back(operation);
+            switchCounts.push_back(switchCount);
+            offsets.push_back(offset);
+            offset += details.totalLength() + 4 * switchCount;
+        }
+        offsets.push_back(offset);
+        ULONG codeSize = offset;
+
+        std::vector<BYTE> code;
+        for (ULONG i = 0; i < count; i++)
+        {
+            const OperationDetails& details = Operations::GetDetails(instrs[i]);
+            if (details.op1 == STP1)
+            {
+                code.push_back(details.op1);
+            }
+            code.push_back(details.op2);
+
+            ULONG next = offsets[i + 1];
+            switch (details.operandParam)
+            {
+            case ShortInlineBrTarget:
+            {
+                LONG displacement = static_cast<LONG>(offsets[input.Next(count)]) - static_cast<LONG>(next);
+                code.push_back(displacement >= -128 && displacement <= 127 ? static_cast<BYTE>(displacement) : 0);
+                break;
+            }
+            case InlineBrTarget:
+                AppendBytes(code, static_cast<LONG>(offsets[input.Next(count)]) - static_cast<LONG>(next), 4);
+                break;
+            case InlineSwitch:
+                AppendBytes(code, switchCounts[i], 4);
+                for (ULONG t = 0; t < switchCounts[i]; t++)
+                {
+                    AppendBytes(code, static_cast<LONG>(offsets[input.Next(count)]) - static_cast<LONG>(next), 4);
+                }
+                break;
+            case InlineI:
+                // Keep clear of the values used to mark inserted code
+                AppendBytes(code, input.Next(0x10000000), 4);
+                break;
+            default:
+                for (int b = 0; b < details.operandSize; b++)
+                {
+                    code.push_back(input.NextByte());
+                }
+                break;
+            }
+        }
+
+        std::vector<TestExceptionClause> clauses;
+        if (count > 1 && (codeSize >= 64 || input.NextBool()))
+        {
+            ULONG clauseCount = input.Next(4);
+            for (ULONG c = 0; c < clauseCount; c++)
+            {
+                // Try blocks can't run to the end of the code, and filters can't start at the
+                // beginning, but otherwise anything goes as far as Method is concerned.
+                ULONG tryStart = input.Next(count - 1);
+                ULONG tryEnd = tryStart + 1 + input.Next(count - 1 - tryStart);
+                ULONG handlerStart = input.Next(count);
+                ULONG handlerEnd = handlerStart + 1 + input.Next(count - handlerStart);
+                static const CorExceptionFlag c_flags[] = {
+                    COR_ILEXCEPTION_CLAUSE_NONE, COR_ILEXCEPTION_CLAUSE_FILTER, COR_ILEXCEPTION_CLAUSE_FINALLY, COR_ILEXCEPTION_CLAUSE_FAULT };
+                CorExceptionFlag flags = c_flags[input.Next(4)];
+                ULONG filterStartOrToken = flags == COR_ILEXCEPTION_CLAUSE_FILTER ? offsets[1 + input.Next(count - 1)] :
+                    flags == COR_ILEXCEPTION_CLAUSE_NONE ? 0x01000000 | input.Next(0x100) : 0;
+                clauses.push_back({
+                    flags,
+                    offsets[tryStart], offsets[tryEnd] - offsets[tryStart],
+                    offsets[handlerStart], offsets[handlerEnd] - offsets[handlerStart],
+                    filterStartOrToken });
+            }
+        }
+
+        if (allowShortForms && clauses.empty() && codeSize < 64 && input.NextBool())
+        {
+            return MakeTinyMethodImage(code);
+        }
+
+        std::vector<BYTE> image = MakeFatMethodImage(code, clauses);
+        auto pHeader = reinterpret_cast<IMAGE_COR_ILMETHOD_FAT*>(image.data());
+        pHeader->MaxStack = static_cast<WORD>(input.Next(20));
+        if (input.NextBool())
+        {
+            pHeader->LocalVarSigTok = 0x11000000 | (1 + input.Next(0x100));
+            pHeader->Flags |= input.NextBool() ? CorILMethod_InitLocals : 0;
+        }
+
+        bool fitsSmallSection = std::all_of(clauses.begin(), clauses.end(), [](const TestExceptionClause& clause) {
+            return clause.tryOffset <= 0xffff && clause.tryLength <= 0xff && clause.handlerOffset <= 0xffff && clause.handlerLength <= 0xff;
+        });
+        if (allowShortForms && !clauses.empty() && fitsSmallSection && clauses.size() * 12 + 4 <= 0xff && input.NextBool())
+        {
+            // Rewrite the clauses as a small section
+            image.resize(image.size() - (clauses.size() * 24 + 4));
+            image.push_back(CorILMethod_Sect_EHTable);
+            image.push_back(static_cast<BYTE>(clauses.size() * 12 + 4));
+            AppendBytes(image, 0, 2);
+            for (auto& clause : clauses)
+            {
+                AppendBytes(image, clause.flags, 2);
+                AppendBytes(image, clause.tryOffset, 2);
+                AppendBytes(image, clause.tryLength, 1);
+                AppendBytes(image, clause.handlerOffset, 2);
+                AppendBytes(image, clause.handlerLength, 1);
+                AppendBytes(image, clause.classTokenOrFilterOffset, 4);
+            }
+        }
+
+        return image;
+    }
+
+    std::vector<BYTE> WriteMethod(Method& method)
+    {
+        std::vector<BYTE> image(method.GetMethodSize());
+        method.WriteMethod(reinterpret_cast<IMAGE_COR_ILMETHOD*>(image.data()));
+        return image;
+    }
+
+    // Checks that a method written by Method has the same code and clauses as the original, allowing
+    // for short branches being widened and small headers and sections being written as fat ones.
+    std::string CheckEquivalent(const DecodedMethod& original, const DecodedMethod& written)
+    {
+        if (original.m_instructions.size() != written.m_instructions.size())
+        {
+            return "instruction count differs";
+        }
+        if (!written.m_isTiny && (original.m_maxStack != written.m_maxStack ||
+            original.m_localsSignature != written.m_localsSignature || original.m_flags != written.m_flags))
+        {
+            return "header differs";
+        }
+
+        for (size_t i = 0; i < original.m_instructions.size(); i++)
+        {
+            auto& origInstr = original.m_instructions[i];
+            auto& writtenInstr = written.m_instructions[i];
+            if (GetLongBranch(origInstr.m_operation) != GetLongBranch(writtenInstr.m_operation) ||
+                origInstr.m_operand != writtenInstr.m_operand ||
+                origInstr.m_targets.size() != writtenInstr.m_targets.size())
+            {
+                return "instruction " + std::to_string(i) + " differs";
+            }
+
+            for (size_t t = 0; t < origInstr.m_targets.size(); t++)
+            {
+                if (GetIndex(original, origInstr.m_targets[t]) != GetIndex(written, writtenInstr.m_targets[t]))
+                {
+                    return "branch target of instruction " + std::to_string(i) + " differs";
+                }
+            }
+        }
+
+        if (original.m_clauses.size() != written.m_clauses.size())
+        {
+            return "exception clause count differs";
+        }
+        for (size_t c = 0; c < original.m_clauses.size(); c++)
+        {
+            auto origOffsets = GetClauseOffsets(original.m_clauses[c]);
+            auto writtenOffsets = GetClauseOffsets(written.m_clauses[c]);
+            if (original.m_clauses[c].m_flags != written.m_clauses[c].m_flags || origOffsets.size() != writtenOffsets.size() ||
+                (!(original.m_clauses[c].m_flags & COR_ILEXCEPTION_CLAUSE_FILTER) &&
+                    original.m_clauses[c].m_filterStartOrToken != written.m_clauses[c].m_filterStartOrToken))
+            {
+                return "exception clause " + std::to_string(c) + " differs";
+            }
+
+            for (size_t o = 0; o < origOffsets.size(); o++)
+            {
+                if (GetIndex(original, origOffsets[o]) != GetIndex(written, writtenOffsets[o]))
+                {
+                    return "exception clause " + std::to_string(c) + " boundary differs";
+                }
+            }
+        }
+
+        return {};
+    }
+
+    bool IsMarker(const DecodedInstruction& instr)
+    {
+        return instr.m_operation == CEE_LDC_I4 && (ReadULong(instr.m_operand.data()) & c_markerMask) == c_markerBase;
+    }
+
+    ULONG GetMarkerOffset(const DecodedInstruction& instr)
+    {
+        return (ReadULong(instr.m_operand.data()) >> 8) & 0xfffff;
+    }
+
+    ULONG GetMarkerIndex(const DecodedInstruction& instr)
+    {
+        return ReadULong(instr.m_operand.data()) & 0xff;
+    }
+
+    // Checks a method with marker code (ldc.i4 marker; pop) inserted at some of its original
+    // instructions. Removing the markers must give back the original code, the markers for each
+    // instruction must be next to it in the order they were queued, and anything that referred to
+    // the instruction must now refer to the start of the markers if they were inserted before it.
+    std::string CheckInsertion(const DecodedMethod& original, const DecodedMethod& written,
+        const std::vector<ULONG>& insertionOffsets, const std::vector<COR_IL_MAP>& ilMap)
+    {
+        // Where each original instruction is now, and where references to it should go
+        std::vector<size_t> newIndexes;
+        std::vector<size_t> referenceIndexes;
+        std::vector<bool> seenInsertions(insertionOffsets.size());
+        size_t groupStart = 0;
+        for (size_t i = 0; i <= written.m_instructions.size(); i++)
+        {
+            if (i < written.m_instructions.size() && IsMarker(written.m_instructions[i]))
+            {
+                auto& marker = written.m_instructions[i];
+                ULONG index = GetMarkerIndex(marker);
+                if (i + 1 == written.m_instructions.size() || written.m_instructions[i + 1].m_operation != CEE_POP ||
+                    index >= insertionOffsets.size() || seenInsertions[index] || insertionOffsets[index] != GetMarkerOffset(marker))
+                {
+                    return "unexpected marker " + std::to_string(index);
+                }
+                seenInsertions[index] = true;
+
+                if (i != groupStart)
+                {
+                    // Follows other markers, so must have been queued after them for the same
+                    // instruction, or be the first of those for the next instruction
+                    auto& previous = written.m_instructions[i - 2];
+                    if (GetMarkerOffset(previous) == GetMarkerOffset(marker) ? GetMarkerIndex(previous) > index :
+                        newIndexes.empty() || GetMarkerOffset(previous) != original.m_instructions[newIndexes.size() - 1].m_offset)
+                    {
+                        return "markers out of order at " + std::to_string(written.m_instructions[i].m_offset);
+                    }
+                }
+                i++;
+                continue;
+            }
+
+            // An original instruction, or the end of the code; the markers before it were inserted
+            // after the previous instruction, then before this one.
+            size_t origIndex = newIndexes.size();
+            ULONG origOffset = origIndex < original.m_instructions.size() ? original.m_instructions[origIndex].m_offset : original.m_codeSize;
+            size_t before = i;
+            for (size_t m = groupStart; m < i; m += 2)
+            {
+                ULONG markerOffset = GetMarkerOffset(written.m_instructions[m]);
+                if (markerOffset == origOffset)
+                {
+                    before = before < m ? before : m;
+                }
+                else if (before < m || origIndex == 0 || markerOffset != original.m_instructions[origIndex - 1].m_offset)
+                {
+                    return "marker for offset " + std::to_string(markerOffset) + " is not next to its instruction";
+                }
+            }
+
+            newIndexes.push_back(i);
+            referenceIndexes.push_back(before);
+            groupStart = i + 1;
+        }
+
+        if (std::find(seenInsertions.begin(), seenInsertions.end(), false) != seenInsertions.end())
+        {
+            return "marker missing";
+        }
+        if (newIndexes.size() != original.m_instructions.size() + 1)
+        {
+            return "instruction count differs once markers are removed";
+        }
+
+        auto checkReference = [&](ULONG origOffset, ULONG writtenOffset) {
+            return referenceIndexes[GetIndex(original, origOffset)] == GetIndex(written, writtenOffset);
+        };
+
+        for (size_t i = 0; i < original.m_instructions.size(); i++)
+        {
+            auto& origInstr = original.m_instructions[i];
+            auto& writtenInstr = written.m_instructions[newIndexes[i]];
+            if (GetLongBranch(origInstr.m_operation) != GetLongBranch(writtenInstr.m_operation) ||
+                origInstr.m_operand != writtenInstr.m_operand ||
+                origInstr.m_targets.size() != writtenInstr.m_targets.size())
+            {
+                return "instruction " + std::to_string(i) + " differs";
+            }
+
+            for (size_t t = 0; t < origInstr.m_targets.size(); t++)
+            {
+                if (!checkReference(origInstr.m_targets[t], writtenInstr.m_targets[t]))
+                {
+                    return "branch target of instruction " + std::to_string(i) + " is wrong";
+                }
+            }
+
+            auto mapping = std::find_if(ilMap.begin(), ilMap.end(), [&](const COR_IL_MAP& entry) { return entry.oldOffset == origInstr.m_offset; });
+            if (mapping == ilMap.end() || mapping->newOffset != writtenInstr.m_offset)
+            {
+                return "IL map entry for instruction " + std::to_string(i) + " is wrong";
+            }
+        }
+
+        if (original.m_clauses.size() != written.m_clauses.size())
+        {
+            return "exception clause count differs";
+        }
+        for (size_t c = 0; c < original.m_clauses.size(); c++)
+        {
+            auto origOffsets = GetClauseOffsets(original.m_clauses[c]);
+            auto writtenOffsets = GetClauseOffsets(written.m_clauses[c]);
+            if (origOffsets.size() != writtenOffsets.size())
+            {
+                return "exception clause " + std::to_string(c) + " differs";
+            }
+
+            for (size_t o = 0; o < origOffsets.size(); o++)
+            {
+                if (!checkReference(origOffsets[o], writtenOffsets[o]))
+                {
+                    return "exception clause " + std::to_string(c) + " boundary is wrong";
+                }
+            }
+        }
+
+        return {};
+    }
+
+    // Generates a method from the input and checks that it survives being read and written back by
+    // Method, compacted, and instrumented. Returns a description of the first problem found.
+    std::string CheckMethodFromFuzzInput(const BYTE* pData, size_t size)
+    {
+        FuzzInput input(pData, size);
+        bool allowShortForms = input.NextBool();
+        std::vector<BYTE> image = GenerateMethod(input, allowShortForms);
+
+        try
+        {
+            DecodedMethod original = Decode(image, "original");
+
+            Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+            std::vector<BYTE> written = WriteMethod(method);
+            if (!allowShortForms && written != image)
+            {
+                return "method with only long forms did not round-trip exactly";
+            }
+
+            std::string failure = CheckEquivalent(original, Decode(written, "written"));
+            if (!failure.empty())
+            {
+                return "round trip: " + failure;
+            }
+
+            Method rereadMethod(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(written.data()));
+            if (WriteMethod(rereadMethod) != written)
+            {
+                return "rewriting a written method changed it";
+            }
+
+            Method compactMethod(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+            compactMethod.Compact();
+            failure = CheckEquivalent(original, Decode(WriteMethod(compactMethod), "compacted"));
+            if (!failure.empty())
+            {
+                return "compact: " + failure;
+            }
+
+            Method instrumentedMethod(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+            std::vector<ULONG> insertionOffsets(input.Next(8));
+            for (ULONG i = 0; i < insertionOffsets.size(); i++)
+            {
+                ULONG origOffset = original.m_instructions[input.Next(static_cast<ULONG>(original.m_instructions.size()))].m_offset;
+                InstructionList instructions;
+                instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4, c_markerBase | (origOffset << 8) | i));
+                instructions.push_back(std::make_unique<Instruction>(CEE_POP));
+                instrumentedMethod.QueueInstructionsAtOriginalOffset(origOffset, instructions);
+                insertionOffsets[i] = origOffset;
+            }
+            instrumentedMethod.ApplyQueuedInstructions();
+            if (input.NextBool())
+            {
+                instrumentedMethod.Compact();
+            }
+
+            std::vector<BYTE> instrumented = WriteMethod(instrumentedMethod);
+            std::vector<COR_IL_MAP> ilMap(instrumentedMethod.GetILMapSize());
+            instrumentedMethod.PopulateILMap(static_cast<ULONG>(ilMap.size()), ilMap.data());
+            failure = CheckInsertion(original, Decode(instrumented, "instrumented"), insertionOffsets, ilMap);
+            if (!failure.empty())
+            {
+                return "insertion: " + failure;
+            }
+        }
+        catch (const std::string& failure)
+        {
+            return failure;
+        }
+
+        return {};
+    }
+}
+
+TEST(MethodRoundTrip, GeneratedMethodsSurviveReadWriteAndInsertion) {
+    for (auto& input : GenerateFuzzInputs(2000, 1))
+    {
+        std::string failure = CheckMethodFromFuzzInput(input.data(), input.size());
+        ASSERT_EQ("", failure) << "input: " << Describe(input);
+    }
+}
+
+TEST(MethodRoundTrip, WidensSmallExceptionSections) {
+    // try { nop; leave.s } finally { endfinally }, with a small EH section
+    std::vector<BYTE> image = MakeFatMethodImage({ 0x00, 0xde, 0x01, 0xdc, 0x2a }, { { COR_ILEXCEPTION_CLAUSE_FINALLY, 0, 3, 3, 1, 0 } });
+    image.resize(image.size() - 28);
+    std::vector<BYTE> smallSection = { CorILMethod_Sect_EHTable, 16, 0, 0, 2, 0, 0, 0, 3, 3, 0, 1, 0, 0, 0, 0 };
+    image.insert(image.end(), smallSection.begin(), smallSection.end());
+
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+    std::vector<BYTE> written = WriteMethod(method);
+
+    auto expected = MakeFatMethodImage({ 0x00, 0xdd, 0x01, 0x00, 0x00, 0x00, 0xdc, 0x2a }, { { COR_ILEXCEPTION_CLAUSE_FINALLY, 0, 6, 6, 1, 0 } });
+    EXPECT_EQ(expected, written);
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(MethodRoundTrip, DISABLED_BenchmarkThroughput) {
+    std::vector<std::vector<BYTE>> images;
+    size_t totalBytes = 0;
+    for (auto& input : GenerateFuzzInputs(20000, 2))
+    {
+        FuzzInput fuzzInput(input.data(), input.size());
+        images.push_back(GenerateMethod(fuzzInput, true));
+        totalBytes += images.back().size();
+    }
+
+    auto measure = [&](const char* name, const std::function<void(const std::vector<BYTE>&)>& process) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto& image : images)
+        {
+            process(image);
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << totalBytes / seconds / (1024 * 1024) << "MB/s" << std::endl;
+    };
+
+    measure("Read:                ", [](const std::vector<BYTE>& image) {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+    });
+    measure("Read, write:         ", [](const std::vector<BYTE>& image) {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+        WriteMethod(method);
+    });
+    measure("Read, insert, write: ", [](const std::vector<BYTE>& image) {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+        for (size_t i = 0; i < method.m_instructions.size() && method.m_instructions[i]->m_origOffset >= 0; i += 8)
+        {
+            InstructionList instructions;
+            instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4, 1));
+            instructions.push_back(std::make_unique<Instruction>(CEE_POP));
+            method.QueueInstructionsAtOriginalOffset(method.m_instructions[i]->m_origOffset, instructions);
+        }
+        method.ApplyQueuedInstructions();
+        method.Compact();
+        WriteMethod(method);
+    });
+}
+
+#ifdef RXPROFILER_FUZZER
+// Entry point for libFuzzer: build this file with the profiler's Instrumentation sources,
+// RXPROFILER_FUZZER defined and -fsanitize=fuzzer (/fsanitize=fuzzer for MSVC), leaving out the
+// other tests and the gtest main.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t size)
+{
+    std::string failure = CheckMethodFromFuzzInput(pData, size);
+    if (!failure.empty())
+    {
+        std::cerr << failure << std::endl;
+        abort();
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,617 @@
+#include "pch.h"
+#include "Instrumentation/Method.h"
+
+#include <chrono>
+#include <iostream>
+
+using namespace Instrumentation;
+
+static std::vector<BYTE> WriteMethod(Method& method)
+{
+    std::vector<BYTE> image(method.GetMethodSize());
+    method.WriteMethod(reinterpret_cast<IMAGE_COR_ILMETHOD*>(image.data()));
+    return image;
+}
+
+static void AppendLittleEndian(std::vector<BYTE>& code, int value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        code.push_back(static_cast<BYTE>(value >> (8 * i)));
+    }
+}
+
+static std::vector<BYTE> GetCode(const std::vector<BYTE>& image)
+{
+    auto pHeader = reinterpret_cast<const IMAGE_COR_ILMETHOD_FAT*>(image.data());
+    auto pCode = image.data() + pHeader->Size * sizeof(DWORD);
+    return std::vector<BYTE>(pCode, pCode + pHeader->CodeSize);
+}
+
+TEST(Method, WritesTinyMethodWithFatHeader) {
+    std::vector<BYTE> code = {
+        0x02,                         // ldarg.0
+        0x28, 0x01, 0x00, 0x00, 0x0a, // call 0a000001
+        0x26,                         // pop
+        0x2a                          // ret
+    };
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(MakeTinyMethodImage(code).data()));
+
+    auto image = WriteMethod(method);
+    auto pHeader = reinterpret_cast<const IMAGE_COR_ILMETHOD_FAT*>(image.data());
+    EXPECT_EQ(CorILMethod_FatFormat, pHeader->Flags & CorILMethod_FormatMask);
+    EXPECT_EQ(4, method.GetNumberOfInstructions());
+    EXPECT_EQ(code, GetCode(image));
+}
+
+TEST(Method, ConvertsShortBranchesToLongBranches) {
+    auto image = MakeTinyMethodImage({
+        0x02,       // ldarg.0
+        0x2d, 0x01, // brtrue.s IL_0004
+        0x00,       // nop
+        0x2a        // IL_0004: ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    std::vector<BYTE> expected = {
+        0x02,                         // ldarg.0
+        0x3a, 0x01, 0x00, 0x00, 0x00, // brtrue IL_0007
+        0x00,                         // nop
+        0x2a                          // IL_0007: ret
+    };
+    EXPECT_EQ(expected, GetCode(WriteMethod(method)));
+}
+
+TEST(Method, KeepsSwitchTargets) {
+    auto image = MakeTinyMethodImage({
+        0x02,                         // ldarg.0
+        0x45, 0x02, 0x00, 0x00, 0x00, // switch (IL_0010, IL_0011)
+        0x02, 0x00, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x00,
+        0x2b, 0x01,                   // br.s IL_0011
+        0x00,                         // IL_0010: nop
+        0x2a                          // IL_0011: ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    std::vector<BYTE> expected = {
+        0x02,                         // ldarg.0
+        0x45, 0x02, 0x00, 0x00, 0x00, // switch (IL_0013, IL_0014)
+        0x05, 0x00, 0x00, 0x00,
+        0x06, 0x00, 0x00, 0x00,
+        0x38, 0x01, 0x00, 0x00, 0x00, // br IL_0014
+        0x00,                         // IL_0013: nop
+        0x2a                          // IL_0014: ret
+    };
+    EXPECT_EQ(expected, GetCode(WriteMethod(method)));
+}
+
+TEST(Method, InsertAtOriginalOffsetRetargetsBranchesToInsertedCode) {
+    auto image = MakeTinyMethodImage({
+        0x02,       // ldarg.0
+        0x2c, 0x01, // brfalse.s IL_0004
+        0x00,       // nop
+        0x2a        // IL_0004: ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    InstructionList instructions;
+    instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4, 7));
+    instructions.push_back(std::make_unique<Instruction>(CEE_POP));
+    method.InsertInstructionsAtOriginalOffset(4, instructions);
+
+    std::vector<BYTE> expected = {
+        0x02,                         // ldarg.0
+        0x39, 0x01, 0x00, 0x00, 0x00, // brfalse IL_0007
+        0x00,                         // nop
+        0x20, 0x07, 0x00, 0x00, 0x00, // IL_0007: ldc.i4 7
+        0x26,                         // pop
+        0x2a                          // ret
+    };
+    EXPECT_EQ(expected, GetCode(WriteMethod(method)));
+
+    std::vector<COR_IL_MAP> map(method.GetILMapSize());
+    method.PopulateILMap(static_cast<ULONG>(map.size()), map.data());
+    ASSERT_EQ(4u, map.size());
+    EXPECT_EQ(4u, map[3].oldOffset);
+    EXPECT_EQ(13u, map[3].newOffset);
+}
+
+TEST(Method, InsertsAtOriginalOffsetsRepeatedly) {
+    auto image = MakeTinyMethodImage({
+        0x02,       // ldarg.0
+        0x2c, 0x01, // brfalse.s IL_0004
+        0x00,       // nop
+        0x2a        // IL_0004: ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    auto insert = [&](long origOffset, CanonicalName operation) {
+        InstructionList instructions;
+        instructions.push_back(std::make_unique<Instruction>(operation));
+        instructions.push_back(std::make_unique<Instruction>(CEE_POP));
+        method.InsertInstructionsAtOriginalOffset(origOffset, instructions);
+    };
+    insert(4, CEE_LDC_I4_1);
+    insert(4, CEE_LDC_I4_2);
+    insert(0, CEE_LDC_I4_3);
+
+    std::vector<BYTE> expected = {
+        0x19,                         // ldc.i4.3
+        0x26,                         // pop
+        0x02,                         // ldarg.0
+        0x39, 0x01, 0x00, 0x00, 0x00, // brfalse IL_0009
+        0x00,                         // nop
+        0x17,                         // IL_0009: ldc.i4.1
+        0x26,                         // pop
+        0x18,                         // ldc.i4.2
+        0x26,                         // pop
+        0x2a                          // ret
+    };
+    EXPECT_EQ(expected, GetCode(WriteMethod(method)));
+
+    std::vector<COR_IL_MAP> map(method.GetILMapSize());
+    method.PopulateILMap(static_cast<ULONG>(map.size()), map.data());
+    ASSERT_EQ(4u, map.size());
+    EXPECT_EQ(2u, map[0].newOffset);
+    EXPECT_EQ(3u, map[1].newOffset);
+    EXPECT_EQ(8u, map[2].newOffset);
+    EXPECT_EQ(13u, map[3].newOffset);
+}
+
+TEST(Method, AppliesQueuedInsertionsTogether) {
+    auto image = MakeTinyMethodImage({
+        0x02,       // ldarg.0
+        0x2c, 0x01, // brfalse.s IL_0004
+        0x00,       // nop
+        0x2a        // IL_0004: ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    auto queue = [&](long origOffset, CanonicalName operation) {
+        InstructionList instructions;
+        instructions.push_back(std::make_unique<Instruction>(operation));
+        instructions.push_back(std::make_unique<Instruction>(CEE_POP));
+        method.QueueInstructionsAtOriginalOffset(origOffset, instructions);
+    };
+    queue(4, CEE_LDC_I4_1);
+    queue(0, CEE_LDC_I4_3);
+    queue(4, CEE_LDC_I4_2);
+    EXPECT_EQ(4, method.GetNumberOfInstructions());
+
+    method.ApplyQueuedInstructions();
+
+    // The same as inserting each in turn
+    std::vector<BYTE> expected = {
+        0x19,                         // ldc.i4.3
+        0x26,                         // pop
+        0x02,                         // ldarg.0
+        0x39, 0x01, 0x00, 0x00, 0x00, // brfalse IL_0009
+        0x00,                         // nop
+        0x17,                         // IL_0009: ldc.i4.1
+        0x26,                         // pop
+        0x18,                         // ldc.i4.2
+        0x26,                         // pop
+        0x2a                          // ret
+    };
+    EXPECT_EQ(expected, GetCode(WriteMethod(method)));
+
+    std::vector<COR_IL_MAP> map(method.GetILMapSize());
+    method.PopulateILMap(static_cast<ULONG>(map.size()), map.data());
+    ASSERT_EQ(4u, map.size());
+    EXPECT_EQ(2u, map[0].newOffset);
+    EXPECT_EQ(13u, map[3].newOffset);
+}
+
+TEST(Method, InsertIntoEmptyMethodResolvesBranchesWithinInsertedCode) {
+    Method method;
+
+    InstructionList instructions;
+    instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4_0));
+    instructions.push_back(std::make_unique<Instruction>(CEE_BRFALSE, 1));
+    instructions.push_back(std::make_unique<Instruction>(CEE_NOP));
+    instructions.push_back(std::make_unique<Instruction>(CEE_NOP));
+    method.InsertInstructionsAtOffset(0, instructions);
+
+    std::vector<BYTE> expected = {
+        0x16,                         // ldc.i4.0
+        0x39, 0x01, 0x00, 0x00, 0x00, // brfalse IL_0007
+        0x00,                         // nop
+        0x00,                         // IL_0007: nop
+        0x2a                          // ret
+    };
+    EXPECT_EQ(expected, GetCode(WriteMethod(method)));
+}
+
+TEST(Method, CompactShortensBranchesInRange) {
+    std::vector<BYTE> code = {
+        0x02,                         // ldarg.0
+        0x39, 0x82, 0x00, 0x00, 0x00, // brfalse IL_0088
+        0x02,                         // IL_0006: ldarg.0
+        0x3a, 0x01, 0x00, 0x00, 0x00, // brtrue IL_000d
+        0x00                          // nop
+    };
+    code.insert(code.end(), 118, 0x00);                      // IL_000d: nop...
+    code.insert(code.end(), { 0x38, 0x7e, 0xff, 0xff, 0xff }); // br IL_0006
+    code.push_back(0x2a);                                    // IL_0088: ret
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(MakeFatMethodImage(code).data()));
+
+    method.Compact();
+
+    // Shortening the branch to IL_000d brings the other two into range
+    auto compacted = GetCode(WriteMethod(method));
+    ASSERT_EQ(128u, compacted.size());
+    EXPECT_EQ(std::vector<BYTE>({ 0x02, 0x2c, 0x7c, 0x02, 0x2d, 0x01, 0x00 }), std::vector<BYTE>(compacted.begin(), compacted.begin() + 7));
+    EXPECT_EQ(std::vector<BYTE>({ 0x2b, 0x84, 0x2a }), std::vector<BYTE>(compacted.end() - 3, compacted.end()));
+
+    // Inserting more code makes them all long again
+    InstructionList instructions;
+    instructions.push_back(std::make_unique<Instruction>(CEE_NOP));
+    method.InsertInstructionsAtOriginalOffset(0, instructions);
+    EXPECT_EQ(code.size() + 1, GetCode(WriteMethod(method)).size());
+}
+
+TEST(Method, CompactWritesTinyHeaderIfMethodQualifies) {
+    std::vector<BYTE> code = {
+        0x02,       // ldarg.0
+        0x2c, 0x01, // brfalse.s IL_0004
+        0x00,       // nop
+        0x2a        // IL_0004: ret
+    };
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(MakeTinyMethodImage(code).data()));
+    method.Compact();
+
+    EXPECT_EQ(MakeTinyMethodImage(code), WriteMethod(method));
+
+    auto withLocals = MakeFatMethodImage(code);
+    reinterpret_cast<IMAGE_COR_ILMETHOD_FAT*>(withLocals.data())->LocalVarSigTok = 0x11000001;
+    Method methodWithLocals(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(withLocals.data()));
+    methodWithLocals.Compact();
+
+    auto image = WriteMethod(methodWithLocals);
+    EXPECT_EQ(CorILMethod_FatFormat, reinterpret_cast<IMAGE_COR_ILMETHOD_FAT*>(image.data())->Flags & CorILMethod_FormatMask);
+    EXPECT_EQ(code, GetCode(image));
+}
+
+TEST(Method, KeepsExceptionClauses) {
+    auto image = MakeFatMethodImage(
+        {
+            0x00,       // nop
+            0xde, 0x03, // leave.s IL_0006
+            0x00,       // nop
+            0x00,       // nop
+            0xdc,       // endfinally
+            0x2a        // IL_0006: ret
+        },
+        { { COR_ILEXCEPTION_CLAUSE_FINALLY, 0, 3, 3, 3, 0 } });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+    EXPECT_EQ(1, method.GetNumberOfExceptions());
+
+    auto written = WriteMethod(method);
+    auto expected = MakeFatMethodImage(
+        {
+            0x00,                         // nop
+            0xdd, 0x03, 0x00, 0x00, 0x00, // leave IL_0009
+            0x00,                         // nop
+            0x00,                         // nop
+            0xdc,                         // endfinally
+            0x2a                          // IL_0009: ret
+        },
+        { { COR_ILEXCEPTION_CLAUSE_FINALLY, 0, 6, 6, 3, 0 } });
+    EXPECT_EQ(expected, written);
+}
+
+// Test calls take the number of args in the bottom byte of the method token, and return a
+// value if the 0x100 bit is set.
+static StackEffectLookup GetTestStackEffects(bool returnsValue)
+{
+    return [returnsValue](const Instruction& instr) -> StackEffect {
+        if (instr.m_operation == CEE_RET)
+        {
+            return { returnsValue ? 1 : 0, 0 };
+        }
+        return { static_cast<int>(instr.m_operand & 0xff), (instr.m_operand & 0x100) ? 1 : 0 };
+    };
+}
+
+TEST(Method, CalculatesMaxStackAcrossBranches) {
+    auto image = MakeTinyMethodImage({
+        0x02,                         // ldarg.0
+        0x2c, 0x0a,                   // brfalse.s IL_000d
+        0x16,                         // ldc.i4.0
+        0x17,                         // ldc.i4.1
+        0x18,                         // ldc.i4.2
+        0x28, 0x02, 0x01, 0x00, 0x0a, // call 0a000102 (two args, returns value)
+        0x58,                         // add
+        0x2a,                         // ret
+        0x16,                         // IL_000d: ldc.i4.0
+        0x2a                          // ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    EXPECT_EQ(3u, method.CalculateMaxStack(GetTestStackEffects(true)));
+}
+
+TEST(Method, CalculatesMaxStackWithExceptionOnStackInHandlers) {
+    auto image = MakeFatMethodImage(
+        {
+            0x00,                         // nop
+            0xde, 0x0a,                   // leave.s IL_000d
+            0x28, 0x01, 0x00, 0x00, 0x0a, // call 0a000001 (takes the exception)
+            0xde, 0x03,                   // leave.s IL_000d
+            0x26,                         // pop
+            0xde, 0x00,                   // leave.s IL_000d
+            0x2a                          // IL_000d: ret
+        },
+        {
+            { COR_ILEXCEPTION_CLAUSE_NONE, 0, 3, 3, 7, 0x01000001 },
+            { COR_ILEXCEPTION_CLAUSE_NONE, 0, 3, 10, 3, 0x01000002 }
+        });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+
+    EXPECT_EQ(1u, method.CalculateMaxStack(GetTestStackEffects(false)));
+}
+
+TEST(Method, CalculatesMaxStackOfInsertedCode) {
+    auto image = MakeTinyMethodImage({
+        0x02,                         // ldarg.0
+        0x03,                         // ldarg.1
+        0x28, 0x02, 0x01, 0x00, 0x0a, // call 0a000102 (two args, returns value)
+        0x2a                          // ret
+    });
+    Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+    EXPECT_EQ(2u, method.CalculateMaxStack(GetTestStackEffects(true)));
+
+    // As for instrumenting a call's return value: Returned(value, id, type)
+    InstructionList instructions;
+    instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4, 1));
+    instructions.push_back(std::make_unique<Instruction>(CEE_LDTOKEN, 0x1b000001));
+    instructions.push_back(std::make_unique<Instruction>(CEE_CALL, 0x0a000103));
+    method.InsertInstructionsAtOriginalOffset(7, instructions);
+    EXPECT_EQ(3u, method.CalculateMaxStack(GetTestStackEffects(true)));
+}
+
+TEST(Method, CalculateMaxStackRejectsBadStackUse) {
+    std::vector<std::vector<BYTE>> badCode =
+    {
+        { 0x26, 0x2a },                               // pop with nothing on the stack
+        { 0x02, 0x2a },                               // return with a value from a void method
+        { 0x02, 0x2d, 0x01, 0x02, 0x2a },             // paths meet with different depths
+        { 0x00 },                                     // runs off the end
+        { 0x28, 0x01, 0x00, 0x00, 0x0a, 0x2a }        // call with too few args
+    };
+
+    for (size_t i = 0; i < badCode.size(); i++)
+    {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(MakeTinyMethodImage(badCode[i]).data()));
+        EXPECT_THROW(method.CalculateMaxStack(GetTestStackEffects(false)), std::domain_error) << "case " << i;
+    }
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(Method, DISABLED_BenchmarkReadInstrumentWrite) {
+    const int c_methods = 20000;
+    const int c_blocksPerMethod = 8;
+
+    std::vector<std::vector<BYTE>> images;
+    for (int m = 0; m < c_methods; m++)
+    {
+        std::vector<BYTE> code;
+        for (int b = 0; b < c_blocksPerMethod; b++)
+        {
+            BYTE blockCode[] = {
+                0x02,                         // ldarg.0
+                0x7b, 0x01, 0x00, 0x00, 0x04, // ldfld 04000001
+                0x2d, 0x09,                   // brtrue.s +9
+                0x02,                         // ldarg.0
+                0x6f, 0x02, 0x00, 0x00, 0x0a, // callvirt 0a000002
+                0x0a,                         // stloc.0
+                0x2b, 0x01,                   // br.s +1
+                0x00,                         // nop
+                0x06,                         // ldloc.0
+                0x26                          // pop
+            };
+            code.insert(code.end(), std::begin(blockCode), std::end(blockCode));
+        }
+        code.push_back(0x2a); // ret
+        images.push_back(MakeFatMethodImage(code));
+    }
+
+    size_t instructionCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto& image : images)
+    {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+        instructionCount += method.GetNumberOfInstructions();
+    }
+    auto readNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (auto& image : images)
+    {
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+        std::vector<long> callOffsets;
+        for (auto pInstr : method.m_instructions)
+        {
+            if (pInstr->m_operation == CEE_CALLVIRT)
+            {
+                callOffsets.push_back(pInstr->m_origOffset);
+            }
+        }
+
+        for (long offset : callOffsets)
+        {
+            InstructionList instructions;
+            instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4, 1));
+            instructions.push_back(std::make_unique<Instruction>(CEE_CALL, 0x0a000003));
+            method.InsertInstructionsAtOriginalOffset(offset, instructions);
+        }
+
+        WriteMethod(method);
+    }
+    auto instrumentNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Read: " << readNs / c_methods << "ns/method, " << readNs / instructionCount << "ns/instruction" << std::endl;
+    std::cout << "Read, instrument and write: " << instrumentNs / c_methods << "ns/method" << std::endl;
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(Method, DISABLED_BenchmarkReadLargeSwitchMethods) {
+    const int c_casesPerSwitch = 16;
+    const size_t c_totalCodeSize = 4 * 1024 * 1024;
+
+    for (size_t codeSize : { 1024, 4 * 1024, 16 * 1024, 64 * 1024 })
+    {
+        // Blocks of a switch whose cases each branch to the end of the block.
+        std::vector<BYTE> code;
+        while (code.size() < codeSize)
+        {
+            code.push_back(0x02); // ldarg.0
+            code.push_back(0x45); // switch
+            AppendLittleEndian(code, c_casesPerSwitch);
+            for (int i = 0; i < c_casesPerSwitch; i++)
+            {
+                AppendLittleEndian(code, i * 8);
+            }
+
+            for (int i = 0; i < c_casesPerSwitch; i++)
+            {
+                code.push_back(0x1f); // ldc.i4.s
+                code.push_back(static_cast<BYTE>(i));
+                code.push_back(0x26); // pop
+                code.push_back(0x38); // br
+                AppendLittleEndian(code, (c_casesPerSwitch - i - 1) * 8);
+            }
+            code.push_back(0x00); // nop
+        }
+        code.push_back(0x2a); // ret
+        auto image = MakeFatMethodImage(code);
+
+        size_t methodCount = c_totalCodeSize / codeSize;
+        size_t instructionCount = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t m = 0; m < methodCount; m++)
+        {
+            Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+            instructionCount += method.GetNumberOfInstructions();
+        }
+        auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << code.size() << " byte method: " << ns / instructionCount << "ns/instruction" << std::endl;
+    }
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(Method, DISABLED_BenchmarkInsertionAtManyCallSites) {
+    const int c_totalCallSites = 20000;
+
+    for (int callSites : { 10, 50, 200, 1000 })
+    {
+        std::vector<BYTE> code;
+        for (int c = 0; c < callSites; c++)
+        {
+            BYTE callCode[] = {
+                0x02,                         // ldarg.0
+                0x6f, 0x02, 0x00, 0x00, 0x0a, // callvirt 0a000002
+                0x26                          // pop
+            };
+            code.insert(code.end(), std::begin(callCode), std::end(callCode));
+        }
+        code.push_back(0x2a); // ret
+        auto image = MakeFatMethodImage(code);
+
+        auto instrument = [&](bool queue) {
+            Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+            for (int c = 0; c < callSites; c++)
+            {
+                // Before and after each call, as the profiler does
+                for (long offset : { c * 7 + 1, c * 7 + 6 })
+                {
+                    InstructionList instructions;
+                    instructions.push_back(std::make_unique<Instruction>(CEE_LDC_I4, c));
+                    instructions.push_back(std::make_unique<Instruction>(CEE_CALL, 0x0a000003));
+                    if (queue)
+                    {
+                        method.QueueInstructionsAtOriginalOffset(offset, instructions);
+                    }
+                    else
+                    {
+                        method.InsertInstructionsAtOriginalOffset(offset, instructions);
+                    }
+                }
+            }
+            method.ApplyQueuedInstructions();
+            return WriteMethod(method);
+        };
+
+        int methodCount = c_totalCallSites / callSites;
+        double ns[2];
+        for (int queue = 0; queue < 2; queue++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int m = 0; m < methodCount; m++)
+            {
+                instrument(queue != 0);
+            }
+            ns[queue] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        EXPECT_EQ(instrument(false), instrument(true));
+        std::cout << callSites << " call sites: " <<
+            ns[0] / methodCount / 1000 << "us/method inserting in turn, " <<
+            ns[1] / methodCount / 1000 << "us/method queued" << std::endl;
+    }
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(Method, DISABLED_BenchmarkWriteLargeMethods) {
+    const size_t c_totalCodeSize = 16 * 1024 * 1024;
+
+    for (size_t codeSize : { 256, 4 * 1024, 64 * 1024 })
+    {
+        // Blocks of a try/catch around a switch whose cases branch to the end of the block.
+        std::vector<BYTE> code;
+        std::vector<TestExceptionClause> clauses;
+        while (code.size() < codeSize)
+        {
+            ULONG tryOffset = static_cast<ULONG>(code.size());
+            code.push_back(0x02); // ldarg.0
+            code.push_back(0x45); // switch
+            AppendLittleEndian(code, 4);
+            for (int i = 0; i < 4; i++)
+            {
+                AppendLittleEndian(code, i * 12);
+            }
+
+            for (int i = 0; i < 4; i++)
+            {
+                code.push_back(0x02);                    // ldarg.0
+                code.push_back(0x6f);                    // callvirt 0a000002
+                AppendLittleEndian(code, 0x0a000002);
+                code.push_back(0x26);                    // pop
+                code.push_back(0xdd);                    // leave
+                AppendLittleEndian(code, (3 - i) * 12 + 3);
+            }
+            code.push_back(0x26);                        // pop
+            code.push_back(0xde);                        // leave.s +0
+            code.push_back(0x00);
+            ULONG handlerOffset = static_cast<ULONG>(code.size()) - 3;
+            clauses.push_back({ COR_ILEXCEPTION_CLAUSE_NONE, tryOffset, handlerOffset - tryOffset, handlerOffset, 3, 0x01000001 });
+        }
+        code.push_back(0x2a); // ret
+        auto image = MakeFatMethodImage(code, clauses);
+
+        Method method(reinterpret_cast<const IMAGE_COR_ILMETHOD*>(image.data()));
+        std::vector<BYTE> buffer(method.GetMethodSize());
+        size_t writeCount = c_totalCodeSize / codeSize;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t w = 0; w < writeCount; w++)
+        {
+            EXPECT_EQ(buffer.size(), method.GetMethodSize());
+            method.WriteMethod(reinterpret_cast<IMAGE_COR_ILMETHOD*>(buffer.data()));
+        }
+        auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << code.size() << " byte method: " << ns / (writeCount * method.GetNumberOfInstructions()) << "ns/instruction" << std::endl;
+    }
+}
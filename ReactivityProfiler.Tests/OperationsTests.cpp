@@ -0,0 +1,98 @@
+#include "pch.h"
+#include "Instrumentation/Operations.h"
+
+#include <chrono>
+#include <iostream>
+
+using namespace Instrumentation;
+
+TEST(Operations, LooksUpOperationsByName) {
+    EXPECT_EQ(CEE_CALL, Operations::GetDetails(CEE_CALL).canonicalName);
+    EXPECT_EQ(0x28, Operations::GetDetails(CEE_CALL).op2);
+    EXPECT_EQ(5, Operations::GetDetails(CEE_CALL).totalLength());
+    EXPECT_EQ(STP1, Operations::GetDetails(CEE_LDLOC).op1);
+    EXPECT_EQ(4, Operations::GetDetails(CEE_LDLOC).totalLength());
+    EXPECT_EQ(InlineSwitch, Operations::GetDetails(CEE_SWITCH).operandParam);
+}
+
+TEST(Operations, LooksUpEveryOpcodeByItsBytes) {
+    int opcodeCount = 0;
+    for (const OperationDetails& details : OperationTables::c_operationDetails)
+    {
+        if (details.op1 == REFPRE || details.op1 == STP1)
+        {
+            EXPECT_EQ(details.canonicalName, Operations::GetDetails(details.op1, details.op2).canonicalName);
+            opcodeCount++;
+        }
+    }
+    EXPECT_GT(opcodeCount, 200);
+}
+
+TEST(Operations, ReportsUnknownOpcodesAsIllegal) {
+    EXPECT_EQ(CEE_ILLEGAL, Operations::GetDetails(STP1, 0x80).canonicalName);
+    EXPECT_EQ(CEE_ILLEGAL, Operations::GetDetails(STP1, 0xFF).canonicalName);
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(Operations, DISABLED_BenchmarkEncodeDecode) {
+    const int c_instructions = 1000000;
+    const int c_repeats = 5;
+
+    std::vector<CanonicalName> opcodeNames;
+    for (const OperationDetails& details : OperationTables::c_operationDetails)
+    {
+        if (details.op1 == REFPRE || details.op1 == STP1)
+        {
+            opcodeNames.push_back(details.canonicalName);
+        }
+    }
+
+    std::vector<CanonicalName> instructions;
+    unsigned int seed = 1;
+    for (int i = 0; i < c_instructions; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        instructions.push_back(opcodeNames[(seed >> 8) % opcodeNames.size()]);
+    }
+
+    std::vector<BYTE> code;
+    code.reserve(c_instructions * 10);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < c_repeats; r++)
+    {
+        code.clear();
+        for (auto name : instructions)
+        {
+            auto& details = Operations::GetDetails(name);
+            if (details.op1 != REFPRE)
+            {
+                code.push_back(details.op1);
+            }
+            code.push_back(details.op2);
+            code.insert(code.end(), details.operandSize, 0);
+        }
+    }
+    auto encodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / c_repeats;
+
+    size_t decoded = 0;
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < c_repeats; r++)
+    {
+        for (size_t position = 0; position < code.size(); decoded++)
+        {
+            BYTE op1 = REFPRE;
+            BYTE op2 = code[position++];
+            if (op2 == STP1)
+            {
+                op1 = STP1;
+                op2 = code[position++];
+            }
+            position += Operations::GetDetails(op1, op2).operandSize;
+        }
+    }
+    auto decodeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / c_repeats;
+
+    EXPECT_EQ(static_cast<size_t>(c_instructions) * c_repeats, decoded);
+    std::cout << "Encode: " << encodeNs / c_instructions << "ns/instruction" << std::endl;
+    std::cout << "Decode: " << decodeNs / c_instructions << "ns/instruction" << std::endl;
+}
@@ -0,0 +1,283 @@
+#include "pch.h"
+#include "segmentedlog.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+static std::vector<byte> MakeRecord(int writer, int sequence)
+{
+    // Variable length so that records straddle chunk boundaries.
+    std::vector<byte> record(8 + (sequence % 200));
+    memcpy(record.data(), &writer, sizeof writer);
+    memcpy(record.data() + 4, &sequence, sizeof sequence);
+    for (size_t i = 8; i < record.size(); i++)
+    {
+        record[i] = static_cast<byte>(writer + sequence + i);
+    }
+    return record;
+}
+
+static void Append(segmented_log& log, const std::vector<byte>& record)
+{
+    log.append(record.size(), [&](byte* pDest) { std::copy(record.begin(), record.end(), pDest); });
+}
+
+TEST(SegmentedLog, ReadsBackAppendedRecords) {
+    segmented_log log;
+    EXPECT_EQ(log.size(), 0);
+    EXPECT_FALSE(log[0]);
+
+    for (int i = 0; i < 10000; i++)
+    {
+        Append(log, MakeRecord(0, i));
+    }
+
+    EXPECT_EQ(log.size(), 10000);
+    for (int i = 0; i < 10000; i++)
+    {
+        auto expected = MakeRecord(0, i);
+        auto actual = log[i];
+        ASSERT_EQ(actual.length(), expected.size());
+        EXPECT_TRUE(std::equal(expected.begin(), expected.end(), actual.begin()));
+    }
+}
+
+TEST(SegmentedLog, HandlesEmptyAndOversizedRecords) {
+    segmented_log log;
+    Append(log, {});
+    Append(log, std::vector<byte>(segmented_log::c_chunkSize + 1, 42));
+
+    EXPECT_EQ(log.size(), 2);
+    EXPECT_EQ(log[0].length(), 0);
+    EXPECT_EQ(log[1].length(), segmented_log::c_chunkSize + 1);
+    EXPECT_EQ(log[1][segmented_log::c_chunkSize], 42);
+}
+
+TEST(SegmentedLog, SpansStayValidWhileAppending) {
+    segmented_log log;
+    Append(log, MakeRecord(0, 0));
+    auto first = log[0];
+
+    for (int i = 1; i < 20000; i++)
+    {
+        Append(log, MakeRecord(0, i));
+    }
+
+    auto expected = MakeRecord(0, 0);
+    EXPECT_EQ(first.begin(), log[0].begin());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), first.begin()));
+}
+
+TEST(SegmentedLog, ConcurrentWritersPublishCompleteRecords) {
+    const int c_writers = 8;
+    const int c_recordsPerWriter = 20000;
+    segmented_log log;
+    std::atomic_bool done = false;
+
+    // Reader checks that every record below the watermark is complete while writers are active.
+    std::thread reader([&] {
+        while (!done)
+        {
+            int32_t count = log.size();
+            for (int32_t i = count > 100 ? count - 100 : 0; i < count; i++)
+            {
+                auto record = log[i];
+                ASSERT_GE(record.length(), 8u);
+                int writer, sequence;
+                memcpy(&writer, record.begin(), sizeof writer);
+                memcpy(&sequence, record.begin() + 4, sizeof sequence);
+                auto expected = MakeRecord(writer, sequence);
+                ASSERT_TRUE(std::equal(expected.begin(), expected.end(), record.begin()));
+            }
+        }
+    });
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < c_writers; w++)
+    {
+        writers.emplace_back([&, w] {
+            for (int i = 0; i < c_recordsPerWriter; i++)
+            {
+                Append(log, MakeRecord(w, i));
+            }
+        });
+    }
+
+    for (auto& t : writers)
+    {
+        t.join();
+    }
+    done = true;
+    reader.join();
+
+    ASSERT_EQ(log.size(), c_writers * c_recordsPerWriter);
+
+    std::vector<int> nextSequence(c_writers);
+    for (int32_t i = 0; i < log.size(); i++)
+    {
+        auto record = log[i];
+        int writer, sequence;
+        memcpy(&writer, record.begin(), sizeof writer);
+        memcpy(&sequence, record.begin() + 4, sizeof sequence);
+
+        // Each writer's records appear in the order it wrote them.
+        EXPECT_EQ(sequence, nextSequence[writer]++);
+    }
+}
+
+// Heap storage that remembers its chunks so that tests can read the chunk space directly.
+class RecordingStorage : public segmented_log_storage
+{
+public:
+    RecordingStorage(std::vector<byte*>& chunks) : m_chunks(chunks)
+    {
+    }
+
+    byte* allocate_chunk(size_t chunk, size_t size) override
+    {
+        if (m_chunks.size() <= chunk)
+        {
+            m_chunks.resize(chunk + 1);
+        }
+        m_chunks[chunk] = new byte[size]();
+        return m_chunks[chunk];
+    }
+
+    void free_chunk(size_t chunk, byte* pChunk) override
+    {
+        delete[] pChunk;
+    }
+
+private:
+    std::vector<byte*>& m_chunks;
+};
+
+// Walks the chunk space the way an external reader of the store file would, returning the
+// lengths of the records found in order.
+static std::vector<uint32_t> WalkChunks(const std::vector<byte*>& chunks)
+{
+    std::vector<uint32_t> lengths;
+    for (byte* pChunk : chunks)
+    {
+        size_t offset = 0;
+        while (offset < segmented_log::c_chunkSize)
+        {
+            uint32_t header;
+            memcpy(&header, pChunk + offset, sizeof header);
+            uint32_t length = header & segmented_log::c_headerLengthMask;
+            if (header == 0)
+            {
+                return lengths;
+            }
+            else if (header & segmented_log::c_paddingHeader)
+            {
+                offset += length;
+            }
+            else if (header & segmented_log::c_oversizedHeader)
+            {
+                lengths.push_back(length);
+                offset += sizeof header;
+            }
+            else
+            {
+                lengths.push_back(length);
+                offset += (sizeof header + length + 3) & ~3;
+            }
+        }
+    }
+
+    return lengths;
+}
+
+TEST(SegmentedLog, ChunkSpaceCanBeWalkedWithoutIndex) {
+    std::vector<byte*> chunks;
+    segmented_log log(std::make_unique<RecordingStorage>(chunks));
+
+    std::vector<uint32_t> expected;
+    for (int i = 0; i < 10000; i++)
+    {
+        auto record = MakeRecord(0, i);
+        Append(log, record);
+        expected.push_back(static_cast<uint32_t>(record.size()));
+    }
+    Append(log, {});
+    expected.push_back(0);
+    Append(log, std::vector<byte>(segmented_log::c_chunkSize, 1));
+    expected.push_back(segmented_log::c_chunkSize);
+    Append(log, MakeRecord(0, 1));
+    expected.push_back(9);
+
+    EXPECT_EQ(WalkChunks(chunks), expected);
+}
+
+TEST(SegmentedLog, FailedAppendDoesNotHoldUpLaterRecords) {
+    std::vector<byte*> chunks;
+    segmented_log log(std::make_unique<RecordingStorage>(chunks));
+
+    Append(log, MakeRecord(0, 0));
+    EXPECT_THROW(log.append(20, [](byte*) { throw std::runtime_error("fill failed"); }), std::runtime_error);
+    Append(log, MakeRecord(0, 1));
+
+    EXPECT_EQ(log.size(), 3);
+    EXPECT_EQ(log[1].length(), 0);
+    EXPECT_EQ(log[2].length(), 9);
+
+    // The failed record's space is padding to a reader walking the chunks.
+    EXPECT_EQ(WalkChunks(chunks), (std::vector<uint32_t>{ 8, 9 }));
+}
+
+// Comparison with the previous store implementation (a mutex-guarded vector of vectors).
+// Run with --gtest_also_run_disabled_tests.
+class MutexVectorLog
+{
+public:
+    void append(const std::vector<byte>& record)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_records.push_back(record);
+    }
+
+private:
+    std::mutex m_mutex;
+    std::vector<std::vector<byte>> m_records;
+};
+
+template<typename TAppend>
+static double TimeConcurrentAppends(int writerCount, int recordsPerWriter, TAppend append)
+{
+    auto record = MakeRecord(0, 60);
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> writers;
+    for (int w = 0; w < writerCount; w++)
+    {
+        writers.emplace_back([&] {
+            for (int i = 0; i < recordsPerWriter; i++)
+            {
+                append(record);
+            }
+        });
+    }
+
+    for (auto& t : writers)
+    {
+        t.join();
+    }
+
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+TEST(SegmentedLog, DISABLED_BenchmarkConcurrentAppend) {
+    const int c_recordsPerWriter = 200000;
+    for (int writers : { 1, 2, 4, 8, 16 })
+    {
+        MutexVectorLog mutexLog;
+        double mutexMs = TimeConcurrentAppends(writers, c_recordsPerWriter, [&](const std::vector<byte>& r) { mutexLog.append(r); });
+
+        segmented_log log;
+        double logMs = TimeConcurrentAppends(writers, c_recordsPerWriter, [&](const std::vector<byte>& r) { Append(log, r); });
+
+        std::cout << writers << " writers: mutex vector " << mutexMs << "ms, segmented_log " << logMs << "ms" << std::endl;
+    }
+}
@@ -0,0 +1,97 @@
+#include "pch.h"
+#include "SignaturePool.h"
+#include "Signature.h"
+
+static const COR_SIGNATURE c_observableOfInt[] = { 0x15, 0x12, 0x08, 0x01, 0x08 }; // GENERICINST CLASS 0x01000002<int32>
+static const COR_SIGNATURE c_observableOfString[] = { 0x15, 0x12, 0x08, 0x01, 0x0e };
+
+TEST(SignaturePool, InternsEqualBlobsToSameCopy) {
+    SignaturePool pool;
+
+    std::vector<COR_SIGNATURE> first(std::begin(c_observableOfInt), std::end(c_observableOfInt));
+    SignatureBlob interned = pool.Intern(first);
+    EXPECT_NE(first.data(), interned.begin());
+    EXPECT_EQ(first, std::vector<COR_SIGNATURE>(interned.begin(), interned.end()));
+
+    // Changing the original doesn't affect the pool's copy, and an equal blob from elsewhere
+    // gives the same copy.
+    first[4] = 0x0e;
+    SignatureBlob again = pool.Intern(SignatureBlob(c_observableOfInt, sizeof(c_observableOfInt)));
+    EXPECT_EQ(interned.begin(), again.begin());
+    EXPECT_EQ(interned.end(), again.end());
+    EXPECT_EQ(0x08, interned[4]);
+
+    SignatureBlob other = pool.Intern(first);
+    EXPECT_NE(interned.begin(), other.begin());
+    EXPECT_EQ(2, pool.GetCount());
+}
+
+TEST(SignaturePool, KeepsBlobsWhereTheyAre) {
+    SignaturePool pool;
+
+    // Enough blobs, of enough sizes, to need several chunks, including some that get their own.
+    std::vector<std::vector<COR_SIGNATURE>> blobs;
+    for (int i = 0; i < 2000; i++)
+    {
+        std::vector<COR_SIGNATURE> blob(1 + (i * 7) % (i % 100 == 0 ? 3000 : 40), static_cast<COR_SIGNATURE>(i));
+        blob[0] = static_cast<COR_SIGNATURE>(i >> 8);
+        blobs.push_back(blob);
+    }
+
+    std::vector<SignatureBlob> interned;
+    for (auto& blob : blobs)
+    {
+        interned.push_back(pool.Intern(blob));
+    }
+
+    for (size_t i = 0; i < blobs.size(); i++)
+    {
+        EXPECT_EQ(blobs[i], std::vector<COR_SIGNATURE>(interned[i].begin(), interned[i].end())) << "blob " << i;
+        EXPECT_EQ(interned[i].begin(), pool.Intern(blobs[i]).begin()) << "blob " << i;
+    }
+}
+
+TEST(SignaturePool, DefinesEachTokenOnce) {
+    SignaturePool pool;
+    SignatureBlob intSig = pool.Intern(SignatureBlob(c_observableOfInt, sizeof(c_observableOfInt)));
+    SignatureBlob stringSig = pool.Intern(SignatureBlob(c_observableOfString, sizeof(c_observableOfString)));
+
+    int defineCount = 0;
+    auto define = [&](mdToken token) {
+        return [&defineCount, token] { defineCount++; return token; };
+    };
+
+    EXPECT_EQ(0x1b000001, pool.GetToken(mdTypeSpecNil, intSig, define(0x1b000001)));
+    EXPECT_EQ(0x1b000001, pool.GetToken(mdTypeSpecNil, intSig, define(0x1b000099)));
+    EXPECT_EQ(1, defineCount);
+
+    // Different kinds of token, or tokens for different generic methods, are kept apart.
+    EXPECT_EQ(0x1b000002, pool.GetToken(mdTypeSpecNil, stringSig, define(0x1b000002)));
+    EXPECT_EQ(0x2b000001, pool.GetToken(0x0a000001, intSig, define(0x2b000001)));
+    EXPECT_EQ(0x2b000002, pool.GetToken(0x0a000002, intSig, define(0x2b000002)));
+    EXPECT_EQ(0x2b000001, pool.GetToken(0x0a000001, pool.Intern(SignatureBlob(c_observableOfInt, sizeof(c_observableOfInt))), define(0x2b000099)));
+    EXPECT_EQ(4, defineCount);
+}
+
+TEST(SignaturePool, InternsSubstitutedTypeArgs) {
+    // Substituting the same type arg into a method's return type at two different call sites
+    // gives one interned blob.
+    const COR_SIGNATURE methodSig[] = { 0x10, 0x00, 0x00, 0x15, 0x12, 0x08, 0x01, 0x1e, 0x00 }; // IObservable<!!0> M<T>()
+    const COR_SIGNATURE typeArg[] = { 0x08 };
+    std::vector<SignatureBlob> methodTypeArgs = { SignatureBlob(typeArg, sizeof(typeArg)) };
+
+    SignaturePool pool;
+    std::vector<COR_SIGNATURE> buffer;
+    std::vector<SignatureBlob> interned;
+    for (int site = 0; site < 2; site++)
+    {
+        MethodSignatureReader reader(SignatureBlob(methodSig, sizeof(methodSig)));
+        reader.MoveNextParam();
+        reader.GetParamReader().GetTypeReader().SubstituteTypeArgs({}, methodTypeArgs, buffer);
+        interned.push_back(pool.Intern(buffer));
+    }
+
+    EXPECT_EQ(std::vector<COR_SIGNATURE>(std::begin(c_observableOfInt), std::end(c_observableOfInt)), std::vector<COR_SIGNATURE>(interned[0].begin(), interned[0].end()));
+    EXPECT_EQ(interned[0].begin(), interned[1].begin());
+    EXPECT_EQ(1, pool.GetCount());
+}
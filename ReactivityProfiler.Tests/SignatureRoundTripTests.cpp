@@ -0,0 +1,953 @@
+#include "pch.h"
+#include "Signature.h"
+
+#include <chrono>
+#include <iostream>
+
+// Generates signatures from a stream of bytes, and checks that the readers give back what was
+// generated, that the writers write the same bytes, and that substituting type arguments agrees
+// with doing the same to the generated types. The bytes are also fed to the readers as they are,
+// which must either read them or reject them with std::domain_error. The bytes come either from
+// a seeded random number generator (the tests below) or from libFuzzer (see the end of the file).
+
+namespace
+{
+    struct GeneratedMethod;
+
+    struct GeneratedType
+    {
+        CorElementType m_kind = ELEMENT_TYPE_I4;
+        CorElementType m_genericInstKind = ELEMENT_TYPE_CLASS;
+        mdToken m_token = 0; // CLASS, VALUETYPE and GENERICINST
+        ULONG m_number = 0; // VAR and MVAR
+        std::vector<std::pair<mdToken, bool>> m_modifiers; // PTR and SZARRAY
+        bool m_isVoidPointer = false;
+        std::vector<GeneratedType> m_children; // element type of ARRAY, PTR and SZARRAY, type args of GENERICINST
+        ULONG m_rank = 0;
+        std::vector<ULONG> m_sizes;
+        std::vector<LONG> m_loBounds;
+        std::shared_ptr<GeneratedMethod> m_method; // FNPTR
+    };
+
+    struct GeneratedParam
+    {
+        std::vector<std::pair<mdToken, bool>> m_modifiers;
+        bool m_isPinned = false;
+        bool m_isByRef = false;
+        CorElementType m_special = ELEMENT_TYPE_END; // VOID or TYPEDBYREF in place of a type
+        GeneratedType m_type;
+    };
+
+    struct GeneratedMethod
+    {
+        bool m_hasThis = false;
+        ULONG m_genericParamCount = 0;
+        GeneratedParam m_return;
+        std::vector<GeneratedParam> m_params;
+    };
+
+    struct GenerateOptions
+    {
+        bool m_writableOnly; // only what SignatureTypeWriter can write other than as a blob
+        ULONG m_typeVarCount;
+        ULONG m_methodVarCount;
+    };
+
+    const int c_maxGeneratedDepth = 4;
+
+    const CorElementType c_primitives[] =
+    {
+        ELEMENT_TYPE_I4, ELEMENT_TYPE_BOOLEAN, ELEMENT_TYPE_CHAR, ELEMENT_TYPE_I1, ELEMENT_TYPE_U1,
+        ELEMENT_TYPE_I2, ELEMENT_TYPE_U2, ELEMENT_TYPE_U4, ELEMENT_TYPE_I8, ELEMENT_TYPE_U8,
+        ELEMENT_TYPE_R4, ELEMENT_TYPE_R8, ELEMENT_TYPE_I, ELEMENT_TYPE_U, ELEMENT_TYPE_OBJECT,
+        ELEMENT_TYPE_STRING
+    };
+
+    // Values that encode to one, two or four bytes
+    ULONG GenerateCompressed(FuzzInput& input, ULONG min = 0)
+    {
+        const ULONG c_limits[] = { 0x80, 0x4000, 0x20000000 };
+        ULONG limit = c_limits[input.Next(3)];
+        return min + input.Next(limit - min);
+    }
+
+    LONG GenerateSigned(FuzzInput& input)
+    {
+        const LONG c_limits[] = { 0x40, 0x2000, 0x10000000 };
+        LONG limit = c_limits[input.Next(3)];
+        return static_cast<LONG>(input.Next(2 * limit)) - limit;
+    }
+
+    mdToken GenerateToken(FuzzInput& input)
+    {
+        const CorTokenType c_tables[] = { mdtTypeRef, mdtTypeDef, mdtTypeSpec };
+        const ULONG c_ridLimits[] = { 0x20, 0x1000, 0x1000000 };
+        CorTokenType table = c_tables[input.Next(3)];
+        return TokenFromRid(1 + input.Next(c_ridLimits[input.Next(3)] - 1), table);
+    }
+
+    std::vector<std::pair<mdToken, bool>> GenerateModifiers(FuzzInput& input)
+    {
+        std::vector<std::pair<mdToken, bool>> modifiers(input.Next(3));
+        for (auto& modifier : modifiers)
+        {
+            modifier = { GenerateToken(input), input.NextBool() };
+        }
+        return modifiers;
+    }
+
+    GeneratedMethod GenerateMethod(FuzzInput& input, int depth, const GenerateOptions& options);
+
+    GeneratedType GenerateType(FuzzInput& input, int depth, const GenerateOptions& options)
+    {
+        enum { PRIMITIVE, CLASS, VALUETYPE, GENERICINST, VAR, MVAR, PTR, SZARRAY, ARRAY, FNPTR, KIND_COUNT };
+        ULONG kind = depth >= c_maxGeneratedDepth ? static_cast<ULONG>(PRIMITIVE) : input.Next(options.m_writableOnly ? static_cast<ULONG>(MVAR + 1) : static_cast<ULONG>(KIND_COUNT));
+        if ((kind == VAR && (options.m_typeVarCount == 0 || options.m_writableOnly)) ||
+            (kind == MVAR && options.m_methodVarCount == 0))
+        {
+            kind = PRIMITIVE;
+        }
+
+        GeneratedType type;
+        switch (kind)
+        {
+        case PRIMITIVE:
+            type.m_kind = c_primitives[input.Next(_countof(c_primitives))];
+            break;
+
+        case CLASS:
+        case VALUETYPE:
+            type.m_kind = kind == CLASS ? ELEMENT_TYPE_CLASS : ELEMENT_TYPE_VALUETYPE;
+            type.m_token = GenerateToken(input);
+            break;
+
+        case GENERICINST:
+            type.m_kind = ELEMENT_TYPE_GENERICINST;
+            type.m_genericInstKind = options.m_writableOnly || input.NextBool() ? ELEMENT_TYPE_CLASS : ELEMENT_TYPE_VALUETYPE;
+            type.m_token = GenerateToken(input);
+            type.m_children.resize(1 + input.Next(3));
+            for (auto& typeArg : type.m_children)
+            {
+                typeArg = GenerateType(input, depth + 1, options);
+            }
+            break;
+
+        case VAR:
+        case MVAR:
+            type.m_kind = kind == VAR ? ELEMENT_TYPE_VAR : ELEMENT_TYPE_MVAR;
+            type.m_number = input.Next(kind == VAR ? options.m_typeVarCount : options.m_methodVarCount);
+            break;
+
+        case PTR:
+        case SZARRAY:
+            type.m_kind = kind == PTR ? ELEMENT_TYPE_PTR : ELEMENT_TYPE_SZARRAY;
+            type.m_modifiers = GenerateModifiers(input);
+            type.m_isVoidPointer = kind == PTR && input.NextBool();
+            if (!type.m_isVoidPointer)
+            {
+                type.m_children.push_back(GenerateType(input, depth + 1, options));
+            }
+            break;
+
+        case ARRAY:
+            type.m_kind = ELEMENT_TYPE_ARRAY;
+            type.m_children.push_back(GenerateType(input, depth + 1, options));
+            type.m_rank = 1 + input.Next(4);
+            type.m_sizes.resize(input.Next(type.m_rank + 1));
+            for (auto& size : type.m_sizes)
+            {
+                size = GenerateCompressed(input);
+            }
+            type.m_loBounds.resize(input.Next(type.m_rank + 1));
+            for (auto& loBound : type.m_loBounds)
+            {
+                loBound = GenerateSigned(input);
+            }
+            break;
+
+        case FNPTR:
+            type.m_kind = ELEMENT_TYPE_FNPTR;
+            type.m_method = std::make_shared<GeneratedMethod>(GenerateMethod(input, depth + 1, options));
+            break;
+        }
+
+        return type;
+    }
+
+    GeneratedParam GenerateParam(FuzzInput& input, int depth, const GenerateOptions& options, ParamKind kind)
+    {
+        GeneratedParam param;
+        if (!options.m_writableOnly)
+        {
+            param.m_modifiers = GenerateModifiers(input);
+            param.m_isPinned = kind == ParamKind::Local && input.NextBool();
+
+            switch (input.Next(8))
+            {
+            case 1:
+                param.m_special = ELEMENT_TYPE_TYPEDBYREF;
+                return param;
+            case 2:
+                param.m_isByRef = true;
+                break;
+            }
+        }
+
+        if (kind == ParamKind::Return && !param.m_isByRef && input.Next(4) == 1)
+        {
+            param.m_special = ELEMENT_TYPE_VOID;
+            return param;
+        }
+
+        param.m_type = GenerateType(input, depth, options);
+        return param;
+    }
+
+    GeneratedMethod GenerateMethod(FuzzInput& input, int depth, const GenerateOptions& options)
+    {
+        GeneratedMethod method;
+        method.m_hasThis = input.NextBool();
+        method.m_genericParamCount = depth == 0 ? options.m_methodVarCount : 0;
+        method.m_return = GenerateParam(input, depth, options, ParamKind::Return);
+        method.m_params.resize(input.Next(6));
+        for (auto& param : method.m_params)
+        {
+            param = GenerateParam(input, depth, options, ParamKind::Normal);
+        }
+        return method;
+    }
+
+    // Encodes the generated signatures independently of the writers
+    class Encoder
+    {
+    public:
+        std::vector<COR_SIGNATURE> m_bytes;
+
+        void Byte(ULONG b)
+        {
+            m_bytes.push_back(static_cast<COR_SIGNATURE>(b));
+        }
+
+        void Unsigned(ULONG value)
+        {
+            if (value < 0x80)
+            {
+                Byte(value);
+            }
+            else if (value < 0x4000)
+            {
+                Byte(0x80 | (value >> 8));
+                Byte(value & 0xff);
+            }
+            else
+            {
+                Byte(0xc0 | (value >> 24));
+                Byte((value >> 16) & 0xff);
+                Byte((value >> 8) & 0xff);
+                Byte(value & 0xff);
+            }
+        }
+
+        // ECMA-335 II.23.2: the value's low bits, rotated left one so the sign bit is bit 0
+        void Signed(LONG value)
+        {
+            ULONG sign = value < 0 ? 1 : 0;
+            if (value >= -0x40 && value < 0x40)
+            {
+                Byte(((value & 0x3f) << 1) | sign);
+            }
+            else if (value >= -0x2000 && value < 0x2000)
+            {
+                ULONG rotated = ((value & 0x1fff) << 1) | sign;
+                Byte(0x80 | (rotated >> 8));
+                Byte(rotated & 0xff);
+            }
+            else
+            {
+                Unsigned(((value & 0x0fffffff) << 1) | sign);
+            }
+        }
+
+        void Token(mdToken token)
+        {
+            ULONG tag = TypeFromToken(token) == mdtTypeDef ? 0 : TypeFromToken(token) == mdtTypeRef ? 1 : 2;
+            Unsigned((RidFromToken(token) << 2) | tag);
+        }
+
+        void Modifiers(const std::vector<std::pair<mdToken, bool>>& modifiers)
+        {
+            for (auto& modifier : modifiers)
+            {
+                Byte(modifier.second ? ELEMENT_TYPE_CMOD_REQD : ELEMENT_TYPE_CMOD_OPT);
+                Token(modifier.first);
+            }
+        }
+
+        void Type(const GeneratedType& type)
+        {
+            Byte(type.m_kind);
+            switch (type.m_kind)
+            {
+            case ELEMENT_TYPE_CLASS:
+            case ELEMENT_TYPE_VALUETYPE:
+                Token(type.m_token);
+                break;
+
+            case ELEMENT_TYPE_GENERICINST:
+                Byte(type.m_genericInstKind);
+                Token(type.m_token);
+                Unsigned(static_cast<ULONG>(type.m_children.size()));
+                for (auto& typeArg : type.m_children)
+                {
+                    Type(typeArg);
+                }
+                break;
+
+            case ELEMENT_TYPE_VAR:
+            case ELEMENT_TYPE_MVAR:
+                Unsigned(type.m_number);
+                break;
+
+            case ELEMENT_TYPE_PTR:
+            case ELEMENT_TYPE_SZARRAY:
+                Modifiers(type.m_modifiers);
+                if (type.m_isVoidPointer)
+                {
+                    Byte(ELEMENT_TYPE_VOID);
+                }
+                else
+                {
+                    Type(type.m_children[0]);
+                }
+                break;
+
+            case ELEMENT_TYPE_ARRAY:
+                Type(type.m_children[0]);
+                Unsigned(type.m_rank);
+                Unsigned(static_cast<ULONG>(type.m_sizes.size()));
+                for (ULONG size : type.m_sizes)
+                {
+                    Unsigned(size);
+                }
+                Unsigned(static_cast<ULONG>(type.m_loBounds.size()));
+                for (LONG loBound : type.m_loBounds)
+                {
+                    Signed(loBound);
+                }
+                break;
+
+            case ELEMENT_TYPE_FNPTR:
+                Method(*type.m_method);
+                break;
+
+            default:
+                // Primitives are just the kind
+                break;
+            }
+        }
+
+        void Param(const GeneratedParam& param)
+        {
+            Modifiers(param.m_modifiers);
+            if (param.m_isPinned)
+            {
+                Byte(ELEMENT_TYPE_PINNED);
+            }
+
+            if (param.m_special != ELEMENT_TYPE_END)
+            {
+                Byte(param.m_special);
+                return;
+            }
+
+            if (param.m_isByRef)
+            {
+                Byte(ELEMENT_TYPE_BYREF);
+            }
+            Type(param.m_type);
+        }
+
+        void Method(const GeneratedMethod& method)
+        {
+            ULONG callConv = IMAGE_CEE_CS_CALLCONV_DEFAULT;
+            if (method.m_hasThis)
+            {
+                callConv |= IMAGE_CEE_CS_CALLCONV_HASTHIS;
+            }
+            if (method.m_genericParamCount > 0)
+            {
+                callConv |= IMAGE_CEE_CS_CALLCONV_GENERIC;
+            }
+
+            Byte(callConv);
+            if (method.m_genericParamCount > 0)
+            {
+                Unsigned(method.m_genericParamCount);
+            }
+            Unsigned(static_cast<ULONG>(method.m_params.size()));
+            Param(method.m_return);
+            for (auto& param : method.m_params)
+            {
+                Param(param);
+            }
+        }
+
+        void Locals(const std::vector<GeneratedParam>& locals)
+        {
+            Byte(IMAGE_CEE_CS_CALLCONV_LOCAL_SIG);
+            Unsigned(static_cast<ULONG>(locals.size()));
+            for (auto& local : locals)
+            {
+                Param(local);
+            }
+        }
+    };
+
+    std::vector<COR_SIGNATURE> Encode(const GeneratedType& type)
+    {
+        Encoder encoder;
+        encoder.Type(type);
+        return encoder.m_bytes;
+    }
+
+    std::vector<COR_SIGNATURE> Encode(const GeneratedMethod& method)
+    {
+        Encoder encoder;
+        encoder.Method(method);
+        return encoder.m_bytes;
+    }
+
+    std::vector<COR_SIGNATURE> Encode(const std::vector<GeneratedParam>& locals)
+    {
+        Encoder encoder;
+        encoder.Locals(locals);
+        return encoder.m_bytes;
+    }
+
+    // Reads signatures back through the readers, giving up on types nested more deeply than any
+    // that are generated (but not more deeply than raw fuzz input can make them).
+    const int c_maxReadDepth = 2 * c_maxGeneratedDepth + 2;
+
+    GeneratedMethod ReadMethod(MethodSignatureReader reader, int depth);
+
+    GeneratedType ReadType(SignatureTypeReader reader, int depth)
+    {
+        GeneratedType type;
+        if (depth > c_maxReadDepth)
+        {
+            reader.GetSigSpan();
+            return type;
+        }
+
+        type.m_kind = reader.GetTypeKind();
+        switch (type.m_kind)
+        {
+        case ELEMENT_TYPE_CLASS:
+        case ELEMENT_TYPE_VALUETYPE:
+            type.m_token = reader.GetToken();
+            break;
+
+        case ELEMENT_TYPE_GENERICINST:
+            type.m_genericInstKind = reader.GetGenericInstKind();
+            type.m_token = reader.GetToken();
+            while (reader.MoveNextTypeArg())
+            {
+                type.m_children.push_back(ReadType(reader.GetTypeReader(), depth + 1));
+            }
+            if (static_cast<size_t>(reader.GetGenArgCount()) != type.m_children.size())
+            {
+                throw std::string("wrong number of type args");
+            }
+            break;
+
+        case ELEMENT_TYPE_VAR:
+        case ELEMENT_TYPE_MVAR:
+            type.m_number = reader.GetVariableNumber();
+            break;
+
+        case ELEMENT_TYPE_PTR:
+        case ELEMENT_TYPE_SZARRAY:
+            while (reader.MoveNextCustomModifier())
+            {
+                type.m_modifiers.push_back(reader.GetCustomModifier());
+            }
+            type.m_isVoidPointer = reader.IsVoidPointer();
+            if (!type.m_isVoidPointer)
+            {
+                type.m_children.push_back(ReadType(reader.GetTypeReader(), depth + 1));
+            }
+            break;
+
+        case ELEMENT_TYPE_ARRAY:
+        {
+            type.m_children.push_back(ReadType(reader.GetTypeReader(), depth + 1));
+            auto shapeReader = reader.GetArrayShapeReader();
+            type.m_rank = shapeReader.GetRank();
+            while (shapeReader.MoveNextSize())
+            {
+                type.m_sizes.push_back(shapeReader.GetSize());
+            }
+            while (shapeReader.MoveNextLoBound())
+            {
+                type.m_loBounds.push_back(shapeReader.GetLoBound());
+            }
+            break;
+        }
+
+        case ELEMENT_TYPE_FNPTR:
+            type.m_method = std::make_shared<GeneratedMethod>(ReadMethod(reader.GetMethodSignatureReader(), depth + 1));
+            break;
+
+        default:
+            // Primitives are just the kind
+            break;
+        }
+
+        return type;
+    }
+
+    GeneratedParam ReadParam(SignatureParamReader reader, int depth)
+    {
+        GeneratedParam param;
+        while (reader.MoveNextCustomModifier())
+        {
+            param.m_modifiers.push_back(reader.GetCustomModifier());
+        }
+
+        if (reader.IsVoid())
+        {
+            param.m_special = ELEMENT_TYPE_VOID;
+        }
+        else if (reader.IsTypedByRef())
+        {
+            param.m_special = ELEMENT_TYPE_TYPEDBYREF;
+        }
+        else
+        {
+            param.m_isByRef = reader.IsByRef();
+            param.m_type = ReadType(reader.GetTypeReader(), depth);
+        }
+        return param;
+    }
+
+    GeneratedMethod ReadMethod(MethodSignatureReader reader, int depth)
+    {
+        GeneratedMethod method;
+        method.m_hasThis = reader.HasThis();
+        method.m_genericParamCount = reader.GenericParamCount();
+
+        ULONG paramCount = reader.ParamCount();
+        if (!reader.MoveNextParam())
+        {
+            throw std::string("no return type");
+        }
+        method.m_return = ReadParam(reader.GetParamReader(), depth);
+        while (reader.MoveNextParam())
+        {
+            method.m_params.push_back(ReadParam(reader.GetParamReader(), depth));
+        }
+
+        if (method.m_params.size() != paramCount)
+        {
+            throw std::string("wrong number of params");
+        }
+        return method;
+    }
+
+    std::vector<GeneratedParam> ReadLocals(const SignatureBlob& sig)
+    {
+        // The local readers don't say whether a local is pinned, but the index does
+        SignatureIndex index = SignatureIndex::IndexLocals(sig);
+        LocalsSignatureReader reader(sig);
+        std::vector<GeneratedParam> locals;
+        while (reader.MoveNext())
+        {
+            locals.push_back(ReadParam(reader.GetLocalReader(), 0));
+            locals.back().m_isPinned = index[locals.size() - 1].m_isPinned;
+        }
+        return locals;
+    }
+
+    void WriteType(SignatureTypeWriter writer, const GeneratedType& type, FuzzInput& input)
+    {
+        if (input.NextBool())
+        {
+            writer.Write(Encode(type));
+            return;
+        }
+
+        switch (type.m_kind)
+        {
+        case ELEMENT_TYPE_CLASS:
+            writer.SetSimpleClass(type.m_token);
+            break;
+        case ELEMENT_TYPE_VALUETYPE:
+            writer.SetSimpleValueType(type.m_token);
+            break;
+        case ELEMENT_TYPE_GENERICINST:
+            writer.SetGenericClass(type.m_token, static_cast<ULONG>(type.m_children.size()));
+            for (auto& typeArg : type.m_children)
+            {
+                WriteType(writer.WriteTypeArg(), typeArg, input);
+            }
+            break;
+        case ELEMENT_TYPE_MVAR:
+            writer.SetMethodTypeVar(type.m_number);
+            break;
+        default:
+            writer.SetPrimitiveKind(type.m_kind);
+            break;
+        }
+    }
+
+    GeneratedType Substitute(const GeneratedType& type, const std::vector<GeneratedType>& typeArgs, const std::vector<GeneratedType>& methodArgs);
+
+    GeneratedParam Substitute(const GeneratedParam& param, const std::vector<GeneratedType>& typeArgs, const std::vector<GeneratedType>& methodArgs)
+    {
+        GeneratedParam substituted = param;
+        if (param.m_special == ELEMENT_TYPE_END)
+        {
+            substituted.m_type = Substitute(param.m_type, typeArgs, methodArgs);
+        }
+        return substituted;
+    }
+
+    GeneratedType Substitute(const GeneratedType& type, const std::vector<GeneratedType>& typeArgs, const std::vector<GeneratedType>& methodArgs)
+    {
+        if (type.m_kind == ELEMENT_TYPE_VAR)
+        {
+            return typeArgs[type.m_number];
+        }
+        if (type.m_kind == ELEMENT_TYPE_MVAR)
+        {
+            return methodArgs[type.m_number];
+        }
+
+        GeneratedType substituted = type;
+        for (auto& child : substituted.m_children)
+        {
+            child = Substitute(child, typeArgs, methodArgs);
+        }
+
+        if (type.m_method)
+        {
+            substituted.m_method = std::make_shared<GeneratedMethod>(*type.m_method);
+            substituted.m_method->m_return = Substitute(type.m_method->m_return, typeArgs, methodArgs);
+            for (auto& param : substituted.m_method->m_params)
+            {
+                param = Substitute(param, typeArgs, methodArgs);
+            }
+        }
+        return substituted;
+    }
+
+    void Expect(bool condition, const char* failure)
+    {
+        if (!condition)
+        {
+            throw std::string(failure);
+        }
+    }
+
+    // Runs something on a signature that isn't known to be well formed: it may throw
+    // std::domain_error, but anything else is a bug. Returns whether it succeeded.
+    bool Tolerate(const char* what, const std::function<void()>& action)
+    {
+        try
+        {
+            action();
+            return true;
+        }
+        catch (const std::domain_error&)
+        {
+            return false;
+        }
+        catch (const std::exception& ex)
+        {
+            throw std::string(what) + " threw " + typeid(ex).name() + ": " + ex.what();
+        }
+    }
+
+    void CheckGeneratedMethod(const GeneratedMethod& method)
+    {
+        std::vector<COR_SIGNATURE> sig = Encode(method);
+        MethodSignatureReader::Check(sig);
+        Expect(Encode(ReadMethod(MethodSignatureReader(sig), 0)) == sig, "method read back differently");
+
+        SignatureIndex index = SignatureIndex::IndexMethod(sig);
+        Expect(index.ParamCount() == method.m_params.size(), "index has wrong number of params");
+        Expect(index.GetEntriesSpan().end() == sig.data() + sig.size(), "index ends in the wrong place");
+        for (size_t i = 0; i < index.GetCount(); i++)
+        {
+            const GeneratedParam& param = i == 0 ? method.m_return : method.m_params[i - 1];
+            const SignatureIndex::Entry& entry = index[i];
+            Expect(i == 0 || entry.m_start == index[i - 1].m_end, "index entries aren't contiguous");
+            Expect(entry.m_isByRef == param.m_isByRef, "index entry has wrong byref");
+            if (param.m_special != ELEMENT_TYPE_END)
+            {
+                Expect(entry.m_typeKind == param.m_special && !entry.HasType(), "index entry has wrong special type");
+            }
+            else
+            {
+                auto typeSpan = entry.GetTypeSpan();
+                Expect(std::vector<COR_SIGNATURE>(typeSpan.begin(), typeSpan.end()) == Encode(param.m_type), "index entry has wrong type");
+                Expect(entry.m_typeKind == param.m_type.m_kind, "index entry has wrong kind");
+            }
+        }
+
+        PrimitiveReader skipReader(sig);
+        skipReader.SkipMethodSignature();
+        Expect(skipReader.GetPtr() == sig.data() + sig.size(), "skipping method ends in the wrong place");
+
+        for (size_t length = 0; length < sig.size(); length++)
+        {
+            Expect(!Tolerate("Check (truncated)", [&] { MethodSignatureReader::Check(SignatureBlob(sig.data(), length)); }),
+                "truncated method signature passed Check");
+        }
+    }
+
+    void CheckGeneratedLocals(const std::vector<GeneratedParam>& locals, const GeneratedType& additional)
+    {
+        std::vector<COR_SIGNATURE> sig = Encode(locals);
+        Expect(Encode(ReadLocals(sig)) == sig, "locals read back differently");
+
+        std::vector<GeneratedParam> appended = locals;
+        appended.push_back({});
+        appended.back().m_type = additional;
+        std::vector<COR_SIGNATURE> additionalSig = Encode(additional);
+        Expect(LocalsSignatureReader(sig).AppendLocals({ additionalSig }) == Encode(appended), "appended locals are wrong");
+    }
+
+    void CheckWriters(FuzzInput& input, const GenerateOptions& writableOptions)
+    {
+        GeneratedMethod method = GenerateMethod(input, 0, writableOptions);
+        std::vector<COR_SIGNATURE> written;
+        MethodSignatureWriter writer(written, method.m_hasThis, static_cast<ULONG>(method.m_params.size()), method.m_genericParamCount);
+        if (method.m_return.m_special == ELEMENT_TYPE_VOID)
+        {
+            writer.SetVoidReturn();
+        }
+        else
+        {
+            WriteType(writer.WriteParam(), method.m_return.m_type, input);
+        }
+        for (auto& param : method.m_params)
+        {
+            WriteType(writer.WriteParam(), param.m_type, input);
+        }
+        writer.Complete();
+        Expect(written == Encode(method), "method writer wrote something different");
+
+        std::vector<GeneratedParam> locals(input.Next(5));
+        for (auto& local : locals)
+        {
+            local.m_type = GenerateType(input, 0, writableOptions);
+        }
+        std::vector<COR_SIGNATURE> writtenLocals = LocalsSignatureWriter::MakeSig(static_cast<ULONG>(locals.size()), [&](LocalsSignatureWriter& localsWriter) {
+            for (auto& local : locals)
+            {
+                WriteType(localsWriter.WriteLocal(), local.m_type, input);
+            }
+        });
+        Expect(writtenLocals == Encode(locals), "locals writer wrote something different");
+        Expect(Encode(ReadLocals(writtenLocals)) == writtenLocals, "written locals read back differently");
+    }
+
+    void CheckSubstitution(FuzzInput& input)
+    {
+        GenerateOptions argOptions = { false, 0, 0 };
+        std::vector<GeneratedType> typeArgs(input.Next(3)), methodArgs(input.Next(3));
+        std::vector<std::vector<COR_SIGNATURE>> argSigs;
+        for (auto& arg : typeArgs)
+        {
+            arg = GenerateType(input, 2, argOptions);
+        }
+        for (auto& arg : methodArgs)
+        {
+            arg = GenerateType(input, 2, argOptions);
+        }
+
+        auto getSpans = [](const std::vector<GeneratedType>& args, std::vector<std::vector<COR_SIGNATURE>>& sigs) {
+            std::vector<SignatureBlob> spans;
+            for (auto& arg : args)
+            {
+                sigs.push_back(Encode(arg));
+            }
+            for (size_t i = sigs.size() - args.size(); i < sigs.size(); i++)
+            {
+                spans.push_back(sigs[i]);
+            }
+            return spans;
+        };
+        argSigs.reserve(typeArgs.size() + methodArgs.size());
+        std::vector<SignatureBlob> typeArgSpans = getSpans(typeArgs, argSigs);
+        std::vector<SignatureBlob> methodArgSpans = getSpans(methodArgs, argSigs);
+
+        GenerateOptions options = { false, static_cast<ULONG>(typeArgs.size()), static_cast<ULONG>(methodArgs.size()) };
+        GeneratedType type = GenerateType(input, 0, options);
+        std::vector<COR_SIGNATURE> sig = Encode(type);
+
+        std::vector<COR_SIGNATURE> expected = Encode(Substitute(type, typeArgs, methodArgs));
+        Expect(SignatureTypeReader(sig).SubstituteTypeArgs(typeArgSpans, methodArgSpans) == expected, "substitution is wrong");
+
+        // Substituting nothing either leaves the type alone, or fails if it has type variables
+        bool hasVariables = expected != sig;
+        std::vector<COR_SIGNATURE> unsubstituted;
+        bool substituted = Tolerate("SubstituteTypeArgs", [&] { unsubstituted = SignatureTypeReader(sig).SubstituteTypeArgs({}, {}); });
+        Expect(substituted ? !hasVariables && unsubstituted == sig : hasVariables, "substituting no type args is wrong");
+    }
+
+    // Treats the input itself as each kind of signature. Anything the checks accept must be
+    // readable all the way through.
+    void CheckRawInput(const BYTE* pData, size_t size)
+    {
+        SignatureBlob raw(pData, size);
+
+        bool checked = Tolerate("Check", [&] { MethodSignatureReader::Check(raw); });
+        bool read = Tolerate("MethodSignatureReader", [&] { ReadMethod(MethodSignatureReader(raw), 0); });
+        bool indexed = Tolerate("SignatureIndex", [&] {
+            SignatureIndex index = SignatureIndex::IndexMethod(raw);
+            Expect(!checked || index.GetEntriesSpan().end() == raw.end(), "index of checked signature ends in the wrong place");
+        });
+        Expect(!checked || (read && indexed), "signature passed Check but can't be read");
+
+        Tolerate("LocalsSignatureReader", [&] { ReadLocals(raw); });
+        Tolerate("AppendLocals", [&] { LocalsSignatureReader(raw).AppendLocals({ SignatureBlob(pData, pData + 1) }); });
+        Tolerate("SignatureTypeReader", [&] { ReadType(SignatureTypeReader(raw), 0); });
+        Tolerate("SubstituteTypeArgs", [&] {
+            std::vector<SignatureBlob> args = { SignatureBlob(pData, size / 2) };
+            SignatureTypeReader(raw).SubstituteTypeArgs(args, args);
+        });
+
+        bool specChecked = Tolerate("MethodSpecSignatureReader::Check", [&] { MethodSpecSignatureReader::Check(raw); });
+        bool specRead = Tolerate("MethodSpecSignatureReader", [&] {
+            MethodSpecSignatureReader reader(raw);
+            while (reader.MoveNextArgType())
+            {
+                ReadType(reader.GetArgTypeReader(), 0);
+            }
+            MethodSpecSignatureReader::GetTypeArgSpans(raw);
+            SignatureIndex::IndexMethodSpec(raw);
+        });
+        Expect(!specChecked || specRead, "method spec passed Check but can't be read");
+    }
+
+    std::string CheckSignaturesFromFuzzInput(const BYTE* pData, size_t size)
+    {
+        try
+        {
+            FuzzInput input(pData, size);
+            GenerateOptions options = { false, input.Next(3), input.Next(3) };
+            CheckGeneratedMethod(GenerateMethod(input, 0, options));
+
+            std::vector<GeneratedParam> locals(input.Next(6));
+            for (auto& local : locals)
+            {
+                local = GenerateParam(input, 0, options, ParamKind::Local);
+            }
+            CheckGeneratedLocals(locals, GenerateType(input, 0, options));
+
+            CheckWriters(input, { true, 0, input.Next(3) });
+            CheckSubstitution(input);
+            CheckRawInput(pData, size);
+        }
+        catch (const std::string& failure)
+        {
+            return failure;
+        }
+        catch (const std::exception& ex)
+        {
+            return std::string("unexpected exception: ") + ex.what();
+        }
+
+        return {};
+    }
+}
+
+TEST(SignatureRoundTrip, GeneratedSignaturesSurviveReadWriteAndSubstitution) {
+    for (auto& input : GenerateFuzzInputs(2000, 3))
+    {
+        std::string failure = CheckSignaturesFromFuzzInput(input.data(), input.size());
+        ASSERT_EQ("", failure) << "input: " << Describe(input);
+    }
+}
+
+TEST(SignatureRoundTrip, RejectsDeeplyNestedTypes) {
+    // Arrays of arrays... and function pointers returning function pointers... are skipped
+    // recursively, so nesting them is limited rather than left to overflow the stack.
+    for (BYTE element : { ELEMENT_TYPE_ARRAY, ELEMENT_TYPE_FNPTR })
+    {
+        std::vector<COR_SIGNATURE> sig;
+        for (int i = 0; i < 100000; i++)
+        {
+            sig.push_back(element);
+            if (element == ELEMENT_TYPE_FNPTR)
+            {
+                sig.push_back(IMAGE_CEE_CS_CALLCONV_DEFAULT);
+                sig.push_back(0);
+            }
+        }
+        sig.push_back(ELEMENT_TYPE_I4);
+
+        EXPECT_THROW(PrimitiveReader(sig).SkipType(), std::domain_error);
+        EXPECT_THROW(SignatureTypeReader(sig).GetSigSpan(), std::domain_error);
+    }
+
+    // Other types nest without recursing
+    std::vector<COR_SIGNATURE> sig(100000, ELEMENT_TYPE_SZARRAY);
+    sig.push_back(ELEMENT_TYPE_I4);
+    EXPECT_EQ(sig.size(), SignatureTypeReader(sig).GetSigSpan().length());
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(SignatureRoundTrip, DISABLED_BenchmarkThroughput) {
+    std::vector<std::vector<COR_SIGNATURE>> sigs;
+    size_t totalBytes = 0;
+    for (auto& input : GenerateFuzzInputs(20000, 4))
+    {
+        FuzzInput fuzzInput(input.data(), input.size());
+        GenerateOptions options = { false, fuzzInput.Next(3), fuzzInput.Next(3) };
+        sigs.push_back(Encode(GenerateMethod(fuzzInput, 0, options)));
+        totalBytes += sigs.back().size();
+    }
+
+    auto measure = [&](const char* name, const std::function<void(const std::vector<COR_SIGNATURE>&)>& process) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 10; i++)
+        {
+            for (auto& sig : sigs)
+            {
+                process(sig);
+            }
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << 10 * totalBytes / seconds / (1024 * 1024) << "MB/s" << std::endl;
+    };
+
+    std::cout << sigs.size() << " signatures, " << totalBytes / sigs.size() << " bytes on average" << std::endl;
+    measure("Check:             ", [](const std::vector<COR_SIGNATURE>& sig) {
+        MethodSignatureReader::Check(sig);
+    });
+    measure("Index:             ", [](const std::vector<COR_SIGNATURE>& sig) {
+        SignatureIndex::IndexMethod(sig);
+    });
+    measure("Read with readers: ", [](const std::vector<COR_SIGNATURE>& sig) {
+        ReadMethod(MethodSignatureReader(sig), 0);
+    });
+}
+
+#ifdef RXPROFILER_FUZZER
+// Entry point for libFuzzer: build this file with the profiler's Signature.cpp, RXPROFILER_FUZZER
+// defined and -fsanitize=fuzzer (/fsanitize=fuzzer for MSVC), leaving out the other tests and
+// the gtest main.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* pData, size_t size)
+{
+    std::string failure = CheckSignaturesFromFuzzInput(pData, size);
+    if (!failure.empty())
+    {
+        std::cerr << failure << std::endl;
+        abort();
+    }
+    return 0;
+}
+#endif
@@ -1,6 +1,9 @@
 #include "pch.h"
 #include "Signature.h"
 
+#include <chrono>
+#include <iostream>
+
 TEST(MethodSignatureReader, CheckPassesOnGoodBlobs) {
     std::vector<std::vector<COR_SIGNATURE>> sigs =
     { 
@@ -85,3 +88,527 @@ TEST(MethodSignatureReader, SubstitutesTypeArgsForZip) {
     
     EXPECT_EQ(param1Subst.size(), 5);
 }
+
+TEST(MethodSignatureReader, ReadsEachKindOfParam) {
+    std::vector<COR_SIGNATURE> sig =
+    {
+        0x00, 0x05, 0x01,                               // static void (
+        0x14, 0x08, 0x02, 0x01, 0x03, 0x01, 0x7f,       //   int32[-1...+2, ],
+        0x0f, 0x20, 0x09, 0x01,                         //   void modopt(0100002)*,
+        0x1b, 0x00, 0x01, 0x08, 0x0e,                   //   int32 *(string),
+        0x10, 0x0e,                                     //   string&,
+        0x16                                            //   typedref)
+    };
+
+    EXPECT_NO_THROW(MethodSignatureReader::Check(sig));
+
+    MethodSignatureReader reader(sig);
+    EXPECT_FALSE(reader.HasThis());
+    EXPECT_EQ(5, reader.ParamCount());
+
+    ASSERT_TRUE(reader.MoveNextParam());
+    EXPECT_TRUE(reader.GetParamReader().IsReturn());
+    EXPECT_TRUE(reader.GetParamReader().IsVoid());
+    EXPECT_FALSE(reader.GetParamReader().HasType());
+
+    ASSERT_TRUE(reader.MoveNextParam());
+    auto arrayReader = reader.GetParamReader().GetTypeReader();
+    EXPECT_EQ(ELEMENT_TYPE_ARRAY, arrayReader.GetTypeKind());
+    EXPECT_EQ(ELEMENT_TYPE_I4, arrayReader.GetTypeReader().GetTypeKind());
+    auto shapeReader = arrayReader.GetArrayShapeReader();
+    EXPECT_EQ(2, shapeReader.GetRank());
+    EXPECT_EQ(1, shapeReader.GetNumSizes());
+    ASSERT_TRUE(shapeReader.MoveNextSize());
+    EXPECT_EQ(3, shapeReader.GetSize());
+    EXPECT_FALSE(shapeReader.MoveNextSize());
+    EXPECT_EQ(1, shapeReader.GetNumLoBounds());
+    ASSERT_TRUE(shapeReader.MoveNextLoBound());
+    EXPECT_EQ(-1, shapeReader.GetLoBound());
+    EXPECT_FALSE(shapeReader.MoveNextLoBound());
+
+    ASSERT_TRUE(reader.MoveNextParam());
+    auto pointerReader = reader.GetParamReader().GetTypeReader();
+    EXPECT_EQ(ELEMENT_TYPE_PTR, pointerReader.GetTypeKind());
+    ASSERT_TRUE(pointerReader.MoveNextCustomModifier());
+    EXPECT_EQ(std::make_pair(static_cast<mdToken>(0x01000002), false), pointerReader.GetCustomModifier());
+    EXPECT_FALSE(pointerReader.MoveNextCustomModifier());
+    EXPECT_TRUE(pointerReader.IsVoidPointer());
+
+    ASSERT_TRUE(reader.MoveNextParam());
+    auto fnPtrReader = reader.GetParamReader().GetTypeReader();
+    EXPECT_EQ(ELEMENT_TYPE_FNPTR, fnPtrReader.GetTypeKind());
+    auto fnSigReader = fnPtrReader.GetMethodSignatureReader();
+    EXPECT_EQ(1, fnSigReader.ParamCount());
+    ASSERT_TRUE(fnSigReader.MoveNextParam());
+    EXPECT_EQ(ELEMENT_TYPE_I4, fnSigReader.GetParamReader().GetTypeReader().GetTypeKind());
+    ASSERT_TRUE(fnSigReader.MoveNextParam());
+    EXPECT_EQ(ELEMENT_TYPE_STRING, fnSigReader.GetParamReader().GetTypeReader().GetTypeKind());
+    EXPECT_FALSE(fnSigReader.MoveNextParam());
+    EXPECT_EQ(5, fnPtrReader.GetSigSpan().length());
+
+    ASSERT_TRUE(reader.MoveNextParam());
+    EXPECT_TRUE(reader.GetParamReader().IsByRef());
+    EXPECT_EQ(ELEMENT_TYPE_STRING, reader.GetParamReader().GetTypeReader().GetTypeKind());
+
+    ASSERT_TRUE(reader.MoveNextParam());
+    EXPECT_TRUE(reader.GetParamReader().IsTypedByRef());
+
+    EXPECT_FALSE(reader.MoveNextParam());
+}
+
+TEST(MethodSignatureReader, CheckFailsOnBadBlobs) {
+    std::vector<std::vector<COR_SIGNATURE>> sigs =
+    {
+        { 0x00, 0x01, 0x01, 0x0e, 0x0e },   // extra byte
+        { 0x00, 0x02, 0x01, 0x0e },         // missing param
+        { 0x00, 0x01, 0x01, 0x01 },         // void param
+        { 0x06, 0x08 }                      // field signature
+    };
+
+    for (auto& sig : sigs)
+    {
+        EXPECT_THROW(MethodSignatureReader::Check(sig), std::domain_error);
+    }
+}
+
+TEST(LocalsSignatureReader, ReadsAndAppendsLocals) {
+    std::vector<COR_SIGNATURE> sig =
+    {
+        0x07, 0x02,
+        0x45, 0x10, 0x08,   // pinned int32&
+        0x1d, 0x0e          // string[]
+    };
+
+    LocalsSignatureReader reader(sig);
+    EXPECT_EQ(2, reader.GetCount());
+    ASSERT_TRUE(reader.MoveNext());
+    EXPECT_TRUE(reader.GetLocalReader().IsByRef());
+    EXPECT_EQ(ELEMENT_TYPE_I4, reader.GetLocalReader().GetTypeReader().GetTypeKind());
+    ASSERT_TRUE(reader.MoveNext());
+    auto arrayReader = reader.GetLocalReader().GetTypeReader();
+    EXPECT_EQ(ELEMENT_TYPE_SZARRAY, arrayReader.GetTypeKind());
+    EXPECT_EQ(ELEMENT_TYPE_STRING, arrayReader.GetTypeReader().GetTypeKind());
+    EXPECT_FALSE(reader.MoveNext());
+
+    std::vector<COR_SIGNATURE> int32Sig = { ELEMENT_TYPE_I4 };
+    std::vector<COR_SIGNATURE> expected = { 0x07, 0x03, 0x45, 0x10, 0x08, 0x1d, 0x0e, 0x08 };
+    EXPECT_EQ(expected, LocalsSignatureReader(sig).AppendLocals({ int32Sig }));
+}
+
+TEST(SignatureTypeReader, GetsTypeArgSpansOfGenericInstance) {
+    // Dictionary<string, List<int32>>
+    std::vector<COR_SIGNATURE> sig = { 0x15, 0x12, 0x49, 0x02, 0x0e, 0x15, 0x12, 0x4d, 0x01, 0x08 };
+
+    SignatureTypeReader reader(sig);
+    EXPECT_EQ(ELEMENT_TYPE_GENERICINST, reader.GetTypeKind());
+    EXPECT_EQ(ELEMENT_TYPE_CLASS, reader.GetGenericInstKind());
+    EXPECT_EQ(0x01000012, reader.GetToken());
+    EXPECT_EQ(2, reader.GetGenArgCount());
+
+    auto spans = reader.GetTypeArgSpans();
+    ASSERT_EQ(2, spans.size());
+    EXPECT_EQ(sig.data() + 4, spans[0].begin());
+    EXPECT_EQ(1, spans[0].length());
+    EXPECT_EQ(sig.data() + 5, spans[1].begin());
+    EXPECT_EQ(5, spans[1].length());
+    EXPECT_EQ(sig.size(), reader.GetSigSpan().length());
+}
+
+// The walk the instrumenter makes over the signature of each method called: is the return type
+// IObservable<T>, and which arguments might be observables?
+static int ClassifyCallSignature(const SignatureBlob& sig, mdToken observableTypeRef, std::vector<SignatureBlob>& argSpans)
+{
+    MethodSignatureReader sigReader(sig);
+    sigReader.MoveNextParam();
+    auto returnReader = sigReader.GetParamReader();
+    if (!returnReader.HasType())
+    {
+        return -1;
+    }
+
+    auto returnTypeReader = returnReader.GetTypeReader();
+    if (returnTypeReader.GetTypeKind() != ELEMENT_TYPE_GENERICINST || returnTypeReader.GetToken() != observableTypeRef)
+    {
+        return -1;
+    }
+
+    returnTypeReader.MoveNextTypeArg();
+    argSpans.push_back(returnTypeReader.GetTypeReader().GetSigSpan());
+
+    int observableArgs = 0;
+    while (sigReader.MoveNextParam())
+    {
+        auto paramReader = sigReader.GetParamReader();
+        if (paramReader.IsTypedByRef() || paramReader.IsByRef())
+        {
+            continue;
+        }
+
+        auto paramTypeReader = paramReader.GetTypeReader();
+        auto kind = paramTypeReader.GetTypeKind();
+        if (kind == ELEMENT_TYPE_CLASS || kind == ELEMENT_TYPE_GENERICINST || kind == ELEMENT_TYPE_SZARRAY)
+        {
+            observableArgs++;
+            argSpans.push_back(paramTypeReader.GetSigSpan());
+        }
+    }
+    return observableArgs;
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(MethodSignatureReader, DISABLED_BenchmarkClassifyCallSignatures) {
+    const mdToken c_IObservable = 0x0100000d;
+    const int c_iterations = 200000;
+
+    std::vector<std::vector<COR_SIGNATURE>> sigs =
+    {
+        // IObservable<T0> ToObservable<T0>(IEnumerable<T0>)
+        { 0x10, 0x01, 0x01, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x00, 0x15, 0x12, 0x55, 0x01, 0x1e, 0x00 },
+        // IObservable<T2> Zip<T0, T1, T2>(IObservable<T0>, IObservable<T1>, Func<T0, T1, T2>)
+        { 0x10, 0x03, 0x03, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x02, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x00, 0x15,
+          0x12, 0x35, 0x01, 0x1e, 0x01, 0x15, 0x12, 0x41, 0x03, 0x1e, 0x00, 0x1e, 0x01, 0x1e, 0x02 },
+        // IObservable<int[]> Buffer(IObservable<int>, int32, int32&)
+        { 0x00, 0x03, 0x15, 0x12, 0x35, 0x01, 0x1d, 0x08, 0x15, 0x12, 0x35, 0x01, 0x08, 0x08, 0x10, 0x08 },
+        // instance void Write(string, object[])
+        { 0x20, 0x02, 0x01, 0x0e, 0x1d, 0x1c },
+        // instance Dictionary<string, List<int>> Get(int32)
+        { 0x20, 0x01, 0x15, 0x12, 0x49, 0x02, 0x0e, 0x15, 0x12, 0x4d, 0x01, 0x08, 0x08 },
+    };
+
+    std::vector<SignatureBlob> argSpans;
+    int observableArgs = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < c_iterations; i++)
+    {
+        for (auto& sig : sigs)
+        {
+            argSpans.clear();
+            observableArgs += ClassifyCallSignature(sig, c_IObservable, argSpans);
+        }
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(c_iterations * (1 + 3 + 1 - 1 - 1), observableArgs);
+    std::cout << ns / (c_iterations * sigs.size()) << "ns/signature" << std::endl;
+}
+
+TEST(PrimitiveReader, ReadsCompressedIntegers) {
+    // Examples from ECMA-335 II.23.2
+    std::vector<std::pair<std::vector<COR_SIGNATURE>, ULONG>> unsignedCases =
+    {
+        { { 0x03 }, 0x03 },
+        { { 0x7f }, 0x7f },
+        { { 0x80, 0x80 }, 0x80 },
+        { { 0xae, 0x57 }, 0x2e57 },
+        { { 0xbf, 0xff }, 0x3fff },
+        { { 0xc0, 0x00, 0x40, 0x00 }, 0x4000 },
+        { { 0xdf, 0xff, 0xff, 0xff }, 0x1fffffff },
+    };
+
+    for (auto& c : unsignedCases)
+    {
+        PrimitiveReader reader(c.first);
+        EXPECT_EQ(c.second, reader.ReadCompressedUnsigned());
+        EXPECT_EQ(c.first.data() + c.first.size(), reader.GetPtr());
+    }
+
+    std::vector<std::pair<std::vector<COR_SIGNATURE>, LONG>> signedCases =
+    {
+        { { 0x06 }, 3 },
+        { { 0x7b }, -3 },
+        { { 0x80, 0x80 }, 64 },
+        { { 0x01 }, -64 },
+        { { 0xc0, 0x00, 0x40, 0x00 }, 8192 },
+        { { 0x80, 0x01 }, -8192 },
+        { { 0xdf, 0xff, 0xff, 0xfe }, 268435455 },
+        { { 0xc0, 0x00, 0x00, 0x01 }, -268435456 },
+    };
+
+    for (auto& c : signedCases)
+    {
+        PrimitiveReader reader(c.first);
+        EXPECT_EQ(c.second, reader.ReadCompressedSigned());
+        EXPECT_EQ(c.first.data() + c.first.size(), reader.GetPtr());
+    }
+
+    std::vector<std::pair<std::vector<COR_SIGNATURE>, mdToken>> tokenCases =
+    {
+        { { 0x08 }, 0x02000002 },
+        { { 0x49 }, 0x01000012 },
+        { { 0x81, 0x2e }, 0x1b00004b },
+        { { 0xc0, 0x01, 0x23, 0x45 }, 0x010048d1 },
+    };
+
+    for (auto& c : tokenCases)
+    {
+        PrimitiveReader reader(c.first);
+        EXPECT_EQ(c.second, reader.ReadTypeDefOrRefEncoded());
+        EXPECT_EQ(c.first.data() + c.first.size(), reader.GetPtr());
+    }
+}
+
+TEST(PrimitiveReader, FailsOnTruncatedValues) {
+    std::vector<std::vector<COR_SIGNATURE>> encodings =
+    {
+        { 0x03 },
+        { 0xae, 0x57 },
+        { 0xc0, 0x00, 0x40, 0x00 },
+    };
+
+    for (auto& encoding : encodings)
+    {
+        for (size_t length = 0; length < encoding.size(); length++)
+        {
+            SignatureBlob truncated(encoding.data(), length);
+            EXPECT_THROW({ PrimitiveReader(truncated).ReadCompressedUnsigned(); }, std::domain_error);
+            EXPECT_THROW({ PrimitiveReader(truncated).ReadCompressedSigned(); }, std::domain_error);
+            EXPECT_THROW({ PrimitiveReader(truncated).ReadTypeDefOrRefEncoded(); }, std::domain_error);
+        }
+    }
+
+    // Types that run off the end, at each point where they could
+    std::vector<COR_SIGNATURE> type = { 0x15, 0x12, 0x81, 0x2e, 0x02, 0x1d, 0x0f, 0x01, 0x11, 0xc0, 0x01, 0x23, 0x45 };
+    PrimitiveReader whole(type);
+    whole.SkipType();
+    EXPECT_EQ(type.data() + type.size(), whole.GetPtr());
+    for (size_t length = 0; length < type.size(); length++)
+    {
+        EXPECT_THROW({ PrimitiveReader(SignatureBlob(type.data(), length)).SkipType(); }, std::domain_error) << length;
+    }
+}
+
+// Method signatures shaped like those of System.Reactive and the BCL: mostly small, with nested
+// generic instances, and tokens encoded in one, two and four bytes.
+static std::vector<std::vector<COR_SIGNATURE>> MakeSkipBenchmarkSignatures()
+{
+    return
+    {
+        // IObservable<T0> ToObservable<T0>(IEnumerable<T0>)
+        { 0x10, 0x01, 0x01, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x00, 0x15, 0x12, 0x55, 0x01, 0x1e, 0x00 },
+        // IObservable<T2> Zip<T0, T1, T2>(IObservable<T0>, IObservable<T1>, Func<T0, T1, T2>)
+        { 0x10, 0x03, 0x03, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x02, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x00, 0x15,
+          0x12, 0x35, 0x01, 0x1e, 0x01, 0x15, 0x12, 0x41, 0x03, 0x1e, 0x00, 0x1e, 0x01, 0x1e, 0x02 },
+        // IObservable<T1> SelectMany<T0, T1>(IObservable<T0>, Func<T0, int, CancellationToken, Task<IEnumerable<T1>>>)
+        { 0x10, 0x02, 0x02, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x01, 0x15, 0x12, 0x35, 0x01, 0x1e, 0x00, 0x15,
+          0x12, 0x81, 0x2d, 0x04, 0x1e, 0x00, 0x08, 0x11, 0x81, 0x31, 0x15, 0x12, 0x81, 0x35, 0x01, 0x15,
+          0x12, 0x55, 0x01, 0x1e, 0x01 },
+        // IObservable<IList<T0>> Buffer<T0>(IObservable<T0>, TimeSpan, int32, IScheduler)
+        { 0x10, 0x01, 0x04, 0x15, 0x12, 0x35, 0x01, 0x15, 0x12, 0x81, 0x41, 0x01, 0x1e, 0x00, 0x15, 0x12,
+          0x35, 0x01, 0x1e, 0x00, 0x11, 0x81, 0x45, 0x08, 0x12, 0x81, 0x49 },
+        // instance void Write(string, object[])
+        { 0x20, 0x02, 0x01, 0x0e, 0x1d, 0x1c },
+        // instance Dictionary<string, List<int>> Get(int32)
+        { 0x20, 0x01, 0x15, 0x12, 0x49, 0x02, 0x0e, 0x15, 0x12, 0x4d, 0x01, 0x08, 0x08 },
+        // bool TryParse(string, NumberStyles, IFormatProvider, float64&)
+        { 0x00, 0x04, 0x02, 0x0e, 0x11, 0xc0, 0x01, 0x23, 0x45, 0x12, 0xc0, 0x01, 0x23, 0x49, 0x10, 0x0d },
+        // void Copy(int32[0...,0...], int32*, native int)
+        { 0x00, 0x03, 0x01, 0x14, 0x08, 0x02, 0x00, 0x02, 0x00, 0x00, 0x0f, 0x08, 0x18 },
+    };
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(PrimitiveReader, DISABLED_BenchmarkSkipSignatures) {
+    const int c_iterations = 500000;
+
+    auto sigs = MakeSkipBenchmarkSignatures();
+    size_t totalBytes = 0;
+    for (auto& sig : sigs)
+    {
+        MethodSignatureReader::Check(sig);
+        totalBytes += sig.size();
+    }
+
+    size_t skippedBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < c_iterations; i++)
+    {
+        for (auto& sig : sigs)
+        {
+            PrimitiveReader reader(sig);
+            reader.SkipMethodSignature();
+            skippedBytes += reader.GetPtr() - sig.data();
+        }
+    }
+    auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(totalBytes * c_iterations, skippedBytes);
+    std::cout << ns / (c_iterations * sigs.size()) << "ns/signature, "
+        << (totalBytes * c_iterations) / (ns / 1e9) / (1024 * 1024) << "MB/s" << std::endl;
+}
+
+TEST(SignatureIndex, MatchesMethodSignatureReader) {
+    auto sigs = MakeSkipBenchmarkSignatures();
+    sigs.push_back(
+    {
+        0x00, 0x05, 0x01,                               // static void (
+        0x14, 0x08, 0x02, 0x01, 0x03, 0x01, 0x7f,       //   int32[-1...+2, ],
+        0x0f, 0x20, 0x09, 0x01,                         //   void modopt(0100002)*,
+        0x1b, 0x00, 0x01, 0x08, 0x0e,                   //   int32 *(string),
+        0x10, 0x0e,                                     //   string&,
+        0x16                                            //   typedref)
+    });
+
+    for (auto& sig : sigs)
+    {
+        SignatureIndex index = SignatureIndex::IndexMethod(sig);
+        MethodSignatureReader reader(sig);
+        EXPECT_EQ(reader.HasThis(), index.HasThis());
+        EXPECT_EQ(reader.GenericParamCount(), index.GenericParamCount());
+        ASSERT_EQ(reader.ParamCount(), index.ParamCount());
+        ASSERT_EQ(reader.ParamCount() + 1, index.GetCount());
+        EXPECT_EQ(sig.data() + sig.size(), index.GetEntriesSpan().end());
+        EXPECT_EQ(sig.data() + sig.size(), index[index.GetCount() - 1].m_end);
+
+        for (size_t i = 0; i < index.GetCount(); i++)
+        {
+            ASSERT_TRUE(reader.MoveNextParam());
+            auto paramReader = reader.GetParamReader();
+            const SignatureIndex::Entry& entry = index[i];
+            if (i > 0)
+            {
+                EXPECT_EQ(index[i - 1].m_end, entry.m_start);
+            }
+
+            EXPECT_EQ(paramReader.IsByRef(), entry.m_isByRef);
+            EXPECT_EQ(paramReader.HasType(), entry.HasType());
+            if (paramReader.IsVoid())
+            {
+                EXPECT_EQ(ELEMENT_TYPE_VOID, entry.m_typeKind);
+            }
+            else if (paramReader.IsTypedByRef())
+            {
+                EXPECT_EQ(ELEMENT_TYPE_TYPEDBYREF, entry.m_typeKind);
+            }
+            else
+            {
+                auto typeReader = paramReader.GetTypeReader();
+                auto kind = typeReader.GetTypeKind();
+                EXPECT_EQ(kind, entry.m_typeKind);
+                EXPECT_EQ(typeReader.GetSigSpan().begin(), entry.GetTypeSpan().begin());
+                EXPECT_EQ(typeReader.GetSigSpan().end(), entry.GetTypeSpan().end());
+                EXPECT_EQ(kind, entry.GetTypeReader().GetTypeKind());
+                if (kind == ELEMENT_TYPE_CLASS || kind == ELEMENT_TYPE_VALUETYPE || kind == ELEMENT_TYPE_GENERICINST)
+                {
+                    EXPECT_EQ(typeReader.GetToken(), entry.m_token);
+                }
+            }
+        }
+        EXPECT_FALSE(reader.MoveNextParam());
+    }
+}
+
+TEST(SignatureIndex, IndexesLocalsAndMethodSpecs) {
+    std::vector<COR_SIGNATURE> localsSig =
+    {
+        0x07, 0x03,
+        0x45, 0x10, 0x08,           // pinned int32&
+        0x1d, 0x0e,                 // string[]
+        0x15, 0x12, 0x49, 0x01, 0x08 // List<int32>
+    };
+
+    SignatureIndex locals = SignatureIndex::IndexLocals(localsSig);
+    ASSERT_EQ(3, locals.GetCount());
+    EXPECT_TRUE(locals[0].m_isPinned);
+    EXPECT_TRUE(locals[0].m_isByRef);
+    EXPECT_EQ(ELEMENT_TYPE_I4, locals[0].m_typeKind);
+    EXPECT_EQ(localsSig.data() + 2, locals[0].m_start);
+    EXPECT_EQ(localsSig.data() + 4, locals[0].m_typeStart);
+    EXPECT_EQ(ELEMENT_TYPE_SZARRAY, locals[1].m_typeKind);
+    EXPECT_FALSE(locals[1].m_isPinned);
+    EXPECT_EQ(ELEMENT_TYPE_GENERICINST, locals[2].m_typeKind);
+    EXPECT_EQ(0x01000012, locals[2].m_token);
+    EXPECT_EQ(localsSig.data() + 2, locals.GetEntriesSpan().begin());
+    EXPECT_EQ(localsSig.data() + localsSig.size(), locals.GetEntriesSpan().end());
+
+    std::vector<COR_SIGNATURE> int32Sig = { ELEMENT_TYPE_I4 };
+    std::vector<COR_SIGNATURE> expected = localsSig;
+    expected[1] = 0x04;
+    expected.push_back(0x08);
+    EXPECT_EQ(expected, locals.AppendLocals({ int32Sig }));
+    EXPECT_EQ(expected, LocalsSignatureReader(localsSig).AppendLocals({ int32Sig }));
+
+    // Zip<string, int64, IObservable<string>>
+    std::vector<COR_SIGNATURE> specSig = { 0x0a, 0x03, 0x0e, 0x0a, 0x15, 0x12, 0x35, 0x01, 0x0e };
+    SignatureIndex spec = SignatureIndex::IndexMethodSpec(specSig);
+    auto spans = MethodSpecSignatureReader::GetTypeArgSpans(specSig);
+    ASSERT_EQ(spans.size(), spec.GetCount());
+    for (size_t i = 0; i < spans.size(); i++)
+    {
+        EXPECT_EQ(spans[i].begin(), spec[i].GetTypeSpan().begin());
+        EXPECT_EQ(spans[i].end(), spec[i].GetTypeSpan().end());
+    }
+    EXPECT_EQ(0x0100000d, spec[2].m_token);
+
+    EXPECT_THROW(SignatureIndex::IndexLocals(specSig), std::domain_error);
+    EXPECT_THROW(SignatureIndex::IndexMethodSpec(localsSig), std::domain_error);
+    EXPECT_THROW(SignatureIndex::IndexLocals(SignatureBlob(localsSig.data(), localsSig.size() - 1)), std::domain_error);
+}
+
+TEST(SignatureIndex, FailsOnBadBlobs) {
+    std::vector<std::vector<COR_SIGNATURE>> sigs =
+    {
+        { 0x00, 0x02, 0x01, 0x0e },         // missing param
+        { 0x00, 0x01, 0x01, 0x01 },         // void param
+        { 0x00, 0x01, 0x01, 0x45, 0x08 },   // pinned param
+        { 0x06, 0x08 }                      // field signature
+    };
+
+    for (auto& sig : sigs)
+    {
+        EXPECT_THROW(SignatureIndex::IndexMethod(sig), std::domain_error);
+    }
+}
+
+// Run with --gtest_also_run_disabled_tests
+TEST(SignatureIndex, DISABLED_BenchmarkRandomParamAccess) {
+    const int c_iterations = 100000;
+
+    // Getting at each parameter of a call's signature, as when moving arguments into locals.
+    auto sigs = MakeSkipBenchmarkSignatures();
+    size_t accesses = 0;
+    for (auto& sig : sigs)
+    {
+        accesses += MethodSignatureReader(sig).ParamCount() + 1;
+    }
+    accesses *= c_iterations;
+
+    int readerKinds = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < c_iterations; i++)
+    {
+        for (auto& sig : sigs)
+        {
+            ULONG paramCount = MethodSignatureReader(sig).ParamCount();
+            for (ULONG k = 0; k <= paramCount; k++)
+            {
+                MethodSignatureReader reader(sig);
+                for (ULONG p = 0; p <= k; p++)
+                {
+                    reader.MoveNextParam();
+                }
+                auto paramReader = reader.GetParamReader();
+                readerKinds += paramReader.HasType() ? paramReader.GetTypeReader().GetTypeKind() : ELEMENT_TYPE_VOID;
+            }
+        }
+    }
+    auto readerNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    int indexKinds = 0;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < c_iterations; i++)
+    {
+        for (auto& sig : sigs)
+        {
+            SignatureIndex index = SignatureIndex::IndexMethod(sig);
+            for (size_t k = 0; k < index.GetCount(); k++)
+            {
+                indexKinds += index[k].HasType() ? index[k].m_typeKind : ELEMENT_TYPE_VOID;
+            }
+        }
+    }
+    auto indexNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(readerKinds, indexKinds);
+    std::cout << "Reader walk: " << readerNs / accesses << "ns/param" << std::endl;
+    std::cout << "Index:       " << indexNs / accesses << "ns/param (including building the index)" << std::endl;
+}
@@ -0,0 +1,354 @@
+#include "pch.h"
+#include "Store.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+STDAPI_(int32_t) GetStoreEventCount();
+STDAPI_(void) ReadStoreEvent(int32_t index, byte** buffer, int32_t* size);
+STDAPI_(int32_t) ReadStoreEvents(int32_t startIndex, int32_t maxCount, byte** buffers, int32_t* sizes);
+
+class RecordReader
+{
+public:
+    RecordReader(const simplespan<byte>& record) : m_ptr(record.begin()), m_end(record.end())
+    {
+    }
+
+    uint32_t Read32()
+    {
+        uint32_t value;
+        ReadBytes(&value, sizeof value);
+        return value;
+    }
+
+    uint64_t Read64()
+    {
+        uint64_t value;
+        ReadBytes(&value, sizeof value);
+        return value;
+    }
+
+    uint32_t ReadVarUInt32()
+    {
+        uint32_t value = 0;
+        for (int shift = 0; ; shift += 7)
+        {
+            byte b;
+            ReadBytes(&b, 1);
+            value |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if (!(b & 0x80))
+            {
+                return value;
+            }
+        }
+    }
+
+    std::string ReadString()
+    {
+        uint32_t length = ReadVarUInt32();
+        std::string s(length, '\0');
+        ReadBytes(s.data(), length);
+        return s;
+    }
+
+    bool AtEnd() const { return m_ptr == m_end; }
+
+private:
+    void ReadBytes(void* pDest, size_t count)
+    {
+        if (m_ptr + count > m_end)
+        {
+            throw std::out_of_range("RecordReader: read past end of record");
+        }
+        memcpy(pDest, m_ptr, count);
+        m_ptr += count;
+    }
+
+    const byte* m_ptr;
+    const byte* m_end;
+};
+
+// Checks that the record is a StringDefined record and returns the ID it defines.
+static uint32_t ExpectStringDefined(const simplespan<byte>& record, const std::string& expected)
+{
+    RecordReader reader(record);
+    EXPECT_EQ(reader.Read32(), 4u); // StringDefined
+    uint32_t id = reader.ReadVarUInt32();
+    EXPECT_EQ(reader.ReadString(), expected);
+    EXPECT_TRUE(reader.AtEnd());
+    return id;
+}
+
+TEST(Store, WritesMethodInfoRecord) {
+    Store store;
+    store.AddMethodInfo(7, 0x123456789, 0x06000042, L"My.Namespace.Type", L"Method");
+
+    ASSERT_EQ(store.GetEventCount(), 3);
+    uint32_t typeNameId = ExpectStringDefined(store.ReadEvent(0), "My.Namespace.Type");
+    uint32_t methodNameId = ExpectStringDefined(store.ReadEvent(1), "Method");
+    EXPECT_NE(typeNameId, methodNameId);
+
+    RecordReader reader(store.ReadEvent(2));
+    EXPECT_EQ(reader.Read32(), 1u); // MethodInfo
+    EXPECT_EQ(reader.Read32(), 7u);
+    EXPECT_EQ(reader.Read64(), 0x123456789u);
+    EXPECT_EQ(reader.Read32(), 0x06000042u);
+    EXPECT_EQ(reader.ReadVarUInt32(), typeNameId);
+    EXPECT_EQ(reader.ReadVarUInt32(), methodNameId);
+    EXPECT_TRUE(reader.AtEnd());
+}
+
+TEST(Store, WritesEachRecordKind) {
+    Store store;
+    store.AddModuleInfo(1, L"C:\\app\\App.dll", L"App");
+    store.AddInstrumentationInfo(3, 2, 0x10, L"System.Reactive.Linq.Observable.Select");
+    store.AddInstrumentationInfo(4, 2, 0x20, L"");
+    store.MethodInstrumentationDone(2);
+
+    ASSERT_EQ(store.GetEventCount(), 6);
+
+    RecordReader module(store.ReadEvent(0));
+    EXPECT_EQ(module.Read32(), 0u);
+    EXPECT_EQ(module.Read64(), 1u);
+    EXPECT_EQ(module.ReadString(), "C:\\app\\App.dll");
+    EXPECT_EQ(module.ReadString(), "App");
+    EXPECT_TRUE(module.AtEnd());
+
+    uint32_t selectId = ExpectStringDefined(store.ReadEvent(1), "System.Reactive.Linq.Observable.Select");
+    RecordReader call(store.ReadEvent(2));
+    EXPECT_EQ(call.Read32(), 2u);
+    EXPECT_EQ(call.Read32(), 3u);
+    EXPECT_EQ(call.Read32(), 2u);
+    EXPECT_EQ(call.Read32(), 0x10u);
+    EXPECT_EQ(call.ReadVarUInt32(), selectId);
+    EXPECT_TRUE(call.AtEnd());
+
+    uint32_t emptyId = ExpectStringDefined(store.ReadEvent(3), "");
+    RecordReader emptyNameCall(store.ReadEvent(4));
+    emptyNameCall.Read32();
+    emptyNameCall.Read32();
+    emptyNameCall.Read32();
+    emptyNameCall.Read32();
+    EXPECT_EQ(emptyNameCall.ReadVarUInt32(), emptyId);
+    EXPECT_TRUE(emptyNameCall.AtEnd());
+
+    RecordReader done(store.ReadEvent(5));
+    EXPECT_EQ(done.Read32(), 3u);
+    EXPECT_EQ(done.Read32(), 2u);
+    EXPECT_TRUE(done.AtEnd());
+}
+
+TEST(Store, DefinesEachStringOnce) {
+    Store store;
+    store.AddInstrumentationInfo(1, 1, 0x10, L"System.Reactive.Linq.Observable.Select");
+    store.AddInstrumentationInfo(2, 1, 0x20, L"System.Reactive.Linq.Observable.Where");
+    store.AddInstrumentationInfo(3, 1, 0x30, L"System.Reactive.Linq.Observable.Select");
+
+    ASSERT_EQ(store.GetEventCount(), 5);
+    uint32_t selectId = ExpectStringDefined(store.ReadEvent(0), "System.Reactive.Linq.Observable.Select");
+    uint32_t whereId = ExpectStringDefined(store.ReadEvent(2), "System.Reactive.Linq.Observable.Where");
+
+    RecordReader thirdCall(store.ReadEvent(4));
+    EXPECT_EQ(thirdCall.Read32(), 2u);
+    EXPECT_EQ(thirdCall.Read32(), 3u);
+    thirdCall.Read32();
+    thirdCall.Read32();
+    EXPECT_EQ(thirdCall.ReadVarUInt32(), selectId);
+    EXPECT_NE(selectId, whereId);
+}
+
+TEST(Store, EncodesStringsAsUtf8) {
+    Store store;
+    store.AddInstrumentationInfo(1, 1, 0, L"Caf\u00e9.\u65e5\u672c.\U0001F600");
+
+    ExpectStringDefined(store.ReadEvent(0), "Caf\xc3\xa9.\xe6\x97\xa5\xe6\x9c\xac.\xf0\x9f\x98\x80");
+}
+
+TEST(Store, DefinesStringsBeforeConcurrentUses) {
+    const int c_threads = 8;
+    const int c_callsPerThread = 5000;
+    Store store;
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < c_threads; t++)
+    {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < c_callsPerThread; i++)
+            {
+                store.AddInstrumentationInfo(t * c_callsPerThread + i, t, i, L"Method" + std::to_wstring(i % 100));
+            }
+        });
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    // IDs are allocated in the order strings are defined, so every reference must be to an
+    // ID below the number of definitions seen so far.
+    uint32_t definitions = 0;
+    for (int32_t i = 0; i < store.GetEventCount(); i++)
+    {
+        RecordReader reader(store.ReadEvent(i));
+        if (reader.Read32() == 4)
+        {
+            uint32_t id = reader.ReadVarUInt32();
+            ASSERT_EQ(id, definitions);
+            definitions++;
+        }
+        else
+        {
+            reader.Read32();
+            reader.Read32();
+            reader.Read32();
+            ASSERT_LT(reader.ReadVarUInt32(), definitions);
+        }
+    }
+
+    EXPECT_EQ(definitions, 100u);
+}
+
+// The serializer that Store used to use, kept for comparison.
+class StringStreamEventRecord
+{
+public:
+    StringStreamEventRecord(uint32_t eventId) { Write32(eventId); }
+
+    void Write64(uint64_t value) { m_buffer.write(reinterpret_cast<byte*>(&value), sizeof value); }
+    void Write32(uint32_t value) { m_buffer.write(reinterpret_cast<byte*>(&value), sizeof value); }
+
+    void Write(const std::wstring& s)
+    {
+        Write32(static_cast<uint32_t>(s.length()));
+        m_buffer.write(reinterpret_cast<const byte*>(s.data()), static_cast<std::streamsize>(s.length()) * sizeof(wchar_t));
+    }
+
+    std::vector<byte> Get() const
+    {
+        std::basic_string<byte> str = m_buffer.str();
+        return std::vector<byte>(str.begin(), str.end());
+    }
+
+private:
+    std::basic_stringstream<byte> m_buffer;
+};
+
+// Per-record cost for typical type/method name lengths. Run with --gtest_also_run_disabled_tests.
+TEST(Store, DISABLED_BenchmarkMethodInfoRecord) {
+    const int c_records = 500000;
+    const std::wstring owningTypeName = L"MyCompany.Trading.Pricing.QuoteStreamAggregator+<>c__DisplayClass12_0";
+    const std::wstring methodName = L"<SubscribeToQuotes>b__3";
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::vector<byte>> legacyRecords;
+    legacyRecords.reserve(c_records);
+    for (int i = 0; i < c_records; i++)
+    {
+        StringStreamEventRecord r(1);
+        r.Write32(i);
+        r.Write64(0x7ff812340000);
+        r.Write32(0x06000000 + i);
+        r.Write(owningTypeName);
+        r.Write(methodName);
+        legacyRecords.push_back(r.Get());
+    }
+    auto legacyNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    Store store;
+    for (int i = 0; i < c_records; i++)
+    {
+        store.AddMethodInfo(i, 0x7ff812340000, 0x06000000 + i, owningTypeName, methodName);
+    }
+    auto storeNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    size_t legacyBytes = 0;
+    for (auto& record : legacyRecords)
+    {
+        legacyBytes += record.size();
+    }
+
+    size_t storeBytes = 0;
+    for (int32_t i = 0; i < store.GetEventCount(); i++)
+    {
+        storeBytes += store.ReadEvent(i).length();
+    }
+
+    std::cout << "stringstream serialization: " << legacyNs / c_records << "ns/record, "
+        << static_cast<double>(legacyBytes) / c_records << " bytes/record; "
+        << "store: " << storeNs / c_records << "ns/record, "
+        << static_cast<double>(storeBytes) / c_records << " bytes/record" << std::endl;
+}
+
+TEST(StoreAccess, ReadStoreEventsRejectsInvalidArguments) {
+    g_Store.MethodInstrumentationDone(1);
+    int32_t count = GetStoreEventCount();
+    ASSERT_GT(count, 0);
+
+    byte* buffers[4] = {};
+    int32_t sizes[4] = {};
+    EXPECT_EQ(0, ReadStoreEvents(-1, 4, buffers, sizes));
+    EXPECT_EQ(0, ReadStoreEvents(0, 0, buffers, sizes));
+    EXPECT_EQ(0, ReadStoreEvents(0, -1, buffers, sizes));
+    EXPECT_EQ(0, ReadStoreEvents(0, 4, nullptr, sizes));
+    EXPECT_EQ(0, ReadStoreEvents(0, 4, buffers, nullptr));
+    EXPECT_EQ(0, ReadStoreEvents(count, 4, buffers, sizes));
+    EXPECT_EQ(nullptr, buffers[0]);
+    EXPECT_EQ(0, sizes[0]);
+
+    EXPECT_EQ(1, ReadStoreEvents(count - 1, 4, buffers, sizes));
+    byte* buffer;
+    int32_t size;
+    ReadStoreEvent(count - 1, &buffer, &size);
+    EXPECT_EQ(buffer, buffers[0]);
+    EXPECT_EQ(size, sizes[0]);
+}
+
+// Replaying the store the way the support assembly used to, one call per event copying each
+// record out, against fetching the record pointers in batches. Run with
+// --gtest_also_run_disabled_tests.
+TEST(StoreAccess, DISABLED_BenchmarkReplay) {
+    const int c_records = 500000;
+    const int c_batchSize = 256;
+    int32_t startIndex = GetStoreEventCount();
+    for (int i = 0; i < c_records; i++)
+    {
+        g_Store.AddMethodInfo(i, 0x7ff812340000, 0x06000000 + i,
+            L"MyCompany.Trading.Pricing.QuoteStreamAggregator+<>c__DisplayClass12_0", L"<SubscribeToQuotes>b__3");
+    }
+    int32_t endIndex = GetStoreEventCount();
+
+    size_t perEventBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int32_t i = startIndex; i < endIndex; i++)
+    {
+        byte* buffer;
+        int32_t size;
+        ReadStoreEvent(i, &buffer, &size);
+        std::vector<byte> copy(buffer, buffer + size);
+        perEventBytes += copy.size();
+    }
+    auto perEventNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    size_t batchBytes = 0;
+    start = std::chrono::steady_clock::now();
+    byte* buffers[c_batchSize];
+    int32_t sizes[c_batchSize];
+    for (int32_t i = startIndex; i < endIndex; )
+    {
+        int32_t count = ReadStoreEvents(i, std::min(c_batchSize, endIndex - i), buffers, sizes);
+        for (int32_t j = 0; j < count; j++)
+        {
+            batchBytes += sizes[j];
+        }
+        i += count;
+    }
+    auto batchNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(perEventBytes, batchBytes);
+    std::cout << "per-event copy: " << perEventNs / c_records << "ns/event; "
+        << "batches of " << c_batchSize << ": " << batchNs / c_records << "ns/event" << std::endl;
+}
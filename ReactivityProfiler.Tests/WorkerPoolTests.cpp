@@ -0,0 +1,23 @@
+#include "pch.h"
+#include "workerpool.h"
+
+TEST(WorkerPool, RunsAllQueuedWork) {
+    std::atomic_int count = 0;
+    std::promise<void> allDone;
+    {
+        worker_pool pool(4);
+        for (int i = 0; i < 1000; i++)
+        {
+            pool.enqueue([&] {
+                if (++count == 1000)
+                {
+                    allDone.set_value();
+                }
+            });
+        }
+
+        allDone.get_future().wait();
+    }
+
+    EXPECT_EQ(count, 1000);
+}
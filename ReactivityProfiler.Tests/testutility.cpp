@@ -1,6 +1,8 @@
 #include "pch.h"
 #include "testutility.h"
 
+#include <random>
+
 std::ostream& operator<< (std::ostream& stm, const std::vector<COR_SIGNATURE>& vec)
 {
     stm << '[';
@@ -17,3 +19,75 @@ std::ostream& operator<< (std::ostream& stm, const std::vector<COR_SIGNATURE>& v
     stm << ']';
     return stm;
 }
+
+std::vector<BYTE> MakeTinyMethodImage(const std::vector<BYTE>& code)
+{
+    std::vector<BYTE> image;
+    image.push_back(static_cast<BYTE>((code.size() << 2) | CorILMethod_TinyFormat));
+    image.insert(image.end(), code.begin(), code.end());
+    return image;
+}
+
+std::vector<BYTE> MakeFatMethodImage(const std::vector<BYTE>& code, const std::vector<TestExceptionClause>& clauses)
+{
+    IMAGE_COR_ILMETHOD_FAT header = {};
+    header.Flags = CorILMethod_FatFormat | (clauses.empty() ? 0 : CorILMethod_MoreSects);
+    header.Size = 3;
+    header.MaxStack = 8;
+    header.CodeSize = static_cast<DWORD>(code.size());
+
+    std::vector<BYTE> image(sizeof(header));
+    memcpy(image.data(), &header, sizeof(header));
+    image.insert(image.end(), code.begin(), code.end());
+
+    if (!clauses.empty())
+    {
+        image.resize((image.size() + 3) & ~3);
+
+        auto append = [&image](ULONG value) {
+            BYTE bytes[sizeof(value)];
+            memcpy(bytes, &value, sizeof(value));
+            image.insert(image.end(), std::begin(bytes), std::end(bytes));
+        };
+
+        ULONG dataSize = static_cast<ULONG>(clauses.size() * 24 + 4);
+        append((dataSize << 8) | CorILMethod_Sect_FatFormat | CorILMethod_Sect_EHTable);
+        for (auto& clause : clauses)
+        {
+            append(clause.flags);
+            append(clause.tryOffset);
+            append(clause.tryLength);
+            append(clause.handlerOffset);
+            append(clause.handlerLength);
+            append(clause.classTokenOrFilterOffset);
+        }
+    }
+
+    return image;
+}
+
+std::vector<std::vector<BYTE>> GenerateFuzzInputs(int count, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::vector<std::vector<BYTE>> inputs(count);
+    for (auto& input : inputs)
+    {
+        input.resize(16 + random() % 2048);
+        for (auto& b : input)
+        {
+            b = static_cast<BYTE>(random());
+        }
+    }
+    return inputs;
+}
+
+std::string Describe(const std::vector<BYTE>& bytes)
+{
+    std::ostringstream stm;
+    stm << std::hex;
+    for (BYTE b : bytes)
+    {
+        stm << static_cast<unsigned>(b) << ' ';
+    }
+    return stm.str();
+}
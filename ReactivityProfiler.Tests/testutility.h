@@ -2,3 +2,59 @@
 
 // write vector to an output stream
 std::ostream& operator<< (std::ostream& stm, const std::vector<COR_SIGNATURE>& vec);
+
+// exception clause for a method image built by MakeFatMethodImage
+struct TestExceptionClause
+{
+    CorExceptionFlag flags;
+    ULONG tryOffset;
+    ULONG tryLength;
+    ULONG handlerOffset;
+    ULONG handlerLength;
+    ULONG classTokenOrFilterOffset;
+};
+
+// build method images (header, code and any exception clauses) to read with Method
+std::vector<BYTE> MakeTinyMethodImage(const std::vector<BYTE>& code);
+std::vector<BYTE> MakeFatMethodImage(const std::vector<BYTE>& code, const std::vector<TestExceptionClause>& clauses = {});
+
+// random inputs for the FuzzInput based tests, and a way to show one that fails
+std::vector<std::vector<BYTE>> GenerateFuzzInputs(int count, unsigned seed);
+std::string Describe(const std::vector<BYTE>& bytes);
+
+// Supplies the choices made while generating test data (methods, signatures) from a stream of
+// bytes; once the input runs out every choice is zero, so generators must treat zero as a
+// valid choice that ends up somewhere finite.
+class FuzzInput
+{
+public:
+    FuzzInput(const BYTE* pData, size_t size) : m_pData(pData), m_size(size), m_position(0)
+    {
+    }
+
+    BYTE NextByte()
+    {
+        return m_position < m_size ? m_pData[m_position++] : 0;
+    }
+
+    // A value in [0, limit)
+    ULONG Next(ULONG limit)
+    {
+        ULONG value = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            value = (value << 8) | NextByte();
+        }
+        return limit == 0 ? 0 : value % limit;
+    }
+
+    bool NextBool()
+    {
+        return (NextByte() & 1) != 0;
+    }
+
+private:
+    const BYTE* m_pData;
+    size_t m_size;
+    size_t m_position;
+};
@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "ILCallScanner.h"
+#include "Operations.h"
+
+namespace Instrumentation
+{
+    namespace
+    {
+        const BYTE c_unknownOpcode = 0xFF;
+
+        // Operand sizes indexed by [0][opcode] for single byte opcodes and [1][last byte] for
+        // two byte ones, built from the same table that Method uses to read instructions.
+        typedef std::array<std::array<BYTE, 256>, 2> OperandSizeTable;
+
+        constexpr OperandSizeTable BuildOperandSizeTable()
+        {
+            OperandSizeTable table = {};
+            for (size_t op2 = 0; op2 < 256; op2++)
+            {
+                for (size_t i = 0; i < 2; i++)
+                {
+                    const OperationDetails& details = Operations::GetDetails(i == 0 ? REFPRE : STP1, static_cast<BYTE>(op2));
+                    table[i][op2] = details.canonicalName == CEE_ILLEGAL ? c_unknownOpcode : static_cast<BYTE>(details.operandSize);
+                }
+            }
+            return table;
+        }
+
+        constexpr OperandSizeTable c_operandSizes = BuildOperandSizeTable();
+        constexpr BYTE c_call = Operations::GetDetails(CEE_CALL).op2;
+        constexpr BYTE c_callvirt = Operations::GetDetails(CEE_CALLVIRT).op2;
+        constexpr BYTE c_switch = Operations::GetDetails(CEE_SWITCH).op2;
+
+        ULONG ReadULong(const BYTE* p)
+        {
+            ULONG value;
+            memcpy(&value, p, sizeof(value));
+            return value;
+        }
+    }
+
+    bool ILCallScanner::AnyCall(const IMAGE_COR_ILMETHOD* pMethod, const std::function<bool(mdToken)>& predicate)
+    {
+        const BYTE* pCode;
+        ULONG codeSize;
+        auto fatImage = static_cast<const COR_ILMETHOD_FAT*>(&pMethod->Fat);
+        if (fatImage->IsFat())
+        {
+            pCode = fatImage->GetCode();
+            codeSize = fatImage->GetCodeSize();
+        }
+        else
+        {
+            auto tinyImage = static_cast<const COR_ILMETHOD_TINY*>(&pMethod->Tiny);
+            pCode = tinyImage->GetCode();
+            codeSize = tinyImage->GetCodeSize();
+        }
+
+        ULONG position = 0;
+        while (position < codeSize)
+        {
+            BYTE op = pCode[position++];
+            BYTE operandSize;
+            if (op == STP1)
+            {
+                if (position == codeSize)
+                {
+                    return true;
+                }
+
+                operandSize = c_operandSizes[1][pCode[position++]];
+            }
+            else
+            {
+                operandSize = c_operandSizes[0][op];
+            }
+
+            if (operandSize == c_unknownOpcode || codeSize - position < operandSize)
+            {
+                ATLTRACE(_T("Unable to decode IL at offset %X"), position);
+                return true;
+            }
+
+            if (op == c_call || op == c_callvirt)
+            {
+                if (predicate(static_cast<mdToken>(ReadULong(pCode + position))))
+                {
+                    return true;
+                }
+            }
+            else if (op == c_switch)
+            {
+                ULONG targetCount = ReadULong(pCode + position);
+                if ((codeSize - position - operandSize) / sizeof(ULONG) < targetCount)
+                {
+                    return true;
+                }
+
+                position += targetCount * sizeof(ULONG);
+            }
+
+            position += operandSize;
+        }
+
+        return false;
+    }
+}
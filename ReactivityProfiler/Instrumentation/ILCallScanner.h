@@ -0,0 +1,16 @@
+#pragma once
+
+namespace Instrumentation
+{
+    /// <summary>Decodes just enough of a method's raw IL to find the methods it calls, so that
+    /// methods with nothing to instrument can be passed over without building a <c>Method</c>.</summary>
+    class ILCallScanner
+    {
+    public:
+        /// <summary>Calls <paramref name="predicate"/> with the token of each call/callvirt instruction
+        /// in the method body, in order, until it returns true.</summary>
+        /// <returns>True if the predicate returned true, or if the IL could not be decoded (so that
+        /// the caller falls back to reading the method in full); false otherwise.</returns>
+        static bool AnyCall(const IMAGE_COR_ILMETHOD* pMethod, const std::function<bool(mdToken)>& predicate);
+    };
+}
@@ -10,6 +10,8 @@ namespace Instrumentation
 		m_operand = 0;
 		m_offset = -1;
 		m_isBranch = false;
+		m_firstBranch = 0;
+		m_branchCount = 0;
 		m_origOffset = -1;
 	}
 
@@ -18,6 +20,8 @@ namespace Instrumentation
 	{
 		m_offset = -1;
 		m_isBranch = false;
+		m_firstBranch = 0;
+		m_branchCount = 0;
 		m_origOffset = -1;
 	}
 
@@ -27,6 +31,8 @@ namespace Instrumentation
 		m_operand = 0;
 		m_offset = -1;
 		m_isBranch = false;
+		m_firstBranch = 0;
+		m_branchCount = 0;
 		m_origOffset = -1;
 	}
 
@@ -38,9 +44,8 @@ namespace Instrumentation
 			m_operation = rhs.m_operation;
 			m_operand = rhs.m_operand;
 			m_isBranch = rhs.m_isBranch;
-			m_branchOffsets = rhs.m_branchOffsets;
-			m_branches = rhs.m_branches;
-			m_joins = rhs.m_joins;
+			m_firstBranch = rhs.m_firstBranch;
+			m_branchCount = rhs.m_branchCount;
 			m_origOffset = rhs.m_origOffset;
 		}
 		return *this;
@@ -54,14 +59,9 @@ namespace Instrumentation
 				return false;
 			if (m_operand != rhs.m_operand)
 				return false;
-			if (m_branches.size() != rhs.m_branches.size())
+			// The targets themselves are held by the owning Method, so only their number is compared.
+			if (m_branchCount != rhs.m_branchCount)
 				return false;
-			auto it2 = rhs.m_branches.begin();
-			for (auto it = m_branches.begin(); it != m_branches.end(); ++it, ++it2)
-			{
-				if (!(*it)->Equivalent(*(*it2)))
-					return false;
-			}
 		}
 		return true;
 	}
@@ -18,6 +18,7 @@ namespace Instrumentation {
 	public:
 		Instruction(CanonicalName operation, ULONGLONG operand);
 		explicit Instruction(CanonicalName operation);
+		Instruction(const Instruction& b) = default; // the arena's blocks hold instructions by value
 
 		protected:
 		Instruction();
@@ -34,19 +35,76 @@ namespace Instrumentation {
 		ULONGLONG m_operand;
 		bool m_isBranch;
 
-		std::vector<long> m_branchOffsets;
-		InstructionReferenceList m_branches;
-		InstructionReferenceList m_joins;
+		// The targets of a branch (one) or switch (any number), as a range of entries in the
+		// branch table of the owning Method.
+		ULONG m_firstBranch;
+		ULONG m_branchCount;
 
 		long m_origOffset;
 
         long length() const
         {
-            return Operations::m_mapNameOperationDetails[m_operation].totalLength();
+            return Operations::GetDetails(m_operation).totalLength();
         }
 
 	public:
 
 		friend class Method;
+		friend class InstructionArena;
+	};
+
+	/// <summary>A branch target, held in a <c>Method</c>'s branch table.</summary>
+	struct BranchTarget
+	{
+		LONG m_offset; // relative to the end of the branch instruction (or switch table)
+		Instruction* m_instruction; // resolved from the offset when the method is read
+	};
+
+	typedef std::vector<BranchTarget> BranchTargetList;
+
+	/// <summary>Owns the <c>Instruction</c>s of a <c>Method</c>.</summary>
+	/// <remarks>Instructions are allocated in blocks, so reading a method body takes a handful of
+	/// allocations rather than one per instruction. They keep their address for the life of the arena,
+	/// so can be referred to by pointer.</remarks>
+	class InstructionArena
+	{
+	public:
+		/// <summary>Make room for at least <paramref name="count"/> more instructions in one block.</summary>
+		void Reserve(size_t count)
+		{
+			if (m_blocks.empty() || m_blocks.back().capacity() - m_blocks.back().size() < count)
+			{
+				AddBlock(count);
+			}
+		}
+
+		Instruction* Allocate(const Instruction& instruction)
+		{
+			if (m_blocks.empty() || m_blocks.back().size() == m_blocks.back().capacity())
+			{
+				AddBlock(m_allocatedCount);
+			}
+
+			m_allocatedCount++;
+			m_blocks.back().push_back(instruction);
+			return &m_blocks.back().back();
+		}
+
+		Instruction* Allocate()
+		{
+			return Allocate(Instruction());
+		}
+
+	private:
+		void AddBlock(size_t capacity)
+		{
+			const size_t c_minimumBlockCapacity = 16;
+			m_blocks.emplace_back();
+			m_blocks.back().reserve(capacity > c_minimumBlockCapacity ? capacity : c_minimumBlockCapacity);
+		}
+
+		// A block is never allowed to grow beyond its reserved capacity, so never moves its contents.
+		std::vector<std::vector<Instruction>> m_blocks;
+		size_t m_allocatedCount = 0;
 	};
 }
\ No newline at end of file
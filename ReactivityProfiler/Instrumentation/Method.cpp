@@ -5,6 +5,40 @@
 
 namespace Instrumentation
 {
+	namespace
+	{
+		/// <summary>How an operation is written: just the parts of its <c>OperationDetails</c>
+		/// that <c>WriteMethod</c> needs, packed small so the table stays in cache</summary>
+		struct Encoding
+		{
+			BYTE opcode[2];
+			BYTE opcodeLength; // 0 for pseudo-instructions (code labels), which aren't written
+			BYTE operandSize;
+		};
+
+		typedef std::array<Encoding, std::size(OperationTables::c_operationDetails)> EncodingTable;
+
+		constexpr EncodingTable BuildEncodingTable()
+		{
+			EncodingTable table = {};
+			for (const OperationDetails& details : OperationTables::c_operationDetails)
+			{
+				Encoding& encoding = table[details.canonicalName];
+				if (details.op1 == REFPRE)
+				{
+					encoding = { { details.op2, 0 }, 1, static_cast<BYTE>(details.operandSize) };
+				}
+				else if (details.op1 == STP1)
+				{
+					encoding = { { details.op1, details.op2 }, 2, static_cast<BYTE>(details.operandSize) };
+				}
+			}
+			return table;
+		}
+
+		constexpr EncodingTable c_encodings = BuildEncodingTable();
+	}
+
     Method::Method() : Method(nullptr)
     {
     }
@@ -15,6 +49,8 @@ namespace Instrumentation
 		m_header.Size = 3;
 		m_header.Flags = CorILMethod_FatFormat;
 		m_header.MaxStack = 8;
+		m_compacted = false;
+		m_layout = {};
 
 		ReadMethod(pMethod);
 	}
@@ -26,7 +62,7 @@ namespace Instrumentation
 	/// <summary>Read the full method from the supplied buffer.</summary>
 	void Method::ReadMethod(const IMAGE_COR_ILMETHOD* pMethod)
 	{
-        BYTE justRet[] = { Operations::m_mapNameOperationDetails[CEE_RET].op2 };
+        BYTE justRet[] = { Operations::GetDetails(CEE_RET).op2 };
         BYTE* pCode;
         if (!pMethod)
         {
@@ -58,121 +94,134 @@ namespace Instrumentation
 	}
 
 	/// <summary>Write the method to a supplied buffer</summary>
-	/// <remarks><para>The buffer must be of the size supplied by <c>GetMethodSize</c>.</para>
-	/// <para>Currently only write methods with 'Fat' headers and 'Fat' Sections - simpler.</para>
+	/// <remarks><para>The buffer must be of the size supplied by <c>GetMethodSize</c>, which also works out
+	/// where each part of the method goes.</para>
+	/// <para>Currently only write methods with 'Fat' headers and 'Fat' Sections - simpler -
+	/// unless <c>Compact</c> has been called and the method qualifies for a 'Tiny' header.</para>
 	/// <para>The buffer will normally be allocated by a call to <c>IMethodMalloc::Alloc</c></para></remarks>
 	void Method::WriteMethod(IMAGE_COR_ILMETHOD* pMethod)
 	{
-		BYTE* pCode;
-		auto fatImage = static_cast<COR_ILMETHOD_FAT*>(&pMethod->Fat);
+		_ASSERTE(m_queuedInsertions.empty());
+		_ASSERTE(m_layout.m_size != 0);
 
-		m_header.Flags &= ~CorILMethod_MoreSects;
-		if (m_exceptions.size() > 0)
+		auto pImage = reinterpret_cast<BYTE*>(pMethod);
+		if (m_layout.m_isTiny)
 		{
-			m_header.Flags |= CorILMethod_MoreSects;
+			auto tinyImage = static_cast<COR_ILMETHOD_TINY*>(&pMethod->Tiny);
+			tinyImage->Flags_CodeSize = static_cast<BYTE>(CorILMethod_TinyFormat | (m_header.CodeSize << (CorILMethod_FormatShift - 1)));
+		}
+		else
+		{
+			memcpy(pImage, &m_header, m_layout.m_headerSize);
 		}
 
-		memcpy(fatImage, &m_header, m_header.Size * sizeof(DWORD));
-
-		pCode = fatImage->GetCode();
-
-		SetBuffer(pCode);
-
-		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
+		BYTE* pCode = pImage + m_layout.m_headerSize;
+		for (auto pInstruction : m_instructions)
 		{
-			auto& details = Operations::m_mapNameOperationDetails[(*it)->m_operation];
-			if (details.op1 == REFPRE)
-			{
-				Write<BYTE>(details.op2);
-			}
-			else if (details.op1 == MOOT)
+			const Encoding& encoding = c_encodings[pInstruction->m_operation];
+			switch (encoding.opcodeLength)
 			{
+			case 2:
+				*pCode++ = encoding.opcode[0];
+				*pCode++ = encoding.opcode[1];
+				break;
+			case 1:
+				*pCode++ = encoding.opcode[0];
+				break;
+			default:
 				continue;
 			}
-			else
-			{
-				Write<BYTE>(details.op1);
-				Write<BYTE>(details.op2);
-			}
 
-			switch (details.operandSize)
+			// operands are little-endian, so are the low bytes of m_operand
+			switch (encoding.operandSize)
 			{
-			case Null:
-				break;
 			case Byte:
-				Write<BYTE>(static_cast<BYTE>((*it)->m_operand));
+				memcpy(pCode, &pInstruction->m_operand, Byte);
 				break;
 			case Word:
-				Write<USHORT>(static_cast<USHORT>((*it)->m_operand));
+				memcpy(pCode, &pInstruction->m_operand, Word);
 				break;
 			case Dword:
-				Write<ULONG>(static_cast<ULONG>((*it)->m_operand));
+				memcpy(pCode, &pInstruction->m_operand, Dword);
 				break;
 			case Qword:
-				Write<ULONGLONG>((*it)->m_operand);
+				memcpy(pCode, &pInstruction->m_operand, Qword);
 				break;
 			default:
 				break;
 			}
+			pCode += encoding.operandSize;
 
-			if ((*it)->m_operation == CEE_SWITCH)
+			if (pInstruction->m_operation == CEE_SWITCH)
 			{
-				for (auto offsetIter = (*it)->m_branchOffsets.begin(); offsetIter != (*it)->m_branchOffsets.end(); ++offsetIter)
+				auto pTargets = m_branchTable.data() + pInstruction->m_firstBranch;
+				for (ULONG i = 0; i < pInstruction->m_branchCount; i++)
 				{
-					Write<long>(*offsetIter);
+					LONG offset = pTargets[i].m_offset;
+					memcpy(pCode, &offset, sizeof(offset));
+					pCode += sizeof(offset);
 				}
 			}
 		}
+		_ASSERTE(pCode == pImage + m_layout.m_headerSize + m_header.CodeSize);
 
-		WriteSections();
+		if (m_layout.m_sectionsOffset != 0)
+		{
+			WriteSections(pImage + m_layout.m_sectionsOffset);
+		}
 	}
 
 	/// <summary>Write out the FAT sections</summary>
-	void Method::WriteSections()
+	void Method::WriteSections(BYTE* pSections)
 	{
-		if (m_exceptions.size() > 0)
+		IMAGE_COR_ILMETHOD_SECT_FAT section;
+		section.Kind = CorILMethod_Sect_FatFormat | CorILMethod_Sect_EHTable;
+		section.DataSize = static_cast<unsigned>(m_exceptions.size() * sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT) + sizeof(section));
+		memcpy(pSections, &section, sizeof(section));
+
+		BYTE* pClause = pSections + sizeof(section);
+		for (auto it = m_exceptions.begin(); it != m_exceptions.end(); ++it)
 		{
-			Align<DWORD>();
-			IMAGE_COR_ILMETHOD_SECT_FAT section;
-			section.Kind = CorILMethod_Sect_FatFormat;
-			section.Kind |= CorILMethod_Sect_EHTable;
-			section.DataSize = (m_exceptions.size() * 24) + 4;
-			Write<IMAGE_COR_ILMETHOD_SECT_FAT>(section);
-			for (auto it = m_exceptions.begin(); it != m_exceptions.end(); ++it)
-			{
-				Write<ULONG>((*it)->m_handlerType);
-				Write<long>((*it)->m_tryStart->m_offset);
-				Write<long>((*it)->m_tryEnd->m_offset - (*it)->m_tryStart->m_offset);
-				Write<long>((*it)->m_handlerStart->m_offset);
-				Write<long>((*it)->m_handlerEnd->m_offset - (*it)->m_handlerStart->m_offset);
-
-				if (COR_ILEXCEPTION_CLAUSE_FILTER == (*it)->m_handlerType)
-				{
-					Write<long>((*it)->m_filterStart->m_offset);
-				}
-				else
-				{
-					Write<ULONG>((*it)->m_token);
-				}
+			IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT clause;
+			clause.Flags = (*it)->m_handlerType;
+			clause.TryOffset = (*it)->m_tryStart->m_offset;
+			clause.TryLength = (*it)->m_tryEnd->m_offset - (*it)->m_tryStart->m_offset;
+			clause.HandlerOffset = (*it)->m_handlerStart->m_offset;
+			clause.HandlerLength = (*it)->m_handlerEnd->m_offset - (*it)->m_handlerStart->m_offset;
+			if (COR_ILEXCEPTION_CLAUSE_FILTER == (*it)->m_handlerType)
+			{
+				clause.FilterOffset = (*it)->m_filterStart->m_offset;
 			}
+			else
+			{
+				clause.ClassToken = (*it)->m_token;
+			}
+
+			memcpy(pClause, &clause, sizeof(clause));
+			pClause += sizeof(clause);
 		}
 	}
 
-    static void RecordBranchInfo(Instruction& instr, const OperationDetails& details)
+    void Method::RecordBranchInfo(Instruction& instr, const OperationDetails& details)
     {
         // are we a branch or a switch
         instr.m_isBranch = (details.controlFlow == BRANCH || details.controlFlow == COND_BRANCH);
+        instr.m_firstBranch = static_cast<ULONG>(m_branchTable.size());
+        instr.m_branchCount = 0;
 
         if (instr.m_isBranch && instr.m_operation != CEE_SWITCH)
         {
+            LONG offset;
             if (details.operandSize == 1)
             {
-                instr.m_branchOffsets.push_back(static_cast<char>(static_cast<BYTE>(instr.m_operand)));
+                offset = static_cast<char>(static_cast<BYTE>(instr.m_operand));
             }
             else
             {
-                instr.m_branchOffsets.push_back(static_cast<ULONG>(instr.m_operand));
+                offset = static_cast<LONG>(instr.m_operand);
             }
+            m_branchTable.push_back({ offset, nullptr });
+            instr.m_branchCount = 1;
         }
     }
 
@@ -183,9 +232,16 @@ namespace Instrumentation
 		_ASSERTE(m_header.CodeSize != 0);
 		_ASSERTE(GetPosition() == 0);
 
+		// IL averages a little over two bytes per instruction, so this usually means one allocation
+		// for each of the instructions and the list of them.
+		size_t expectedCount = m_header.CodeSize / 2 + 1;
+		m_arena.Reserve(expectedCount);
+		m_instructions.reserve(expectedCount);
+		m_instructionsByOriginalOffset.assign(m_header.CodeSize, nullptr);
+
 		while (GetPosition() < m_header.CodeSize)
 		{
-			std::unique_ptr<Instruction> pInstruction(new Instruction());
+			Instruction* pInstruction = m_arena.Allocate();
 			pInstruction->m_offset = GetPosition();
 			pInstruction->m_origOffset = pInstruction->m_offset;
 
@@ -197,7 +253,7 @@ namespace Instrumentation
 				op2 = Read<BYTE>();
 			}
 
-			OperationDetails &details = Operations::m_mapOpsOperationDetails[MAKEWORD(op1, op2)];
+			const OperationDetails &details = Operations::GetDetails(op1, op2);
 			pInstruction->m_operation = details.canonicalName;
 			switch (details.operandSize)
 			{
@@ -225,17 +281,20 @@ namespace Instrumentation
 			if (pInstruction->m_operation == CEE_SWITCH)
 			{
 				auto numbranches = static_cast<DWORD>(pInstruction->m_operand);
-				while (numbranches-- != 0) pInstruction->m_branchOffsets.push_back(Read<long>());
+				pInstruction->m_branchCount = numbranches;
+				while (numbranches-- != 0) m_branchTable.push_back({ Read<LONG>(), nullptr });
 			}
 
-			m_instructions.push_back(std::move(pInstruction));
+			m_instructions.push_back(pInstruction);
+			m_instructionsByOriginalOffset[pInstruction->m_offset] = pInstruction;
 		}
 
 		ReadSections();
 
 		SetBuffer(nullptr);
 
-		ResolveBranches(m_instructions.begin(), m_instructions.end());
+		ResolveBranches(m_instructions.begin(), m_instructions.end(),
+			[this](long offset) { return GetInstructionAtOriginalOffset(offset); });
 
 		ConvertShortBranches(m_instructions.begin(), m_instructions.end());
 
@@ -250,9 +309,9 @@ namespace Instrumentation
 
 		auto pSection = std::make_unique<ExceptionHandler>();
 		pSection->m_handlerType = type;
-		pSection->m_tryStart = GetInstructionAtOffset(tryStart);
-		pSection->m_tryEnd = GetInstructionAtOffset(tryStart + tryEnd);
-		pSection->m_handlerStart = GetInstructionAtOffset(handlerStart);
+		pSection->m_tryStart = GetInstructionAtOriginalOffset(tryStart);
+		pSection->m_tryEnd = GetInstructionAtOriginalOffset(tryStart + tryEnd);
+		pSection->m_handlerStart = GetInstructionAtOriginalOffset(handlerStart);
 		pSection->m_handlerEnd = GetInstructionAtOffset(handlerStart + handlerEnd,
 			(type & COR_ILEXCEPTION_CLAUSE_FINALLY) == COR_ILEXCEPTION_CLAUSE_FINALLY,
 			(type & COR_ILEXCEPTION_CLAUSE_FAULT) == COR_ILEXCEPTION_CLAUSE_FAULT,
@@ -260,7 +319,7 @@ namespace Instrumentation
 			(type & COR_ILEXCEPTION_CLAUSE_NONE) == COR_ILEXCEPTION_CLAUSE_NONE);
 
 		if (filterStart != 0) {
-			pSection->m_filterStart = GetInstructionAtOffset(filterStart);
+			pSection->m_filterStart = GetInstructionAtOriginalOffset(filterStart);
 		}
 
 		pSection->m_token = token;
@@ -281,7 +340,7 @@ namespace Instrumentation
 
 			if (COR_ILEXCEPTION_CLAUSE_FILTER == type)
 			{
-				filterStart = Read<long>();
+				filterStart = Read<ULONG>();
 			}
 			else
 			{
@@ -307,7 +366,7 @@ namespace Instrumentation
 				{
 					Advance(-1);
 					int count = ((Read<ULONG>() >> 8) / 24);
-					ReadExceptionHandlers<ULONG, long, long>(count);
+					ReadExceptionHandlers<ULONG, ULONG, ULONG>(count);
 				}
 				else
 				{
@@ -319,21 +378,29 @@ namespace Instrumentation
 		}
 	}
 
-	/// <summary>Gets the <c>Instruction</c> that has (is at) the specified offset.</summary>
-	/// <param name="offset">The offset to look for.</param>
-	/// <returns>An <c>Instruction</c> that exists at that location.</returns>
-	/// <remarks>Ensure that the offsets are current by executing <c>RecalculateOffsets</c>
-	/// beforehand</remarks>
-	Instruction * Method::GetInstructionAtOffset(long offset)
+	/// <summary>Gets the <c>Instruction</c> that was at the specified offset when the method was read.</summary>
+	/// <param name="origOffset">The original offset to look for.</param>
+	/// <returns>The <c>Instruction</c>, or null if no instruction started at that offset.</returns>
+	/// <remarks>Unlike the search by current offset this is a simple lookup, and remains valid
+	/// as instructions are inserted.</remarks>
+	Instruction * Method::GetInstructionAtOriginalOffset(long origOffset)
 	{
-        return GetInstructionAtOffset(offset, m_instructions.begin(), m_instructions.end());
+		if (origOffset < 0 || static_cast<size_t>(origOffset) >= m_instructionsByOriginalOffset.size())
+		{
+			_ASSERTE(FALSE);
+			return nullptr;
+		}
+
+		auto pInstruction = m_instructionsByOriginalOffset[origOffset];
+		_ASSERTE(pInstruction != nullptr);
+		return pInstruction;
 	}
 
 	/// <summary>Gets the <c>Instruction</c> that has (is at) the specified offset.</summary>
 	/// <param name="offset">The offset to look for.</param>
 	/// <returns>An <c>Instruction</c> that exists at that location.</returns>
-	/// <remarks>Ensure that the offsets are current by executing <c>RecalculateOffsets</c>
-	/// beforehand. Only should be used when trying to find the instruction pointed to be a finally 
+	/// <remarks>Used while reading the method, so the offset is an original one. Only should
+	/// be used when trying to find the instruction pointed to be a finally 
 	/// block which may be beyond the bounds of the method itself</remarks>
 	/// <example>
 	///     void Method()
@@ -350,26 +417,22 @@ namespace Instrumentation
 	/// </example>
 	Instruction * Method::GetInstructionAtOffset(long offset, bool isFinally, bool isFault, bool isFilter, bool isTyped)
 	{
-		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
+		if (offset < static_cast<long>(m_instructionsByOriginalOffset.size()))
 		{
-			if ((*it)->m_offset == offset)
-			{
-				return it->get();
-			}
+			return GetInstructionAtOriginalOffset(offset);
 		}
 
 		if (isFinally || isFault || isFilter || isTyped)
 		{
-			auto pLast = m_instructions.back().get();
-			auto& details = Operations::m_mapNameOperationDetails[pLast->m_operation];
+			auto pLast = m_instructions.back();
+			auto& details = Operations::GetDetails(pLast->m_operation);
 			if (offset == pLast->m_offset + details.length + details.operandSize)
 			{
 				// add a code label to hang the clause handler end off
-				auto pInstruction = std::make_unique<Instruction>(CEE_CODE_LABEL);
+				auto pInstruction = m_arena.Allocate(Instruction(CEE_CODE_LABEL));
 				pInstruction->m_offset = offset;
-                auto p = pInstruction.get();
-				m_instructions.push_back(std::move(pInstruction));
-				return p;
+				m_instructions.push_back(pInstruction);
+				return pInstruction;
 			}
 		}
 		_ASSERTE(FALSE);
@@ -381,28 +444,25 @@ namespace Instrumentation
 	/// <remarks>This allows us to insert (or modify) instructions without losing the intended 'goto' 
 	/// point. <c>RecalculateOffsets</c> is used to rebuild the new required operand(s) based on the
 	/// offsets of the instructions being referenced</remarks>
-	void Method::ResolveBranches(InstructionList::iterator begin, InstructionList::iterator end)
+	/// <param name="findInstruction">Finds the instruction at a given offset.</param>
+	template<class InstructionLookup>
+	void Method::ResolveBranches(InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end, InstructionLookup findInstruction)
 	{
 		for (auto it = begin; it != end; ++it)
 		{
-			(*it)->m_branches.clear();
-			auto& details = Operations::m_mapNameOperationDetails[(*it)->m_operation];
+			auto& details = Operations::GetDetails((*it)->m_operation);
 			auto baseOffset = (*it)->m_offset + details.length + details.operandSize;
 			if ((*it)->m_operation == CEE_SWITCH)
 			{
 				baseOffset += (4 * static_cast<long>((*it)->m_operand));
 			}
 
-			for (auto offsetIter = (*it)->m_branchOffsets.begin(); offsetIter != (*it)->m_branchOffsets.end(); ++offsetIter)
+			for (ULONG i = 0; i < (*it)->m_branchCount; i++)
 			{
-				auto offset = baseOffset + (*offsetIter);
-				auto instruction = GetInstructionAtOffset(offset, begin, end);
-				if (instruction != nullptr)
-				{
-					(*it)->m_branches.push_back(instruction);
-				}
+				auto& target = m_branchTable[(*it)->m_firstBranch + i];
+				target.m_instruction = findInstruction(baseOffset + target.m_offset);
+				_ASSERTE(target.m_instruction != nullptr);
 			}
-			_ASSERTE((*it)->m_branchOffsets.size() == (*it)->m_branches.size());
 		}
 	}
 
@@ -422,14 +482,14 @@ namespace Instrumentation
 	{
 		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
 		{
-			auto& details = Operations::m_mapNameOperationDetails[(*it)->m_operation];
+			auto& details = Operations::GetDetails((*it)->m_operation);
 			if (details.operandSize == Null)
 			{
 				RELTRACE(_T("(IL_%04X) IL_%04X %s"), (*it)->m_origOffset, (*it)->m_offset, details.stringName);
 			}
 			else if (details.operandParam == ShortInlineBrTarget || details.operandParam == InlineBrTarget)
 			{
-				auto offset = (*it)->m_offset + (*it)->m_branchOffsets[0] + details.length + details.operandSize;
+				auto offset = (*it)->m_offset + m_branchTable[(*it)->m_firstBranch].m_offset + details.length + details.operandSize;
 				RELTRACE(_T("(IL_%04X) IL_%04X %s IL_%04X"),
 					(*it)->m_origOffset, (*it)->m_offset, details.stringName, offset);
 			}
@@ -463,30 +523,32 @@ namespace Instrumentation
 					(*it)->m_origOffset, (*it)->m_offset, details.stringName, (*it)->m_operand);
 			}
 			
-			for (auto offsetIter = (*it)->m_branchOffsets.begin(); offsetIter != (*it)->m_branchOffsets.end(); ++offsetIter)
+			for (ULONG i = 0; i < (*it)->m_branchCount; i++)
 			{
 				if ((*it)->m_operation == CEE_SWITCH)
 				{
-					auto offset = (*it)->m_offset + (4 * static_cast<long>((*it)->m_operand)) + (*offsetIter) + details.length + details.operandSize;
+					auto offset = (*it)->m_offset + (4 * static_cast<long>((*it)->m_operand)) + m_branchTable[(*it)->m_firstBranch + i].m_offset + details.length + details.operandSize;
 					RELTRACE(_T("    IL_%04X"), offset);
 				}
 			}
 		}
 	}
 
-    Instruction* Method::GetInstructionAtOffset(long offset, InstructionList::iterator begin, InstructionList::iterator end)
+    /// <summary>Gets the first <c>Instruction</c> in a range that is at the specified offset.</summary>
+    /// <remarks>The offsets must be in order, as they are after <c>CalculateOffsets</c>.</remarks>
+    Instruction* Method::GetInstructionAtOffset(long offset, InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end)
     {
-        for (auto it = begin; it != end; ++it)
+        auto it = std::lower_bound(begin, end, offset,
+            [](const Instruction* pInstruction, long offset) { return pInstruction->m_offset < offset; });
+        if (it != end && (*it)->m_offset == offset)
         {
-            if ((*it)->m_offset == offset)
-            {
-                return it->get();
-            }
+            return *it;
         }
         _ASSERTE(FALSE);
         return nullptr;
     }
 
+
 	void Method::DumpExceptionFilters()
 	{
 		int i = 0;
@@ -512,11 +574,11 @@ namespace Instrumentation
 	/// the new required offset. Save time/effort and make all branches long ones.</para> 
 	/// <para>Could add the capability to optimise long to short at a later date but consider 
 	/// the benefits dubious after all the new instrumentation has been added.</para></remarks>
-	void Method::ConvertShortBranches(InstructionList::iterator begin, InstructionList::iterator end)
+	void Method::ConvertShortBranches(InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end)
 	{
 		for (auto it = begin; it != end; ++it)
 		{
-			OperationDetails &details = Operations::m_mapNameOperationDetails[(*it)->m_operation];
+			const OperationDetails &details = Operations::GetDetails((*it)->m_operation);
 			if ((*it)->m_isBranch && details.operandSize == 1)
 			{
 				CanonicalName newOperation = (*it)->m_operation;
@@ -570,17 +632,236 @@ namespace Instrumentation
 				(*it)->m_operation = newOperation;
 				(*it)->m_operand = UNSAFE_BRANCH_OPERAND;
 			}
+		}
+	}
+
+	static CanonicalName GetShortBranch(CanonicalName operation)
+	{
+		switch (operation)
+		{
+		case CEE_BR:
+			return CEE_BR_S;
+		case CEE_BRFALSE:
+			return CEE_BRFALSE_S;
+		case CEE_BRTRUE:
+			return CEE_BRTRUE_S;
+		case CEE_BEQ:
+			return CEE_BEQ_S;
+		case CEE_BGE:
+			return CEE_BGE_S;
+		case CEE_BGT:
+			return CEE_BGT_S;
+		case CEE_BLE:
+			return CEE_BLE_S;
+		case CEE_BLT:
+			return CEE_BLT_S;
+		case CEE_BNE_UN:
+			return CEE_BNE_UN_S;
+		case CEE_BGE_UN:
+			return CEE_BGE_UN_S;
+		case CEE_BGT_UN:
+			return CEE_BGT_UN_S;
+		case CEE_BLE_UN:
+			return CEE_BLE_UN_S;
+		case CEE_BLT_UN:
+			return CEE_BLT_UN_S;
+		case CEE_LEAVE:
+			return CEE_LEAVE_S;
+		default:
+			return operation;
+		}
+	}
+
+	/// <summary>Make the method as small as possible once all the instrumentation has been added.</summary>
+	/// <remarks><para>Converts long branches back to short ones wherever the target is in range.
+	/// Shortening branches only ever brings others closer to their targets, so this is repeated
+	/// until there are no more to shorten.</para>
+	/// <para>Also allows the method to be written with a 'Tiny' header if it qualifies.</para>
+	/// <para>Any further insertions convert all branches back to long ones.</para></remarks>
+	void Method::Compact()
+	{
+		_ASSERTE(m_queuedInsertions.empty());
+
+		bool shortened;
+		do
+		{
+			shortened = false;
+			for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
+			{
+				if (!(*it)->m_isBranch)
+				{
+					continue;
+				}
+
+				CanonicalName shortOperation = GetShortBranch((*it)->m_operation);
+				auto displacement = static_cast<LONG>((*it)->m_operand);
+				if (shortOperation != (*it)->m_operation && displacement >= -128 && displacement <= 127)
+				{
+					(*it)->m_operation = shortOperation;
+					shortened = true;
+				}
+			}
+
+			if (shortened)
+			{
+				RecalculateOffsets();
+			}
+		} while (shortened);
+
+		m_compacted = true;
+	}
+
+	/// <summary>Work out the most items the method can have on the evaluation stack, by following
+	/// every path through the code as the runtime's verifier does</summary>
+	/// <remarks><para>Fixed stack behaviour comes from "opcode.def"; the rest (calls and return)
+	/// is given by <paramref name="getVariableStackEffect"/>, which is only asked for the parts
+	/// that "opcode.def" gives as variable.</para>
+	/// <para>Throws if the stack would underflow, if paths meet with different stack depths, or
+	/// if the code runs off the end, since the runtime would reject the method anyway.</para></remarks>
+	/// <returns>The value to use as the header's MaxStack</returns>
+	unsigned int Method::CalculateMaxStack(const StackEffectLookup& getVariableStackEffect)
+	{
+		RecalculateOffsets();
+
+		const int c_notReached = -1;
+		std::vector<int> depths(m_instructions.size(), c_notReached);
+		std::vector<size_t> pending;
+		int maxDepth = 0;
+
+		auto reach = [&](const Instruction* pInstruction, int depth) {
+			size_t index = GetInstructionIndex(pInstruction);
+			if (depths[index] == c_notReached)
+			{
+				depths[index] = depth;
+				pending.push_back(index);
+				if (depth > maxDepth)
+				{
+					maxDepth = depth;
+				}
+			}
+			else if (depths[index] != depth)
+			{
+				throw std::domain_error("Method::CalculateMaxStack - inconsistent stack depth");
+			}
+		};
+
+		if (!m_instructions.empty())
+		{
+			reach(m_instructions.front(), 0);
+		}
+
+		for (auto& pHandler : m_exceptions)
+		{
+			reach(pHandler->m_tryStart, 0);
+
+			// Catch and filter blocks start with the exception on the stack
+			bool isCatch = (pHandler->m_handlerType & (COR_ILEXCEPTION_CLAUSE_FINALLY | COR_ILEXCEPTION_CLAUSE_FAULT)) == 0;
+			reach(pHandler->m_handlerStart, isCatch ? 1 : 0);
+			if (pHandler->m_handlerType & COR_ILEXCEPTION_CLAUSE_FILTER)
+			{
+				reach(pHandler->m_filterStart, 1);
+			}
+		}
+
+		while (!pending.empty())
+		{
+			size_t index = pending.back();
+			pending.pop_back();
+
+			const Instruction& instr = *m_instructions[index];
+			const OperationDetails& details = Operations::GetDetails(instr.m_operation);
+			int pop = details.stackPop;
+			int push = details.stackPush;
+			if (pop < 0 || push < 0)
+			{
+				StackEffect effect = getVariableStackEffect(instr);
+				pop = pop < 0 ? effect.pop : pop;
+				push = push < 0 ? effect.push : push;
+			}
+
+			int depth = depths[index];
+			if (depth < pop)
+			{
+				throw std::domain_error("Method::CalculateMaxStack - stack underflow");
+			}
+			depth += push - pop;
+
+			bool fallsThrough = true;
+			switch (details.controlFlow)
+			{
+			case BRANCH:
+				fallsThrough = false;
+				if (instr.m_operation == CEE_LEAVE || instr.m_operation == CEE_LEAVE_S)
+				{
+					depth = 0;
+				}
+				break;
+			case RETURN:
+				if (instr.m_operation == CEE_RET && depth != 0)
+				{
+					throw std::domain_error("Method::CalculateMaxStack - stack not empty on return");
+				}
+				fallsThrough = false;
+				break;
+			case THROW:
+				fallsThrough = false;
+				break;
+			case CALL:
+				fallsThrough = instr.m_operation != CEE_JMP;
+				break;
+			default:
+				break;
+			}
+
+			for (ULONG i = 0; i < instr.m_branchCount; i++)
+			{
+				reach(m_branchTable[instr.m_firstBranch + i].m_instruction, depth);
+			}
+
+			if (fallsThrough)
+			{
+				if (index + 1 == m_instructions.size())
+				{
+					throw std::domain_error("Method::CalculateMaxStack - code runs off the end of the method");
+				}
+				reach(m_instructions[index + 1], depth);
+			}
+		}
 
-			(*it)->m_branchOffsets.clear();
+		return maxDepth;
+	}
+
+	/// <summary>Find the position of an instruction in the method, using the current offsets</summary>
+	size_t Method::GetInstructionIndex(const Instruction* pInstruction) const
+	{
+		auto it = std::lower_bound(m_instructions.begin(), m_instructions.end(), pInstruction->m_offset,
+			[](const Instruction* pInstr, long offset) { return pInstr->m_offset < offset; });
+		if (it == m_instructions.end() || *it != pInstruction)
+		{
+			throw std::domain_error("Method::GetInstructionIndex - instruction is not in the method");
 		}
+		return it - m_instructions.begin();
 	}
 
-    void Method::CalculateOffsets(InstructionList::iterator begin, InstructionList::iterator end)
+	/// <summary>Test if the method can be written with a 'Tiny' header, which has no room for
+	/// anything but the code size</summary>
+	/// <remarks>Requires the code size to be current, as it is after <c>RecalculateOffsets</c>.</remarks>
+	bool Method::CanWriteTinyHeader() const
+	{
+		return m_compacted
+			&& m_header.CodeSize < 64
+			&& m_header.MaxStack <= 8
+			&& IsNilToken(m_header.LocalVarSigTok)
+			&& (m_header.Flags & CorILMethod_InitLocals) == 0
+			&& m_exceptions.empty();
+	}
+
+    long Method::CalculateOffsets(InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end)
     {
         long position = 0;
         for (auto it = begin; it != end; ++it)
         {
-            auto& details = Operations::m_mapNameOperationDetails[(*it)->m_operation];
+            auto& details = Operations::GetDetails((*it)->m_operation);
             (*it)->m_offset = position;
             position += details.length;
             position += details.operandSize;
@@ -589,33 +870,35 @@ namespace Instrumentation
                 position += 4 * static_cast<long>((*it)->m_operand);
             }
         }
+        return position;
     }
 
 	/// <summary>Recalculate the offsets of each instruction taking into account the instruction
 	/// size, the operand size and any extra datablocks CEE_SWITCH</summary>
+	/// <remarks>Also brings the code size in the header up to date.</remarks>
 	void Method::RecalculateOffsets()
 	{
-        CalculateOffsets(m_instructions.begin(), m_instructions.end());
+        m_header.CodeSize = CalculateOffsets(m_instructions.begin(), m_instructions.end());
 
 		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
 		{
-			auto& details = Operations::m_mapNameOperationDetails[(*it)->m_operation];
+			auto& details = Operations::GetDetails((*it)->m_operation);
 			if ((*it)->m_isBranch)
 			{
-				(*it)->m_branchOffsets.clear();
+				auto pTargets = m_branchTable.data() + (*it)->m_firstBranch;
 				if ((*it)->m_operation == CEE_SWITCH)
 				{
 					auto offset = ((*it)->m_offset + details.length + details.operandSize + (4 * static_cast<long>((*it)->m_operand)));
-					for (auto bit = (*it)->m_branches.begin(); bit != (*it)->m_branches.end(); ++bit)
+					for (ULONG i = 0; i < (*it)->m_branchCount; i++)
 					{
-						(*it)->m_branchOffsets.push_back((*bit)->m_offset - offset);
+						pTargets[i].m_offset = pTargets[i].m_instruction->m_offset - offset;
 					}
 				}
 				else
 				{
 #pragma warning(suppress:26451)
-					(*it)->m_operand = (*it)->m_branches[0]->m_offset - ((*it)->m_offset + details.length + details.operandSize);
-					(*it)->m_branchOffsets.push_back(static_cast<long>((*it)->m_operand));
+					(*it)->m_operand = pTargets->m_instruction->m_offset - ((*it)->m_offset + details.length + details.operandSize);
+					pTargets->m_offset = static_cast<LONG>((*it)->m_operand);
 				}
 			}
 		}
@@ -625,28 +908,37 @@ namespace Instrumentation
 	/// the code size and the (aligned) creitical sections if they exist. Use this
 	/// to get the size required for allocating memory.</summary>
 	/// <returns>The size of the method.</returns>
-	/// <remarks>It is recomended that <c>RecalculateOffsets</c> should be called 
-	/// beforehand if any instrumentation has been done</remarks>
+	/// <remarks><para>It is recomended that <c>RecalculateOffsets</c> should be called 
+	/// beforehand if any instrumentation has been done</para>
+	/// <para>The code size comes from the last <c>RecalculateOffsets</c>, so this doesn't need to
+	/// look at the instructions; the layout worked out here is what <c>WriteMethod</c> follows.</para></remarks>
 	long Method::GetMethodSize()
 	{
-		auto lastInstruction = m_instructions.back().get();
-		auto& details = Operations::m_mapNameOperationDetails[lastInstruction->m_operation];
+		_ASSERTE(m_header.CodeSize == static_cast<DWORD>(m_instructions.back()->m_offset + m_instructions.back()->length()));
 
-		m_header.CodeSize = lastInstruction->m_offset + details.length + details.operandSize;
-		long size = sizeof(IMAGE_COR_ILMETHOD_FAT) + m_header.CodeSize;
+		m_layout.m_isTiny = CanWriteTinyHeader();
+		m_layout.m_sectionsOffset = 0;
+		if (m_layout.m_isTiny)
+		{
+			m_layout.m_headerSize = sizeof(IMAGE_COR_ILMETHOD_TINY);
+			m_layout.m_size = m_layout.m_headerSize + m_header.CodeSize;
+			return m_layout.m_size;
+		}
+
+		m_layout.m_headerSize = sizeof(IMAGE_COR_ILMETHOD_FAT);
+		m_layout.m_size = m_layout.m_headerSize + m_header.CodeSize;
 
 		m_header.Flags &= ~CorILMethod_MoreSects;
 		if (m_exceptions.size() > 0)
 		{
 			m_header.Flags |= CorILMethod_MoreSects;
-			long align = sizeof(DWORD) - 1;
-#pragma warning(suppress:26451)
-            size = ((size + align) & ~align);
-#pragma warning(suppress:26451)
-            size += ((static_cast<long>(m_exceptions.size()) * 6) + 1) * sizeof(long);
+			ULONG align = sizeof(DWORD) - 1;
+			m_layout.m_sectionsOffset = (m_layout.m_size + align) & ~align;
+			m_layout.m_size = m_layout.m_sectionsOffset + static_cast<ULONG>(sizeof(IMAGE_COR_ILMETHOD_SECT_FAT) +
+				m_exceptions.size() * sizeof(IMAGE_COR_ILMETHOD_SECT_EH_CLAUSE_FAT));
 		}
 
-		return size;
+		return m_layout.m_size;
 	}
 
 	/// <summary>Test if a method has already been instrumented by comparing a list of instructions at that location</summary>
@@ -681,45 +973,39 @@ namespace Instrumentation
 	/// copy the data between them</remarks>
 	void Method::InsertInstructionsAtOffset(long offset, const InstructionList &instructions)
 	{
-		InstructionList clone;
-		for (auto it = instructions.begin(); it != instructions.end(); ++it)
+		if (m_compacted)
 		{
-            auto clonedInstr = std::make_unique<Instruction>(*(*it));
-            RecordBranchInfo(*clonedInstr, Operations::m_mapNameOperationDetails[clonedInstr->m_operation]);
-			clone.push_back(std::move(clonedInstr));
+			// the inserted code may put short branches out of range
+			ConvertShortBranches(m_instructions.begin(), m_instructions.end());
+			m_compacted = false;
 		}
 
+		InstructionReferenceList clone = CloneInstructions(instructions);
+
 		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
 		{
 			if ((*it)->m_offset == offset)
 			{
 				++it;
-				m_instructions.insert(it, std::make_move_iterator(clone.begin()), std::make_move_iterator(clone.end()));
+				m_instructions.insert(it, clone.begin(), clone.end());
 				break;
 			}
 		}
 
-        InstructionList::iterator begin, end;
+        InstructionReferenceList::iterator begin, end;
 		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
 		{
 			if ((*it)->m_origOffset == offset)
 			{
                 begin = it;
-				auto orig = *(*it);
-				for (unsigned int i = 0; i < clone.size(); i++)
-				{
-					auto temp = it;
-					++it;
-					*(*temp) = *(*it);
-				}
-				*(*it) = orig;
-                end = it;
+                MoveInstructionToEndOfInsertion(it, clone.size());
+                end = it + clone.size();
 				break;
 			}
 		}
 
         CalculateOffsets(begin, end); // assign temporary offsets within the new block so ResolveBranches works
-        ResolveBranches(begin, end);
+        ResolveBranches(begin, end, [begin, end](long offset) { return GetInstructionAtOffset(offset, begin, end); });
         ConvertShortBranches(begin, end);
 
 		RecalculateOffsets();
@@ -728,61 +1014,155 @@ namespace Instrumentation
 	/// <summary>Insert a sequence of instructions at a sequence point</summary>
 	/// <param name="origOffset">The original (as in before any instrumentation) offset to look for.</param>
 	/// <param name="instructions">The list of instructions to insert at that location.</param>
-	/// <remarks>Original pointer references are maintained by inserting the sequence of instructions 
-	/// after the intended target and then using a copy operator on the <c>Instruction</c> objects to 
-	/// copy the data between them</remarks>
+	/// <remarks>Any instructions already queued are inserted at the same time. Inserting many
+	/// sequences is cheaper done with <c>QueueInstructionsAtOriginalOffset</c> and a single
+	/// <c>ApplyQueuedInstructions</c>.</remarks>
 	void Method::InsertInstructionsAtOriginalOffset(long origOffset, const InstructionList &instructions)
 	{
-		InstructionList clone;
-		for (auto it = instructions.begin(); it != instructions.end(); ++it)
+		QueueInstructionsAtOriginalOffset(origOffset, instructions);
+		ApplyQueuedInstructions();
+	}
+
+	/// <summary>Queue a sequence of instructions to be inserted at a sequence point by <c>ApplyQueuedInstructions</c></summary>
+	/// <param name="origOffset">The original (as in before any instrumentation) offset to look for.</param>
+	/// <param name="instructions">The list of instructions to insert at that location.</param>
+	void Method::QueueInstructionsAtOriginalOffset(long origOffset, const InstructionList &instructions)
+	{
+		if (GetInstructionAtOriginalOffset(origOffset) == nullptr || instructions.empty())
 		{
-            auto clonedInstr = std::make_unique<Instruction>(*(*it));
-            RecordBranchInfo(*clonedInstr, Operations::m_mapNameOperationDetails[clonedInstr->m_operation]);
-			clone.push_back(std::move(clonedInstr));
+			return;
 		}
 
-		long actualOffset = 0;
-		Instruction* actualInstruction = nullptr;
-		for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
+		m_queuedInsertions.push_back({ origOffset, CloneInstructions(instructions) });
+	}
+
+	/// <summary>Insert all the queued sequences of instructions, then recalculate the offsets</summary>
+	/// <remarks><para>The result is the same as inserting each sequence in turn with
+	/// <c>InsertInstructionsAtOriginalOffset</c>, but the instruction list is rebuilt and the
+	/// offsets recalculated only once.</para>
+	/// <para>Sequences go before the original instruction, in the order they were queued, and
+	/// original pointer references to the instruction (branches, exception handlers) are moved
+	/// to the start of the first sequence by using a copy operator on the <c>Instruction</c>
+	/// objects to swap the data between them.</para></remarks>
+	void Method::ApplyQueuedInstructions()
+	{
+		if (m_queuedInsertions.empty())
 		{
-			if ((*it)->m_origOffset == origOffset)
-			{
-				actualInstruction = it->get();
-				actualOffset = (actualInstruction)->m_offset;
-				++it;
-				m_instructions.insert(it, std::make_move_iterator(clone.begin()), std::make_move_iterator(clone.end()));
-				break;
-			}
+			return;
 		}
 
-        InstructionList::iterator begin, end;
-        if (!DoesTryHandlerPointToOffset(actualOffset))
+		if (m_compacted)
 		{
-			for (auto it = m_instructions.begin(); it != m_instructions.end(); ++it)
+			// the inserted code may put short branches out of range
+			ConvertShortBranches(m_instructions.begin(), m_instructions.end());
+			m_compacted = false;
+		}
+
+		std::stable_sort(m_queuedInsertions.begin(), m_queuedInsertions.end(),
+			[](const QueuedInsertion& a, const QueuedInsertion& b) { return a.m_origOffset < b.m_origOffset; });
+
+		size_t insertedCount = 0;
+		for (auto& insertion : m_queuedInsertions)
+		{
+			insertedCount += insertion.m_instructions.size();
+		}
+
+		InstructionReferenceList instructions;
+		instructions.reserve(m_instructions.size() + insertedCount);
+		std::vector<std::pair<size_t, size_t>> insertedRanges; // start and end of each sequence in the new list
+		insertedRanges.reserve(m_queuedInsertions.size());
+
+		auto queued = m_queuedInsertions.begin();
+		for (auto pInstruction : m_instructions)
+		{
+			// Original instructions are still in order of their original offset
+			if (queued == m_queuedInsertions.end() ||
+				pInstruction != m_instructionsByOriginalOffset[queued->m_origOffset])
 			{
-				if (it->get() == actualInstruction)
-				{
-                    begin = it;
-					Instruction orig = *(*it);
-					for (unsigned int i = 0; i < clone.size(); i++)
-					{
-						auto temp = it;
-						++it;
-						*(*temp) = *(*it);
-					}
-					*(*it) = orig;
-                    end = it;
-					break;
-				}
+				instructions.push_back(pInstruction);
+				continue;
+			}
+
+			bool insertAfter = DoesTryHandlerPointToOffset(pInstruction->m_offset);
+			if (insertAfter)
+			{
+				instructions.push_back(pInstruction);
+			}
+
+			size_t firstStart = instructions.size();
+			long origOffset = queued->m_origOffset;
+			for (; queued != m_queuedInsertions.end() && queued->m_origOffset == origOffset; ++queued)
+			{
+				size_t start = instructions.size();
+				instructions.insert(instructions.end(), queued->m_instructions.begin(), queued->m_instructions.end());
+				insertedRanges.push_back({ start, instructions.size() });
+			}
+
+			if (!insertAfter)
+			{
+				Instruction* pFirst = instructions[firstStart];
+				Instruction orig = *pInstruction;
+				*pInstruction = *pFirst;
+				*pFirst = orig;
+
+				instructions[firstStart] = pInstruction;
+				instructions.push_back(pFirst);
+				m_instructionsByOriginalOffset[origOffset] = pFirst;
 			}
 		}
 
-        CalculateOffsets(begin, end); // temporary offsets
-        ResolveBranches(begin, end);
-        ConvertShortBranches(begin, end);
+		_ASSERTE(queued == m_queuedInsertions.end());
+		m_queuedInsertions.clear();
+		m_instructions.swap(instructions);
 
-        RecalculateOffsets();
-    }
+		for (auto& range : insertedRanges)
+		{
+			auto begin = m_instructions.begin() + range.first;
+			auto end = m_instructions.begin() + range.second;
+			CalculateOffsets(begin, end); // temporary offsets within the sequence so ResolveBranches works
+			ResolveBranches(begin, end, [begin, end](long offset) { return GetInstructionAtOffset(offset, begin, end); });
+			ConvertShortBranches(begin, end);
+		}
+
+		RecalculateOffsets();
+	}
+
+	/// <summary>Copy a list of instructions into the method's storage</summary>
+	InstructionReferenceList Method::CloneInstructions(const InstructionList &instructions)
+	{
+		InstructionReferenceList clone;
+		clone.reserve(instructions.size());
+		for (auto it = instructions.begin(); it != instructions.end(); ++it)
+		{
+            auto clonedInstr = m_arena.Allocate(*(*it));
+            RecordBranchInfo(*clonedInstr, Operations::GetDetails(clonedInstr->m_operation));
+			clone.push_back(clonedInstr);
+		}
+		return clone;
+	}
+
+	/// <summary>Moves an instruction to follow the instructions just inserted after it.</summary>
+	/// <param name="it">The position of the instruction.</param>
+	/// <param name="insertedCount">The number of instructions inserted after it.</param>
+	/// <remarks>Original pointer references are maintained by using a copy operator on the <c>Instruction</c>
+	/// objects to copy the data between them, so that anything that referred to the instruction (e.g. a branch
+	/// or exception handler) now refers to the first inserted instruction.</remarks>
+	void Method::MoveInstructionToEndOfInsertion(InstructionReferenceList::iterator it, size_t insertedCount)
+	{
+		Instruction orig = *(*it);
+		for (size_t i = 0; i < insertedCount; i++)
+		{
+			auto temp = it;
+			++it;
+			*(*temp) = *(*it);
+		}
+		*(*it) = orig;
+
+		if (orig.m_origOffset != -1)
+		{
+			m_instructionsByOriginalOffset[orig.m_origOffset] = *it;
+		}
+	}
 
 	/// <summary>Test if we have an exception where the handler start points to the 
 	/// instruction at the supplied offset</summary>
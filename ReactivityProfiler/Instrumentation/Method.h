@@ -6,6 +6,18 @@
 
 namespace Instrumentation
 {
+	/// <summary>The numbers of items an instruction takes off and puts on the evaluation stack</summary>
+	struct StackEffect
+	{
+		int pop;
+		int push;
+	};
+
+	/// <summary>Gives the stack effect of an instruction whose stack behaviour depends on a signature:
+	/// that of the called method for <c>call</c>, <c>callvirt</c>, <c>calli</c> and <c>newobj</c>, or of
+	/// the method itself for <c>ret</c></summary>
+	typedef std::function<StackEffect(const Instruction&)> StackEffectLookup;
+
 	/// <summary>The <c>Method</c> entity builds a 'model' of the IL that can then be modified</summary>
 	class Method :
 		public MethodBuffer
@@ -20,6 +32,10 @@ namespace Instrumentation
 		void WriteMethod(IMAGE_COR_ILMETHOD* pMethod);
 		void InsertInstructionsAtOriginalOffset(long origOffset, const InstructionList &instructions);
 		void InsertInstructionsAtOffset(long offset, const InstructionList &instructions);
+		void QueueInstructionsAtOriginalOffset(long origOffset, const InstructionList &instructions);
+		void ApplyQueuedInstructions();
+		void Compact();
+		unsigned int CalculateMaxStack(const StackEffectLookup& getVariableStackEffect);
 		void DumpIL(bool enableDump);
 		ULONG GetILMapSize();
 		void PopulateILMap(ULONG mapSize, COR_IL_MAP* maps);
@@ -43,6 +59,11 @@ namespace Instrumentation
 			m_header.MaxStack += extraStackSize;
 		}
 
+		void SetStackSize(unsigned int stackSize)
+		{
+			m_header.MaxStack = stackSize;
+		}
+
 		DWORD GetCodeSize() const { return m_header.CodeSize; }
 
 
@@ -53,14 +74,19 @@ namespace Instrumentation
 		void ReadMethod(const IMAGE_COR_ILMETHOD* pMethod);
 		void ReadBody();
 
-        static void CalculateOffsets(InstructionList::iterator begin, InstructionList::iterator end);
-		static void ConvertShortBranches(InstructionList::iterator begin, InstructionList::iterator end);
-		static void ResolveBranches(InstructionList::iterator begin, InstructionList::iterator end);
+        static long CalculateOffsets(InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end);
+		static void ConvertShortBranches(InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end);
+		void RecordBranchInfo(Instruction& instr, const OperationDetails& details);
+		template<class InstructionLookup>
+		void ResolveBranches(InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end, InstructionLookup findInstruction);
 		void DumpExceptionFilters();
 		void DumpInstructions();
-        static Instruction* GetInstructionAtOffset(long offset, InstructionList::iterator begin, InstructionList::iterator end);
-		Instruction * GetInstructionAtOffset(long offset);
+        static Instruction* GetInstructionAtOffset(long offset, InstructionReferenceList::iterator begin, InstructionReferenceList::iterator end);
 		Instruction * GetInstructionAtOffset(long offset, bool isFinally, bool isFault, bool isFilter, bool isTyped);
+		Instruction * GetInstructionAtOriginalOffset(long origOffset);
+		size_t GetInstructionIndex(const Instruction* pInstruction) const;
+		InstructionReferenceList CloneInstructions(const InstructionList &instructions);
+		void MoveInstructionToEndOfInsertion(InstructionReferenceList::iterator it, size_t insertedCount);
 		void ReadSections();
 
 		template<class flag, class start, class end>
@@ -68,13 +94,41 @@ namespace Instrumentation
 
 		std::unique_ptr<ExceptionHandler> ReadExceptionHandler(enum CorExceptionFlag type, long tryStart, long tryEnd, long handlerStart, long handlerEnd, long filterStart, ULONG token);
 
-		void WriteSections();
+		void WriteSections(BYTE* pSections);
+		bool CanWriteTinyHeader() const;
 		bool DoesTryHandlerPointToOffset(long offset);
 
 	private:
 		// all instrumented methods will be FAT (with FAT SECTIONS if exist) regardless
 		IMAGE_COR_ILMETHOD_FAT m_header;
         ULONG m_originalHeaderSize;
+		bool m_compacted;
+
+		// Where each part goes when the method is written, as worked out by GetMethodSize.
+		struct Layout
+		{
+			bool m_isTiny;
+			ULONG m_headerSize;
+			ULONG m_sectionsOffset; // 0 if there are no sections
+			ULONG m_size;
+		};
+
+		Layout m_layout;
+
+		// Storage for the instructions, and the targets of the branches among them.
+		InstructionArena m_arena;
+		BranchTargetList m_branchTable;
+
+		// The original instructions, indexed by their original offset (null for offsets inside an instruction).
+		InstructionReferenceList m_instructionsByOriginalOffset;
+
+		struct QueuedInsertion
+		{
+			long m_origOffset;
+			InstructionReferenceList m_instructions;
+		};
+
+		std::vector<QueuedInsertion> m_queuedInsertions;
 
 #ifdef TEST_FRAMEWORK
 	public:
@@ -84,7 +138,7 @@ namespace Instrumentation
 		ExceptionHandlerList m_exceptions;
 #endif
 	public:
-		InstructionList m_instructions;
+		InstructionReferenceList m_instructions;
 
 		int GetNumberOfInstructions() const
 		{
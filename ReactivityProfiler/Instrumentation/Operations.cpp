@@ -2,43 +2,15 @@
 #include "pch.h"
 #include "Operations.h"
 
-// these defines are used when we pull in "opcode.def" and use the macro 
-// operator n##args to munge them together
-#define nInlineNone           Null
-#define nShortInlineVar       Byte
-#define nShortInlineI         Byte
-#define nInlineI              Dword
-#define nInlineI8             Qword
-#define nShortInlineR         Dword
-#define nInlineR              Qword
-#define nInlineMethod         Dword
-#define nInlineSig            Dword
-#define nInlineBrTarget       Dword
-#define nInlineType           Dword
-#define nInlineVar            Word
-#define nShortInlineBrTarget  Byte
-#define nInlineTok            Dword
-#define nInlineField          Dword
-#define nInlineSwitch         Dword
-#define nInlineString         Dword
-
 namespace Instrumentation
 {
-	MapCanonicalNameOperationDetails Operations::m_mapNameOperationDetails;
-	MapOpsOperationDetails Operations::m_mapOpsOperationDetails;
-
-	Operations Operations::m_operations;
-
-	/// <summary>Build the static instance</summary>
-	Operations::Operations()
-	{
-#define OPDEF(name, str, decs, incs, args, optp, stdlen, stdop1, stdop2, flow) \
-    { \
-    OperationDetails operation = {name, args, n##args, flow, stdlen, stdop1, stdop2, optp, _T(str)}; \
-    m_mapNameOperationDetails[name] = operation;  \
-    m_mapOpsOperationDetails[MAKEWORD(stdop1,stdop2)] = operation;  \
-    }
-#include "opcode.def"
-#undef OPDEF
-	}
-}
\ No newline at end of file
+	// The tables are all built at compile time, so check them here
+	static_assert(Operations::GetDetails(CEE_SWITCH).canonicalName == CEE_SWITCH, "Operation details are not in CanonicalName order");
+	static_assert(Operations::GetDetails(CEE_READONLY).canonicalName == CEE_READONLY, "Operation details are not in CanonicalName order");
+	static_assert(Operations::GetDetails(REFPRE, 0x28).canonicalName == CEE_CALL, "One byte opcode lookup failed");
+	static_assert(Operations::GetDetails(STP1, 0x0C).canonicalName == CEE_LDLOC, "Two byte opcode lookup failed");
+	static_assert(Operations::GetDetails(STP1, 0xFF).canonicalName == CEE_ILLEGAL, "Unknown opcode lookup failed");
+	static_assert(Operations::GetDetails(CEE_LDC_I8).totalLength() == 9, "Operand size lookup failed");
+	static_assert(Operations::GetDetails(CEE_STELEM_REF).stackPop == 3 && Operations::GetDetails(CEE_STELEM_REF).stackPush == 0, "Stack behaviour lookup failed");
+	static_assert(Operations::GetDetails(CEE_CALL).stackPop < 0 && Operations::GetDetails(CEE_NEWOBJ).stackPush == 1, "Stack behaviour lookup failed");
+}
@@ -76,34 +76,113 @@ struct OperationDetails
     OperandParam operandParam;
     OperandSize operandSize;
     ControlFlow controlFlow;
+    signed char stackPop;  // number of items taken off the stack, or negative if it depends on the operand
+    signed char stackPush; // number of items put on the stack, or negative if it depends on the operand
     BYTE length;
     BYTE op1;
     BYTE op2;
     OpcodeKind opcodeKind;
-    TCHAR *stringName;
+    const TCHAR *stringName;
 
-    int totalLength() const
+    constexpr int totalLength() const
     {
         return length + operandSize;
     }
 };
 
-typedef std::unordered_map<CanonicalName, OperationDetails> MapCanonicalNameOperationDetails;
-typedef std::unordered_map<DWORD, OperationDetails> MapOpsOperationDetails;
-
 namespace Instrumentation
 {
-	/// <summary>The container of the static lists used for the <c>OperationDetails</c> lookups</summary>
-	/// <remarks>The lists are built when we instantiate our static instance m_operations</remarks>
+	namespace OperationTables
+	{
+		constexpr OperandSize GetOperandSize(OperandParam operandParam)
+		{
+			switch (operandParam)
+			{
+			case ShortInlineVar:
+			case ShortInlineI:
+			case ShortInlineBrTarget:
+				return Byte;
+			case InlineVar:
+				return Word;
+			case InlineI:
+			case ShortInlineR:
+			case InlineMethod:
+			case InlineSig:
+			case InlineBrTarget:
+			case InlineSwitch:
+			case InlineString:
+			case InlineType:
+			case InlineField:
+			case InlineTok:
+				return Dword;
+			case InlineI8:
+			case InlineR:
+				return Qword;
+			default:
+				return Null;
+			}
+		}
+
+		// The stack behaviour columns of "opcode.def" as numbers of stack items. The Var
+		// ones depend on the signature of the method called or returned from.
+		constexpr signed char Pop0 = 0, Pop1 = 1, PopI = 1, PopI8 = 1, PopR4 = 1, PopR8 = 1, PopRef = 1, VarPop = -1;
+		constexpr signed char Push0 = 0, Push1 = 1, PushI = 1, PushI8 = 1, PushR4 = 1, PushR8 = 1, PushRef = 1, VarPush = -1;
+
+		// In the same order as CanonicalName, so can be indexed by it
+		inline constexpr OperationDetails c_operationDetails[] =
+		{
+#define OPDEF(name, str, decs, incs, args, optp, stdlen, stdop1, stdop2, flow) \
+			{ name, args, GetOperandSize(args), flow, decs, incs, stdlen, stdop1, stdop2, optp, _T(str) },
+#include <opcode.def>
+#undef OPDEF
+		};
+
+		typedef std::array<std::array<CanonicalName, 256>, 2> OpcodeTable;
+
+		// Indexed by [0][op2] for single byte opcodes and [1][op2] for two byte (STP1 op2) opcodes
+		constexpr OpcodeTable BuildOpcodeTable()
+		{
+			OpcodeTable table = {};
+			for (size_t i = 0; i < 256; i++)
+			{
+				table[0][i] = CEE_ILLEGAL;
+				table[1][i] = CEE_ILLEGAL;
+			}
+
+			for (const OperationDetails& details : c_operationDetails)
+			{
+				if (details.op1 == REFPRE)
+				{
+					table[0][details.op2] = details.canonicalName;
+				}
+				else if (details.op1 == STP1)
+				{
+					table[1][details.op2] = details.canonicalName;
+				}
+			}
+			return table;
+		}
+
+		inline constexpr OpcodeTable c_opcodeTable = BuildOpcodeTable();
+	}
+
+	/// <summary>The lookups of <c>OperationDetails</c></summary>
+	/// <remarks>The tables are built at compile time from "opcode.def"</remarks>
 	class Operations
 	{
 	public:
-		static MapCanonicalNameOperationDetails m_mapNameOperationDetails;
-		static MapOpsOperationDetails m_mapOpsOperationDetails;
-	protected:
-		Operations();
-	private:
-		static Operations m_operations;
+		static constexpr const OperationDetails& GetDetails(CanonicalName name)
+		{
+			return OperationTables::c_operationDetails[name];
+		}
 
+		/// <summary>Get the details of the operation with the given opcode</summary>
+		/// <param name="op1"><c>STP1</c> for a two byte opcode, otherwise <c>REFPRE</c></param>
+		/// <param name="op2">The last byte of the opcode</param>
+		/// <returns>The details of the operation, or of <c>CEE_ILLEGAL</c> if there's no such opcode</returns>
+		static constexpr const OperationDetails& GetDetails(BYTE op1, BYTE op2)
+		{
+			return GetDetails(OperationTables::c_opcodeTable[op1 == STP1 ? 1 : 0][op2]);
+		}
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,65 @@
+#include "pch.h"
+#include "LocalsAllocator.h"
+#include "Signature.h"
+
+LocalsAllocator::LocalsAllocator(const SignatureBlob& existingLocalsSig) :
+    m_existingLocalsSig(existingLocalsSig.begin(), existingLocalsSig.end()),
+    m_existingCount(0)
+{
+    if (!m_existingLocalsSig.empty())
+    {
+        m_existingCount = LocalsSignatureReader(m_existingLocalsSig).GetCount();
+    }
+}
+
+ULONG LocalsAllocator::Allocate(const SignatureBlob& typeSig)
+{
+    for (size_t i = 0; i < m_locals.size(); i++)
+    {
+        Local& local = m_locals[i];
+        if (!local.m_inUse &&
+            local.m_typeSig.size() == typeSig.length() &&
+            std::equal(local.m_typeSig.begin(), local.m_typeSig.end(), typeSig.begin()))
+        {
+            local.m_inUse = true;
+            return m_existingCount + static_cast<ULONG>(i);
+        }
+    }
+
+    if (GetCount() >= 0xfffe)
+    {
+        throw std::domain_error("Too many locals");
+    }
+
+    m_locals.push_back({ { typeSig.begin(), typeSig.end() }, true });
+    return GetCount() - 1;
+}
+
+void LocalsAllocator::ReleaseAll()
+{
+    for (Local& local : m_locals)
+    {
+        local.m_inUse = false;
+    }
+}
+
+std::vector<COR_SIGNATURE> LocalsAllocator::GetSignature() const
+{
+    std::vector<SignatureBlob> newLocals;
+    for (const Local& local : m_locals)
+    {
+        newLocals.push_back(local.m_typeSig);
+    }
+
+    if (m_existingLocalsSig.empty())
+    {
+        return LocalsSignatureWriter::MakeSig(static_cast<ULONG>(newLocals.size()), [&](LocalsSignatureWriter& w) {
+            for (auto& typeSig : newLocals)
+            {
+                w.WriteLocal().Write(typeSig);
+            }
+        });
+    }
+
+    return LocalsSignatureReader(m_existingLocalsSig).AppendLocals(newLocals);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+// Hands out the extra locals needed by the instrumentation of a method. Each instrumented
+// call site only needs its locals between storing and reloading the call's arguments, so
+// sites never overlap, and a local left over from an earlier site can be reused by a later
+// one that needs a local of exactly the same type. The extended locals signature is then
+// built once for the whole method, rather than once per call site.
+class LocalsAllocator
+{
+public:
+    // existingLocalsSig is the method's original locals signature, or an empty blob if it
+    // has none.
+    LocalsAllocator(const SignatureBlob& existingLocalsSig);
+
+    // Returns the index of a local of the given type that isn't in use by the current site,
+    // adding one if necessary.
+    ULONG Allocate(const SignatureBlob& typeSig);
+
+    // Marks the end of a site, so that all the locals it was given can be reused.
+    void ReleaseAll();
+
+    ULONG GetExistingCount() const { return m_existingCount; }
+    ULONG GetCount() const { return m_existingCount + static_cast<ULONG>(m_locals.size()); }
+    bool HasNewLocals() const { return !m_locals.empty(); }
+
+    // Returns the original locals signature with all the added locals appended.
+    std::vector<COR_SIGNATURE> GetSignature() const;
+
+private:
+    struct Local
+    {
+        std::vector<COR_SIGNATURE> m_typeSig;
+        bool m_inUse;
+    };
+
+    std::vector<COR_SIGNATURE> m_existingLocalsSig;
+    ULONG m_existingCount;
+    std::vector<Local> m_locals;
+};
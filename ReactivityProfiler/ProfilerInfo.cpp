@@ -103,13 +103,21 @@ void CProfilerInfo::SetILFunctionBody(ModuleID moduleId, mdMethodDef methodToken
     ));
 }
 
-void CProfilerInfo::SetILInstrumentedCodeMap(FunctionID functionId, bool isFirstCallForFunc, const simplespan<COR_IL_MAP>& map)
+void CProfilerInfo::SetILInstrumentedCodeMap(FunctionID functionId, bool isFirstCallForFunc, const std::vector<COR_IL_MAP>& map)
 {
+    // The runtime takes ownership of the entries it's given, so each call gets its own copy.
+    auto pEntries = static_cast<COR_IL_MAP*>(CoTaskMemAlloc(map.size() * sizeof(COR_IL_MAP)));
+    if (!pEntries)
+    {
+        throw E_OUTOFMEMORY;
+    }
+    std::copy(map.begin(), map.end(), pEntries);
+
     CHECK_SUCCESS(m_profilerInfo->SetILInstrumentedCodeMap(
         functionId,
         isFirstCallForFunc,
-        static_cast<ULONG>(map.length()),
-        map.begin()
+        static_cast<ULONG>(map.size()),
+        pEntries
     ));
 }
 
@@ -324,6 +332,20 @@ mdModule CMetadataImport::GetCurrentModule() const
     return token;
 }
 
+ULONG CMetadataImport::GetMethodDefCount() const
+{
+    CComQIPtr<IMetaDataTables, &IID_IMetaDataTables> tables(m_metadata);
+    if (!tables)
+    {
+        throw E_NOINTERFACE;
+    }
+
+    // Metadata table numbers are the same as the token types.
+    ULONG rowCount;
+    CHECK_SUCCESS(tables->GetTableInfo(mdtMethodDef >> 24, nullptr, &rowCount, nullptr, nullptr, nullptr));
+    return rowCount;
+}
+
 CCorEnum<IMetaDataAssemblyImport, mdAssemblyRef> CMetadataAssemblyImport::EnumAssemblyRefs()
 {
     CCorEnum<IMetaDataAssemblyImport, mdAssemblyRef> e(m_metadata.p, [=](auto imp, auto e, auto arr, auto c, auto pc) { return imp->EnumAssemblyRefs(e, arr, c, pc); });
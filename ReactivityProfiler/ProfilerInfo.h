@@ -218,6 +218,7 @@ public:
     SignatureBlob GetTypeSpecFromToken(mdTypeSpec typeSpecToken) const;
     SignatureBlob GetSigFromToken(mdSignature sigTok) const;
     mdModule GetCurrentModule() const;
+    ULONG GetMethodDefCount() const; // method def RIDs run from 1 to this
 
     operator bool() const { return m_metadata; }
 
@@ -298,7 +299,7 @@ public:
     simplespan<const byte> GetILFunctionBody(ModuleID moduleId, mdMethodDef methodToken);
     simplespan<byte> AllocateFunctionBody(ModuleID moduleId, size_t size);
     void SetILFunctionBody(ModuleID moduleId, mdMethodDef methodToken, const simplespan<byte>& body);
-    void SetILInstrumentedCodeMap(FunctionID functionId, bool isFirstCallForFunc, const simplespan<COR_IL_MAP>& map);
+    void SetILInstrumentedCodeMap(FunctionID functionId, bool isFirstCallForFunc, const std::vector<COR_IL_MAP>& map);
 
     CMetadataImport GetMetadataImport(ModuleID moduleId, DWORD openFlags);
     CMetadataAssemblyImport GetMetadataAssemblyImport(ModuleID moduleId, DWORD openFlags);
@@ -1,24 +1,13 @@
 #include "pch.h"
 #include "RxProfiler.h"
 #include "RxProfilerImpl.h"
+#include "Instrumentation/ILCallScanner.h"
+#include "LocalsAllocator.h"
 #include "Signature.h"
 #include "Store.h"
 
 using namespace Instrumentation;
 
-typedef std::variant<SignatureBlob, std::vector<COR_SIGNATURE>> SigSpanOrVector;
-static SignatureBlob getSpan(const SigSpanOrVector& ssov)
-{
-    if (std::holds_alternative<SignatureBlob>(ssov))
-    {
-        return std::get<SignatureBlob>(ssov);
-    }
-    else
-    {
-        return std::get<std::vector<COR_SIGNATURE>>(ssov);
-    }
-}
-
 struct MethodCallInfo
 {
     std::wstring name;
@@ -28,50 +17,77 @@ struct MethodCallInfo
     SignatureBlob typeSpecBlob;
 };
 
-struct ObservableCallInfo
+// A called method that returns an observable, with what we need to know to instrument calls
+// to it. The same method is usually called from many places in a module, so these are kept
+// per module, keyed by the token of the call instruction's operand. The type sigs are
+// interned in the module's signature pool.
+struct ObservableCallTarget
 {
     std::wstring m_calledMethodName;
-    int m_instructionOffset = 0; // if call instruction has prefix(es), this is the offset of the (first) prefix
-    int m_instructionLength = 0; // includes length of any prefix(es)
-    SigSpanOrVector m_returnType;
+    SignatureBlob m_returnType;
     mdToken m_returnObservableTypeRef = 0; // IObservable, IConnectedObservable, IGroupedObservable...?
-    SigSpanOrVector m_returnTypeArg; // if call returns IObservable<T>, this is T
+    SignatureBlob m_returnTypeArg; // if call returns IObservable<T>, this is T
 
     // The follows vectors hold a value for each method argument starting with the first observable one.
     std::vector<bool> m_argIsObservable;
-    // Span of the sig that applies to the parameter type
-    std::vector<SigSpanOrVector> m_argTypeSpan;
+    // Sig of the parameter type
+    std::vector<SignatureBlob> m_argTypeSpan;
+
+    // Tokens for the calls into the support assembly, defined in the module the first time a
+    // call to this method is instrumented.
+    std::once_flag m_tokensDefined;
+    std::vector<mdMethodSpec> m_argumentMethodSpecs; // Instrument.Argument<T> for each observable arg
+    mdMethodSpec m_returnedMethodSpec = 0; // Instrument.Returned<T> or ReturnedSubinterface<T>
+    mdTypeSpec m_returnTypeSpec = 0; // only needed for ReturnedSubinterface
+};
+
+struct ObservableCallInfo
+{
+    std::shared_ptr<ObservableCallTarget> m_pTarget;
+    int m_instructionOffset = 0; // if call instruction has prefix(es), this is the offset of the (first) prefix
+    int m_instructionLength = 0; // includes length of any prefix(es)
 };
 
 class MethodBodyInstrumenter
 {
 public:
-    MethodBodyInstrumenter(CProfilerInfo& profilerInfo, FunctionID functionId, const MethodProps& props, const FunctionInfo& info, CMetadataImport& metadata, std::shared_ptr<PerModuleData>& pPerModuleData) :
+    MethodBodyInstrumenter(CProfilerInfo& profilerInfo, FunctionID functionId, const MethodProps& props, const FunctionInfo& info, const CMetadataImport& metadata, PerModuleData& perModuleData) :
         m_profilerInfo(profilerInfo),
         m_functionId(functionId),
         m_methodProps(props),
         m_functionInfo(info),
         m_metadataImport(metadata),
-        m_pPerModuleData(pPerModuleData),
+        m_perModuleData(perModuleData),
         m_instrumentedMethodId(0)
     {
     }
 
     void Instrument();
 
+    // Rewrites a method ahead of JIT compilation, for a task queued when its module loaded.
+    static RewrittenFunctionData RewriteEagerly(CProfilerInfo& profilerInfo, ModuleID moduleId, mdMethodDef methodDefToken, const CMetadataImport& metadata, PerModuleData& perModuleData);
+
 private:
-    RewrittenFunctionData GetOrCreateRewrittenFunctionData();
+    std::shared_ptr<RewriteTask> GetOrCreateRewriteTask();
     RewrittenFunctionData CreateInstrumentedFunction();
+    void ReportToStore(const RewrittenFunctionData& data);
+    std::shared_ptr<ObservableCallTarget> GetCallTarget(mdToken calledMethodToken);
+    std::shared_ptr<ObservableCallTarget> CreateCallTarget(mdToken calledMethodToken);
     bool TryFindObservableCalls();
+    void DefineInstrumentationTokens(ObservableCallTarget& target, CMetadataEmit& emit);
+    mdMethodSpec DefineMethodSpec(mdToken genericMethodToken, const SignatureBlob& sigBlob, CMetadataEmit& emit);
+    mdTypeSpec DefineTypeSpec(const SignatureBlob& sigBlob, CMetadataEmit& emit);
+    mdSignature GetTokenFromSig(const SignatureBlob& sigBlob, CMetadataEmit& emit);
     void InstrumentCall(ObservableCallInfo& call, CMetadataEmit& emit);
+    bool SetStackSize(const IMAGE_COR_ILMETHOD* pOriginalMethodImage);
     MethodCallInfo GetMethodCallInfo(mdToken method);
 
     CProfilerInfo& m_profilerInfo;
     FunctionID m_functionId;
-    const MethodProps& m_methodProps;
-    const FunctionInfo& m_functionInfo;
-    CMetadataImport& m_metadataImport;
-    std::shared_ptr<PerModuleData>& m_pPerModuleData;
+    const MethodProps m_methodProps;
+    const FunctionInfo m_functionInfo;
+    CMetadataImport m_metadataImport;
+    PerModuleData& m_perModuleData; // lives as long as the profiler
     std::wstring m_owningTypeName;
 
     ObservableTypeReferences observableTypeRefs;
@@ -79,6 +95,8 @@ private:
 
     std::unique_ptr<Method> m_method;
     std::vector<ObservableCallInfo> m_observableCalls;
+    std::unique_ptr<LocalsAllocator> m_pLocals;
+    std::vector<InstrumentationPointInfo> m_instrumentationPoints;
 
     int32_t m_instrumentedMethodId;
 };
@@ -89,7 +107,7 @@ void CRxProfiler::InstrumentMethodBody(FunctionID functionId, const MethodProps&
 {
     try
     {
-        MethodBodyInstrumenter instrumenter(m_profilerInfo, functionId, props, info, metadata, pPerModuleData);
+        MethodBodyInstrumenter instrumenter(m_profilerInfo, functionId, props, info, metadata, *pPerModuleData);
         instrumenter.Instrument();
     }
     catch (std::exception ex)
@@ -98,56 +116,142 @@ void CRxProfiler::InstrumentMethodBody(FunctionID functionId, const MethodProps&
     }
 }
 
-RewrittenFunctionData MethodBodyInstrumenter::GetOrCreateRewrittenFunctionData()
+void CRxProfiler::QueueEagerRewrites(ModuleID moduleId, const std::shared_ptr<PerModuleData>& pPerModuleData)
 {
-    std::unique_lock<std::mutex> pmd_lock(m_pPerModuleData->m_mutex);
+    // Going through the module's methods is left to the pool too, so as not to hold up the
+    // module load, or JIT compilation of its methods, which waits for the module's lock.
+    m_pEagerRewritePool->enqueue([this, moduleId, pPerModuleData] {
+        CMetadataImport metadataImport = m_profilerInfo.GetMetadataImport(moduleId, ofRead);
+        PerModuleData& perModuleData = *pPerModuleData;
+        ULONG methodDefCount = metadataImport.GetMethodDefCount();
+        int queuedCount = 0;
+        for (ULONG rid = 1; rid <= methodDefCount; rid++)
+        {
+            if (perModuleData.m_methodsNotRewritten.test(rid))
+            {
+                continue;
+            }
+
+            mdMethodDef methodDefToken = TokenFromRid(rid, mdtMethodDef);
+            std::shared_ptr<RewriteTask> pTask;
+            {
+                std::lock_guard<std::mutex> lock_pmd(perModuleData.m_mutex);
+                std::shared_ptr<RewriteTask>& pMapTask = perModuleData.m_rewrittenFunctions[methodDefToken];
+                if (pMapTask)
+                {
+                    // Already being JIT compiled
+                    continue;
+                }
+
+                pMapTask = std::make_shared<RewriteTask>([=, &perModuleData] {
+                    return MethodBodyInstrumenter::RewriteEagerly(m_profilerInfo, moduleId, methodDefToken, metadataImport, perModuleData);
+                });
+                pTask = pMapTask;
+            }
 
-    observableTypeRefs = m_pPerModuleData->m_observableTypeRefs;
-    supportRefs = m_pPerModuleData->m_supportAssemblyRefs;
+            m_pEagerRewritePool->enqueue([pTask] { pTask->Run(); });
+            queuedCount++;
+        }
 
-    // task to instrument the function
-    std::packaged_task<RewrittenFunctionData()> task([=] { return CreateInstrumentedFunction(); });
+        ATLTRACE(L"Queued %d methods for eager rewriting", queuedCount);
+    });
+}
 
-    // try and put the future result of the task into the map
-    decltype(m_pPerModuleData->m_rewrittenFunctions)::value_type mapEntry = { m_functionInfo.functionToken, task.get_future() };
-    auto insertResult = m_pPerModuleData->m_rewrittenFunctions.insert(std::move(mapEntry));
+RewrittenFunctionData MethodBodyInstrumenter::RewriteEagerly(CProfilerInfo& profilerInfo, ModuleID moduleId, mdMethodDef methodDefToken, const CMetadataImport& metadata, PerModuleData& perModuleData)
+{
+    MethodProps props = metadata.GetMethodProps(methodDefToken);
+    if (props.codeRva == 0)
+    {
+        // No IL (abstract, extern, runtime-implemented...)
+        perModuleData.m_methodsNotRewritten.set(RidFromToken(methodDefToken));
+        return {};
+    }
 
-    pmd_lock.unlock();
+    FunctionInfo info;
+    info.moduleId = moduleId;
+    info.functionToken = methodDefToken;
 
-    if (insertResult.second)
+    // There's no function ID until the method is JIT compiled, but it's only needed to set
+    // the instrumented code map, which happens then.
+    MethodBodyInstrumenter instrumenter(profilerInfo, 0, props, info, metadata, perModuleData);
     {
-        // we inserted our task's future result, so run the task.
-        task();
+        std::lock_guard<std::mutex> lock_pmd(perModuleData.m_mutex);
+        instrumenter.observableTypeRefs = perModuleData.m_observableTypeRefs;
+        instrumenter.supportRefs = perModuleData.m_supportAssemblyRefs;
+    }
+
+    return instrumenter.CreateInstrumentedFunction();
+}
+
+std::shared_ptr<RewriteTask> MethodBodyInstrumenter::GetOrCreateRewriteTask()
+{
+    std::lock_guard<std::mutex> pmd_lock(m_perModuleData.m_mutex);
+
+    observableTypeRefs = m_perModuleData.m_observableTypeRefs;
+    supportRefs = m_perModuleData.m_supportAssemblyRefs;
+
+    // Use the existing task for this function if there is one (queued for eager rewriting,
+    // or created by another thread JIT compiling a different instantiation of it).
+    std::shared_ptr<RewriteTask>& pMapTask = m_perModuleData.m_rewrittenFunctions[m_functionInfo.functionToken];
+    if (!pMapTask)
+    {
+        pMapTask = std::make_shared<RewriteTask>([=] { return CreateInstrumentedFunction(); });
     }
     else
     {
-        ATLTRACE(L"%s has already been instrumented", m_methodProps.name.c_str());
+        ATLTRACE(L"%s has already been queued for instrumentation", m_methodProps.name.c_str());
     }
 
-    // obtain the result from the task (either the one we inserted successfully, or one
-    // inserted previously)
-    auto insertedMapEntry = insertResult.first;
-    auto& insertedFuture = insertedMapEntry->second;
-    return insertedFuture.get();
+    return pMapTask;
 }
 
 void MethodBodyInstrumenter::Instrument()
 {
-    RewrittenFunctionData data = GetOrCreateRewrittenFunctionData();
+    std::shared_ptr<RewriteTask> pTask = GetOrCreateRewriteTask();
+
+    // Runs the task on this thread unless it has already started, in which case waits for it.
+    const RewrittenFunctionData& data = pTask->GetResult();
 
     if (data.m_rewrittenILBuffer)
     {
         m_profilerInfo.SetILFunctionBody(m_functionInfo.moduleId, m_functionInfo.functionToken, data.m_rewrittenILBuffer);
+
+        // Only now is the method actually instrumented (eager rewrites are done for methods
+        // that may never be JIT compiled).
+        pTask->ReportOnce([&] { ReportToStore(data); });
+
         m_profilerInfo.SetILInstrumentedCodeMap(m_functionId, true, data.m_instrumentedCodeMap);
     }
 }
 
+void MethodBodyInstrumenter::ReportToStore(const RewrittenFunctionData& data)
+{
+    g_Store.AddMethodInfo(
+        data.m_instrumentedMethodId,
+        m_functionInfo.moduleId,
+        m_functionInfo.functionToken,
+        data.m_owningTypeName,
+        m_methodProps.name);
+
+    for (auto& point : data.m_instrumentationPoints)
+    {
+        g_Store.AddInstrumentationInfo(
+            point.m_instrumentationPoint,
+            data.m_instrumentedMethodId,
+            point.m_instructionOffset,
+            point.m_pTarget->m_calledMethodName);
+    }
+
+    g_Store.MethodInstrumentationDone(data.m_instrumentedMethodId);
+}
+
 RewrittenFunctionData MethodBodyInstrumenter::CreateInstrumentedFunction()
 {
     simplespan<const byte> ilCode = m_profilerInfo.GetILFunctionBody(m_functionInfo.moduleId, m_functionInfo.functionToken);
     if (!ilCode)
     {
         ATLTRACE(L"%s is not an IL function", m_methodProps.name.c_str());
+        m_perModuleData.m_methodsNotRewritten.set(RidFromToken(m_functionInfo.functionToken));
         return {};
     }
 
@@ -155,15 +259,52 @@ RewrittenFunctionData MethodBodyInstrumenter::CreateInstrumentedFunction()
     const byte* codeBytes = ilCode.begin();
     const IMAGE_COR_ILMETHOD* pMethodImage = reinterpret_cast<const IMAGE_COR_ILMETHOD*>(codeBytes);
 
+    // Most methods call nothing returning an observable, so check the raw IL for calls that
+    // do before building the full model of it.
+    if (!ILCallScanner::AnyCall(pMethodImage, [this](mdToken calledMethodToken) { return GetCallTarget(calledMethodToken) != nullptr; }))
+    {
+        m_perModuleData.m_methodsNotRewritten.set(RidFromToken(m_functionInfo.functionToken));
+        return {};
+    }
+
     m_method = std::make_unique<Method>(pMethodImage);
 
     if (!TryFindObservableCalls())
     {
+        m_perModuleData.m_methodsNotRewritten.set(RidFromToken(m_functionInfo.functionToken));
         return {};
     }
 
     m_instrumentedMethodId = ++s_instrumentationIdSource;
 
+    CMetadataEmit emit = m_profilerInfo.GetMetadataEmit(m_functionInfo.moduleId, ofRead | ofWrite);
+
+    for (auto& call : m_observableCalls)
+    {
+        InstrumentCall(call, emit);
+    }
+
+    m_method->ApplyQueuedInstructions();
+
+    // The stack size can only be checked once the calls have been instrumented, by which time
+    // the method's IDs have been taken and its call targets defined in the module. Those are
+    // harmless if unused; what's deferred until the check passes is the locals signature and
+    // anything recorded in the store, so the store never describes a method left as it was.
+    if (!SetStackSize(pMethodImage))
+    {
+        m_perModuleData.m_methodsNotRewritten.set(RidFromToken(m_functionInfo.functionToken));
+        return {};
+    }
+
+    if (m_pLocals && m_pLocals->HasNewLocals())
+    {
+        std::vector<COR_SIGNATURE> extendedLocalsSig = m_pLocals->GetSignature();
+        mdSignature extendedLocalsTok = GetTokenFromSig(extendedLocalsSig, emit);
+        ATLTRACE("Got extended locals token: %x for %s (%u locals, %u added)", extendedLocalsTok, FormatBytes(extendedLocalsSig).c_str(),
+            m_pLocals->GetCount(), m_pLocals->GetCount() - m_pLocals->GetExistingCount());
+        m_method->SetLocalsSignature(extendedLocalsTok);
+    }
+
     auto owningTypeProps = m_metadataImport.GetTypeDefProps(m_methodProps.classDefToken);
     m_owningTypeName = owningTypeProps.name;
     mdTypeDef typeDefToken = m_methodProps.classDefToken;
@@ -174,22 +315,7 @@ RewrittenFunctionData MethodBodyInstrumenter::CreateInstrumentedFunction()
         m_owningTypeName = owningTypeProps.name + L"+" + m_owningTypeName;
     }
 
-    g_Store.AddMethodInfo(
-        m_instrumentedMethodId,
-        m_functionInfo.moduleId,
-        m_functionInfo.functionToken,
-        m_owningTypeName,
-        m_methodProps.name);
-
-    CMetadataEmit emit = m_profilerInfo.GetMetadataEmit(m_functionInfo.moduleId, ofRead | ofWrite);
-
-    for (auto call : m_observableCalls)
-    {
-        InstrumentCall(call, emit);
-    }
-
-    // allow for up to two additional arguments pushed in post-call instrumentation
-    m_method->IncrementStackSize(2);
+    m_method->Compact();
 
 #ifdef DEBUG
     m_method->DumpIL(true);
@@ -202,112 +328,198 @@ RewrittenFunctionData MethodBodyInstrumenter::CreateInstrumentedFunction()
     m_method->WriteMethod(reinterpret_cast<IMAGE_COR_ILMETHOD*>(rewrittenILBuffer.begin()));
 
     ULONG mapSize = m_method->GetILMapSize();
-    COR_IL_MAP* ilMapEntries = static_cast<COR_IL_MAP*>(CoTaskMemAlloc(mapSize * sizeof(COR_IL_MAP)));
-    m_method->PopulateILMap(mapSize, ilMapEntries);
+    std::vector<COR_IL_MAP> ilMap(mapSize);
+    m_method->PopulateILMap(mapSize, ilMap.data());
 
-    g_Store.MethodInstrumentationDone(m_instrumentedMethodId);
-
-    return { rewrittenILBuffer, { ilMapEntries, mapSize } };
+    return { rewrittenILBuffer, std::move(ilMap), m_instrumentedMethodId, m_owningTypeName, std::move(m_instrumentationPoints) };
 }
 
-bool MethodBodyInstrumenter::TryFindObservableCalls()
+std::shared_ptr<ObservableCallTarget> MethodBodyInstrumenter::GetCallTarget(mdToken calledMethodToken)
 {
-    for (auto it = m_method->m_instructions.begin(); it < m_method->m_instructions.end(); it++)
+    std::shared_ptr<ObservableCallTarget> pTarget;
+    if (m_perModuleData.m_callTargets.try_get(calledMethodToken, pTarget))
     {
-        auto pInstr = it->get();
-        auto operation = pInstr->m_operation;
-        if (operation != CEE_CALL && operation != CEE_CALLVIRT)
-        {
-            // We're only interested in call instructions
-            continue;
-        }
+        return pTarget;
+    }
 
-        mdToken calledMethodToken = static_cast<mdToken>(pInstr->m_operand);
-        MethodCallInfo methodCallInfo = GetMethodCallInfo(calledMethodToken);
+    pTarget = CreateCallTarget(calledMethodToken);
+    if (!m_perModuleData.m_callTargets.try_add(calledMethodToken, pTarget))
+    {
+        // Another thread got there first: use its one, so that the instrumentation tokens are
+        // only defined once.
+        m_perModuleData.m_callTargets.try_get(calledMethodToken, pTarget);
+    }
 
-        ATLTRACE(L"%s calls %s (RVA %x)", m_methodProps.name.c_str(), methodCallInfo.name.c_str(),
-            m_methodProps.codeRva + pInstr->m_origOffset);
+    return pTarget;
+}
+
+std::shared_ptr<ObservableCallTarget> MethodBodyInstrumenter::CreateCallTarget(mdToken calledMethodToken)
+{
+    MethodCallInfo methodCallInfo = GetMethodCallInfo(calledMethodToken);
+    if (!methodCallInfo.sigBlob)
+    {
+        return nullptr;
+    }
 
 #ifdef DEBUG
-        MethodSignatureReader::Check(methodCallInfo.sigBlob);
+    MethodSignatureReader::Check(methodCallInfo.sigBlob);
 #endif
 
-        MethodSignatureReader sigReader(methodCallInfo.sigBlob);
-        sigReader.MoveNextParam(); // move to the return value "parameter"
-        auto returnReader = sigReader.GetParamReader();
+    MethodSignatureReader sigReader(methodCallInfo.sigBlob);
+    sigReader.MoveNextParam(); // move to the return value "parameter"
+    auto returnReader = sigReader.GetParamReader();
 
-        if (!returnReader.HasType())
-        {
-            // Method returns void (or something without a static type).
-            continue;
-        }
+    if (!returnReader.HasType())
+    {
+        // Method returns void (or something without a static type).
+        return nullptr;
+    }
 
-        auto returnTypeReader = returnReader.GetTypeReader();
-        if (returnTypeReader.GetTypeKind() != ELEMENT_TYPE_GENERICINST)
-        {
-            // All the types we care about are generic.
-            // We only look for methods that return specific interfaces, not arbitrary subinterfaces
-            // or implementations of them.
-            continue;
-        }
+    auto returnTypeReader = returnReader.GetTypeReader();
+    if (returnTypeReader.GetTypeKind() != ELEMENT_TYPE_GENERICINST)
+    {
+        // All the types we care about are generic.
+        // We only look for methods that return specific interfaces, not arbitrary subinterfaces
+        // or implementations of them.
+        return nullptr;
+    }
 
-        mdToken returnTypeRef = returnTypeReader.GetToken();
-        if (returnTypeRef != observableTypeRefs.m_IObservable &&
-            returnTypeRef != observableTypeRefs.m_IConnectableObservable &&
-            returnTypeRef != observableTypeRefs.m_IGroupedObservable)
-        {
-            continue;
-        }
+    mdToken returnTypeRef = returnTypeReader.GetToken();
+    if (returnTypeRef != observableTypeRefs.m_IObservable &&
+        returnTypeRef != observableTypeRefs.m_IConnectableObservable &&
+        returnTypeRef != observableTypeRefs.m_IGroupedObservable)
+    {
+        return nullptr;
+    }
 
-        ATLTRACE(L"%s returns an I[Connectable|Grouped]Observable!", methodCallInfo.name.c_str());
+    ATLTRACE(L"%s returns an I[Connectable|Grouped]Observable!", methodCallInfo.name.c_str());
 
-        std::vector<SignatureBlob> typeTypeArgs, methodTypeArgs;
+    std::vector<SignatureBlob> typeTypeArgs, methodTypeArgs;
 
-        if (methodCallInfo.typeSpecBlob)
+    if (methodCallInfo.typeSpecBlob)
+    {
+        // Invoking a method on a constructed type instance
+        SignatureTypeReader typeSpecReader(methodCallInfo.typeSpecBlob);
+        if (typeSpecReader.GetTypeKind() == ELEMENT_TYPE_GENERICINST)
         {
-            // Invoking a method on a constructed type instance
-            SignatureTypeReader typeSpecReader(methodCallInfo.typeSpecBlob);
-            if (typeSpecReader.GetTypeKind() == ELEMENT_TYPE_GENERICINST)
-            {
-                typeTypeArgs = typeSpecReader.GetTypeArgSpans();
-            }
+            typeTypeArgs = typeSpecReader.GetTypeArgSpans();
         }
+    }
 
-        if (methodCallInfo.genericInstBlob)
-        {
-            // Invoking a generic method instance
+    if (methodCallInfo.genericInstBlob)
+    {
+        // Invoking a generic method instance
 #ifdef DEBUG
-            MethodSpecSignatureReader::Check(methodCallInfo.genericInstBlob);
+        MethodSpecSignatureReader::Check(methodCallInfo.genericInstBlob);
 #endif
 
-            methodTypeArgs = MethodSpecSignatureReader::GetTypeArgSpans(methodCallInfo.genericInstBlob);
+        methodTypeArgs = MethodSpecSignatureReader::GetTypeArgSpans(methodCallInfo.genericInstBlob);
+    }
+
+    // If there's any generic stuff going on, we need to fabricate new bits of
+    // sig using the type/method type arguments rather than just taking the
+    // appropriate span of the method sig. Set up a function to do this. Either
+    // way the sig is interned, as the same types turn up in many call targets.
+    SignaturePool& signatures = m_perModuleData.m_signatures;
+    std::vector<COR_SIGNATURE> substitutedSig;
+    std::function<SignatureBlob(SignatureTypeReader&)> getTypeSig;
+    if (!methodTypeArgs.empty() || !typeTypeArgs.empty())
+    {
+        getTypeSig = [&](SignatureTypeReader& tr) {
+            tr.SubstituteTypeArgs(typeTypeArgs, methodTypeArgs, substitutedSig);
+            return signatures.Intern(substitutedSig);
+        };
+    }
+    else
+    {
+        getTypeSig = [&signatures](SignatureTypeReader& tr) {
+            return signatures.Intern(tr.GetSigSpan());
+        };
+    }
+
+    auto pTarget = std::make_shared<ObservableCallTarget>();
+    pTarget->m_returnObservableTypeRef = returnTypeRef;
+    pTarget->m_calledMethodName = methodCallInfo.name;
+
+    // Record the return type
+    returnTypeReader.MoveNextTypeArg();
+    if (returnTypeRef == observableTypeRefs.m_IGroupedObservable)
+    {
+        // First type arg to IGroupedObservable is TKey, we want the second, TElement.
+        returnTypeReader.MoveNextTypeArg();
+    }
+    pTarget->m_returnTypeArg = getTypeSig(returnTypeReader.GetTypeReader());
+    pTarget->m_returnType = getTypeSig(returnTypeReader);
+
+    // Now look at the arguments
+    while (sigReader.MoveNextParam())
+    {
+        auto paramReader = sigReader.GetParamReader();
+        if (paramReader.IsTypedByRef() || paramReader.IsByRef())
+        {
+            // Avoid dealing with anything except by-value args for now. This means
+            // we can't do anything with earlier args either.
+            pTarget->m_argIsObservable.clear();
+            pTarget->m_argTypeSpan.clear();
+            continue;
+        } 
+             
+        auto paramTypeReader = paramReader.GetTypeReader();
+        auto paramTypeKind = paramTypeReader.GetTypeKind();
+        // Interesting arguments could include observables, delegates returning observables,
+        // Tasks returning observables, arrays of observables, and probably others.
+        // Here we just filter out value types and some other less common stuff, and leave
+        // it to the Instrument methods in the support assembly to decide whether to do anything
+        // with the rest.
+        bool isObservable =
+            paramTypeKind == ELEMENT_TYPE_CLASS ||
+            paramTypeKind == ELEMENT_TYPE_GENERICINST ||
+            paramTypeKind == ELEMENT_TYPE_SZARRAY;
+
+        // No need to start recording arg info until the first observable arg
+        if (isObservable || !pTarget->m_argIsObservable.empty())
+        {
+            pTarget->m_argIsObservable.push_back(isObservable);
+            pTarget->m_argTypeSpan.push_back(getTypeSig(paramTypeReader));
         }
+    }
+
+    ATLTRACE(L"%s has %d interesting args", methodCallInfo.name.c_str(),
+        std::count(pTarget->m_argIsObservable.begin(), pTarget->m_argIsObservable.end(), true));
+
+    return pTarget;
+}
 
-        // If there's any generic stuff going on, we need to fabricate new bits of
-        // sig using the type/method type arguments rather than just returning the
-        // appropriate span of the method sig. Set up a function to do this.
-        std::function<SigSpanOrVector(SignatureTypeReader&)> getSigSpanOrVector;
-        if (!methodTypeArgs.empty() || !typeTypeArgs.empty())
+bool MethodBodyInstrumenter::TryFindObservableCalls()
+{
+    for (auto it = m_method->m_instructions.begin(); it < m_method->m_instructions.end(); it++)
+    {
+        auto pInstr = *it;
+        auto operation = pInstr->m_operation;
+        if (operation != CEE_CALL && operation != CEE_CALLVIRT)
         {
-            getSigSpanOrVector = [&typeTypeArgs, &methodTypeArgs](SignatureTypeReader& tr) {
-                return tr.SubstituteTypeArgs(typeTypeArgs, methodTypeArgs);
-            };
+            // We're only interested in call instructions
+            continue;
         }
-        else
+
+        mdToken calledMethodToken = static_cast<mdToken>(pInstr->m_operand);
+        std::shared_ptr<ObservableCallTarget> pTarget = GetCallTarget(calledMethodToken);
+        if (!pTarget)
         {
-            getSigSpanOrVector = [](SignatureTypeReader& tr) {
-                return tr.GetSigSpan();
-            };
+            continue;
         }
 
+        ATLTRACE(L"%s calls %s (RVA %x)", m_methodProps.name.c_str(), pTarget->m_calledMethodName.c_str(),
+            m_methodProps.codeRva + pInstr->m_origOffset);
+
         ObservableCallInfo callInfo;
         int prefixLength = 0;
         auto prefixIt = it;
         while (prefixIt != m_method->m_instructions.begin())
         {
             prefixIt--;
-            auto pPotentialPrefixInstr = prefixIt->get();
-            if (Operations::m_mapNameOperationDetails[pPotentialPrefixInstr->m_operation].opcodeKind != IPrefix)
+            auto pPotentialPrefixInstr = *prefixIt;
+            if (Operations::GetDetails(pPotentialPrefixInstr->m_operation).opcodeKind != IPrefix)
             {
                 break;
             }
@@ -315,129 +527,117 @@ bool MethodBodyInstrumenter::TryFindObservableCalls()
             prefixLength += pPotentialPrefixInstr->length();
         }
 
-        callInfo.m_returnObservableTypeRef = returnTypeRef;
-        callInfo.m_calledMethodName = methodCallInfo.name;
+        callInfo.m_pTarget = pTarget;
         callInfo.m_instructionOffset = pInstr->m_origOffset - prefixLength;
         callInfo.m_instructionLength = prefixLength + pInstr->length();
 
-        // Record the return type
-        returnTypeReader.MoveNextTypeArg();
-        if (returnTypeRef == observableTypeRefs.m_IGroupedObservable)
-        {
-            // First type arg to IGroupedObservable is TKey, we want the second, TElement.
-            returnTypeReader.MoveNextTypeArg();
-        }
-        callInfo.m_returnTypeArg = getSigSpanOrVector(returnTypeReader.GetTypeReader());
-        callInfo.m_returnType = getSigSpanOrVector(returnTypeReader);
+        m_observableCalls.push_back(std::move(callInfo));
+    }
+
+    return !m_observableCalls.empty();
+}
 
-        // Now look at the arguments
-        while (sigReader.MoveNextParam())
+void MethodBodyInstrumenter::DefineInstrumentationTokens(ObservableCallTarget& target, CMetadataEmit& emit)
+{
+    target.m_argumentMethodSpecs.resize(target.m_argIsObservable.size());
+    for (size_t arg = 0; arg < target.m_argIsObservable.size(); arg++)
+    {
+        if (target.m_argIsObservable[arg])
         {
-            auto paramReader = sigReader.GetParamReader();
-            if (paramReader.IsTypedByRef() || paramReader.IsByRef())
-            {
-                // Avoid dealing with anything except by-value args for now. This means
-                // we can't do anything with earlier args either.
-                callInfo.m_argIsObservable.clear();
-                callInfo.m_argTypeSpan.clear();
-                continue;
-            } 
-             
-            auto paramTypeReader = paramReader.GetTypeReader();
-            auto paramTypeKind = paramTypeReader.GetTypeKind();
-            // Interesting arguments could include observables, delegates returning observables,
-            // Tasks returning observables, arrays of observables, and probably others.
-            // Here we just filter out value types and some other less common stuff, and leave
-            // it to the Instrument methods in the support assembly to decide whether to do anything
-            // with the rest.
-            bool isObservable =
-                paramTypeKind == ELEMENT_TYPE_CLASS ||
-                paramTypeKind == ELEMENT_TYPE_GENERICINST ||
-                paramTypeKind == ELEMENT_TYPE_SZARRAY;
-
-            // No need to start recording arg info until the first observable arg
-            if (isObservable || !callInfo.m_argIsObservable.empty())
-            {
-                callInfo.m_argIsObservable.push_back(isObservable);
-                callInfo.m_argTypeSpan.push_back(getSigSpanOrVector(paramTypeReader));
-            }
+            std::vector<COR_SIGNATURE> argumentCallSig;
+            MethodSpecSignatureWriter(argumentCallSig, 1).AddTypeArg(target.m_argTypeSpan[arg]);
+
+            target.m_argumentMethodSpecs[arg] = DefineMethodSpec(supportRefs.m_Argument, argumentCallSig, emit);
         }
+    }
 
-        ATLTRACE(L"%s has %d interesting args", methodCallInfo.name.c_str(),
-            std::count(callInfo.m_argIsObservable.begin(), callInfo.m_argIsObservable.end(), true));
+    std::vector<COR_SIGNATURE> sig;
+    MethodSpecSignatureWriter sigWriter(sig, 1);
+    sigWriter.AddTypeArg(target.m_returnTypeArg);
 
-        m_observableCalls.push_back(std::move(callInfo));
+    if (target.m_returnObservableTypeRef == observableTypeRefs.m_IObservable)
+    {
+        target.m_returnedMethodSpec = DefineMethodSpec(supportRefs.m_Returned, sig, emit);
     }
+    else
+    {
+        target.m_returnTypeSpec = DefineTypeSpec(target.m_returnType, emit);
+        target.m_returnedMethodSpec = DefineMethodSpec(supportRefs.m_ReturnedSubinterface, sig, emit);
+    }
+}
 
-    return !m_observableCalls.empty();
+// The following define tokens through the module's signature pool, so that calls to different
+// methods that need the same instantiation (Argument<IObservable<int>>, say) share one token,
+// as do methods whose extended locals come out the same.
+mdMethodSpec MethodBodyInstrumenter::DefineMethodSpec(mdToken genericMethodToken, const SignatureBlob& sigBlob, CMetadataEmit& emit)
+{
+    SignaturePool& signatures = m_perModuleData.m_signatures;
+    SignatureBlob internedSig = signatures.Intern(sigBlob);
+    return signatures.GetToken(genericMethodToken, internedSig, [&] { return emit.DefineMethodSpec({ genericMethodToken, internedSig }); });
+}
+
+mdTypeSpec MethodBodyInstrumenter::DefineTypeSpec(const SignatureBlob& sigBlob, CMetadataEmit& emit)
+{
+    SignaturePool& signatures = m_perModuleData.m_signatures;
+    SignatureBlob internedSig = signatures.Intern(sigBlob);
+    return signatures.GetToken(mdTypeSpecNil, internedSig, [&] { return emit.DefineTypeSpec(internedSig); });
+}
+
+mdSignature MethodBodyInstrumenter::GetTokenFromSig(const SignatureBlob& sigBlob, CMetadataEmit& emit)
+{
+    SignaturePool& signatures = m_perModuleData.m_signatures;
+    SignatureBlob internedSig = signatures.Intern(sigBlob);
+    return signatures.GetToken(mdSignatureNil, internedSig, [&] { return emit.GetTokenFromSig(internedSig); });
 }
 
 void MethodBodyInstrumenter::InstrumentCall(ObservableCallInfo& call, CMetadataEmit& emit)
 {
     int32_t instrumentationPoint = ++s_instrumentationIdSource;
 
+    ObservableCallTarget& target = *call.m_pTarget;
+    std::call_once(target.m_tokensDefined, [&] { DefineInstrumentationTokens(target, emit); });
+
     InstructionList preCallInstrs;
-    if (!call.m_argIsObservable.empty())
+    if (!target.m_argIsObservable.empty())
     {
         // Calling Instrument.Argument(arg, n) on each observable arg means we need to
-        // stash the stacked argument values somewhere temporarily, so add some extra
-        // locals.
-        // (Currently not taking account of the possibility of sharing these locals between
-        // multiple instrumentations.)
-        std::vector<SignatureBlob> argTypeSpans;
-        std::transform(
-            call.m_argTypeSpan.begin(), call.m_argTypeSpan.end(),
-            std::back_inserter(argTypeSpans),
-            getSpan);
-        int argCount = static_cast<int>(call.m_argIsObservable.size()); // not necessarily all args, but the ones we're dealing with
-
-        mdSignature localsSigTok = m_method->GetLocalsSignature();
-        std::vector<COR_SIGNATURE> extendedLocalsSig;
-        int existingLocalsCount;
-        if (IsNilToken(localsSigTok))
+        // stash the stacked argument values somewhere temporarily, so take some locals
+        // from the method's allocator. They're only live until the call, so locals of the
+        // same type can be shared with other call sites.
+        if (!m_pLocals)
         {
-            existingLocalsCount = 0;
-            extendedLocalsSig = LocalsSignatureWriter::MakeSig(argCount, [&](LocalsSignatureWriter& w) {
-                std::for_each(argTypeSpans.begin(), argTypeSpans.end(), 
-                    [&](SignatureBlob b) { w.WriteLocal().Write(b); });
-            });
+            mdSignature localsSigTok = m_method->GetLocalsSignature();
+            m_pLocals = std::make_unique<LocalsAllocator>(IsNilToken(localsSigTok) ? SignatureBlob() : m_metadataImport.GetSigFromToken(localsSigTok));
         }
-        else
+
+        int argCount = static_cast<int>(target.m_argIsObservable.size()); // not necessarily all args, but the ones we're dealing with
+
+        // Don't need a local for arg 0 as it stays on the stack.
+        std::vector<ULONG> argLocals(argCount);
+        for (int arg = 1; arg < argCount; arg++)
         {
-            SignatureBlob localsSigBlob;
-            localsSigBlob = m_metadataImport.GetSigFromToken(localsSigTok);
-            LocalsSignatureReader localsSigReader(localsSigBlob);
-            existingLocalsCount = localsSigReader.GetCount();
-            extendedLocalsSig = localsSigReader.AppendLocals(argTypeSpans);
+            argLocals[arg] = m_pLocals->Allocate(target.m_argTypeSpan[arg]);
         }
-
-        mdSignature extendedLocalsTok = emit.GetTokenFromSig(extendedLocalsSig);
-        ATLTRACE("Got extended locals token: %x for %s", extendedLocalsTok, FormatBytes(extendedLocalsSig).c_str());
-        m_method->SetLocalsSignature(extendedLocalsTok);
+        m_pLocals->ReleaseAll();
 
         // Step 1: working backwards through the args, store each arg into its local.
         // Don't do arg 0 as we'd just have to load it again.
         for (int arg = argCount - 1; arg > 0; arg--)
         {
-            preCallInstrs.push_back(std::make_unique<Instruction>(CEE_STLOC, existingLocalsCount + arg));
+            preCallInstrs.push_back(std::make_unique<Instruction>(CEE_STLOC, argLocals[arg]));
         }
         // Step 2: working forwards through the args, load each arg, and call Instrument.Argument if observable.
         for (int arg = 0; arg < argCount; arg++)
         {
             if (arg > 0)
             {
-                preCallInstrs.push_back(std::make_unique<Instruction>(CEE_LDLOC, existingLocalsCount + arg));
+                preCallInstrs.push_back(std::make_unique<Instruction>(CEE_LDLOC, argLocals[arg]));
             }
 
-            if (call.m_argIsObservable[arg])
+            if (target.m_argIsObservable[arg])
             {
-                std::vector<COR_SIGNATURE> argumentCallSig;
-                MethodSpecSignatureWriter(argumentCallSig, 1).AddTypeArg(getSpan(call.m_argTypeSpan[arg]));
-
-                mdMethodSpec argumentMethodSpecToken = emit.DefineMethodSpec({ supportRefs.m_Argument, argumentCallSig });
-
                 preCallInstrs.push_back(std::make_unique<Instruction>(CEE_LDC_I4, instrumentationPoint));
-                preCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, argumentMethodSpecToken));
+                preCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, target.m_argumentMethodSpecs[arg]));
             }
         }
     }
@@ -447,50 +647,137 @@ void MethodBodyInstrumenter::InstrumentCall(ObservableCallInfo& call, CMetadataE
     preCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, supportRefs.m_Calling));
 
     ATLTRACE("Inserting %d instructions at %x", preCallInstrs.size(), call.m_instructionOffset);
-    m_method->InsertInstructionsAtOriginalOffset(
+    m_method->QueueInstructionsAtOriginalOffset(
         call.m_instructionOffset,
         preCallInstrs);
 
     // Generate a call to Instrument.Returned(retval, n) or ReturnedSubinterface(retval, n, type)
     // to be inserted right after the call.
-    std::vector<COR_SIGNATURE> sig;
-    MethodSpecSignatureWriter sigWriter(sig, 1);
-    sigWriter.AddTypeArg(getSpan(call.m_returnTypeArg));
-
     InstructionList postCallInstrs;
     // Initially on the stack is the returned value from the call, and this will be the first
     // argument to our generated call. Push the instrumentation point ID as the second argument.
     postCallInstrs.push_back(std::make_unique<Instruction>(CEE_LDC_I4, instrumentationPoint));
 
-    if (call.m_returnObservableTypeRef == observableTypeRefs.m_IObservable)
+    if (target.m_returnObservableTypeRef == observableTypeRefs.m_IObservable)
     {
-        mdMethodSpec methodSpecToken = emit.DefineMethodSpec({ supportRefs.m_Returned, sig });
-        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, methodSpecToken));
+        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, target.m_returnedMethodSpec));
     }
     else
     {
-        mdTypeSpec returnTypeSpecToken = emit.DefineTypeSpec(getSpan(call.m_returnType));
-
         // Push the type handle of the return type as the third argument.
-        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_LDTOKEN, returnTypeSpecToken));
-        mdMethodSpec methodSpecToken = emit.DefineMethodSpec({ supportRefs.m_ReturnedSubinterface, sig });
-        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, methodSpecToken));
+        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_LDTOKEN, target.m_returnTypeSpec));
+        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_CALL, target.m_returnedMethodSpec));
 
         // Need to cast the return value to the expected subtype
-        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_CASTCLASS, returnTypeSpecToken));
+        postCallInstrs.push_back(std::make_unique<Instruction>(CEE_CASTCLASS, target.m_returnTypeSpec));
     }
 
     long offsetToInsertAt = call.m_instructionOffset + call.m_instructionLength;
     ATLTRACE("Inserting %d instructions at %x", postCallInstrs.size(), offsetToInsertAt);
-    m_method->InsertInstructionsAtOriginalOffset(
+    m_method->QueueInstructionsAtOriginalOffset(
         offsetToInsertAt,
         postCallInstrs);
 
-    g_Store.AddInstrumentationInfo(
-        instrumentationPoint, 
-        m_instrumentedMethodId,
-        call.m_instructionOffset,
-        call.m_calledMethodName);
+    m_instrumentationPoints.push_back({ instrumentationPoint, call.m_instructionOffset, call.m_pTarget });
+}
+
+// Sets the rewritten method's MaxStack to what it actually needs, which also checks that the
+// instrumentation has left the stack consistent. Returns false if it hasn't.
+bool MethodBodyInstrumenter::SetStackSize(const IMAGE_COR_ILMETHOD* pOriginalMethodImage)
+{
+    try
+    {
+        m_method->SetStackSize(m_method->CalculateMaxStack(GetStackEffectLookup(m_metadataImport, m_methodProps.sigBlob)));
+        return true;
+    }
+    catch (const std::exception& ex)
+    {
+        ATLTRACE("Stack analysis of rewritten method failed: %s", ex.what());
+    }
+
+    // Only blame the instrumentation if the original method can be analysed: it could be using
+    // calls whose signatures we don't read, or code the verifier wouldn't accept anyway.
+    try
+    {
+        Method(pOriginalMethodImage).CalculateMaxStack(GetStackEffectLookup(m_metadataImport, m_methodProps.sigBlob));
+    }
+    catch (const std::exception&)
+    {
+        // allow for up to two additional arguments pushed in post-call instrumentation
+        m_method->IncrementStackSize(2);
+        return true;
+    }
+
+    RELTRACE(L"Instrumentation of %s leaves the stack inconsistent - not rewriting it", m_methodProps.name.c_str());
+    return false;
+}
+
+static SignatureBlob GetCalledMethodSig(const CMetadataImport& metadata, mdToken method)
+{
+    if (TypeFromToken(method) == mdtMethodSpec)
+    {
+        method = metadata.GetMethodSpecProps(method).genericMethodToken;
+    }
+
+    switch (TypeFromToken(method))
+    {
+    case mdtMethodDef:
+        return metadata.GetMethodProps(method).sigBlob;
+    case mdtMemberRef:
+        return metadata.GetMemberRefProps(method).sigBlob;
+    case mdtSignature: // calli
+        return metadata.GetSigFromToken(method);
+    default:
+        throw std::domain_error("Unexpected token type for call");
+    }
+}
+
+static bool ReturnsValue(MethodSignatureReader& sigReader)
+{
+    sigReader.MoveNextParam();
+    return !sigReader.GetParamReader().IsVoid();
+}
+
+StackEffectLookup GetStackEffectLookup(const CMetadataImport& metadata, const SignatureBlob& methodSig)
+{
+    MethodSignatureReader methodSigReader(methodSig);
+    int returnCount = ReturnsValue(methodSigReader) ? 1 : 0;
+
+    // Methods tend to make several calls to the same method, so keep what we find out about
+    // each one rather than going back to the metadata.
+    std::unordered_map<mdToken, StackEffect> callEffects;
+
+    return [=](const Instruction& instr) mutable -> StackEffect {
+        if (instr.m_operation == CEE_RET)
+        {
+            return { returnCount, 0 };
+        }
+
+        mdToken method = static_cast<mdToken>(instr.m_operand);
+        auto it = callEffects.find(method);
+        if (it == callEffects.end())
+        {
+            MethodSignatureReader sigReader(GetCalledMethodSig(metadata, method));
+            int argCount = static_cast<int>(sigReader.ParamCount());
+            if (sigReader.HasThis() && !sigReader.HasExplicitThis())
+            {
+                argCount++;
+            }
+
+            it = callEffects.emplace(method, StackEffect{ argCount, ReturnsValue(sigReader) ? 1 : 0 }).first;
+        }
+
+        StackEffect effect = it->second;
+        if (instr.m_operation == CEE_NEWOBJ)
+        {
+            effect.pop--; // the new object is passed as this, rather than taken from the stack
+        }
+        else if (instr.m_operation == CEE_CALLI)
+        {
+            effect.pop++; // the function pointer
+        }
+        return effect;
+    };
 }
 
 MethodCallInfo MethodBodyInstrumenter::GetMethodCallInfo(mdToken method)
@@ -10,6 +10,7 @@
 static bool IsSystemAssembly(const AssemblyProps& assemblyProps);
 static bool IsMscorlib(const AssemblyProps& assemblyProps);
 static bool IsSupportAssembly(const AssemblyProps& assemblyProps);
+static bool IsEagerRewriteEnabled();
 
 // CRxProfiler
 
@@ -35,13 +36,23 @@ HRESULT CRxProfiler::Initialize(
             COR_PRF_MONITOR_JIT_COMPILATION,
             COR_PRF_HIGH_ADD_ASSEMBLY_REFERENCES
         );
+
+        if (IsEagerRewriteEnabled())
+        {
+            // Leave a core for the threads doing the actual work of the application.
+            unsigned threadCount = std::thread::hardware_concurrency();
+            threadCount = threadCount > 1 ? threadCount - 1 : 1;
+            RELTRACE("Eager rewriting enabled (%u threads)", threadCount);
+            m_pEagerRewritePool = std::make_unique<worker_pool>(threadCount);
+        }
     });
 }
 
 HRESULT CRxProfiler::Shutdown()
 {
-    return HandleExceptions([] {
+    return HandleExceptions([=] {
         RELTRACE("Shutdown");
+        m_pEagerRewritePool.reset();
         RemoveTransientRegistryKey();
     });
 }
@@ -87,7 +98,15 @@ HRESULT CRxProfiler::ModuleLoadFinished(
             // But we don't need to report modules with no Rx involvement
             if (pPerModuleData->m_referencesObservableTypes)
             {
+                CMetadataImport metadataImport = m_profilerInfo.GetMetadataImport(moduleId, ofRead);
+                pPerModuleData->m_methodsNotRewritten.reset(metadataImport.GetMethodDefCount() + 1);
+
                 g_Store.AddModuleInfo(moduleId, moduleInfo.name, pPerModuleData->m_assemblyProps.name);
+
+                if (m_pEagerRewritePool)
+                {
+                    QueueEagerRewrites(moduleId, pPerModuleData);
+                }
             }
         }
     });
@@ -118,7 +137,8 @@ HRESULT CRxProfiler::JITCompilationStarted(FunctionID functionId, BOOL fIsSafeTo
         FunctionInfo info = m_profilerInfo.GetFunctionInfo(functionId);
         std::shared_ptr<PerModuleData> pPerModuleData;
         if (!m_moduleInfoMap.try_get(info.moduleId, pPerModuleData) ||
-            !pPerModuleData->m_referencesObservableTypes)
+            !pPerModuleData->m_referencesObservableTypes ||
+            pPerModuleData->m_methodsNotRewritten.test(RidFromToken(info.functionToken)))
         {
             return;
         }
@@ -132,6 +152,24 @@ HRESULT CRxProfiler::JITCompilationStarted(FunctionID functionId, BOOL fIsSafeTo
     });
 }
 
+// Set REACTIVITYPROFILER_EAGERREWRITE to rewrite the IL of all methods in a module on a
+// background thread pool when the module loads, rather than when each method is JIT compiled.
+// This trades memory for first-call latency: every method with an observable call gets a new
+// body from AllocateFunctionBody, plus its locals signature and MethodSpecs in the module's
+// metadata, whether or not it's ever called, and none of that loader heap memory is given back
+// until the module unloads. TestProfilee's "firstcall" mode times the difference.
+bool IsEagerRewriteEnabled()
+{
+    wchar_t value[16];
+    DWORD length = GetEnvironmentVariableW(L"REACTIVITYPROFILER_EAGERREWRITE", value, ARRAYSIZE(value));
+    if (length == 0 || length >= ARRAYSIZE(value))
+    {
+        return length != 0;
+    }
+
+    return lstrcmpi(value, L"0") != 0 && lstrcmpi(value, L"false") != 0;
+}
+
 bool IsSystemAssembly(const AssemblyProps& assemblyProps)
 {
     if (IsMscorlib(assemblyProps))
@@ -9,6 +9,7 @@
 #include "ProfileBase.h"
 #include "ProfilerInfo.h"
 #include "concurrentmap.h"
+#include "workerpool.h"
 #include "Instrumentation/Method.h"
 
 using namespace ATL;
@@ -82,10 +83,12 @@ private:
     concurrent_map<ModuleID, std::shared_ptr<PerModuleData>> m_moduleInfoMap;
     RuntimeInfo m_runtimeInfo;
     std::atomic<ModuleID> m_supportAssemblyModuleId;
+    std::unique_ptr<worker_pool> m_pEagerRewritePool; // only if eager rewriting is enabled
 
     void InstallAssemblyResolutionHandler(ModuleID mscorlibId);
     bool ReferencesObservableInterfaces(ModuleID moduleId, ObservableTypeReferences& typeRefs);
     void AddSupportAssemblyReference(ModuleID moduleId, PerModuleData& perModuleData);
+    void QueueEagerRewrites(ModuleID moduleId, const std::shared_ptr<PerModuleData>& pPerModuleData);
     void InstrumentMethodBody(FunctionID functionId, const MethodProps& name, const FunctionInfo& info, CMetadataImport& metadata, std::shared_ptr<PerModuleData>& pPerModuleData);
 };
 
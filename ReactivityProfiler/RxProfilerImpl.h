@@ -1,5 +1,9 @@
 #pragma once
 
+#include "concurrentbitset.h"
+#include "concurrentmap.h"
+#include "SignaturePool.h"
+
 struct ObservableTypeReferences
 {
     mdTypeRef m_IObservable = 0;
@@ -17,10 +21,66 @@ struct SupportAssemblyReferences
     mdMemberRef m_ReturnedSubinterface = 0;
 };
 
+struct ObservableCallTarget;
+
+// An instrumented call in a rewritten function.
+struct InstrumentationPointInfo
+{
+    int32_t m_instrumentationPoint;
+    int32_t m_instructionOffset;
+    std::shared_ptr<ObservableCallTarget> m_pTarget;
+};
+
 struct RewrittenFunctionData
 {
     simplespan<byte> m_rewrittenILBuffer;
-    simplespan<COR_IL_MAP> m_instrumentedCodeMap;
+    std::vector<COR_IL_MAP> m_instrumentedCodeMap; // copied for each function ID the body is set for
+
+    // Recorded in the store when the rewritten body is first set.
+    int32_t m_instrumentedMethodId = 0;
+    std::wstring m_owningTypeName;
+    std::vector<InstrumentationPointInfo> m_instrumentationPoints;
+};
+
+// Rewrite of a function's IL. It may be queued for eager rewriting when its module loads,
+// or created when the function is JIT compiled; whichever thread gets to it first runs it,
+// and any others wait for the result.
+class RewriteTask
+{
+public:
+    RewriteTask(std::function<RewrittenFunctionData()> rewrite) :
+        m_task(std::move(rewrite)),
+        m_result(m_task.get_future().share())
+    {
+    }
+
+    void Run()
+    {
+        std::call_once(m_started, [this] {
+            m_task();
+
+            // Let go of the rewrite, and whatever it holds, now the result is ready.
+            m_task = std::packaged_task<RewrittenFunctionData()>();
+        });
+    }
+
+    const RewrittenFunctionData& GetResult()
+    {
+        Run();
+        return m_result.get();
+    }
+
+    // Calls report the first time it's called; any other callers wait until that's done.
+    void ReportOnce(const std::function<void()>& report)
+    {
+        std::call_once(m_reported, report);
+    }
+
+private:
+    std::packaged_task<RewrittenFunctionData()> m_task;
+    std::once_flag m_started;
+    std::once_flag m_reported;
+    std::shared_future<RewrittenFunctionData> m_result;
 };
 
 struct PerModuleData
@@ -32,9 +92,28 @@ struct PerModuleData
     AssemblyProps m_assemblyProps;
     ObservableTypeReferences m_observableTypeRefs;
     SupportAssemblyReferences m_supportAssemblyRefs;
-    std::unordered_map<mdToken, std::future<RewrittenFunctionData>> m_rewrittenFunctions;
+    std::unordered_map<mdToken, std::shared_ptr<RewriteTask>> m_rewrittenFunctions;
+
+    // Indexed by method def RID: set once a method has been scanned and found to need no
+    // rewriting, so that further JIT compilations of it (generic instantiations, re-JIT)
+    // can be skipped without any metadata calls. Read without taking m_mutex.
+    concurrent_bitset m_methodsNotRewritten;
+
+    // Classification of each method token seen as the operand of a call/callvirt: null if
+    // the method doesn't return one of the observable types. Lets a method's calls be checked
+    // without metadata calls before going to the trouble of parsing its IL in full, and
+    // repeated calls to the same method be instrumented without re-reading its signature.
+    concurrent_map<mdToken, std::shared_ptr<ObservableCallTarget>> m_callTargets;
+
+    // Signature blobs made while instrumenting the module's methods, and the tokens defined
+    // for them.
+    SignaturePool m_signatures;
 };
 
+// Gives the stack behaviour of calls and returns in the body of a method with the given
+// signature, so that Method::CalculateMaxStack can work out the size of its stack.
+extern Instrumentation::StackEffectLookup GetStackEffectLookup(const CMetadataImport& metadata, const SignatureBlob& methodSig);
+
 extern const wchar_t* GetSupportAssemblyName();
 extern std::wstring GetSupportAssemblyPath();
 extern void RemoveTransientRegistryKey();
@@ -122,6 +122,7 @@ void CRxProfiler::AddSupportAssemblyReference(ModuleID moduleId, PerModuleData&
 
     CMetadataAssemblyEmit assemblyEmit = m_profilerInfo.GetMetadataAssemblyEmit(moduleId, ofRead | ofWrite);
     CMetadataEmit emit = m_profilerInfo.GetMetadataEmit(moduleId, ofRead | ofWrite);
+    CMetadataImport metadataImport = m_profilerInfo.GetMetadataImport(moduleId, ofRead);
 
     static byte c_mscorlibPublicKeyToken[] = { 0xb7, 0x7a, 0x5c, 0x56, 0x19, 0x34, 0xe0, 0x89 };
     ASSEMBLYMETADATA mscorlibMetadata = {};
@@ -193,6 +194,8 @@ void CRxProfiler::AddSupportAssemblyReference(ModuleID moduleId, PerModuleData&
             builder.SetLocalsSignature(sigToken);
         }
 
+        builder.SetStackSize(builder.CalculateMaxStack(GetStackEffectLookup(metadataImport, metadataImport.GetMethodProps(token).sigBlob)));
+
 #ifdef DEBUG
         builder.DumpIL(true);
 #endif
@@ -307,6 +310,8 @@ void CRxProfiler::InstallAssemblyResolutionHandler(ModuleID hostModuleId)
             builder.SetLocalsSignature(sigToken);
         }
 
+        builder.SetStackSize(builder.CalculateMaxStack(GetStackEffectLookup(metadataImport, metadataImport.GetMethodProps(token).sigBlob)));
+
 #ifdef DEBUG
         builder.DumpIL(true);
 #endif
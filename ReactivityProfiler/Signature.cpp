@@ -2,8 +2,6 @@
 
 #include "Signature.h"
 
-typedef const COR_SIGNATURE* sigPtr;
-
 // Implement additional methods as and when they are needed
 class SignatureVisitor
 {
@@ -73,556 +71,489 @@ private:
     const std::vector<SignatureBlob>& m_methodTypeArgSpans;
 };
 
-class PrimitiveReader
+void PrimitiveReader::LimitExceeded()
 {
-public:
-    PrimitiveReader(sigPtr start, sigPtr limit) :
-        m_limit(limit),
-        m_ptr(start)
-    {
-    }
-
-    PrimitiveReader(const SignatureBlob& span) : PrimitiveReader(span.begin(), span.end())
-    {
-    }
+    throw std::domain_error("PrimitiveReader: ran beyond end of sig blob");
+}
 
-    byte ReadByte()
+// Reads the two and four byte forms, checking the bounds once for the whole value.
+ULONG PrimitiveReader::ReadLongCompressedUnsigned(byte b1)
+{
+    if ((b1 & 0x40) == 0)
     {
-        if (m_ptr >= m_limit)
+        if (m_limit - m_ptr < 2)
         {
             LimitExceeded();
         }
 
-        return *m_ptr++;
+        ULONG value = ((b1 & 0x3f) << 8) | m_ptr[1];
+        m_ptr += 2;
+        return value;
     }
 
-    byte PeekByte()
+    if (m_limit - m_ptr < 4)
     {
-        if (m_ptr >= m_limit)
-        {
-            LimitExceeded();
-        }
-
-        return *m_ptr;
+        LimitExceeded();
     }
 
-    ULONG ReadCompressedUnsigned();
-    LONG ReadCompressedSigned();
-    mdToken ReadTypeDefOrRefEncoded();
+    ULONG value = ((b1 & 0x3f) << 24) | (m_ptr[1] << 16) | (m_ptr[2] << 8) | m_ptr[3];
+    m_ptr += 4;
+    return value;
+}
 
-    sigPtr GetPtr()
-    {
-        return m_ptr;
-    }
+LONG PrimitiveReader::ReadCompressedSigned()
+{
+    // The value is rotated left one bit within the 6, 13 or 28 bits of the encoding length, so
+    // the sign ends up in bit 0. This relies on signed ints using 2's complement.
+    byte b1 = PeekByte();
+    ULONG rotated = ReadCompressedUnsigned();
+    ULONG signBits = (b1 & 0x80) == 0 ? 0xffffffc0 : (b1 & 0x40) == 0 ? 0xffffe000 : 0xf0000000;
 
-    void SetPtr(sigPtr ptr)
+    ULONG bits = rotated >> 1;
+    if (rotated & 1)
     {
-        m_ptr = ptr;
+        bits |= signBits;
     }
+    return static_cast<LONG>(bits);
+}
 
-private:
-    const sigPtr m_limit;
-    sigPtr m_ptr;
-
-    void LimitExceeded()
+mdToken PrimitiveReader::ReadTypeDefOrRefEncoded()
+{
+    ULONG typeDefOrRef = ReadCompressedUnsigned();
+    ULONG rid = typeDefOrRef >> 2;
+    switch (typeDefOrRef & 3)
     {
-        throw std::domain_error("PrimitiveReader: ran beyond end of sig blob");
+    case 0: // type def
+        return TokenFromRid(mdtTypeDef, rid);
+    case 1: // type ref
+        return TokenFromRid(mdtTypeRef, rid);
+    case 2: // type spec
+        return TokenFromRid(mdtTypeSpec, rid);
+    default: // not defined
+        throw std::domain_error("ReadTypeDefOrRefEncoded: bad token encoding");
     }
-};
-
-typedef std::unique_ptr<PrimitiveReader> UniquePrimitiveReader;
+}
 
-class ReaderBase
+void PrimitiveReader::SkipTypeDefOrRefEncoded()
 {
-public:
-    ReaderBase(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-        m_reader(std::move(reader)),
-        m_visitor(visitor)
+    SkipCompressed();
+    if ((m_ptr[-1] & 3) == 3)
     {
+        throw std::domain_error("ReadTypeDefOrRefEncoded: bad token encoding");
     }
+}
 
-    virtual ~ReaderBase()
+bool PrimitiveReader::TryReadCustomModifier(std::pair<mdToken, bool>& modifier)
+{
+    byte b = PeekByte();
+    if (b != ELEMENT_TYPE_CMOD_OPT && b != ELEMENT_TYPE_CMOD_REQD)
     {
+        return false;
     }
 
-    void SetVisitor(SignatureVisitor* visitor)
-    {
-        ResetToStartForVisitor();
-        m_visitor = visitor;
-        m_visitor->Attached(GetPtr());
-    }
+    ReadByte();
+    modifier = { ReadTypeDefOrRefEncoded(), b == ELEMENT_TYPE_CMOD_REQD };
+    return true;
+}
 
-protected:
-    virtual void ResetToStartForVisitor()
+void PrimitiveReader::SkipCustomModifiers()
+{
+    for (;;)
     {
-        throw std::logic_error("SetVisitor operation not supported");
-    }
-    virtual void MoveToEnd() = 0;
+        byte b = PeekByte();
+        if (b != ELEMENT_TYPE_CMOD_OPT && b != ELEMENT_TYPE_CMOD_REQD)
+        {
+            return;
+        }
 
-    template<typename TReader, typename ... TArgs>
-    std::shared_ptr<TReader> CreateChildReader(TArgs... args)
-    {
-        return std::make_shared<TReader>(std::move(m_reader), GetVisitor(), args...);
+        m_ptr++;
+        SkipTypeDefOrRefEncoded();
     }
+}
 
-    template<typename TReader>
-    void EndChildReader(std::shared_ptr<TReader>& pChildReader)
+void PrimitiveReader::SkipType(SignatureVisitor* visitor)
+{
+    // The element types of pointers and arrays, and the type args of generic instances, follow
+    // on one after another to the end of the type, so rather than recursing for each, keep count
+    // of how many types are still to be skipped. Only ARRAY, which has its shape after its element
+    // type, and FNPTR need to recurse.
+    uint64_t pending = 1;
+    do
     {
-        ReclaimPrimitiveReader(*pChildReader);
-        pChildReader.reset();
-    }
+        pending--;
+        sigPtr start = m_ptr;
+        byte typeKind = ReadByte();
+        switch (typeKind)
+        {
+        case ELEMENT_TYPE_BOOLEAN:
+        case ELEMENT_TYPE_CHAR:
+        case ELEMENT_TYPE_I1:
+        case ELEMENT_TYPE_I2:
+        case ELEMENT_TYPE_I4:
+        case ELEMENT_TYPE_I8:
+        case ELEMENT_TYPE_U1:
+        case ELEMENT_TYPE_U2:
+        case ELEMENT_TYPE_U4:
+        case ELEMENT_TYPE_U8:
+        case ELEMENT_TYPE_R4:
+        case ELEMENT_TYPE_R8:
+        case ELEMENT_TYPE_I:
+        case ELEMENT_TYPE_U:
+        case ELEMENT_TYPE_OBJECT:
+        case ELEMENT_TYPE_STRING:
+            break;
+
+        case ELEMENT_TYPE_CLASS:
+        case ELEMENT_TYPE_VALUETYPE:
+            SkipTypeDefOrRefEncoded();
+            break;
+
+        case ELEMENT_TYPE_GENERICINST:
+            ReadByte();
+            SkipTypeDefOrRefEncoded();
+            pending += ReadCompressedUnsigned();
+            break;
+
+        case ELEMENT_TYPE_MVAR:
+        case ELEMENT_TYPE_VAR:
+            if (visitor)
+            {
+                ULONG varNumber = ReadCompressedUnsigned();
+                if (typeKind == ELEMENT_TYPE_MVAR)
+                {
+                    visitor->VisitMethodTypeVariable(varNumber, { start, m_ptr });
+                }
+                else
+                {
+                    visitor->VisitTypeTypeVariable(varNumber, { start, m_ptr });
+                }
+            }
+            else
+            {
+                SkipCompressed();
+            }
+            break;
 
-    PrimitiveReader& PrimitiveReader()
-    {
-        return *m_reader;
-    }
+        case ELEMENT_TYPE_PTR:
+            SkipCustomModifiers();
+            if (PeekByte() == ELEMENT_TYPE_VOID)
+            {
+                m_ptr++;
+            }
+            else
+            {
+                pending++;
+            }
+            break;
 
-    byte ReadByte()
-    {
-        return m_reader->ReadByte();
-    }
+        case ELEMENT_TYPE_SZARRAY:
+            SkipCustomModifiers();
+            pending++;
+            break;
 
-    byte PeekByte()
-    {
-        return m_reader->PeekByte();
-    }
+        case ELEMENT_TYPE_ARRAY:
+        case ELEMENT_TYPE_FNPTR:
+            if (++m_nesting > c_maxNesting)
+            {
+                throw std::domain_error("PrimitiveReader::SkipType - types nested too deeply");
+            }
 
-    ULONG ReadCompressedUnsigned()
-    {
-        return m_reader->ReadCompressedUnsigned();
-    }
+            if (typeKind == ELEMENT_TYPE_ARRAY)
+            {
+                SkipType(visitor);
+                SkipArrayShape();
+            }
+            else
+            {
+                SkipMethodSignature(visitor);
+            }
+            m_nesting--;
+            break;
 
-    LONG ReadCompressedSigned()
-    {
-        return m_reader->ReadCompressedSigned();
-    }
+        default:
+            throw std::domain_error("PrimitiveReader::SkipType - bad type element");
+        }
+    } while (pending != 0);
+}
 
-    mdToken ReadTypeDefOrRefEncoded()
+bool PrimitiveReader::SkipParamModifiers(ParamKind kind)
+{
+    bool isPinned = false;
+    for (;;)
     {
-        return m_reader->ReadTypeDefOrRefEncoded();
+        byte b = PeekByte();
+        if (b == ELEMENT_TYPE_PINNED)
+        {
+            if (kind != ParamKind::Local)
+            {
+                throw std::domain_error("Constraint element is not allowed in a parameter");
+            }
+            m_ptr++;
+            isPinned = true;
+        }
+        else if (b == ELEMENT_TYPE_CMOD_OPT || b == ELEMENT_TYPE_CMOD_REQD)
+        {
+            m_ptr++;
+            SkipTypeDefOrRefEncoded();
+        }
+        else
+        {
+            return isPinned;
+        }
     }
+}
 
-    sigPtr GetPtr()
+void PrimitiveReader::SkipParam(ParamKind kind, SignatureVisitor* visitor)
+{
+    SkipParamModifiers(kind);
+
+    byte b = PeekByte();
+    if (b == ELEMENT_TYPE_TYPEDBYREF)
     {
-        return m_reader->GetPtr();
+        ReadByte();
+        return;
     }
 
-    SignatureVisitor* GetVisitor()
+    if (b == ELEMENT_TYPE_BYREF)
     {
-        return m_visitor;
+        ReadByte();
     }
-
-public:
-    UniquePrimitiveReader&& ReturnPrimitiveReader()
+    else if (b == ELEMENT_TYPE_VOID)
     {
-        MoveToEnd();
-        return std::move(m_reader);
+        if (kind != ParamKind::Return)
+        {
+            throw std::domain_error("PrimitiveReader::SkipParam - Void element in parameter");
+        }
+
+        ReadByte();
+        return;
     }
 
-private:
-    void ReclaimPrimitiveReader(ReaderBase& childReader)
+    SkipType(visitor);
+}
+
+// How much to reserve for a count read from a signature: every item takes at least a byte, so
+// a corrupt count can't make us allocate more than the rest of the blob could hold
+static size_t ReserveCount(size_t count, const PrimitiveReader& reader)
+{
+    return std::min(count, static_cast<size_t>(reader.GetLimit() - reader.GetPtr()));
+}
+
+// Reads the start of a method signature, up to the return "parameter"
+static void ReadMethodSignatureHeader(PrimitiveReader& reader, byte& callConvByte, ULONG& genericParamCount, ULONG& paramCount)
+{
+    const uint16_t c_allowedCallConvs = 0x0511; // excludes localvar, field, property, genericinst & undefined values
+    callConvByte = reader.ReadByte();
+    auto callConv = callConvByte & IMAGE_CEE_CS_CALLCONV_MASK;
+    if (!((1 << callConv) & c_allowedCallConvs))
     {
-        m_reader = childReader.ReturnPrimitiveReader();
+        throw std::domain_error("MethodSignatureReader: sigBlob is not a MethodDefSig/MethodRefSig");
     }
 
-    UniquePrimitiveReader m_reader;
-    SignatureVisitor* m_visitor;
-};
+    genericParamCount = (callConvByte & IMAGE_CEE_CS_CALLCONV_GENERIC) ? reader.ReadCompressedUnsigned() : 0;
+    paramCount = reader.ReadCompressedUnsigned();
+}
 
-class CustomModListReader
+void PrimitiveReader::SkipMethodSignature(SignatureVisitor* visitor)
 {
-public:
-    bool TryRead(PrimitiveReader& reader)
+    byte callConvByte;
+    ULONG genericParamCount, paramCount;
+    ReadMethodSignatureHeader(*this, callConvByte, genericParamCount, paramCount);
+
+    SkipParam(ParamKind::Return, visitor);
+
+    bool inVarArgParams = false;
+    for (ULONG i = 0; i < paramCount; i++)
     {
-        byte b = reader.PeekByte();
-        if (b != ELEMENT_TYPE_CMOD_OPT && b != ELEMENT_TYPE_CMOD_REQD)
+        if (PeekByte() == ELEMENT_TYPE_SENTINEL)
         {
-            return false;
+            ReadByte();
+            inVarArgParams = true;
         }
-
-        m_cmod = reader.ReadByte();
-        m_typeDefOrRef = reader.ReadTypeDefOrRefEncoded();
-        return true;
+        SkipParam(inVarArgParams ? ParamKind::VarArg : ParamKind::Normal, visitor);
     }
+}
 
-    std::pair<mdToken, bool> GetAsPair()
+void PrimitiveReader::SkipArrayShape()
+{
+    SkipCompressed(); // rank
+    ULONG sizesCount = ReadCompressedUnsigned();
+    for (ULONG i = 0; i < sizesCount; i++)
     {
-        return { m_typeDefOrRef, m_cmod == ELEMENT_TYPE_CMOD_REQD };
+        SkipCompressed();
     }
 
-    byte m_cmod = 0;
-    mdToken m_typeDefOrRef = 0;
-};
-
-class MethodSignatureReaderState : public ReaderBase
-{
-public:
-    MethodSignatureReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor);
-
-    bool MoveNextParam();
-
-    void MoveToEnd() override;
-
-    byte m_callConvByte;
-    ULONG m_paramCount;
-    ULONG m_genericParamCount;
+    ULONG loboundsCount = ReadCompressedUnsigned();
+    for (ULONG i = 0; i < loboundsCount; i++)
+    {
+        SkipCompressed();
+    }
+}
 
-    ULONG m_currentParam; // 0 = return, first actual parameter is 1
-    bool m_inVarArgParams;
 
-    std::shared_ptr<SignatureParamReaderState> m_paramReader;
+// ========================== Reader class implementations =============================
 
-private:
-    enum
-    {
-        INIT,
-        PARAM,
-        END
-    } m_where;
-};
 
-enum class ParamKind
+MethodSignatureReader::MethodSignatureReader(const SignatureBlob& sigBlob) :
+    MethodSignatureReader(PrimitiveReader(sigBlob))
 {
-    Normal,
-    Return,
-    VarArg
-};
+}
 
-class SignatureParamReaderState : public ReaderBase
+MethodSignatureReader::MethodSignatureReader(const PrimitiveReader& reader) :
+    m_reader(reader),
+    m_currentParam(0),
+    m_inVarArgParams(false),
+    m_where(INIT)
 {
-public:
-    SignatureParamReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor, ParamKind kind);
+    ReadMethodSignatureHeader(m_reader, m_callConvByte, m_genericParamCount, m_paramCount);
+}
 
-    bool MoveNextCustomModifier();
-    std::pair<mdToken, bool> GetCustomModifier();
+bool MethodSignatureReader::HasThis()
+{
+    return m_callConvByte & IMAGE_CEE_CS_CALLCONV_HASTHIS;
+}
 
-    void AdvanceToType();
+bool MethodSignatureReader::HasExplicitThis()
+{
+    return m_callConvByte & IMAGE_CEE_CS_CALLCONV_EXPLICITTHIS;
+}
 
-    void MoveToEnd() override;
+byte MethodSignatureReader::GetCallingConvention()
+{
+    return m_callConvByte & IMAGE_CEE_CS_CALLCONV_MASK;
+}
 
-    ParamKind m_kind;
-    CustomModListReader m_modsReader;
-    bool m_isTypedByRef;
-    bool m_isByRef;
-    bool m_isVoid;
+ULONG MethodSignatureReader::GenericParamCount()
+{
+    return m_genericParamCount;
+}
 
-    std::shared_ptr<SignatureTypeReaderState> m_typeReader;
+ULONG MethodSignatureReader::ParamCount()
+{
+    return m_paramCount;
+}
 
-    enum
+bool MethodSignatureReader::MoveNextParam()
+{
+    if (m_where == END)
     {
-        INIT,
-        CUSTOM_MOD,
-        PRE_TYPE,
-        TYPE,
-        END
-    } m_where;
+        return false;
+    }
 
-protected:
-    virtual void OnPinnedConstraint();
-};
+    if (m_where == INIT)
+    {
+        // first "param" is return, which is always present
+        m_currentParam = 0;
+        m_where = PARAM;
+        return true;
+    }
 
-class SignatureTypeReaderState : public ReaderBase
-{
-public:
-    SignatureTypeReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor);
+    // m_where == PARAM
+    m_reader.SkipParam(m_currentParam == 0 ? ParamKind::Return : ParamKind::Normal);
 
-    CorElementType GetTypeKind()
+    m_currentParam++;
+    if (m_currentParam > m_paramCount)
     {
-        ReadTypeKind();
-        return static_cast<CorElementType>(m_typeKind);
+        m_where = END;
+        return false;
     }
 
-    CorElementType GetGenericInstKind()
+    if (m_reader.PeekByte() == ELEMENT_TYPE_SENTINEL)
     {
-        ReadTypeKind();
-        return static_cast<CorElementType>(m_genericInstKind);
+        m_reader.ReadByte();
+        m_inVarArgParams = true;
     }
 
-    void ReadTypeKind();
+    return true;
+}
+
+SignatureParamReader MethodSignatureReader::GetParamReader()
+{
+    if (m_where != PARAM)
+    {
+        throw std::logic_error("MethodSignatureReader::GetParamReader - bad call sequence");
+    }
 
-    mdToken GetToken();
-    ULONG GetTypeVarNumber();
-    LONG GetTypeArgCount();
+    ParamKind kind = m_currentParam == 0 ? ParamKind::Return : m_inVarArgParams ? ParamKind::VarArg : ParamKind::Normal;
+    return SignatureParamReader(m_reader, kind);
+}
 
-    bool MoveNextCustomModifier();
-    std::pair<mdToken, bool> GetCustomModifier();
+void MethodSignatureReader::Check(const SignatureBlob& sigBlob)
+{
+    PrimitiveReader reader(sigBlob);
+    reader.SkipMethodSignature();
 
-    void AdvanceToArrayShape();
+    if (reader.GetPtr() != sigBlob.end())
+    {
+        throw std::domain_error("MethodDefOrRef signature blob contains bytes beyond end of signature");
+    }
+}
 
-    bool MoveNextTypeArg();
+SignatureParamReader::SignatureParamReader(const PrimitiveReader& reader, ParamKind kind) :
+    m_reader(reader),
+    m_kind(kind),
+    m_modifier(0, false),
+    m_isTypedByRef(false),
+    m_isByRef(false),
+    m_isVoid(false),
+    m_where(INIT)
+{
+}
 
-    void AdvanceToType(); // for PTR/SZARRAY (no-op otherwise)
+bool SignatureParamReader::IsReturn()
+{
+    return m_kind == ParamKind::Return;
+}
 
-    void MoveToEnd() override;
-    void ResetToStartForVisitor() override;
+bool SignatureParamReader::IsVarArg()
+{
+    return m_kind == ParamKind::VarArg;
+}
 
-    bool IsOkToReadTypeArgSpans()
+bool SignatureParamReader::MoveNextCustomModifier()
+{
+    if (m_where > CUSTOM_MOD)
     {
-        ReadTypeKind();
-        return m_where == GENERICINST_INIT;
+        return false;
     }
 
-    SignatureBlob GetSigSpan()
+    if (m_reader.PeekByte() == ELEMENT_TYPE_PINNED)
     {
-        MoveToEnd();
-        return { m_start, GetPtr() };
+        if (m_kind != ParamKind::Local)
+        {
+            throw std::domain_error("Constraint element is not allowed in a parameter");
+        }
+        m_reader.ReadByte();
     }
 
-    std::shared_ptr<SignatureTypeReaderState> m_typeReader;
-    std::shared_ptr<MethodSignatureReaderState> m_methodSigReader;
-    std::shared_ptr<SignatureArrayShapeReaderState> m_arrayShapeReader;
-    bool m_isVoidPtr;
-
-private:
-    sigPtr m_start;
-    byte m_typeKind;
-    byte m_genericInstKind;
-    CustomModListReader m_modsReader;
-    mdToken m_token;
-    LONG m_typeArgCount;
-    ULONG m_typeVarNumber;
-    LONG m_currentTypeArg;
+    bool hasMod = m_reader.TryReadCustomModifier(m_modifier);
+    m_where = hasMod ? CUSTOM_MOD : PRE_TYPE;
+    return hasMod;
+}
 
-    enum
+std::pair<mdToken, bool> SignatureParamReader::GetCustomModifier()
+{
+    if (m_where != CUSTOM_MOD)
     {
-        INIT,
-        ARRAY_TYPE,
-        ARRAY_SHAPE,
-        FNPTR_METHOD_SIG,
-        GENERICINST_INIT,
-        GENERICINST_TYPE,
-        PTR_INIT,
-        PTR_CUSTOM_MOD,
-        PTR_PRE_TYPE,
-        PTR_TYPE,
-        SZARRAY_INIT,
-        SZARRAY_CUSTOM_MOD,
-        SZARRAY_PRE_TYPE,
-        SZARRAY_TYPE,
-        END
-    } m_where;
-};
+        throw std::logic_error("SignatureParamReader::GetCustomModifier");
+    }
 
-class SignatureArrayShapeReaderState : public ReaderBase
-{
-public:
-    SignatureArrayShapeReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor);
+    return m_modifier;
+}
 
-    bool MoveNextSize();
-    ULONG GetLoBoundsCount();
-    bool MoveNextLoBound();
+void SignatureParamReader::AdvanceToType()
+{
+    if (m_where > PRE_TYPE)
+    {
+        return;
+    }
 
-    void MoveToEnd() override;
+    while (MoveNextCustomModifier()) {}
 
-    ULONG m_rank;
-    ULONG m_sizesCount;
-    ULONG m_currentSize;
-    LONG m_currentLoBound;
-
-private:
-    ULONG m_loboundsCount;
-    ULONG m_current;
-    enum
-    {
-        INIT,
-        SIZE,
-        POST_SIZES,
-        PRE_LOBOUNDS,
-        LOBOUND,
-        END
-    } m_where;
-};
-
-class MethodSpecSignatureReaderState : public ReaderBase
-{
-public:
-    MethodSpecSignatureReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor);
-
-    bool MoveNextArgType();
-
-    void MoveToEnd();
-
-    ULONG m_argTypeCount;
-    std::shared_ptr<SignatureTypeReaderState> m_typeReader;
-
-private:
-    ULONG m_currentArgType;
-    enum
-    {
-        INIT,
-        TYPE,
-        END
-    } m_where;
-};
-
-class SignatureLocalReaderState : public SignatureParamReaderState
-{
-public:
-    SignatureLocalReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-        SignatureParamReaderState(reader, visitor, ParamKind::Normal),
-        m_hasPinnedConstraint(false)
-    {
-    }
-
-    bool m_hasPinnedConstraint;
-
-protected:
-    void OnPinnedConstraint() override
-    {
-        m_hasPinnedConstraint = true;
-    }
-};
-
-class LocalsSignatureReaderState : public ReaderBase
-{
-public:
-    LocalsSignatureReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor);
-
-    bool MoveNext();
-    void MoveToEnd() override;
-
-    uint16_t m_count;
-    uint16_t m_current;
-
-    std::shared_ptr<SignatureLocalReaderState> m_localReader;
-    sigPtr m_startLocals;
-
-private:
-    enum
-    {
-        INIT,
-        LOCAL,
-        END
-    } m_where;
-};
-
-
-
-MethodSignatureReaderState::MethodSignatureReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-    ReaderBase(reader, visitor),
-    m_currentParam(0),
-    m_inVarArgParams(0),
-    m_where(INIT)
-{
-    const uint16_t c_allowedCallConvs = 0x0511; // excludes localvar, field, property, genericinst & undefined values
-    m_callConvByte = ReadByte();
-    auto callConv = m_callConvByte & IMAGE_CEE_CS_CALLCONV_MASK;
-    if (!((1 << callConv) & c_allowedCallConvs))
-    {
-        throw std::domain_error("MethodSignatureReaderState: sigBlob is not a MethodDefSig/MethodRefSig");
-    }
-
-    if (m_callConvByte & IMAGE_CEE_CS_CALLCONV_GENERIC)
-    {
-        m_genericParamCount = ReadCompressedUnsigned();
-    }
-    else
-    {
-        m_genericParamCount = 0;
-    }
-
-    m_paramCount = ReadCompressedUnsigned();
-}
-
-bool MethodSignatureReaderState::MoveNextParam()
-{
-    if (m_where == END)
-    {
-        return false;
-    }
-
-    if (m_where == INIT)
-    {
-        // first "param" is return, which is always present
-        m_currentParam = 0;
-        m_paramReader = CreateChildReader<SignatureParamReaderState>(ParamKind::Return);
-        m_where = PARAM;
-        return true;
-    }
-
-    // m_where == PARAM
-    EndChildReader(m_paramReader);
-
-    m_currentParam++;
-    if (m_currentParam > m_paramCount)
-    {
-        m_where = END;
-        return false;
-    }
-
-    if (PeekByte() == ELEMENT_TYPE_SENTINEL)
-    {
-        ReadByte();
-        m_inVarArgParams = true;
-    }
-
-    m_paramReader = CreateChildReader<SignatureParamReaderState>(m_inVarArgParams ? ParamKind::VarArg : ParamKind::Normal);
-    return true;
-}
-
-void MethodSignatureReaderState::MoveToEnd()
-{
-    while (MoveNextParam()) {}
-}
-
-SignatureParamReaderState::SignatureParamReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor, ParamKind kind) :
-    ReaderBase(reader, visitor),
-    m_kind(kind),
-    m_where(INIT),
-    m_isTypedByRef(false),
-    m_isByRef(false),
-    m_isVoid(false)
-{
-}
-
-bool SignatureParamReaderState::MoveNextCustomModifier()
-{
-    if (m_where > CUSTOM_MOD)
-    {
-        return false;
-    }
-
-    if (PeekByte() == ELEMENT_TYPE_PINNED)
-    {
-        OnPinnedConstraint();
-        ReadByte();
-    }
-
-    bool hasMod = m_modsReader.TryRead(PrimitiveReader());
-    m_where = hasMod ? CUSTOM_MOD : PRE_TYPE;
-    return hasMod;
-}
-
-std::pair<mdToken, bool> SignatureParamReaderState::GetCustomModifier()
-{
-    if (m_where != CUSTOM_MOD)
-    {
-        throw std::logic_error("SignatureParamReaderState::GetCustomModifier");
-    }
-
-    return m_modsReader.GetAsPair();
-}
-
-void SignatureParamReaderState::AdvanceToType()
-{
-    if (m_where > PRE_TYPE)
-    {
-        return;
-    }
-
-    if (m_where < PRE_TYPE)
-    {
-        while (MoveNextCustomModifier()) {}
-        if (m_where != PRE_TYPE)
-        {
-            throw std::logic_error("SignatureParamReaderState::EnsureFlagsRead - bad internal state");
-        }
-    }
-
-    byte b = PeekByte();
+    byte b = m_reader.PeekByte();
     if (b == ELEMENT_TYPE_TYPEDBYREF)
     {
-        ReadByte();
+        m_reader.ReadByte();
         m_isTypedByRef = true;
         m_where = END;
         return;
@@ -630,17 +561,16 @@ void SignatureParamReaderState::AdvanceToType()
 
     if (b == ELEMENT_TYPE_BYREF)
     {
-        ReadByte();
+        m_reader.ReadByte();
         m_isByRef = true;
     }
-
-    if (b == ELEMENT_TYPE_VOID)
+    else if (b == ELEMENT_TYPE_VOID)
     {
-        ReadByte();
+        m_reader.ReadByte();
 
         if (m_kind != ParamKind::Return)
         {
-            throw std::domain_error("SignatureParamReaderState::EnsureFlagsRead - Void element in parameter");
+            throw std::domain_error("SignatureParamReader::AdvanceToType - Void element in parameter");
         }
 
         m_isVoid = true;
@@ -649,86 +579,100 @@ void SignatureParamReaderState::AdvanceToType()
     }
 
     m_where = TYPE;
-    m_typeReader = CreateChildReader<SignatureTypeReaderState>();
 }
 
-void SignatureParamReaderState::MoveToEnd()
+bool SignatureParamReader::IsTypedByRef()
+{
+    AdvanceToType();
+    return m_isTypedByRef;
+}
+
+bool SignatureParamReader::IsVoid()
+{
+    AdvanceToType();
+    return m_isVoid;
+}
+
+bool SignatureParamReader::IsByRef()
+{
+    AdvanceToType();
+    return m_isByRef;
+}
+
+bool SignatureParamReader::HasType()
 {
     AdvanceToType();
-    if (m_where < END)
+    return m_where == TYPE;
+}
+
+SignatureTypeReader SignatureParamReader::GetTypeReader()
+{
+    if (!HasType())
     {
-        EndChildReader(m_typeReader);
+        throw std::logic_error("SignatureParamReader::GetTypeReader - no type - use HasType to guard");
     }
+    return SignatureTypeReader(m_reader);
 }
 
-void SignatureParamReaderState::OnPinnedConstraint()
+SignatureTypeReader::SignatureTypeReader(const SignatureBlob& typeSpecSig) :
+    SignatureTypeReader(PrimitiveReader(typeSpecSig))
 {
-    throw std::domain_error("Constraint element is not allowed in a parameter");
 }
 
-SignatureTypeReaderState::SignatureTypeReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-    ReaderBase(reader, visitor),
+SignatureTypeReader::SignatureTypeReader(const PrimitiveReader& reader) :
+    m_reader(reader),
+    m_start(reader.GetPtr()),
+    m_childStart(nullptr),
+    m_arrayShapeStart(nullptr),
+    m_typeKind(0),
+    m_genericInstKind(0),
+    m_modifier(0, false),
     m_token(0),
     m_typeArgCount(0),
+    m_typeVarNumber(0),
     m_currentTypeArg(0),
     m_isVoidPtr(false),
-    m_genericInstKind(0),
-    m_typeVarNumber(0),
-    m_where(INIT),
-    m_typeKind(0)
+    m_where(INIT)
 {
-    m_start = GetPtr();
 }
 
-void SignatureTypeReaderState::ReadTypeKind()
+void SignatureTypeReader::ReadTypeKind()
 {
     if (m_where > INIT)
     {
         return;
     }
 
-    m_typeKind = ReadByte();
+    m_typeKind = m_reader.ReadByte();
     switch (m_typeKind)
     {
     case ELEMENT_TYPE_ARRAY:
-        m_typeReader = CreateChildReader<SignatureTypeReaderState>();
+        m_childStart = m_reader.GetPtr();
         m_where = ARRAY_TYPE;
         break;
 
     case ELEMENT_TYPE_CLASS:
     case ELEMENT_TYPE_VALUETYPE:
-        m_token = ReadTypeDefOrRefEncoded();
+        m_token = m_reader.ReadTypeDefOrRefEncoded();
         m_where = END;
         break;
 
     case ELEMENT_TYPE_FNPTR:
-        m_methodSigReader = CreateChildReader<MethodSignatureReaderState>();
+        m_childStart = m_reader.GetPtr();
         m_where = FNPTR_METHOD_SIG;
         break;
 
     case ELEMENT_TYPE_GENERICINST:
-        m_genericInstKind = ReadByte();
-        m_token = ReadTypeDefOrRefEncoded();
-        m_typeArgCount = ReadCompressedUnsigned(); // doc says it's signed but it doesn't appear to be
+        m_genericInstKind = m_reader.ReadByte();
+        m_token = m_reader.ReadTypeDefOrRefEncoded();
+        m_typeArgCount = m_reader.ReadCompressedUnsigned(); // doc says it's signed but it doesn't appear to be
         m_where = GENERICINST_INIT;
         break;
 
     case ELEMENT_TYPE_MVAR:
     case ELEMENT_TYPE_VAR:
-        m_typeVarNumber = ReadCompressedUnsigned();
+        m_typeVarNumber = m_reader.ReadCompressedUnsigned();
         m_where = END;
-
-        if (GetVisitor())
-        {
-            if (m_typeKind == ELEMENT_TYPE_MVAR)
-            {
-                GetVisitor()->VisitMethodTypeVariable(m_typeVarNumber, GetSigSpan());
-            }
-            else
-            {
-                GetVisitor()->VisitTypeTypeVariable(m_typeVarNumber, GetSigSpan());
-            }
-        }
         break;
 
     case ELEMENT_TYPE_PTR:
@@ -759,12 +703,26 @@ void SignatureTypeReaderState::ReadTypeKind()
         break;
 
     default:
-        throw std::domain_error("SignatureTypeReaderState - bad type element");
+        throw std::domain_error("SignatureTypeReader - bad type element");
     }
 }
 
-bool SignatureTypeReaderState::MoveNextCustomModifier()
+CorElementType SignatureTypeReader::GetTypeKind()
+{
+    ReadTypeKind();
+    return static_cast<CorElementType>(m_typeKind);
+}
+
+CorElementType SignatureTypeReader::GetGenericInstKind()
+{
+    ReadTypeKind();
+    return static_cast<CorElementType>(m_genericInstKind);
+}
+
+bool SignatureTypeReader::MoveNextCustomModifier()
 {
+    ReadTypeKind();
+
     decltype(m_where) where_custom_mod, where_next;
     if (m_where == PTR_INIT || m_where == PTR_CUSTOM_MOD)
     {
@@ -781,7 +739,7 @@ bool SignatureTypeReaderState::MoveNextCustomModifier()
         return false;
     }
 
-    if (m_modsReader.TryRead(PrimitiveReader()))
+    if (m_reader.TryReadCustomModifier(m_modifier))
     {
         m_where = where_custom_mod;
         return true;
@@ -793,82 +751,26 @@ bool SignatureTypeReaderState::MoveNextCustomModifier()
     }
 }
 
-std::pair<mdToken, bool> SignatureTypeReaderState::GetCustomModifier()
+std::pair<mdToken, bool> SignatureTypeReader::GetCustomModifier()
 {
     if (m_where != PTR_CUSTOM_MOD && m_where != SZARRAY_CUSTOM_MOD)
     {
-        throw std::logic_error("SignatureTypeReaderState::GetCustomModifier - bad call");
+        throw std::logic_error("SignatureTypeReader::GetCustomModifier - bad call");
     }
-    return m_modsReader.GetAsPair();
+    return m_modifier;
 }
 
-mdToken SignatureTypeReaderState::GetToken()
+mdToken SignatureTypeReader::GetToken()
 {
     auto kind = GetTypeKind();
     if (kind != ELEMENT_TYPE_CLASS && kind != ELEMENT_TYPE_VALUETYPE && kind != ELEMENT_TYPE_GENERICINST)
     {
-        throw std::logic_error("SignatureTypeReaderState::GetToken - invalid for this kind of type");
+        throw std::logic_error("SignatureTypeReader::GetToken - invalid for this kind of type");
     }
     return m_token;
 }
 
-ULONG SignatureTypeReaderState::GetTypeVarNumber()
-{
-    auto kind = GetTypeKind();
-    if (kind != ELEMENT_TYPE_MVAR && kind != ELEMENT_TYPE_VAR)
-    {
-        throw std::logic_error("SignatureTypeReaderState::GetTypeVarNumber - invalid for this kind of type");
-    }
-    return m_typeVarNumber;
-}
-
-LONG SignatureTypeReaderState::GetTypeArgCount()
-{
-    auto kind = GetTypeKind();
-    if (kind != ELEMENT_TYPE_GENERICINST)
-    {
-        throw std::logic_error("SignatureTypeReaderState::GetTypeArgCount - invalid for this kind of type");
-    }
-    return m_typeArgCount;
-}
-
-void SignatureTypeReaderState::AdvanceToArrayShape()
-{
-    if (m_where == ARRAY_TYPE)
-    {
-        EndChildReader(m_typeReader);
-
-        m_arrayShapeReader = CreateChildReader<SignatureArrayShapeReaderState>();
-        m_where = ARRAY_SHAPE;
-    }
-}
-
-bool SignatureTypeReaderState::MoveNextTypeArg()
-{
-    ReadTypeKind();
-    if (m_where != GENERICINST_INIT && m_where != GENERICINST_TYPE)
-    {
-        return false;
-    }
-
-    if (m_where == GENERICINST_TYPE)
-    {
-        EndChildReader(m_typeReader);
-        m_currentTypeArg++;
-    }
-
-    if (m_currentTypeArg >= m_typeArgCount)
-    {
-        m_where = END;
-        return false;
-    }
-
-    m_typeReader = CreateChildReader<SignatureTypeReaderState>();
-    m_where = GENERICINST_TYPE;
-    return true;
-}
-
-void SignatureTypeReaderState::AdvanceToType()
+void SignatureTypeReader::AdvanceToType()
 {
     while (MoveNextCustomModifier()) {}
 
@@ -883,573 +785,138 @@ void SignatureTypeReaderState::AdvanceToType()
     }
     else
     {
-        return;
-    }
-
-    if (PeekByte() == ELEMENT_TYPE_VOID)
-    {
-        if (m_where != PTR_PRE_TYPE)
-        {
-            throw std::domain_error("SignatureTypeReaderState::AdvanceToType - unexpected VOID element");
-        }
-
-        ReadByte();
-        m_isVoidPtr = true;
-    }
-
-    m_typeReader = CreateChildReader<SignatureTypeReaderState>();
-    m_where = where_next;
-}
-
-void SignatureTypeReaderState::MoveToEnd()
-{
-    ReadTypeKind();
-
-    switch (m_where)
-    {
-    case ARRAY_TYPE:
-        AdvanceToArrayShape();
-        //fallthru
-    case ARRAY_SHAPE:
-        EndChildReader(m_arrayShapeReader);
-        break;
-    case FNPTR_METHOD_SIG:
-        EndChildReader(m_methodSigReader);
-        break;
-    case GENERICINST_INIT:
-    case GENERICINST_TYPE:
-        while (MoveNextTypeArg()) {}
-        break;
-    case PTR_INIT:
-    case PTR_CUSTOM_MOD:
-    case PTR_PRE_TYPE:
-    case SZARRAY_INIT:
-    case SZARRAY_CUSTOM_MOD:
-    case SZARRAY_PRE_TYPE:
-        AdvanceToType();
-        //fallthru
-    case PTR_TYPE:
-    case SZARRAY_TYPE:
-        EndChildReader(m_typeReader);
-        break;
-    case END:
-        break;
-    default:
-        throw std::logic_error("SignatureTypeReaderState::MoveToEnd - bad m_where");
-    }
-
-    m_where = END;
-}
-
-void SignatureTypeReaderState::ResetToStartForVisitor()
-{
-    if (m_where == INIT)
-    {
-        return;
-    }
-
-    // Bit of a hack but ensures known state
-    MoveToEnd();
-    PrimitiveReader().SetPtr(m_start);
-    m_currentTypeArg = 0;
-    m_where = INIT;
-}
-
-SignatureArrayShapeReaderState::SignatureArrayShapeReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-    ReaderBase(reader, visitor),
-    m_loboundsCount(0),
-    m_current(0),
-    m_currentLoBound(0),
-    m_currentSize(0)
-{
-    m_rank = ReadCompressedUnsigned();
-    m_sizesCount = ReadCompressedUnsigned();
-    m_where = INIT;
-}
-
-bool SignatureArrayShapeReaderState::MoveNextSize()
-{
-    if (m_where == SIZE)
-    {
-        m_current++;
-    }
-    else if (m_where == INIT)
-    {
-        m_current = 0;
-    }
-    else
-    {
-        return false;
-    }
-
-    if (m_current >= m_sizesCount)
-    {
-        m_where = POST_SIZES;
-        return false;
-    }
-
-    m_currentSize = ReadCompressedUnsigned();
-    m_where = SIZE;
-    return true;
-}
-
-ULONG SignatureArrayShapeReaderState::GetLoBoundsCount()
-{
-    while (m_where < POST_SIZES)
-    {
-        MoveNextSize();
-    }
-
-    if (m_where == POST_SIZES)
-    {
-        m_loboundsCount = ReadCompressedUnsigned();
-        m_where = PRE_LOBOUNDS;
-    }
-
-    return m_loboundsCount;
-}
-
-bool SignatureArrayShapeReaderState::MoveNextLoBound()
-{
-    GetLoBoundsCount();
-
-    if (m_where == LOBOUND)
-    {
-        m_current++;
-    }
-    else if (m_where == PRE_LOBOUNDS)
-    {
-        m_current = 0;
-    }
-    else
-    {
-        return false;
-    }
-
-    if (m_current >= m_loboundsCount)
-    {
-        m_where = END;
-        return false;
-    }
-
-    m_currentLoBound = ReadCompressedSigned();
-    m_where = LOBOUND;
-    return true;
-}
-
-void SignatureArrayShapeReaderState::MoveToEnd()
-{
-    while (MoveNextLoBound()) {}
-}
-
-MethodSpecSignatureReaderState::MethodSpecSignatureReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-    ReaderBase(reader, visitor),
-    m_currentArgType(0)
-{
-    byte ccByte = ReadByte();
-    if (ccByte != IMAGE_CEE_CS_CALLCONV_GENERICINST)
-    {
-        throw std::domain_error("MethodInst signature should start with GENERICINST");
-    }
-
-    m_argTypeCount = ReadCompressedUnsigned();
-
-    m_where = INIT;
-}
-
-bool MethodSpecSignatureReaderState::MoveNextArgType()
-{
-    if (m_where == INIT)
-    {
-        m_currentArgType = 0;
-    }
-    else if (m_where > TYPE)
-    {
-        return false;
-    }
-    else
-    {
-        EndChildReader(m_typeReader);
-        m_currentArgType++;
-    }
-
-    if (m_currentArgType >= m_argTypeCount)
-    {
-        m_where = END;
-        return false;
-    }
-
-    m_typeReader = CreateChildReader<SignatureTypeReaderState>();
-    m_where = TYPE;
-    return true;
-}
-
-void MethodSpecSignatureReaderState::MoveToEnd()
-{
-    while (MoveNextArgType()) {}
-}
-
-LocalsSignatureReaderState::LocalsSignatureReaderState(UniquePrimitiveReader& reader, SignatureVisitor* visitor) :
-    ReaderBase(reader, visitor),
-    m_where(INIT),
-    m_current(0)
-{
-    byte ccByte = ReadByte();
-    if (ccByte != IMAGE_CEE_CS_CALLCONV_LOCAL_SIG)
-    {
-        throw std::domain_error("Locals signature has incorrect calling convention byte");
-    }
-
-    ULONG count = ReadCompressedUnsigned();
-    if (count > 0xfffe)
-    {
-        throw std::domain_error("Locals signature count exceeds maximum");
-    }
-
-    m_count = static_cast<uint16_t>(count);
-    m_startLocals = GetPtr();
-}
-
-bool LocalsSignatureReaderState::MoveNext()
-{
-    if (m_where == END)
-    {
-        return false;
-    }
-
-    if (m_where == INIT)
-    {
-        m_current = 0;
-    }
-    else
-    {
-        EndChildReader(m_localReader);
-        m_current++;
-    }
-
-    if (m_current >= m_count)
-    {
-        m_where = END;
-        return false;
-    }
-
-    m_localReader = CreateChildReader<SignatureLocalReaderState>();
-    m_where = LOCAL;
-    return true;
-}
-
-void LocalsSignatureReaderState::MoveToEnd()
-{
-    while (MoveNext()) {}
-}
-
-
-
-ULONG PrimitiveReader::ReadCompressedUnsigned()
-{
-    COR_SIGNATURE b1 = ReadByte();
-    if ((b1 & 0x80) == 0)
-    {
-        return b1;
-    }
-
-    b1 &= 0x7f;
-
-    if ((b1 & 0x40) == 0)
-    {
-        return (b1 << 8) | ReadByte();
-    }
-
-    ULONG value = b1 & 0x3f;
-    value = (value << 8) | ReadByte();
-    value = (value << 8) | ReadByte();
-    value = (value << 8) | ReadByte();
-    return value;
-}
-
-LONG PrimitiveReader::ReadCompressedSigned()
-{
-    // This implementation relies on signed ints using 2's complement
-    COR_SIGNATURE b1 = ReadByte();
-    if ((b1 & 0x80) == 0)
-    {
-        uint8_t bits = (b1 >> 1);
-        if (b1 & 1)
-        {
-            bits |= 0xc0;
-        }
-        return static_cast<int8_t>(bits);
-    }
-
-    b1 &= 0x7f;
-
-    if ((b1 & 0x40) == 0)
-    {
-        uint16_t b12 = (b1 << 8) | ReadByte();
-        uint16_t bits = b12 >> 1;
-        if (b12 & 1)
-        {
-            bits |= 0xe000;
-        }
-        return static_cast<int16_t>(bits);
-    }
-
-    uint32_t b1234 = b1 & 0x3f;
-    b1234 = (b1234 << 8) | ReadByte();
-    b1234 = (b1234 << 8) | ReadByte();
-    b1234 = (b1234 << 8) | ReadByte();
-    
-    uint32_t bits = b1234 >> 1;
-    if (b1234 & 1)
-    {
-        bits |= 0xe0000000;
-    }
-    return static_cast<int32_t>(bits);
-}
-
-mdToken PrimitiveReader::ReadTypeDefOrRefEncoded()
-{
-    ULONG typeDefOrRef = ReadCompressedUnsigned();
-    ULONG rid = typeDefOrRef >> 2;
-    mdToken typeToken = 0;
-    switch (typeDefOrRef & 3)
-    {
-    case 0: // type def
-        return TokenFromRid(mdtTypeDef, rid);
-    case 1: // type ref
-        return TokenFromRid(mdtTypeRef, rid);
-    case 2: // type spec
-        return TokenFromRid(mdtTypeSpec, rid);
-    default: // not defined
-        throw std::domain_error("ReadTypeDefOrRefEncoded: bad token encoding");
-    }
-}
-
-
-// ========================== Reader class implementations =============================
-
-
-static std::shared_ptr<MethodSignatureReaderState> CreateMethodSignatureReaderState(const SignatureBlob& sigBlob)
-{
-    auto primitiveReader = std::make_unique<PrimitiveReader>(sigBlob);
-    return std::make_shared<MethodSignatureReaderState>(primitiveReader, nullptr);
-}
-
-MethodSignatureReader::MethodSignatureReader(const SignatureBlob& sigBlob) :
-    MethodSignatureReader(CreateMethodSignatureReaderState(sigBlob))
-{
-}
-
-MethodSignatureReader::MethodSignatureReader(const std::shared_ptr<MethodSignatureReaderState>& state) :
-    m_state(state)
-{
-}
-
-bool MethodSignatureReader::HasThis()
-{
-    return m_state->m_callConvByte & IMAGE_CEE_CS_CALLCONV_HASTHIS;
-}
-
-byte MethodSignatureReader::GetCallingConvention()
-{
-    return m_state->m_callConvByte & IMAGE_CEE_CS_CALLCONV_MASK;
-}
-
-ULONG MethodSignatureReader::GenericParamCount()
-{
-    return m_state->m_genericParamCount;
-}
-
-ULONG MethodSignatureReader::ParamCount()
-{
-    return m_state->m_paramCount;
-}
-
-bool MethodSignatureReader::MoveNextParam()
-{
-    return m_state->MoveNextParam();
-}
-
-SignatureParamReader MethodSignatureReader::GetParamReader()
-{
-    return SignatureParamReader(m_state->m_paramReader);
-}
-
-void MethodSignatureReader::Check(const SignatureBlob& sigBlob)
-{
-    auto primitiveReader = std::make_unique<PrimitiveReader>(sigBlob);
-    MethodSignatureReaderState s(primitiveReader, nullptr);
-
-    primitiveReader = s.ReturnPrimitiveReader();
-
-    auto endPtr = primitiveReader->GetPtr();
-    if (endPtr != sigBlob.end())
-    {
-        throw std::domain_error("MethodDefOrRef signature blob contains bytes beyond end of signature");
-    }
-}
-
-SignatureParamReader::SignatureParamReader(const std::shared_ptr<SignatureParamReaderState>& state) :
-    m_state(state)
-{
-}
-
-bool SignatureParamReader::IsReturn()
-{
-    return m_state->m_kind == ParamKind::Return;
-}
-
-bool SignatureParamReader::IsVarArg()
-{
-    return m_state->m_kind == ParamKind::VarArg;
-}
-
-bool SignatureParamReader::MoveNextCustomModifier()
-{
-    return m_state->MoveNextCustomModifier();
-}
-
-std::pair<mdToken, bool> SignatureParamReader::GetCustomModifier()
-{
-    return m_state->GetCustomModifier();
-}
-
-bool SignatureParamReader::IsTypedByRef()
-{
-    m_state->AdvanceToType();
-    return m_state->m_isTypedByRef;
-}
-
-bool SignatureParamReader::IsVoid()
-{
-    m_state->AdvanceToType();
-    return m_state->m_isVoid;
-}
-
-bool SignatureParamReader::IsByRef()
-{
-    m_state->AdvanceToType();
-    return m_state->m_isByRef;
-}
-
-bool SignatureParamReader::HasType()
-{
-    m_state->AdvanceToType();
-    return m_state->m_typeReader != nullptr;
-}
-
-SignatureTypeReader SignatureParamReader::GetTypeReader()
-{
-    m_state->AdvanceToType();
-    return m_state->m_typeReader;
-}
-
-SignatureTypeReader::SignatureTypeReader(const std::shared_ptr<SignatureTypeReaderState>& state) :
-    m_state(state)
-{
-}
-
-static std::shared_ptr<SignatureTypeReaderState> CreateSignatureTypeReaderState(const SignatureBlob& typeSpecSig)
-{
-    auto primitiveReader = std::make_unique<PrimitiveReader>(typeSpecSig);
-    return std::make_shared<SignatureTypeReaderState>(primitiveReader, nullptr);
-}
-
-SignatureTypeReader::SignatureTypeReader(const SignatureBlob& typeSpecSig) :
-    SignatureTypeReader(CreateSignatureTypeReaderState(typeSpecSig))
-{
-}
-
-CorElementType SignatureTypeReader::GetTypeKind()
-{
-    return m_state->GetTypeKind();
-}
-
-CorElementType SignatureTypeReader::GetGenericInstKind()
-{
-    return m_state->GetGenericInstKind();
-}
+        return;
+    }
 
-bool SignatureTypeReader::MoveNextCustomModifier()
-{
-    return m_state->MoveNextCustomModifier();
-}
+    if (m_reader.PeekByte() == ELEMENT_TYPE_VOID)
+    {
+        if (m_where != PTR_PRE_TYPE)
+        {
+            throw std::domain_error("SignatureTypeReader::AdvanceToType - unexpected VOID element");
+        }
 
-std::pair<mdToken, bool> SignatureTypeReader::GetCustomModifier()
-{
-    return m_state->GetCustomModifier();
-}
+        m_reader.ReadByte();
+        m_isVoidPtr = true;
+    }
 
-mdToken SignatureTypeReader::GetToken()
-{
-    return m_state->GetToken();
+    m_childStart = m_reader.GetPtr();
+    m_where = where_next;
 }
 
 bool SignatureTypeReader::IsVoidPointer()
 {
-    m_state->AdvanceToType();
-    return m_state->m_isVoidPtr;
+    AdvanceToType();
+    return m_isVoidPtr;
 }
 
 SignatureTypeReader SignatureTypeReader::GetTypeReader()
 {
-    m_state->AdvanceToType();
-    if (m_state->m_typeReader == nullptr)
+    AdvanceToType();
+    switch (m_where)
     {
-        if (m_state->m_isVoidPtr)
+    case PTR_TYPE:
+        if (m_isVoidPtr)
         {
             throw std::logic_error("SignatureTypeReader::GetTypeReader - void pointer has no type reader - use IsVoidPointer to guard");
         }
+        // fallthru
+    case ARRAY_TYPE:
+    case ARRAY_SHAPE:
+    case SZARRAY_TYPE:
+    case GENERICINST_TYPE:
+        return SignatureTypeReader(PrimitiveReader(m_childStart, m_reader.GetLimit()));
+    default:
         throw std::logic_error("SignatureTypeReader::GetTypeReader - bad call");
     }
-    return m_state->m_typeReader;
 }
 
 SignatureArrayShapeReader SignatureTypeReader::GetArrayShapeReader()
 {
-    m_state->AdvanceToArrayShape();
-    if (m_state->m_arrayShapeReader == nullptr)
+    ReadTypeKind();
+    if (m_where == ARRAY_TYPE)
+    {
+        m_reader.SkipType();
+        m_arrayShapeStart = m_reader.GetPtr();
+        m_where = ARRAY_SHAPE;
+    }
+
+    if (m_where != ARRAY_SHAPE)
     {
         throw std::logic_error("SignatureTypeReader::GetArrayShapeReader - bad call");
     }
-    return m_state->m_arrayShapeReader;
+    return SignatureArrayShapeReader(PrimitiveReader(m_arrayShapeStart, m_reader.GetLimit()));
 }
 
 MethodSignatureReader SignatureTypeReader::GetMethodSignatureReader()
 {
-    if (m_state->m_methodSigReader == nullptr)
+    ReadTypeKind();
+    if (m_where != FNPTR_METHOD_SIG)
     {
         throw std::logic_error("SignatureTypeReader::GetMethodSignatureReader - bad call");
     }
-    return m_state->m_methodSigReader;
+    return MethodSignatureReader(PrimitiveReader(m_childStart, m_reader.GetLimit()));
 }
 
 ULONG SignatureTypeReader::GetVariableNumber()
 {
-    return m_state->GetTypeVarNumber();
+    auto kind = GetTypeKind();
+    if (kind != ELEMENT_TYPE_MVAR && kind != ELEMENT_TYPE_VAR)
+    {
+        throw std::logic_error("SignatureTypeReader::GetVariableNumber - invalid for this kind of type");
+    }
+    return m_typeVarNumber;
 }
 
 LONG SignatureTypeReader::GetGenArgCount()
 {
-    return m_state->GetTypeArgCount();
+    auto kind = GetTypeKind();
+    if (kind != ELEMENT_TYPE_GENERICINST)
+    {
+        throw std::logic_error("SignatureTypeReader::GetGenArgCount - invalid for this kind of type");
+    }
+    return m_typeArgCount;
 }
 
 bool SignatureTypeReader::MoveNextTypeArg()
 {
-    return m_state->MoveNextTypeArg();
+    ReadTypeKind();
+    if (m_where != GENERICINST_INIT && m_where != GENERICINST_TYPE)
+    {
+        return false;
+    }
+
+    if (m_where == GENERICINST_TYPE)
+    {
+        m_reader.SkipType();
+        m_currentTypeArg++;
+    }
+
+    if (m_currentTypeArg >= m_typeArgCount)
+    {
+        m_where = END;
+        return false;
+    }
+
+    m_childStart = m_reader.GetPtr();
+    m_where = GENERICINST_TYPE;
+    return true;
 }
 
 std::vector<SignatureBlob> SignatureTypeReader::GetTypeArgSpans()
 {
-    if (!m_state->IsOkToReadTypeArgSpans())
+    ReadTypeKind();
+    if (m_where != GENERICINST_INIT)
     {
         throw std::logic_error("SignatureTypeReader::GetTypeArgSpans - bad call");
     }
 
     std::vector<SignatureBlob> typeArgSpans;
+    typeArgSpans.reserve(ReserveCount(static_cast<ULONG>(m_typeArgCount), m_reader));
     while (MoveNextTypeArg())
     {
-        typeArgSpans.push_back(GetTypeReader().GetSigSpan());
+        PrimitiveReader typeArgReader = m_reader;
+        typeArgReader.SkipType();
+        typeArgSpans.push_back({ m_childStart, typeArgReader.GetPtr() });
     }
 
     return typeArgSpans;
@@ -1457,103 +924,191 @@ std::vector<SignatureBlob> SignatureTypeReader::GetTypeArgSpans()
 
 SignatureBlob SignatureTypeReader::GetSigSpan()
 {
-    return m_state->GetSigSpan();
+    PrimitiveReader reader(m_start, m_reader.GetLimit());
+    reader.SkipType();
+    return { m_start, reader.GetPtr() };
 }
 
 std::vector<COR_SIGNATURE> SignatureTypeReader::SubstituteTypeArgs(const std::vector<SignatureBlob>& typeTypeArgs, const std::vector<SignatureBlob>& methodTypeArgs)
 {
     std::vector<COR_SIGNATURE> buffer;
+    SubstituteTypeArgs(typeTypeArgs, methodTypeArgs, buffer);
+    return buffer;
+}
+
+void SignatureTypeReader::SubstituteTypeArgs(const std::vector<SignatureBlob>& typeTypeArgs, const std::vector<SignatureBlob>& methodTypeArgs, std::vector<COR_SIGNATURE>& buffer)
+{
+    buffer.clear();
     SubstitutingVisitor visitor(buffer, typeTypeArgs, methodTypeArgs);
-    m_state->SetVisitor(&visitor);
-    visitor.Complete(m_state->GetSigSpan().end());
+    visitor.Attached(m_start);
 
-    return buffer;
+    PrimitiveReader reader(m_start, m_reader.GetLimit());
+    reader.SkipType(&visitor);
+    visitor.Complete(reader.GetPtr());
 }
 
-SignatureArrayShapeReader::SignatureArrayShapeReader(const std::shared_ptr<SignatureArrayShapeReaderState>& state) :
-    m_state(state)
+SignatureArrayShapeReader::SignatureArrayShapeReader(const PrimitiveReader& reader) :
+    m_reader(reader),
+    m_currentSize(0),
+    m_currentLoBound(0),
+    m_loboundsCount(0),
+    m_current(0),
+    m_where(INIT)
 {
+    m_rank = m_reader.ReadCompressedUnsigned();
+    m_sizesCount = m_reader.ReadCompressedUnsigned();
 }
 
 ULONG SignatureArrayShapeReader::GetRank()
 {
-    return m_state->m_rank;
+    return m_rank;
 }
 
 ULONG SignatureArrayShapeReader::GetNumSizes()
 {
-    return m_state->m_sizesCount;
+    return m_sizesCount;
 }
 
 bool SignatureArrayShapeReader::MoveNextSize()
 {
-    return m_state->MoveNextSize();
+    if (m_where == SIZE)
+    {
+        m_current++;
+    }
+    else if (m_where == INIT)
+    {
+        m_current = 0;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (m_current >= m_sizesCount)
+    {
+        m_where = POST_SIZES;
+        return false;
+    }
+
+    m_currentSize = m_reader.ReadCompressedUnsigned();
+    m_where = SIZE;
+    return true;
 }
 
 ULONG SignatureArrayShapeReader::GetSize()
 {
-    return m_state->m_currentSize;
+    return m_currentSize;
 }
 
 ULONG SignatureArrayShapeReader::GetNumLoBounds()
 {
-    return m_state->GetLoBoundsCount();
+    while (m_where < POST_SIZES)
+    {
+        MoveNextSize();
+    }
+
+    if (m_where == POST_SIZES)
+    {
+        m_loboundsCount = m_reader.ReadCompressedUnsigned();
+        m_where = PRE_LOBOUNDS;
+    }
+
+    return m_loboundsCount;
 }
 
 bool SignatureArrayShapeReader::MoveNextLoBound()
 {
-    return m_state->MoveNextLoBound();
-}
+    GetNumLoBounds();
 
-LONG SignatureArrayShapeReader::GetLoBound()
-{
-    return m_state->m_currentLoBound;
+    if (m_where == LOBOUND)
+    {
+        m_current++;
+    }
+    else if (m_where == PRE_LOBOUNDS)
+    {
+        m_current = 0;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (m_current >= m_loboundsCount)
+    {
+        m_where = END;
+        return false;
+    }
+
+    m_currentLoBound = m_reader.ReadCompressedSigned();
+    m_where = LOBOUND;
+    return true;
 }
 
-static std::shared_ptr<MethodSpecSignatureReaderState> CreateMethodSpecSignatureReaderState(const SignatureBlob& sigBlob)
+LONG SignatureArrayShapeReader::GetLoBound()
 {
-    auto primitiveReader = std::make_unique<PrimitiveReader>(sigBlob);
-    return std::make_shared<MethodSpecSignatureReaderState>(primitiveReader, nullptr);
+    return m_currentLoBound;
 }
 
 MethodSpecSignatureReader::MethodSpecSignatureReader(const SignatureBlob& sigBlob) :
-    MethodSpecSignatureReader(CreateMethodSpecSignatureReaderState(sigBlob))
+    m_reader(sigBlob),
+    m_currentArgType(0),
+    m_where(INIT)
 {
-}
+    byte ccByte = m_reader.ReadByte();
+    if (ccByte != IMAGE_CEE_CS_CALLCONV_GENERICINST)
+    {
+        throw std::domain_error("MethodInst signature should start with GENERICINST");
+    }
 
-MethodSpecSignatureReader::MethodSpecSignatureReader(const std::shared_ptr<MethodSpecSignatureReaderState>& state) :
-    m_state(state)
-{
+    m_argTypeCount = m_reader.ReadCompressedUnsigned();
 }
 
 ULONG MethodSpecSignatureReader::TypeArgCount()
 {
-    return m_state->m_argTypeCount;
+    return m_argTypeCount;
 }
 
 bool MethodSpecSignatureReader::MoveNextArgType()
 {
-    return m_state->MoveNextArgType();
+    if (m_where == INIT)
+    {
+        m_currentArgType = 0;
+    }
+    else if (m_where > TYPE)
+    {
+        return false;
+    }
+    else
+    {
+        m_reader.SkipType();
+        m_currentArgType++;
+    }
+
+    if (m_currentArgType >= m_argTypeCount)
+    {
+        m_where = END;
+        return false;
+    }
+
+    m_where = TYPE;
+    return true;
 }
 
 SignatureTypeReader MethodSpecSignatureReader::GetArgTypeReader()
 {
-    if (m_state->m_typeReader == nullptr)
+    if (m_where != TYPE)
     {
         throw std::logic_error("MethodSpecSignatureReader::GetArgTypeReader - bad call");
     }
-    return m_state->m_typeReader;
+    return SignatureTypeReader(m_reader);
 }
 
 void MethodSpecSignatureReader::Check(const SignatureBlob& sigBlob)
 {
-    auto primitiveReader = std::make_unique<PrimitiveReader>(sigBlob);
-    MethodSpecSignatureReaderState s(primitiveReader, nullptr);
-
-    primitiveReader = s.ReturnPrimitiveReader();
-    auto endPtr = primitiveReader->GetPtr();
+    MethodSpecSignatureReader reader(sigBlob);
+    while (reader.MoveNextArgType()) {}
 
-    if (endPtr != sigBlob.end())
+    if (reader.m_reader.GetPtr() != sigBlob.end())
     {
         throw std::domain_error("MethodSpec signature blob contains bytes beyond end of signature");
     }
@@ -1563,43 +1118,210 @@ std::vector<SignatureBlob> MethodSpecSignatureReader::GetTypeArgSpans(const Sign
 {
     std::vector<SignatureBlob> typeArgSpans;
     MethodSpecSignatureReader specReader(sigBlob);
+    typeArgSpans.reserve(ReserveCount(specReader.TypeArgCount(), specReader.m_reader));
     while (specReader.MoveNextArgType())
     {
-        typeArgSpans.push_back(specReader.GetArgTypeReader().GetSigSpan());
+        sigPtr start = specReader.m_reader.GetPtr();
+        PrimitiveReader typeArgReader = specReader.m_reader;
+        typeArgReader.SkipType();
+        typeArgSpans.push_back({ start, typeArgReader.GetPtr() });
     }
 
     return typeArgSpans;
 }
 
-static std::shared_ptr<LocalsSignatureReaderState> CreateLocalsSignatureReaderState(const SignatureBlob& sigBlob)
-{
-    auto primitiveReader = std::make_unique<PrimitiveReader>(sigBlob);
-    return std::make_shared<LocalsSignatureReaderState>(primitiveReader, nullptr);
-}
-
 LocalsSignatureReader::LocalsSignatureReader(const SignatureBlob& sigBlob) :
-    m_state(CreateLocalsSignatureReaderState(sigBlob))
+    m_reader(sigBlob),
+    m_current(0),
+    m_start(sigBlob.begin()),
+    m_where(INIT)
 {
+    byte ccByte = m_reader.ReadByte();
+    if (ccByte != IMAGE_CEE_CS_CALLCONV_LOCAL_SIG)
+    {
+        throw std::domain_error("Locals signature has incorrect calling convention byte");
+    }
+
+    ULONG count = m_reader.ReadCompressedUnsigned();
+    if (count > 0xfffe)
+    {
+        throw std::domain_error("Locals signature count exceeds maximum");
+    }
+
+    m_count = static_cast<uint16_t>(count);
 }
 
 uint16_t LocalsSignatureReader::GetCount()
 {
-    return m_state->m_count;
+    return m_count;
 }
 
 bool LocalsSignatureReader::MoveNext()
 {
-    return m_state->MoveNext();
+    if (m_where == END)
+    {
+        return false;
+    }
+
+    if (m_where == INIT)
+    {
+        m_current = 0;
+    }
+    else
+    {
+        m_reader.SkipParam(ParamKind::Local);
+        m_current++;
+    }
+
+    if (m_current >= m_count)
+    {
+        m_where = END;
+        return false;
+    }
+
+    m_where = LOCAL;
+    return true;
 }
 
 SignatureLocalReader LocalsSignatureReader::GetLocalReader()
 {
-    if (!m_state->m_localReader)
+    if (m_where != LOCAL)
     {
         throw std::logic_error("LocalsSignatureReader::GetLocalReader - bad call sequence");
     }
 
-    return m_state->m_localReader;
+    return SignatureLocalReader(m_reader, ParamKind::Local);
+}
+
+SignatureIndex::SignatureIndex() :
+    m_entriesStart(nullptr),
+    m_entriesEnd(nullptr),
+    m_callConvByte(0),
+    m_genericParamCount(0),
+    m_firstVarArg(SIZE_MAX)
+{
+}
+
+SignatureIndex SignatureIndex::IndexMethod(const SignatureBlob& sigBlob)
+{
+    SignatureIndex index;
+    PrimitiveReader reader(sigBlob);
+    ULONG paramCount;
+    ReadMethodSignatureHeader(reader, index.m_callConvByte, index.m_genericParamCount, paramCount);
+
+    index.m_entriesStart = reader.GetPtr();
+    index.m_entries.reserve(ReserveCount(static_cast<size_t>(paramCount) + 1, reader));
+    index.AddParam(reader, ParamKind::Return);
+    for (ULONG i = 1; i <= paramCount; i++)
+    {
+        if (reader.PeekByte() == ELEMENT_TYPE_SENTINEL)
+        {
+            reader.ReadByte();
+            index.m_firstVarArg = i;
+        }
+        index.AddParam(reader, index.IsVarArg(i) ? ParamKind::VarArg : ParamKind::Normal);
+    }
+
+    index.m_entriesEnd = reader.GetPtr();
+    return index;
+}
+
+SignatureIndex SignatureIndex::IndexLocals(const SignatureBlob& sigBlob)
+{
+    // Constructing the reader checks the header
+    LocalsSignatureReader localsReader(sigBlob);
+    PrimitiveReader reader(localsReader.m_reader);
+
+    SignatureIndex index;
+    index.m_callConvByte = IMAGE_CEE_CS_CALLCONV_LOCAL_SIG;
+    index.m_entriesStart = reader.GetPtr();
+    index.m_entries.reserve(ReserveCount(localsReader.GetCount(), reader));
+    for (uint16_t i = 0; i < localsReader.GetCount(); i++)
+    {
+        index.AddParam(reader, ParamKind::Local);
+    }
+
+    index.m_entriesEnd = reader.GetPtr();
+    return index;
+}
+
+SignatureIndex SignatureIndex::IndexMethodSpec(const SignatureBlob& sigBlob)
+{
+    MethodSpecSignatureReader specReader(sigBlob);
+    PrimitiveReader reader(specReader.m_reader);
+
+    SignatureIndex index;
+    index.m_callConvByte = IMAGE_CEE_CS_CALLCONV_GENERICINST;
+    index.m_entriesStart = reader.GetPtr();
+    index.m_entries.reserve(ReserveCount(specReader.TypeArgCount(), reader));
+    for (ULONG i = 0; i < specReader.TypeArgCount(); i++)
+    {
+        index.AddType(reader);
+    }
+
+    index.m_entriesEnd = reader.GetPtr();
+    return index;
+}
+
+void SignatureIndex::AddParam(PrimitiveReader& reader, ParamKind kind)
+{
+    sigPtr start = reader.GetPtr();
+    bool isPinned = reader.SkipParamModifiers(kind);
+    bool isByRef = false;
+
+    byte b = reader.PeekByte();
+    if (b == ELEMENT_TYPE_TYPEDBYREF || b == ELEMENT_TYPE_VOID)
+    {
+        if (b == ELEMENT_TYPE_VOID && kind != ParamKind::Return)
+        {
+            throw std::domain_error("SignatureIndex - Void element in parameter");
+        }
+
+        reader.ReadByte();
+        m_entries.push_back({ start, reader.GetPtr(), reader.GetPtr(), 0, static_cast<CorElementType>(b), false, isPinned });
+        return;
+    }
+
+    if (b == ELEMENT_TYPE_BYREF)
+    {
+        reader.ReadByte();
+        isByRef = true;
+    }
+
+    AddType(reader);
+    Entry& entry = m_entries.back();
+    entry.m_start = start;
+    entry.m_isByRef = isByRef;
+    entry.m_isPinned = isPinned;
+}
+
+void SignatureIndex::AddType(PrimitiveReader& reader)
+{
+    sigPtr typeStart = reader.GetPtr();
+    byte typeKind = reader.PeekByte();
+    mdToken token = 0;
+    if (typeKind == ELEMENT_TYPE_CLASS || typeKind == ELEMENT_TYPE_VALUETYPE || typeKind == ELEMENT_TYPE_GENERICINST)
+    {
+        PrimitiveReader tokenReader(reader);
+        tokenReader.ReadByte();
+        if (typeKind == ELEMENT_TYPE_GENERICINST)
+        {
+            tokenReader.ReadByte();
+        }
+        token = tokenReader.ReadTypeDefOrRefEncoded();
+    }
+
+    reader.SkipType();
+    m_entries.push_back({ typeStart, typeStart, reader.GetPtr(), token, static_cast<CorElementType>(typeKind), false, false });
+}
+
+SignatureTypeReader SignatureIndex::Entry::GetTypeReader() const
+{
+    if (!HasType())
+    {
+        throw std::logic_error("SignatureIndex::Entry::GetTypeReader - no type - use HasType to guard");
+    }
+    return SignatureTypeReader(GetTypeSpan());
 }
 
 
@@ -1640,7 +1362,7 @@ typedef std::unique_ptr<PrimitiveWriter> UniquePrimitiveWriter;
 class WriterBase
 {
 public:
-    WriterBase(UniquePrimitiveWriter& writer)
+    WriterBase(UniquePrimitiveWriter writer)
         : m_writer(std::move(writer))
     {
     }
@@ -1753,7 +1475,7 @@ void PrimitiveWriter::AppendTypeDefOrRefEncoded(mdToken value)
 class SignatureTypeWriterState : public WriterBase
 {
 public:
-    SignatureTypeWriterState(UniquePrimitiveWriter& writer);
+    SignatureTypeWriterState(UniquePrimitiveWriter writer);
 
     void Write(const SignatureBlob& typeSigSpan);
     void SetPrimitive(CorElementType kind);
@@ -1779,8 +1501,8 @@ private:
     } m_where;
 };
 
-SignatureTypeWriterState::SignatureTypeWriterState(UniquePrimitiveWriter& writer) :
-    WriterBase(writer),
+SignatureTypeWriterState::SignatureTypeWriterState(UniquePrimitiveWriter writer) :
+    WriterBase(std::move(writer)),
     m_where(INIT),
     m_typeArgCount(0),
     m_currentTypeArg(0)
@@ -1957,7 +1679,7 @@ SignatureTypeWriter SignatureTypeWriter::WriteTypeArg()
 class MethodSignatureWriterState : public WriterBase
 {
 public:
-    MethodSignatureWriterState(UniquePrimitiveWriter& writer, bool hasThis, ULONG paramCount, ULONG genericParamCount);
+    MethodSignatureWriterState(UniquePrimitiveWriter writer, bool hasThis, ULONG paramCount, ULONG genericParamCount);
 
     void SetVoidReturn();
     std::shared_ptr<SignatureTypeWriterState> CreateNextParamTypeWriter();
@@ -1979,8 +1701,8 @@ private:
     } m_where;
 };
 
-MethodSignatureWriterState::MethodSignatureWriterState(UniquePrimitiveWriter& writer, bool hasThis, ULONG paramCount, ULONG genericParamCount) :
-    WriterBase(writer),
+MethodSignatureWriterState::MethodSignatureWriterState(UniquePrimitiveWriter writer, bool hasThis, ULONG paramCount, ULONG genericParamCount) :
+    WriterBase(std::move(writer)),
     m_paramCount(paramCount),
     m_currentParam(0),
     m_where(INIT)
@@ -2073,7 +1795,7 @@ void MethodSignatureWriterState::Complete()
 static std::shared_ptr<MethodSignatureWriterState> CreateMethodSignatureWriterState(std::vector<COR_SIGNATURE>& buffer, bool hasThis, ULONG paramCount, ULONG genericParamCount)
 {
     auto primitiveWriter = std::make_unique<PrimitiveWriter>(buffer);
-    return std::make_shared<MethodSignatureWriterState>(primitiveWriter, hasThis, paramCount, genericParamCount);
+    return std::make_shared<MethodSignatureWriterState>(std::move(primitiveWriter), hasThis, paramCount, genericParamCount);
 }
 
 MethodSignatureWriter::MethodSignatureWriter(std::vector<COR_SIGNATURE>& buffer, bool hasThis, ULONG paramCount, ULONG genericParamCount) :
@@ -2125,7 +1847,7 @@ std::vector<COR_SIGNATURE> MethodSignatureWriter::WriteInstance(ULONG paramCount
 class MethodSpecSignatureWriterState : public WriterBase
 {
 public:
-    MethodSpecSignatureWriterState(UniquePrimitiveWriter& writer, ULONG typeArgCount);
+    MethodSpecSignatureWriterState(UniquePrimitiveWriter writer, ULONG typeArgCount);
 
     void AddTypeArg(const SignatureBlob& sigBlobSpan)
     {
@@ -2151,8 +1873,8 @@ private:
     ULONG m_typeArgsAdded;
 };
 
-MethodSpecSignatureWriterState::MethodSpecSignatureWriterState(UniquePrimitiveWriter& writer, ULONG typeArgCount) :
-    WriterBase(writer),
+MethodSpecSignatureWriterState::MethodSpecSignatureWriterState(UniquePrimitiveWriter writer, ULONG typeArgCount) :
+    WriterBase(std::move(writer)),
     m_typeArgCount(typeArgCount),
     m_typeArgsAdded(0)
 {
@@ -2177,6 +1899,11 @@ void MethodSpecSignatureWriter::AddTypeArg(const SignatureBlob& sigBlobSpan)
 
 
 std::vector<COR_SIGNATURE> LocalsSignatureReader::AppendLocals(const std::vector<SignatureBlob>& additionalLocals)
+{
+    return SignatureIndex::IndexLocals({ m_start, m_reader.GetLimit() }).AppendLocals(additionalLocals);
+}
+
+std::vector<COR_SIGNATURE> SignatureIndex::AppendLocals(const std::vector<SignatureBlob>& additionalLocals) const
 {
     size_t totalCount = GetCount() + additionalLocals.size();
     if (totalCount > 0xfffe)
@@ -2188,7 +1915,7 @@ std::vector<COR_SIGNATURE> LocalsSignatureReader::AppendLocals(const std::vector
     PrimitiveWriter writer(buffer);
     writer.Append(IMAGE_CEE_CS_CALLCONV_LOCAL_SIG);
     writer.AppendCompressedUnsigned(static_cast<ULONG>(totalCount));
-    writer.Append({ m_state->m_startLocals, m_state->ReturnPrimitiveReader()->GetPtr() });
+    writer.Append(GetEntriesSpan());
     for (auto localSigSpan : additionalLocals)
     {
         writer.Append(localSigSpan);
@@ -2204,7 +1931,7 @@ std::vector<COR_SIGNATURE> LocalsSignatureReader::AppendLocals(const std::vector
 class LocalsSignatureWriterState : public WriterBase
 {
 public:
-    LocalsSignatureWriterState(UniquePrimitiveWriter& writer, ULONG count);
+    LocalsSignatureWriterState(UniquePrimitiveWriter writer, ULONG count);
 
     std::shared_ptr<SignatureTypeWriterState> CreateNextTypeWriter();
     void Complete() override;
@@ -2224,8 +1951,8 @@ private:
     } m_where;
 };
 
-LocalsSignatureWriterState::LocalsSignatureWriterState(UniquePrimitiveWriter& writer, ULONG count) :
-    WriterBase(writer),
+LocalsSignatureWriterState::LocalsSignatureWriterState(UniquePrimitiveWriter writer, ULONG count) :
+    WriterBase(std::move(writer)),
     m_count(count),
     m_current(0),
     m_where(INIT)
@@ -2284,7 +2011,7 @@ void LocalsSignatureWriterState::Complete()
 static std::shared_ptr<LocalsSignatureWriterState> CreateLocalsSignatureWriterState(std::vector<COR_SIGNATURE>& buffer, ULONG count)
 {
     auto primitiveWriter = std::make_unique<PrimitiveWriter>(buffer);
-    return std::make_shared<LocalsSignatureWriterState>(primitiveWriter, count);
+    return std::make_shared<LocalsSignatureWriterState>(std::move(primitiveWriter), count);
 }
 
 LocalsSignatureWriter::LocalsSignatureWriter(std::vector<COR_SIGNATURE>& buffer, ULONG count) :
@@ -3,13 +3,7 @@
 #include "common.h"
 
 class MethodSignatureReader;
-
-class SignatureArrayShapeReaderState;
-class SignatureTypeReaderState;
-class SignatureParamReaderState;
-class MethodSignatureReaderState;
-class MethodSpecSignatureReaderState;
-class LocalsSignatureReaderState;
+class SignatureVisitor;
 
 class SignatureTypeWriterState;
 class SignatureParamWriterState;
@@ -17,11 +11,128 @@ class MethodSignatureWriterState;
 class MethodSpecSignatureWriterState;
 class LocalsSignatureWriterState;
 
-class SignatureArrayShapeReader
+typedef const COR_SIGNATURE* sigPtr;
+
+enum class ParamKind
+{
+    Normal,
+    Return,
+    VarArg,
+    Local // may be pinned
+};
+
+// The readers below are small values holding a PrimitiveReader (a position in the blob), so
+// reading a signature doesn't allocate. Getting a child reader (a parameter's type, a type
+// argument) copies the position, and moving a reader on skips over whatever it was on, so
+// copies of readers are independent of each other.
+class PrimitiveReader
 {
 public:
-    SignatureArrayShapeReader(const std::shared_ptr<SignatureArrayShapeReaderState>& state);
+    PrimitiveReader(sigPtr start, sigPtr limit) :
+        m_limit(limit),
+        m_ptr(start),
+        m_nesting(0)
+    {
+    }
+
+    PrimitiveReader(const SignatureBlob& span) : PrimitiveReader(span.begin(), span.end())
+    {
+    }
+
+    byte ReadByte()
+    {
+        if (m_ptr >= m_limit)
+        {
+            LimitExceeded();
+        }
+
+        return *m_ptr++;
+    }
+
+    byte PeekByte()
+    {
+        if (m_ptr >= m_limit)
+        {
+            LimitExceeded();
+        }
+
+        return *m_ptr;
+    }
+
+    ULONG ReadCompressedUnsigned()
+    {
+        // Counts, type variable numbers and most tokens fit in the one byte form
+        if (m_ptr < m_limit && (*m_ptr & 0x80) == 0)
+        {
+            return *m_ptr++;
+        }
+
+        return ReadLongCompressedUnsigned(PeekByte());
+    }
+
+    // Moves past a compressed unsigned or signed value without decoding it
+    void SkipCompressed()
+    {
+        if (m_ptr >= m_limit)
+        {
+            LimitExceeded();
+        }
+
+        // The length is given by the top bits of the first byte: 0xx 1, 10x 2, 11x 4. This
+        // looks it up in a table of nibbles indexed by the top three bits.
+        ptrdiff_t length = (0x44221111 >> ((*m_ptr >> 5) * 4)) & 0xf;
+        if (m_limit - m_ptr < length)
+        {
+            LimitExceeded();
+        }
+
+        m_ptr += length;
+    }
+
+    LONG ReadCompressedSigned();
+    mdToken ReadTypeDefOrRefEncoded();
+    void SkipTypeDefOrRefEncoded();
+    bool TryReadCustomModifier(std::pair<mdToken, bool>& modifier);
+    void SkipCustomModifiers();
+
+    // Move past a whole item, checking it as it goes
+    void SkipType(SignatureVisitor* visitor = nullptr);
+    void SkipParam(ParamKind kind, SignatureVisitor* visitor = nullptr);
+    bool SkipParamModifiers(ParamKind kind); // custom modifiers, and PINNED for a local: returns whether pinned
+    void SkipMethodSignature(SignatureVisitor* visitor = nullptr);
+    void SkipArrayShape();
+
+    sigPtr GetPtr() const
+    {
+        return m_ptr;
+    }
+
+    sigPtr GetLimit() const
+    {
+        return m_limit;
+    }
+
+    void SetPtr(sigPtr ptr)
+    {
+        m_ptr = ptr;
+    }
 
+private:
+    // ARRAY and FNPTR types are skipped recursively, so how deeply they can nest is limited, so
+    // that a malformed signature can't overflow the stack.
+    static const int c_maxNesting = 64;
+
+    sigPtr m_limit;
+    sigPtr m_ptr;
+    int m_nesting;
+
+    ULONG ReadLongCompressedUnsigned(byte b1);
+    [[noreturn]] static void LimitExceeded();
+};
+
+class SignatureArrayShapeReader
+{
+public:
     ULONG GetRank();
     ULONG GetNumSizes();
     bool MoveNextSize();
@@ -31,13 +142,31 @@ public:
     LONG GetLoBound();
 
 private:
-    const std::shared_ptr<SignatureArrayShapeReaderState> m_state;
+    friend class SignatureTypeReader;
+    SignatureArrayShapeReader(const PrimitiveReader& reader);
+
+    PrimitiveReader m_reader;
+    ULONG m_rank;
+    ULONG m_sizesCount;
+    ULONG m_currentSize;
+    LONG m_currentLoBound;
+    ULONG m_loboundsCount;
+    ULONG m_current;
+
+    enum
+    {
+        INIT,
+        SIZE,
+        POST_SIZES,
+        PRE_LOBOUNDS,
+        LOBOUND,
+        END
+    } m_where;
 };
 
 class SignatureTypeReader
 {
 public:
-    SignatureTypeReader(const std::shared_ptr<SignatureTypeReaderState>& state);
     SignatureTypeReader(const SignatureBlob& typeSpecSig);
 
     CorElementType GetTypeKind();
@@ -59,16 +188,56 @@ public:
     std::vector<COR_SIGNATURE> SubstituteTypeArgs(
         const std::vector<SignatureBlob>& typeTypeArgs,
         const std::vector<SignatureBlob>& methodTypeArgs);
+    // Reuses the given buffer, which is cleared first
+    void SubstituteTypeArgs(
+        const std::vector<SignatureBlob>& typeTypeArgs,
+        const std::vector<SignatureBlob>& methodTypeArgs,
+        std::vector<COR_SIGNATURE>& buffer);
 
 private:
-    const std::shared_ptr<SignatureTypeReaderState> m_state;
+    friend class SignatureParamReader;
+    friend class MethodSpecSignatureReader;
+    SignatureTypeReader(const PrimitiveReader& reader);
+
+    void ReadTypeKind();
+    void AdvanceToType();
+
+    PrimitiveReader m_reader;
+    sigPtr m_start;
+    sigPtr m_childStart; // element type, current type arg or FNPTR method signature
+    sigPtr m_arrayShapeStart;
+    byte m_typeKind;
+    byte m_genericInstKind;
+    std::pair<mdToken, bool> m_modifier;
+    mdToken m_token;
+    LONG m_typeArgCount;
+    ULONG m_typeVarNumber;
+    LONG m_currentTypeArg;
+    bool m_isVoidPtr;
+
+    enum
+    {
+        INIT,
+        ARRAY_TYPE,
+        ARRAY_SHAPE,
+        FNPTR_METHOD_SIG,
+        GENERICINST_INIT,
+        GENERICINST_TYPE,
+        PTR_INIT,
+        PTR_CUSTOM_MOD,
+        PTR_PRE_TYPE,
+        PTR_TYPE,
+        SZARRAY_INIT,
+        SZARRAY_CUSTOM_MOD,
+        SZARRAY_PRE_TYPE,
+        SZARRAY_TYPE,
+        END
+    } m_where;
 };
 
 class SignatureParamReader
 {
 public:
-    SignatureParamReader(const std::shared_ptr<SignatureParamReaderState>& state);
-
     bool IsReturn();
     bool IsVarArg();
     bool MoveNextCustomModifier();
@@ -80,16 +249,36 @@ public:
     SignatureTypeReader GetTypeReader();
 
 private:
-    const std::shared_ptr<SignatureParamReaderState> m_state;
+    friend class MethodSignatureReader;
+    friend class LocalsSignatureReader;
+    SignatureParamReader(const PrimitiveReader& reader, ParamKind kind);
+
+    void AdvanceToType();
+
+    PrimitiveReader m_reader;
+    ParamKind m_kind;
+    std::pair<mdToken, bool> m_modifier;
+    bool m_isTypedByRef;
+    bool m_isByRef;
+    bool m_isVoid;
+
+    enum
+    {
+        INIT,
+        CUSTOM_MOD,
+        PRE_TYPE,
+        TYPE,
+        END
+    } m_where;
 };
 
 class MethodSignatureReader
 {
 public:
     MethodSignatureReader(const SignatureBlob& sigBlob);
-    MethodSignatureReader(const std::shared_ptr<MethodSignatureReaderState>& state);
 
     bool HasThis();
+    bool HasExplicitThis();
     byte GetCallingConvention();
     ULONG GenericParamCount();
     ULONG ParamCount();
@@ -101,14 +290,29 @@ public:
     static void Check(const SignatureBlob& sigBlob);
 
 private:
-    const std::shared_ptr<MethodSignatureReaderState> m_state;
+    friend class SignatureTypeReader;
+    MethodSignatureReader(const PrimitiveReader& reader);
+
+    PrimitiveReader m_reader;
+    byte m_callConvByte;
+    ULONG m_paramCount;
+    ULONG m_genericParamCount;
+
+    ULONG m_currentParam; // 0 = return, first actual parameter is 1
+    bool m_inVarArgParams;
+
+    enum
+    {
+        INIT,
+        PARAM,
+        END
+    } m_where;
 };
 
 class MethodSpecSignatureReader
 {
 public:
     MethodSpecSignatureReader(const SignatureBlob& sigBlob);
-    MethodSpecSignatureReader(const std::shared_ptr<MethodSpecSignatureReaderState>& state);
 
     ULONG TypeArgCount();
 
@@ -119,7 +323,18 @@ public:
     static std::vector<SignatureBlob> GetTypeArgSpans(const SignatureBlob& sigBlob);
 
 private:
-    const std::shared_ptr<MethodSpecSignatureReaderState> m_state;
+    friend class SignatureIndex;
+
+    PrimitiveReader m_reader;
+    ULONG m_argTypeCount;
+    ULONG m_currentArgType;
+
+    enum
+    {
+        INIT,
+        TYPE,
+        END
+    } m_where;
 };
 
 typedef SignatureParamReader SignatureLocalReader;
@@ -136,7 +351,82 @@ public:
     std::vector<COR_SIGNATURE> AppendLocals(const std::vector<SignatureBlob>& additionalLocals);
 
 private:
-    const std::shared_ptr<LocalsSignatureReaderState> m_state;
+    friend class SignatureIndex;
+
+    PrimitiveReader m_reader;
+    uint16_t m_count;
+    uint16_t m_current;
+    sigPtr m_start;
+
+    enum
+    {
+        INIT,
+        LOCAL,
+        END
+    } m_where;
+};
+
+// Where each parameter of a method signature, local of a locals signature or type argument of a
+// method spec signature is, found in one pass over it, so that they can be got at in any order
+// without walking the ones before them. Entries point into the signature, which must outlive
+// the index.
+class SignatureIndex
+{
+public:
+    struct Entry
+    {
+        sigPtr m_start; // including custom modifiers, PINNED and BYREF
+        sigPtr m_typeStart; // same as m_end for void and typedbyref
+        sigPtr m_end;
+        mdToken m_token; // for CLASS, VALUETYPE and GENERICINST, otherwise 0
+        CorElementType m_typeKind; // VOID, TYPEDBYREF or the type's first element
+        bool m_isByRef;
+        bool m_isPinned;
+
+        SignatureBlob GetSpan() const { return { m_start, m_end }; }
+        bool HasType() const { return m_typeStart != m_end; }
+        SignatureBlob GetTypeSpan() const { return { m_typeStart, m_end }; }
+        SignatureTypeReader GetTypeReader() const; // throws if !HasType()
+    };
+
+    // Entry 0 is the return type, and entry n is parameter n.
+    static SignatureIndex IndexMethod(const SignatureBlob& sigBlob);
+    // Entry n is local n.
+    static SignatureIndex IndexLocals(const SignatureBlob& sigBlob);
+    // Entry n is type argument n.
+    static SignatureIndex IndexMethodSpec(const SignatureBlob& sigBlob);
+
+    size_t GetCount() const { return m_entries.size(); }
+    const Entry& operator[](size_t index) const { return m_entries[index]; }
+    std::vector<Entry>::const_iterator begin() const { return m_entries.begin(); }
+    std::vector<Entry>::const_iterator end() const { return m_entries.end(); }
+
+    // For a method signature
+    byte GetCallingConvention() const { return m_callConvByte & IMAGE_CEE_CS_CALLCONV_MASK; }
+    bool HasThis() const { return m_callConvByte & IMAGE_CEE_CS_CALLCONV_HASTHIS; }
+    bool HasExplicitThis() const { return m_callConvByte & IMAGE_CEE_CS_CALLCONV_EXPLICITTHIS; }
+    ULONG GenericParamCount() const { return m_genericParamCount; }
+    ULONG ParamCount() const { return static_cast<ULONG>(m_entries.size() - 1); }
+    bool IsVarArg(size_t index) const { return index >= m_firstVarArg; }
+
+    // The signature's entries, without its header or anything after them
+    SignatureBlob GetEntriesSpan() const { return { m_entriesStart, m_entriesEnd }; }
+
+    // For a locals signature, returns it with the additional locals appended
+    std::vector<COR_SIGNATURE> AppendLocals(const std::vector<SignatureBlob>& additionalLocals) const;
+
+private:
+    SignatureIndex();
+
+    void AddParam(PrimitiveReader& reader, ParamKind kind);
+    void AddType(PrimitiveReader& reader);
+
+    std::vector<Entry> m_entries;
+    sigPtr m_entriesStart;
+    sigPtr m_entriesEnd;
+    byte m_callConvByte;
+    ULONG m_genericParamCount;
+    size_t m_firstVarArg;
 };
 
 class SignatureTypeWriter
@@ -0,0 +1,102 @@
+#include "pch.h"
+#include "SignaturePool.h"
+
+namespace
+{
+    const size_t c_chunkSize = 4096;
+}
+
+SignaturePool::SignaturePool() :
+    m_pNext(nullptr),
+    m_remaining(0)
+{
+}
+
+SignatureBlob SignaturePool::Intern(const SignatureBlob& sig)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto location = m_blobs.find(sig);
+    if (location != m_blobs.end())
+    {
+        return *location;
+    }
+
+    size_t length = sig.length();
+    COR_SIGNATURE* pCopy = Allocate(length);
+    if (length > 0)
+    {
+        memcpy(pCopy, sig.begin(), length);
+    }
+
+    SignatureBlob interned(pCopy, length);
+    m_blobs.insert(interned);
+    return interned;
+}
+
+mdToken SignaturePool::GetToken(mdToken owner, const SignatureBlob& internedSig, const std::function<mdToken()>& define)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    // Pool threads and JIT threads can be rewriting methods of the same module at once, so
+    // it's defining the token while holding the lock that makes sure it's only defined once.
+    auto key = std::make_pair(owner, internedSig.begin());
+    auto location = m_tokens.find(key);
+    if (location != m_tokens.end())
+    {
+        return location->second;
+    }
+
+    mdToken token = define();
+    m_tokens.insert({ key, token });
+    return token;
+}
+
+size_t SignaturePool::GetCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_blobs.size();
+}
+
+COR_SIGNATURE* SignaturePool::Allocate(size_t size)
+{
+    if (size > c_chunkSize / 4)
+    {
+        // Big enough to have a chunk to itself, leaving the current chunk in use.
+        m_chunks.push_back(std::make_unique<COR_SIGNATURE[]>(size));
+        return m_chunks.back().get();
+    }
+
+    if (size > m_remaining)
+    {
+        m_chunks.push_back(std::make_unique<COR_SIGNATURE[]>(c_chunkSize));
+        m_pNext = m_chunks.back().get();
+        m_remaining = c_chunkSize;
+    }
+
+    COR_SIGNATURE* p = m_pNext;
+    m_pNext += size;
+    m_remaining -= size;
+    return p;
+}
+
+size_t SignaturePool::BlobHash::operator()(const SignatureBlob& sig) const
+{
+    // FNV-1a: sigs are short, so hashing byte by byte is fine.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (COR_SIGNATURE b : sig)
+    {
+        hash = (hash ^ b) * 0x100000001b3ull;
+    }
+    return static_cast<size_t>(hash);
+}
+
+bool SignaturePool::BlobEqual::operator()(const SignatureBlob& a, const SignatureBlob& b) const
+{
+    return a.length() == b.length() && std::equal(a.begin(), a.end(), b.begin());
+}
+
+size_t SignaturePool::TokenKeyHash::operator()(const std::pair<mdToken, const COR_SIGNATURE*>& key) const
+{
+    return std::hash<const COR_SIGNATURE*>()(key.second) ^ (static_cast<size_t>(key.first) * 0x9E3779B97F4A7C15ull);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "common.h"
+
+#include <unordered_set>
+
+// Holds one copy of each distinct signature blob a module's instrumentation builds, such as
+// the type sigs substituted from a generic call's type arguments, so that the same
+// IObservable<int> sig made for a hundred call sites is only stored once. Interned blobs stay
+// where they are until the pool is destroyed, and equal blobs are interned to the same
+// address, so they can be compared and keyed on by pointer.
+//
+// The metadata tokens defined for a blob (a TypeSpec, a MethodSpec of some generic method, a
+// StandAloneSig) are cached against the interned blob, so each is only defined once per module.
+class SignaturePool
+{
+public:
+    SignaturePool();
+
+    SignaturePool(const SignaturePool&) = delete;
+    SignaturePool& operator=(const SignaturePool&) = delete;
+
+    // Returns the pool's copy of the blob, adding it if necessary.
+    SignatureBlob Intern(const SignatureBlob& sig);
+
+    // Returns the token previously defined for the interned blob against the given owner,
+    // calling define to get it the first time. The owner distinguishes what kind of token the
+    // blob defines: the generic method token for a MethodSpec, or the nil token of the kind
+    // (mdTypeSpecNil, mdSignatureNil) otherwise.
+    mdToken GetToken(mdToken owner, const SignatureBlob& internedSig, const std::function<mdToken()>& define);
+
+    size_t GetCount();
+
+private:
+    struct BlobHash
+    {
+        size_t operator()(const SignatureBlob& sig) const;
+    };
+
+    struct BlobEqual
+    {
+        bool operator()(const SignatureBlob& a, const SignatureBlob& b) const;
+    };
+
+    struct TokenKeyHash
+    {
+        size_t operator()(const std::pair<mdToken, const COR_SIGNATURE*>& key) const;
+    };
+
+    COR_SIGNATURE* Allocate(size_t size);
+
+    std::mutex m_mutex;
+    std::unordered_set<SignatureBlob, BlobHash, BlobEqual> m_blobs;
+    std::unordered_map<std::pair<mdToken, const COR_SIGNATURE*>, mdToken, TokenKeyHash> m_tokens;
+
+    // Blobs are copied into chunks that are never freed or moved until the pool is.
+    std::vector<std::unique_ptr<COR_SIGNATURE[]>> m_chunks;
+    COR_SIGNATURE* m_pNext;
+    size_t m_remaining;
+};
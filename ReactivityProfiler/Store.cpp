@@ -1,5 +1,9 @@
 #include "pch.h"
 #include "Store.h"
+#include "segmentedlog.h"
+#include "StoreFile.h"
+
+#include <shared_mutex>
 
 Store g_Store;
 
@@ -9,56 +13,157 @@ enum class EventId
     MethodInfo,
     CallInfo,
     MethodInstrumentationDone,
+    StringDefined,
 };
 
-class EventRecord
+// Record contents: a 32-bit EventId followed by the fields written in the StoreImpl method
+// for that event; fixed-size fields are little-endian. Changes here must be reflected in
+// c_storeFileVersion (StoreFile.h) and the managed decoders.
+//
+// Strings are stored as UTF-8. Names that recur across many records (type, method and
+// called method names) are interned: the first use of each one adds a StringDefined record
+// giving it an ID, and records refer to it by that ID from then on. Lengths and string IDs
+// are written as unsigned LEB128 varints.
+
+// Calls onCodePoint for each code point in s, combining UTF-16 surrogate pairs where wchar_t
+// is 16 bits. Unpaired surrogates become U+FFFD.
+template<typename TOnCodePoint>
+static void ForEachCodePoint(const std::wstring& s, TOnCodePoint&& onCodePoint)
 {
-public:
-    EventRecord(EventId eventId)
+    for (size_t i = 0; i < s.length(); i++)
     {
-        Write32(static_cast<uint32_t>(eventId));
+        uint32_t c = static_cast<uint32_t>(s[i]);
+        if (c >= 0xD800 && c <= 0xDFFF)
+        {
+            if (sizeof(wchar_t) == 2 && c <= 0xDBFF && i + 1 < s.length() &&
+                s[i + 1] >= 0xDC00 && s[i + 1] <= 0xDFFF)
+            {
+                c = 0x10000 + ((c - 0xD800) << 10) + (static_cast<uint32_t>(s[i + 1]) - 0xDC00);
+                i++;
+            }
+            else
+            {
+                c = 0xFFFD;
+            }
+        }
+
+        onCodePoint(c);
     }
+}
+
+static size_t Utf8Length(uint32_t codePoint)
+{
+    return codePoint < 0x80 ? 1 : codePoint < 0x800 ? 2 : codePoint < 0x10000 ? 3 : 4;
+}
+
+static size_t Utf8Length(const std::wstring& s)
+{
+    size_t length = 0;
+    ForEachCodePoint(s, [&](uint32_t c) { length += Utf8Length(c); });
+    return length;
+}
 
-    void Write64(uint64_t value)
+static size_t VarUInt32Length(uint32_t value)
+{
+    size_t length = 1;
+    while (value >= 0x80)
     {
-        m_buffer.write(reinterpret_cast<byte*>(&value), sizeof value);
+        value >>= 7;
+        length++;
     }
+    return length;
+}
+
+// Records are serialized in two passes over the same field list: EventRecordSizer works
+// out how many bytes are needed, then EventRecordWriter writes the fields directly into
+// the space reserved for the record in the log.
+class EventRecordSizer
+{
+public:
+    void Write64(uint64_t value) { m_size += sizeof value; }
+    void Write32(uint32_t value) { m_size += sizeof value; }
+    void Write32(int32_t value) { m_size += sizeof value; }
+    void WriteVarUInt32(uint32_t value) { m_size += VarUInt32Length(value); }
 
-    void Write32(uint32_t value)
+    void Write(const std::wstring& s)
     {
-        m_buffer.write(reinterpret_cast<byte*>(&value), sizeof value);
+        size_t length = Utf8Length(s);
+        m_size += VarUInt32Length(static_cast<uint32_t>(length)) + length;
     }
 
-    void Write32(int32_t value)
+    size_t Size() const { return m_size; }
+
+private:
+    size_t m_size = 0;
+};
+
+class EventRecordWriter
+{
+public:
+    EventRecordWriter(byte* pDest) : m_pDest(pDest)
     {
-        m_buffer.write(reinterpret_cast<byte*>(&value), sizeof value);
     }
 
-    void Write(const std::wstring& s)
+    void Write64(uint64_t value) { WriteBytes(&value, sizeof value); }
+    void Write32(uint32_t value) { WriteBytes(&value, sizeof value); }
+    void Write32(int32_t value) { WriteBytes(&value, sizeof value); }
+
+    void WriteVarUInt32(uint32_t value)
     {
-        int length = static_cast<int>(s.length());
-        Write32(length);
-        m_buffer.write(reinterpret_cast<const byte*>(s.data()), static_cast<std::streamsize>(length) * sizeof(wchar_t));
+        while (value >= 0x80)
+        {
+            *m_pDest++ = static_cast<byte>(value | 0x80);
+            value >>= 7;
+        }
+        *m_pDest++ = static_cast<byte>(value);
     }
 
-    std::vector<byte> Get() const
+    void Write(const std::wstring& s)
     {
-        std::basic_string<byte> str = m_buffer.str();
-        size_t contentLen = str.length();
-
-        std::vector<byte> vec;
-        vec.resize(contentLen);
-        std::copy(str.begin(), str.end(), vec.begin());
-        return std::move(vec);
+        WriteVarUInt32(static_cast<uint32_t>(Utf8Length(s)));
+        ForEachCodePoint(s, [&](uint32_t c) {
+            if (c < 0x80)
+            {
+                *m_pDest++ = static_cast<byte>(c);
+            }
+            else if (c < 0x800)
+            {
+                *m_pDest++ = static_cast<byte>(0xC0 | (c >> 6));
+                *m_pDest++ = static_cast<byte>(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                *m_pDest++ = static_cast<byte>(0xE0 | (c >> 12));
+                *m_pDest++ = static_cast<byte>(0x80 | ((c >> 6) & 0x3F));
+                *m_pDest++ = static_cast<byte>(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                *m_pDest++ = static_cast<byte>(0xF0 | (c >> 18));
+                *m_pDest++ = static_cast<byte>(0x80 | ((c >> 12) & 0x3F));
+                *m_pDest++ = static_cast<byte>(0x80 | ((c >> 6) & 0x3F));
+                *m_pDest++ = static_cast<byte>(0x80 | (c & 0x3F));
+            }
+        });
     }
 
 private:
-    std::basic_stringstream<byte> m_buffer;
+    void WriteBytes(const void* pSource, size_t count)
+    {
+        memcpy(m_pDest, pSource, count);
+        m_pDest += count;
+    }
+
+    byte* m_pDest;
 };
 
 class StoreImpl
 {
 public:
+    StoreImpl() : m_log(CreateStoreFileStorageFromEnvironment())
+    {
+    }
+
     void AddModuleInfo(ModuleID moduleId, const std::wstring& modulePath, const std::wstring& assemblyName);
 
     void AddMethodInfo(
@@ -78,26 +183,38 @@ public:
 
     int32_t GetEventCount()
     {
-        std::lock_guard lockBuffer(m_mutex);
-        return static_cast<int32_t>(m_buffer.size());
+        return m_log.size();
     }
 
+    // The returned span remains valid for the lifetime of the store.
     simplespan<byte> ReadEvent(int32_t index)
     {
-        std::lock_guard lockBuffer(m_mutex);
-        auto& vec = m_buffer[index];
-        return vec;
+        return m_log[index];
     }
 
 private:
-    void WriteRecord(const EventRecord& rec)
+    // writeFields is called with an EventRecordSizer and then an EventRecordWriter, so must
+    // write the same fields each time.
+    template<typename TWriteFields>
+    void WriteRecord(EventId eventId, TWriteFields&& writeFields)
     {
-        std::lock_guard lockBuffer(m_mutex);
-        m_buffer.push_back(rec.Get());
+        EventRecordSizer sizer;
+        sizer.Write32(static_cast<uint32_t>(eventId));
+        writeFields(sizer);
+
+        m_log.append(sizer.Size(), [&](byte* pDest) {
+            EventRecordWriter writer(pDest);
+            writer.Write32(static_cast<uint32_t>(eventId));
+            writeFields(writer);
+        });
     }
 
-    std::mutex m_mutex;
-    std::vector<std::vector<byte>> m_buffer;
+    uint32_t GetStringId(const std::wstring& s);
+
+    segmented_log m_log;
+
+    std::shared_mutex m_stringIdsMutex;
+    std::unordered_map<std::wstring, uint32_t> m_stringIds;
 };
 
 Store::Store() :
@@ -105,6 +222,10 @@ Store::Store() :
 {
 }
 
+Store::~Store()
+{
+}
+
 void Store::AddModuleInfo(ModuleID moduleId, const std::wstring& modulePath, const std::wstring& assemblyName)
 {
     m_pImpl->AddModuleInfo(moduleId, modulePath, assemblyName);
@@ -146,11 +267,11 @@ simplespan<byte> Store::ReadEvent(int32_t index)
 
 void StoreImpl::AddModuleInfo(ModuleID moduleId, const std::wstring& modulePath, const std::wstring& assemblyName)
 {
-    EventRecord r(EventId::ModuleInfo);
-    r.Write64(moduleId);
-    r.Write(modulePath);
-    r.Write(assemblyName);
-    WriteRecord(r);
+    WriteRecord(EventId::ModuleInfo, [&](auto& r) {
+        r.Write64(moduleId);
+        r.Write(modulePath);
+        r.Write(assemblyName);
+    });
 }
 
 void StoreImpl::AddMethodInfo(
@@ -160,13 +281,15 @@ void StoreImpl::AddMethodInfo(
     const std::wstring& owningTypeName, 
     const std::wstring& name)
 {
-    EventRecord r(EventId::MethodInfo);
-    r.Write32(instrumentedMethodId);
-    r.Write64(moduleId);
-    r.Write32(functionToken);
-    r.Write(owningTypeName);
-    r.Write(name);
-    WriteRecord(r);
+    uint32_t owningTypeNameId = GetStringId(owningTypeName);
+    uint32_t nameId = GetStringId(name);
+    WriteRecord(EventId::MethodInfo, [&](auto& r) {
+        r.Write32(instrumentedMethodId);
+        r.Write64(moduleId);
+        r.Write32(functionToken);
+        r.WriteVarUInt32(owningTypeNameId);
+        r.WriteVarUInt32(nameId);
+    });
 }
 
 void StoreImpl::AddInstrumentationInfo(
@@ -175,17 +298,47 @@ void StoreImpl::AddInstrumentationInfo(
     int32_t instructionOffset,
     const std::wstring& calledMethodName)
 {
-    EventRecord r(EventId::CallInfo);
-    r.Write32(instrumentationPoint);
-    r.Write32(instrumentedMethodId);
-    r.Write32(instructionOffset);
-    r.Write(calledMethodName);
-    WriteRecord(r);
+    uint32_t calledMethodNameId = GetStringId(calledMethodName);
+    WriteRecord(EventId::CallInfo, [&](auto& r) {
+        r.Write32(instrumentationPoint);
+        r.Write32(instrumentedMethodId);
+        r.Write32(instructionOffset);
+        r.WriteVarUInt32(calledMethodNameId);
+    });
 }
 
 void StoreImpl::MethodInstrumentationDone(int32_t instrumentedMethodId)
 {
-    EventRecord r(EventId::MethodInstrumentationDone);
-    r.Write32(instrumentedMethodId);
-    WriteRecord(r);
+    WriteRecord(EventId::MethodInstrumentationDone, [&](auto& r) {
+        r.Write32(instrumentedMethodId);
+    });
+}
+
+uint32_t StoreImpl::GetStringId(const std::wstring& s)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(m_stringIdsMutex);
+        auto it = m_stringIds.find(s);
+        if (it != m_stringIds.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::unique_lock<std::shared_mutex> lock(m_stringIdsMutex);
+    auto it = m_stringIds.find(s);
+    if (it != m_stringIds.end())
+    {
+        return it->second;
+    }
+
+    // The definition is appended before the ID is visible to other threads, so it always
+    // comes before any record that refers to it.
+    uint32_t id = static_cast<uint32_t>(m_stringIds.size());
+    WriteRecord(EventId::StringDefined, [&](auto& r) {
+        r.WriteVarUInt32(id);
+        r.Write(s);
+    });
+    m_stringIds.emplace(s, id);
+    return id;
 }
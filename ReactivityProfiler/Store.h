@@ -6,6 +6,7 @@ class Store
 {
 public:
     Store();
+    ~Store();
 
     void AddModuleInfo(
         ModuleID moduleId, 
@@ -13,6 +13,33 @@ STDAPI_(void) ReadStoreEvent(int32_t index, byte** buffer, int32_t* size)
     *size = static_cast<int>(eventData.length());
 }
 
+// Fills in the data pointer and size of up to maxCount events starting at startIndex, and returns
+// the number of events filled in. The event data is not copied: records in the store never move,
+// so the pointers remain valid for the lifetime of the process. Returns 0 without touching the
+// arrays if the arguments don't describe a valid range.
+STDAPI_(int32_t) ReadStoreEvents(int32_t startIndex, int32_t maxCount, byte** buffers, int32_t* sizes)
+{
+    if (startIndex < 0 || maxCount <= 0 || !buffers || !sizes)
+    {
+        return 0;
+    }
+
+    int32_t count = g_Store.GetEventCount() - startIndex;
+    if (count > maxCount)
+    {
+        count = maxCount;
+    }
+
+    for (int32_t i = 0; i < count; i++)
+    {
+        simplespan<byte> eventData = g_Store.ReadEvent(startIndex + i);
+        buffers[i] = eventData.begin();
+        sizes[i] = static_cast<int32_t>(eventData.length());
+    }
+
+    return count > 0 ? count : 0;
+}
+
 STDAPI_(int64_t*) GetCommonSequenceIdSource()
 {
     static int64_t sequenceIdSource;
@@ -0,0 +1,109 @@
+#include "pch.h"
+#include "StoreFile.h"
+
+static const wchar_t* const c_StoreFileVariable = L"REACTIVITYPROFILER_STOREFILE";
+
+static HRESULT LastErrorResult()
+{
+    DWORD error = GetLastError();
+    return error != ERROR_SUCCESS ? HRESULT_FROM_WIN32(error) : E_FAIL;
+}
+
+class StoreFileStorage : public segmented_log_storage
+{
+public:
+    StoreFileStorage(HANDLE hFile) : m_hFile(hFile), m_fileSize(c_storeFileHeaderSize)
+    {
+    }
+
+    ~StoreFileStorage()
+    {
+        CloseHandle(m_hFile);
+    }
+
+    byte* allocate_chunk(size_t chunk, size_t size) override
+    {
+        uint64_t offset = c_storeFileHeaderSize + static_cast<uint64_t>(chunk) * size;
+        uint64_t end = offset + size;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_fileSize < end)
+        {
+            // The new part of the file reads as zeros, as segmented_log requires.
+            LARGE_INTEGER newSize;
+            newSize.QuadPart = end;
+            if (!SetFilePointerEx(m_hFile, newSize, nullptr, FILE_BEGIN) || !SetEndOfFile(m_hFile))
+            {
+                CHECK_SUCCESS_MSG(LastErrorResult(), "Extending store file");
+            }
+            m_fileSize = end;
+        }
+
+        // A file mapping can't grow, so each chunk gets its own; the view keeps it alive.
+        HANDLE hMapping = CreateFileMappingW(m_hFile, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(m_fileSize >> 32), static_cast<DWORD>(m_fileSize), nullptr);
+        if (!hMapping)
+        {
+            CHECK_SUCCESS_MSG(LastErrorResult(), "Creating store file mapping");
+        }
+
+        void* pView = MapViewOfFile(hMapping, FILE_MAP_WRITE,
+            static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), size);
+        HRESULT hrMap = pView ? S_OK : LastErrorResult();
+        CloseHandle(hMapping);
+        CHECK_SUCCESS_MSG(hrMap, "Mapping store file chunk");
+
+        return static_cast<byte*>(pView);
+    }
+
+    void free_chunk(size_t chunk, byte* pChunk) override
+    {
+        UnmapViewOfFile(pChunk);
+    }
+
+private:
+    const HANDLE m_hFile;
+    std::mutex m_mutex;
+    uint64_t m_fileSize;
+};
+
+std::unique_ptr<segmented_log_storage> CreateStoreFileStorageFromEnvironment()
+{
+    DWORD length = GetEnvironmentVariableW(c_StoreFileVariable, nullptr, 0);
+    if (length == 0)
+    {
+        return nullptr;
+    }
+
+    std::vector<wchar_t> path(length);
+    GetEnvironmentVariableW(c_StoreFileVariable, path.data(), length);
+
+    // Other processes may read the file while we write it.
+    HANDLE hFile = CreateFileW(path.data(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        RELTRACE(L"Unable to create store file %s (error %u); keeping store in memory", path.data(), GetLastError());
+        return nullptr;
+    }
+
+    std::vector<byte> headerBytes(c_storeFileHeaderSize);
+    StoreFileHeader header = {};
+    memcpy(header.m_magic, c_storeFileMagic, sizeof header.m_magic);
+    header.m_version = c_storeFileVersion;
+    header.m_headerSize = c_storeFileHeaderSize;
+    header.m_chunkSize = static_cast<uint32_t>(segmented_log::c_chunkSize);
+    header.m_processId = GetCurrentProcessId();
+    memcpy(headerBytes.data(), &header, sizeof header);
+
+    DWORD written;
+    if (!WriteFile(hFile, headerBytes.data(), c_storeFileHeaderSize, &written, nullptr) || written != c_storeFileHeaderSize)
+    {
+        RELTRACE(L"Unable to write store file %s (error %u); keeping store in memory", path.data(), GetLastError());
+        CloseHandle(hFile);
+        return nullptr;
+    }
+
+    RELTRACE(L"Writing store to %s", path.data());
+    return std::make_unique<StoreFileStorage>(hFile);
+}
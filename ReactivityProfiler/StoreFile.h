@@ -0,0 +1,35 @@
+#pragma once
+
+#include "segmentedlog.h"
+
+// Spill file for the instrumentation store, used in place of heap memory when the
+// REACTIVITYPROFILER_STOREFILE environment variable gives a file path. The data chunks
+// are memory-mapped views of the file, so the OS can page them out, and the file can be
+// read by other processes while the profilee is running.
+//
+// File format, version 1. All values are little-endian.
+//  - StoreFileHeader, padded with zeros to c_storeFileHeaderSize bytes.
+//  - The store's data chunks in order, each m_chunkSize bytes long. The file grows one
+//    chunk at a time, so the last chunk may be partly filled.
+// Within each chunk, records are framed by 32-bit headers as described in segmentedlog.h;
+// a reader should start at the beginning of the first chunk and stop at the first zero
+// header. The record contents (event id followed by fields) are as described in Store.cpp.
+// Records appear in the order in which their space was reserved, which respects the
+// ordering guarantee for string definitions.
+
+constexpr char c_storeFileMagic[8] = { 'R', 'X', 'S', 'T', 'O', 'R', 'E', '\0' };
+constexpr uint32_t c_storeFileVersion = 1;
+constexpr uint32_t c_storeFileHeaderSize = 64 * 1024; // Windows allocation granularity
+
+struct StoreFileHeader
+{
+    char m_magic[8];
+    uint32_t m_version;
+    uint32_t m_headerSize;
+    uint32_t m_chunkSize;
+    uint32_t m_processId;
+};
+
+// Returns storage backed by the file named in the environment, or null if there isn't one
+// or it cannot be created (in which case the store falls back to the heap).
+std::unique_ptr<segmented_log_storage> CreateStoreFileStorageFromEnvironment();
@@ -0,0 +1,48 @@
+#pragma once
+
+// Fixed-size set of flags that can be set and tested from any thread without locking.
+// Flags can only be set, never cleared. Indexes outside the size given to reset() are
+// treated as clear and can't be set.
+class concurrent_bitset
+{
+public:
+    // Call once, before any flags are set. Until then the bitset reads as empty.
+    void reset(size_t size)
+    {
+        size_t wordCount = (size + c_bitsPerWord - 1) / c_bitsPerWord;
+        m_words = std::make_unique<std::atomic<uint32_t>[]>(wordCount);
+        for (size_t i = 0; i < wordCount; i++)
+        {
+            m_words[i] = 0;
+        }
+        m_size.store(size, std::memory_order_release);
+    }
+
+    size_t size() const { return m_size.load(std::memory_order_acquire); }
+
+    bool test(size_t index) const
+    {
+        if (index >= size())
+        {
+            return false;
+        }
+
+        return (m_words[index / c_bitsPerWord].load(std::memory_order_relaxed) & bit(index)) != 0;
+    }
+
+    void set(size_t index)
+    {
+        if (index < size())
+        {
+            m_words[index / c_bitsPerWord].fetch_or(bit(index), std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static constexpr size_t c_bitsPerWord = 32;
+
+    static uint32_t bit(size_t index) { return 1u << (index % c_bitsPerWord); }
+
+    std::unique_ptr<std::atomic<uint32_t>[]> m_words;
+    std::atomic<size_t> m_size = 0;
+};
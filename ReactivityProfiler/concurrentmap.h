@@ -1,17 +1,24 @@
 #pragma once
 
+#include <shared_mutex>
+
+// Map for read-mostly use from many threads. Entries are spread over a fixed number of
+// shards, each with its own reader/writer lock, so lookups only share a lock with other
+// lookups of keys in the same shard, and then only in shared mode.
 template <typename Key, typename Value>
 class concurrent_map
 {
 private:
-    typedef const std::lock_guard<std::mutex> lock_guard;
+    typedef const std::shared_lock<std::shared_mutex> read_lock;
+    typedef const std::unique_lock<std::shared_mutex> write_lock;
 public:
     bool try_get(Key key, Value& value)
     {
-        lock_guard lock(m_mutex);
+        shard& s = get_shard(key);
+        read_lock lock(s.m_mutex);
 
-        auto location = m_map.find(key);
-        if (location == m_map.end())
+        auto location = s.m_map.find(key);
+        if (location == s.m_map.end())
         {
             return false;
         }
@@ -22,21 +29,30 @@ public:
 
     bool try_add(Key key, const Value& value)
     {
-        lock_guard lock(m_mutex);
+        shard& s = get_shard(key);
+        write_lock lock(s.m_mutex);
 
-        bool inserted = m_map.insert({ key, value }).second;
+        bool inserted = s.m_map.insert({ key, value }).second;
         return inserted;
     }
 
     Value add_or_get(Key key, std::function<Value()> valueFactory)
     {
-        lock_guard lock(m_mutex);
+        Value value;
+        if (try_get(key, value))
+        {
+            return value;
+        }
+
+        shard& s = get_shard(key);
+        write_lock lock(s.m_mutex);
 
-        auto location = m_map.find(key);
-        if (location == m_map.end())
+        // Another thread may have added it since we looked.
+        auto location = s.m_map.find(key);
+        if (location == s.m_map.end())
         {
-            Value value = valueFactory();
-            m_map.insert({ key, value });
+            value = valueFactory();
+            s.m_map.insert({ key, value });
             return value;
         }
 
@@ -44,6 +60,23 @@ public:
     }
 
 private:
-    std::mutex m_mutex;
-    std::unordered_map<Key, Value> m_map;
-};
\ No newline at end of file
+    static constexpr size_t c_shardBits = 4;
+
+    // Each shard on its own cache line(s) so that readers of different shards don't
+    // contend on the lock words.
+    struct alignas(64) shard
+    {
+        std::shared_mutex m_mutex;
+        std::unordered_map<Key, Value> m_map;
+    };
+
+    shard& get_shard(const Key& key)
+    {
+        // Keys are often pointers or IDs with low bits that rarely vary, so mix the hash
+        // (Fibonacci hashing) and take the top bits.
+        uint64_t hash = static_cast<uint64_t>(std::hash<Key>()(key)) * 0x9E3779B97F4A7C15ull;
+        return m_shards[hash >> (64 - c_shardBits)];
+    }
+
+    shard m_shards[1 << c_shardBits];
+};
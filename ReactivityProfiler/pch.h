@@ -26,6 +26,7 @@
 #include <sstream>
 #include <iomanip>
 #include <algorithm>
+#include <array>
 #include <future>
 
 #include "ReleaseTrace.h"
@@ -0,0 +1,294 @@
+#pragma once
+
+// Supplies the memory for segmented_log's data chunks. Chunks must be zero-filled.
+class segmented_log_storage
+{
+public:
+    virtual ~segmented_log_storage() {}
+
+    virtual byte* allocate_chunk(size_t chunk, size_t size) = 0;
+    virtual void free_chunk(size_t chunk, byte* pChunk) = 0;
+};
+
+// Append-only log of variable-length byte records that can be written by many threads
+// at once without taking a lock.
+//
+// Record data is placed in fixed-size chunks that are never moved or freed, so a span
+// returned by operator[] stays valid for the lifetime of the log. Writers reserve an
+// index and a range of chunk space with atomic increments, fill in their record and then
+// advance the published watermark; readers only ever see records below the watermark,
+// which are guaranteed to be complete.
+//
+// Chunk space is also readable without the index. Each record is preceded by a 32-bit
+// header and padded to a multiple of 4 bytes:
+//  - 0: not written yet (or the end of the data)
+//  - c_recordHeader | length: a complete record of length bytes
+//  - c_paddingHeader | length: length bytes of unused space, including the header
+//  - c_oversizedHeader | length: a record too big for a chunk, held elsewhere
+// Headers are written after the data they describe, so a reader that walks the chunks
+// in order sees only complete records.
+class segmented_log
+{
+public:
+    static constexpr size_t c_chunkSize = 256 * 1024;
+    static constexpr size_t c_maxChunks = 16 * 1024; // 4GB of record data
+    static constexpr size_t c_indexBlockSize = 4096;
+    static constexpr size_t c_maxIndexBlocks = 16 * 1024;
+    static constexpr size_t c_maxRecords = c_maxIndexBlocks * c_indexBlockSize; // ~67 million
+
+    static constexpr uint32_t c_recordHeader = 0x80000000;
+    static constexpr uint32_t c_paddingHeader = 0x40000000;
+    static constexpr uint32_t c_oversizedHeader = 0x20000000;
+    static constexpr uint32_t c_headerLengthMask = 0x0FFFFFFF;
+
+    // If storage is null, chunks are allocated on the heap.
+    segmented_log(std::unique_ptr<segmented_log_storage> storage = nullptr) :
+        m_storage(storage ? std::move(storage) : std::make_unique<heap_storage>()),
+        m_chunks(new std::atomic<byte*>[c_maxChunks]),
+        m_indexBlocks(new std::atomic<IndexEntry*>[c_maxIndexBlocks]),
+        m_reservedBytes(0),
+        m_reservedCount(0),
+        m_publishedCount(0)
+    {
+        for (size_t i = 0; i < c_maxChunks; i++)
+        {
+            m_chunks[i] = nullptr;
+        }
+
+        for (size_t i = 0; i < c_maxIndexBlocks; i++)
+        {
+            m_indexBlocks[i] = nullptr;
+        }
+    }
+
+    segmented_log(const segmented_log&) = delete;
+    segmented_log& operator=(const segmented_log&) = delete;
+
+    ~segmented_log()
+    {
+        for (size_t i = 0; i < c_maxChunks; i++)
+        {
+            if (byte* pChunk = m_chunks[i].load())
+            {
+                m_storage->free_chunk(i, pChunk);
+            }
+        }
+
+        for (size_t i = 0; i < c_maxIndexBlocks; i++)
+        {
+            delete[] m_indexBlocks[i].load();
+        }
+    }
+
+    // Reserves size bytes, calls fill with a pointer to them and then publishes the record.
+    // Returns the index of the new record.
+    template<typename TFill>
+    int32_t append(size_t size, TFill&& fill)
+    {
+        // Claim an index first, so that nothing is written once the log is full.
+        size_t index = m_reservedCount.load();
+        do
+        {
+            if (index >= c_maxRecords)
+            {
+                throw std::length_error("segmented_log: too many records");
+            }
+        } while (!m_reservedCount.compare_exchange_weak(index, index + 1));
+
+        byte* pData = nullptr;
+        try
+        {
+            pData = reserve(size);
+            fill(pData);
+        }
+        catch (...)
+        {
+            abandon(index, size, pData);
+            throw;
+        }
+
+        if (size <= c_maxChunkRecordSize)
+        {
+            write_header(pData - c_headerSize, c_recordHeader | static_cast<uint32_t>(size));
+        }
+
+        IndexEntry& entry = get_index_block(index / c_indexBlockSize)[index % c_indexBlockSize];
+        entry.m_length = size;
+        entry.m_pData.store(pData);
+
+        publish();
+        return static_cast<int32_t>(index);
+    }
+
+    // Number of records that are complete and may be read.
+    int32_t size() const
+    {
+        return static_cast<int32_t>(m_publishedCount.load());
+    }
+
+    simplespan<byte> operator[](int32_t index) const
+    {
+        if (index < 0 || static_cast<size_t>(index) >= m_publishedCount.load())
+        {
+            return {};
+        }
+
+        const IndexEntry& entry = m_indexBlocks[index / c_indexBlockSize].load()[index % c_indexBlockSize];
+        return { entry.m_pData.load(), entry.m_length };
+    }
+
+private:
+    static constexpr size_t c_headerSize = sizeof(uint32_t);
+    static constexpr size_t c_maxChunkRecordSize = c_chunkSize - c_headerSize;
+
+    class heap_storage : public segmented_log_storage
+    {
+    public:
+        byte* allocate_chunk(size_t chunk, size_t size) override { return new byte[size](); }
+        void free_chunk(size_t chunk, byte* pChunk) override { delete[] pChunk; }
+    };
+
+    struct IndexEntry
+    {
+        std::atomic<byte*> m_pData = nullptr; // null until the record is complete
+        size_t m_length = 0;
+    };
+
+    static void write_header(byte* pHeader, uint32_t header)
+    {
+        reinterpret_cast<std::atomic<uint32_t>*>(pHeader)->store(header, std::memory_order_release);
+    }
+
+    // Returns a pointer to where the record data should go; for records that fit in a chunk
+    // there is space for the header just before it.
+    byte* reserve(size_t size)
+    {
+        if (size > c_maxChunkRecordSize)
+        {
+            // Rare enough that a lock is fine. A placeholder in chunk space keeps the
+            // record's place for readers that walk the chunks.
+            byte* pPlaceholder = reserve_in_chunk(c_headerSize);
+            write_header(pPlaceholder, c_oversizedHeader | static_cast<uint32_t>(size & c_headerLengthMask));
+
+            std::lock_guard<std::mutex> lock(m_oversizedMutex);
+            m_oversized.push_back(std::make_unique<byte[]>(size));
+            return m_oversized.back().get();
+        }
+
+        return reserve_in_chunk(c_headerSize + size) + c_headerSize;
+    }
+
+    byte* reserve_in_chunk(size_t size)
+    {
+        size_t paddedSize = (size + 3) & ~static_cast<size_t>(3);
+        while (true)
+        {
+            size_t offset = m_reservedBytes.fetch_add(paddedSize);
+            size_t chunk = offset / c_chunkSize;
+            size_t offsetInChunk = offset % c_chunkSize;
+            if (chunk >= c_maxChunks)
+            {
+                throw std::length_error("segmented_log: out of chunk space");
+            }
+
+            if (offsetInChunk + paddedSize <= c_chunkSize)
+            {
+                return get_chunk(chunk) + offsetInChunk;
+            }
+
+            // Straddles the end of the chunk: mark the space we got as padding in both chunks
+            // and try again, which will land in the next one.
+            write_header(get_chunk(chunk) + offsetInChunk, c_paddingHeader | static_cast<uint32_t>(c_chunkSize - offsetInChunk));
+            size_t overhang = offsetInChunk + paddedSize - c_chunkSize;
+            if (chunk + 1 < c_maxChunks)
+            {
+                write_header(get_chunk(chunk + 1), c_paddingHeader | static_cast<uint32_t>(overhang));
+            }
+        }
+    }
+
+    byte* get_chunk(size_t chunk)
+    {
+        byte* pChunk = m_chunks[chunk].load();
+        if (pChunk)
+        {
+            return pChunk;
+        }
+
+        byte* pNewChunk = m_storage->allocate_chunk(chunk, c_chunkSize);
+        if (m_chunks[chunk].compare_exchange_strong(pChunk, pNewChunk))
+        {
+            return pNewChunk;
+        }
+
+        // Another writer got there first - pChunk now holds the winner.
+        m_storage->free_chunk(chunk, pNewChunk);
+        return pChunk;
+    }
+
+    IndexEntry* get_index_block(size_t block)
+    {
+        IndexEntry* pBlock = m_indexBlocks[block].load();
+        if (pBlock)
+        {
+            return pBlock;
+        }
+
+        std::unique_ptr<IndexEntry[]> pNewBlock(new IndexEntry[c_indexBlockSize]);
+        if (m_indexBlocks[block].compare_exchange_strong(pBlock, pNewBlock.get()))
+        {
+            return pNewBlock.release();
+        }
+
+        return pBlock;
+    }
+
+    // Completes a claimed index with an empty record, so the records after it can still be
+    // published, and marks any chunk space reserved for it as padding.
+    void abandon(size_t index, size_t size, byte* pData)
+    {
+        if (pData && size <= c_maxChunkRecordSize)
+        {
+            size_t paddedSize = (c_headerSize + size + 3) & ~static_cast<size_t>(3);
+            write_header(pData - c_headerSize, c_paddingHeader | static_cast<uint32_t>(paddedSize));
+        }
+
+        static byte s_abandonedRecord;
+        IndexEntry& entry = get_index_block(index / c_indexBlockSize)[index % c_indexBlockSize];
+        entry.m_length = 0;
+        entry.m_pData.store(&s_abandonedRecord);
+        publish();
+    }
+
+    // Moves the published watermark forward over every contiguous completed record.
+    // Records can complete out of order, so whichever writer fills the gap at the
+    // watermark carries it past the records completed ahead of it.
+    void publish()
+    {
+        size_t published = m_publishedCount.load();
+        while (published < m_reservedCount.load())
+        {
+            IndexEntry* pBlock = m_indexBlocks[published / c_indexBlockSize].load();
+            if (!pBlock || !pBlock[published % c_indexBlockSize].m_pData.load())
+            {
+                return;
+            }
+
+            // On failure published is refreshed with the current value and we go round again.
+            if (m_publishedCount.compare_exchange_weak(published, published + 1))
+            {
+                published++;
+            }
+        }
+    }
+
+    const std::unique_ptr<segmented_log_storage> m_storage;
+    const std::unique_ptr<std::atomic<byte*>[]> m_chunks;
+    const std::unique_ptr<std::atomic<IndexEntry*>[]> m_indexBlocks;
+    std::atomic<size_t> m_reservedBytes;
+    std::atomic<size_t> m_reservedCount;
+    std::atomic<size_t> m_publishedCount;
+
+    std::mutex m_oversizedMutex;
+    std::vector<std::unique_ptr<byte[]>> m_oversized;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <queue>
+#include <thread>
+
+// Fixed set of threads that run queued work items in the order they were queued.
+// Destroying the pool discards any work that hasn't started and waits for the rest.
+class worker_pool
+{
+public:
+    worker_pool(unsigned threadCount)
+    {
+        for (unsigned i = 0; i < threadCount; i++)
+        {
+            m_threads.emplace_back([this] { run(); });
+        }
+    }
+
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    ~worker_pool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_workAvailable.notify_all();
+
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    void enqueue(std::function<void()> work)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_work.push(std::move(work));
+        }
+        m_workAvailable.notify_one();
+    }
+
+private:
+    void run()
+    {
+        while (true)
+        {
+            std::function<void()> work;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_workAvailable.wait(lock, [this] { return m_stopping || !m_work.empty(); });
+                if (m_stopping)
+                {
+                    return;
+                }
+
+                work = std::move(m_work.front());
+                m_work.pop();
+            }
+
+            try
+            {
+                work();
+            }
+            catch (...)
+            {
+                // Work items are expected to deal with their own errors; don't let one
+                // take the process down.
+            }
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_workAvailable;
+    std::queue<std::function<void()>> m_work;
+    bool m_stopping = false;
+    std::vector<std::thread> m_threads;
+};
@@ -0,0 +1,93 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Linq;
+using System.Reactive.Linq;
+using System.Text;
+using System.Threading;
+
+namespace TestProfilee
+{
+    // Times the first call of methods that the profiler instruments, for comparing the JIT-time
+    // rewrite with REACTIVITYPROFILER_EAGERREWRITE=1 (and with profiling off). Run as
+    // "Launch.cmd firstcall".
+    internal static class FirstCallTiming
+    {
+        public static void Run()
+        {
+            // Give the eager rewrite pool time to get through this module before anything is timed.
+            Thread.Sleep(TimeSpan.FromSeconds(2));
+
+            var methods = new (string Name, Func<int> Method)[]
+            {
+                (nameof(SelectWhere), SelectWhere),
+                (nameof(SelectMany), SelectMany),
+                (nameof(GroupBy), GroupBy),
+                (nameof(Zip), Zip),
+                (nameof(Scan), Scan),
+                (nameof(Buffer), Buffer),
+                (nameof(Merge), Merge),
+                (nameof(GenericChain), GenericChain<string>),
+            };
+
+            long totalTicks = 0;
+            foreach (var (name, method) in methods)
+            {
+                var stopwatch = Stopwatch.StartNew();
+                method();
+                long firstCallTicks = stopwatch.ElapsedTicks;
+
+                stopwatch.Restart();
+                method();
+                long secondCallTicks = stopwatch.ElapsedTicks;
+
+                totalTicks += firstCallTicks - secondCallTicks;
+                Console.WriteLine($"{name}: first call {ToMicroseconds(firstCallTicks):F0}us, second call {ToMicroseconds(secondCallTicks):F0}us");
+            }
+
+            Console.WriteLine($"Total first call overhead: {ToMicroseconds(totalTicks):F0}us");
+        }
+
+        private static double ToMicroseconds(long ticks) => ticks * 1e6 / Stopwatch.Frequency;
+
+        private static int SelectWhere()
+        {
+            return Observable.Range(0, 10).Select(x => x * 2).Where(x => x % 3 != 0).Count().Wait();
+        }
+
+        private static int SelectMany()
+        {
+            return Observable.Range(0, 5).SelectMany(x => Observable.Range(0, x)).Count().Wait();
+        }
+
+        private static int GroupBy()
+        {
+            return Observable.Range(0, 10).GroupBy(x => x % 3).SelectMany(g => g.Count()).Sum().Wait();
+        }
+
+        private static int Zip()
+        {
+            return Observable.Range(0, 5).Zip(Observable.Range(5, 5), (a, b) => a + b).Sum().Wait();
+        }
+
+        private static int Scan()
+        {
+            return Observable.Range(0, 10).Scan((acc, x) => acc + x).LastAsync().Wait();
+        }
+
+        private static int Buffer()
+        {
+            return Observable.Range(0, 10).Buffer(3).Select(b => b.Count).Sum().Wait();
+        }
+
+        private static int Merge()
+        {
+            return Observable.Merge(Observable.Range(0, 5), Observable.Range(5, 5)).Count().Wait();
+        }
+
+        private static int GenericChain<T>()
+        {
+            return Observable.Return(default(T)).Select(x => x).DefaultIfEmpty().Count().Wait();
+        }
+    }
+}
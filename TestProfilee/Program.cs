@@ -26,6 +26,12 @@ namespace TestProfilee
 
         static void Main(string[] args)
         {
+            if (args.Length > 0 && args[0] == "firstcall")
+            {
+                FirstCallTiming.Run();
+                return;
+            }
+
             Main2(args);
         }
 